@@ -21,8 +21,11 @@
  *
  */
 
+#include "config.h"
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <utime.h>
@@ -31,6 +34,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 #include "libbb.h"
 
 int copy_file(const char *source, const char *dest, int flags)
@@ -168,8 +174,15 @@ int copy_file(const char *source, const char *dest, int flags)
 			goto end;
 		}
 
+#ifdef FICLONE
+		/* Share the data with the source where the file system can. */
+		if (ioctl(fileno(dfp), FICLONE, fileno(sfp)) < 0
+				&& copy_file_chunk(sfp, dfp, -1) < 0)
+			status = -1;
+#else
 		if (copy_file_chunk(sfp, dfp, -1) < 0)
 			status = -1;
+#endif
 
 		if (fclose(dfp) < 0) {
 			perror_msg("unable to close `%s'", dest);
@@ -21,10 +21,71 @@
  * USA
  */
 
+#include "config.h"
+
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include "libbb.h"
 
+#ifdef HAVE_COPY_FILE_RANGE
+/* Copy CHUNKSIZE bytes (or until EOF if CHUNKSIZE equals -1) between two
+ * regular files inside the kernel, which may share their extents rather
+ * than copy them. Returns 0 when done, 1 if the rest, now in *CHUNKSIZE,
+ * has to be copied by hand, and -1 on error. */
+static int copy_file_range_chunk(FILE *src_file, FILE *dst_file,
+		unsigned long long *chunksize)
+{
+	int src_fd = fileno(src_file), dst_fd = fileno(dst_file);
+	struct stat src_stat, dst_stat;
+	off_t src_pos;
+	ssize_t n;
+	size_t size;
+
+	if (fstat(src_fd, &src_stat) < 0 || !S_ISREG(src_stat.st_mode)
+			|| fstat(dst_fd, &dst_stat) < 0 || !S_ISREG(dst_stat.st_mode))
+		return 1;
+
+	/* Nothing may be left in the stdio buffers. */
+	src_pos = lseek(src_fd, 0, SEEK_CUR);
+	if (src_pos < 0 || ftello(src_file) != src_pos || fflush(dst_file) != 0)
+		return 1;
+
+	while (*chunksize != 0) {
+		size = *chunksize > 1 << 30 ? 1 << 30 : *chunksize;
+
+		n = copy_file_range(src_fd, NULL, dst_fd, NULL, size, 0);
+		if (n < 0) {
+			if (errno == EINVAL || errno == EXDEV || errno == ENOSYS
+					|| errno == EOPNOTSUPP)
+				break;
+			perror_msg("copy_file_range");
+			return -1;
+		} else if (n == 0) {
+			if (*chunksize != -1) {
+				error_msg("Unable to read all data");
+				return -1;
+			}
+			*chunksize = 0;
+			break;
+		}
+
+		if (*chunksize != -1)
+			*chunksize -= n;
+	}
+
+	/* Bring the streams back in line with their descriptors. */
+	if (fseeko(src_file, lseek(src_fd, 0, SEEK_CUR), SEEK_SET) < 0
+			|| fseeko(dst_file, lseek(dst_fd, 0, SEEK_CUR), SEEK_SET) < 0) {
+		perror_msg("seek");
+		return -1;
+	}
+
+	return *chunksize != 0;
+}
+#endif
+
 /* Copy CHUNKSIZE bytes (or until EOF if CHUNKSIZE equals -1) from SRC_FILE
  * to DST_FILE.  */
 extern int copy_file_chunk(FILE *src_file, FILE *dst_file, unsigned long long chunksize)
@@ -32,6 +93,15 @@ extern int copy_file_chunk(FILE *src_file, FILE *dst_file, unsigned long long ch
 	size_t nread, nwritten, size;
 	char buffer[BUFSIZ];
 
+#ifdef HAVE_COPY_FILE_RANGE
+	switch (copy_file_range_chunk(src_file, dst_file, &chunksize)) {
+	case 0:
+		return 0;
+	case -1:
+		return -1;
+	}
+#endif
+
 	while (chunksize != 0) {
 		if (chunksize > BUFSIZ)
 			size = BUFSIZ;
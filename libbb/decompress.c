@@ -0,0 +1,445 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * The decompressors which package members and package indexes can be
+ * compressed with, found by file name and by magic.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "libbb.h"
+
+#define DECOMPRESS_BUF_LEN (64 * 1024)
+
+/*
+ * Each decompressor stops at the end of the compressed stream, as unzip()
+ * does, since a package member is followed by the rest of the package. A
+ * reader which stops reading, such as at the end of a tar archive, is not
+ * an error.
+ */
+
+/* An uncompressed member, such as data.tar. */
+static int
+uncompressed(FILE *in, FILE *out)
+{
+	char *buf;
+	size_t n;
+	int err = 0;
+
+	buf = xmalloc(DECOMPRESS_BUF_LEN);
+
+	while ((n = fread(buf, 1, DECOMPRESS_BUF_LEN, in)) > 0) {
+		if (fwrite(buf, 1, n, out) != n) {
+			if (errno != EPIPE) {
+				perror_msg("write");
+				err = -1;
+			}
+			break;
+		}
+	}
+	if (ferror(in)) {
+		perror_msg("read");
+		err = -1;
+	}
+
+	free(buf);
+	return err;
+}
+
+#ifdef HAVE_LZMA
+static int
+unxz(FILE *in, FILE *out)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_action action = LZMA_RUN;
+	lzma_ret ret;
+	uint8_t *inbuf, *outbuf;
+	size_t n;
+	int err = 0;
+
+	if (lzma_stream_decoder(&strm, UINT64_MAX, 0) != LZMA_OK) {
+		error_msg("Failed to start the xz decoder");
+		return -1;
+	}
+
+	inbuf = xmalloc(DECOMPRESS_BUF_LEN);
+	outbuf = xmalloc(DECOMPRESS_BUF_LEN);
+	strm.next_out = outbuf;
+	strm.avail_out = DECOMPRESS_BUF_LEN;
+
+	for (;;) {
+		if (strm.avail_in == 0 && action == LZMA_RUN) {
+			strm.next_in = inbuf;
+			strm.avail_in = fread(inbuf, 1, DECOMPRESS_BUF_LEN, in);
+			if (ferror(in)) {
+				perror_msg("read");
+				err = -1;
+				break;
+			}
+			if (feof(in))
+				action = LZMA_FINISH;
+		}
+
+		ret = lzma_code(&strm, action);
+
+		if (strm.avail_out == 0 || ret == LZMA_STREAM_END) {
+			n = DECOMPRESS_BUF_LEN - strm.avail_out;
+			if (fwrite(outbuf, 1, n, out) != n) {
+				if (errno != EPIPE) {
+					perror_msg("write");
+					err = -1;
+				}
+				break;
+			}
+			strm.next_out = outbuf;
+			strm.avail_out = DECOMPRESS_BUF_LEN;
+		}
+
+		if (ret == LZMA_STREAM_END)
+			break;
+		if (ret != LZMA_OK) {
+			error_msg("Invalid xz data (error %d)", ret);
+			err = -1;
+			break;
+		}
+	}
+
+	lzma_end(&strm);
+	free(inbuf);
+	free(outbuf);
+	return err;
+}
+#else
+#define unxz NULL
+#endif
+
+#ifdef HAVE_ZSTD
+static int
+unzstd(FILE *in, FILE *out)
+{
+	ZSTD_DCtx *dctx;
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	size_t in_len, out_len, ret = 0;
+	void *inbuf, *outbuf;
+	int err = 0;
+
+	dctx = ZSTD_createDCtx();
+	if (dctx == NULL) {
+		error_msg("Failed to start the zstd decoder");
+		return -1;
+	}
+
+	in_len = ZSTD_DStreamInSize();
+	out_len = ZSTD_DStreamOutSize();
+	inbuf = xmalloc(in_len);
+	outbuf = xmalloc(out_len);
+
+	while (err == 0 && (input.size = fread(inbuf, 1, in_len, in)) > 0) {
+		input.src = inbuf;
+		input.pos = 0;
+		/* A full output buffer may leave more to flush. */
+		do {
+			output.dst = outbuf;
+			output.size = out_len;
+			output.pos = 0;
+			ret = ZSTD_decompressStream(dctx, &output, &input);
+			if (ZSTD_isError(ret)) {
+				error_msg("Invalid zstd data: %s",
+						ZSTD_getErrorName(ret));
+				err = -1;
+				break;
+			}
+			if (fwrite(outbuf, 1, output.pos, out) != output.pos) {
+				if (errno != EPIPE) {
+					perror_msg("write");
+					err = -1;
+				}
+				goto done;
+			}
+			/* The end of the frame. */
+			if (ret == 0)
+				goto done;
+		} while (input.pos < input.size || output.pos == output.size);
+	}
+	if (err == 0 && ferror(in)) {
+		perror_msg("read");
+		err = -1;
+	}
+	if (err == 0 && ret != 0) {
+		error_msg("Truncated zstd data");
+		err = -1;
+	}
+
+done:
+	ZSTD_freeDCtx(dctx);
+	free(inbuf);
+	free(outbuf);
+	return err;
+}
+#else
+#define unzstd NULL
+#endif
+
+#ifdef HAVE_LZ4
+static int
+unlz4(FILE *in, FILE *out)
+{
+	LZ4F_dctx *dctx;
+	size_t n, src_len, dst_len, ret = 0;
+	char *inbuf, *outbuf, *src;
+	int err = 0;
+
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx,
+					LZ4F_VERSION))) {
+		error_msg("Failed to start the lz4 decoder");
+		return -1;
+	}
+
+	inbuf = xmalloc(DECOMPRESS_BUF_LEN);
+	outbuf = xmalloc(DECOMPRESS_BUF_LEN);
+
+	while (err == 0 && (n = fread(inbuf, 1, DECOMPRESS_BUF_LEN, in)) > 0) {
+		src = inbuf;
+		/* A full output buffer may leave more to flush. */
+		do {
+			src_len = n;
+			dst_len = DECOMPRESS_BUF_LEN;
+			ret = LZ4F_decompress(dctx, outbuf, &dst_len,
+					src, &src_len, NULL);
+			if (LZ4F_isError(ret)) {
+				error_msg("Invalid lz4 data: %s",
+						LZ4F_getErrorName(ret));
+				err = -1;
+				break;
+			}
+			if (fwrite(outbuf, 1, dst_len, out) != dst_len) {
+				if (errno != EPIPE) {
+					perror_msg("write");
+					err = -1;
+				}
+				goto done;
+			}
+			/* The end of the frame. */
+			if (ret == 0)
+				goto done;
+			src += src_len;
+			n -= src_len;
+		} while (n > 0 || dst_len == DECOMPRESS_BUF_LEN);
+	}
+	if (err == 0 && ferror(in)) {
+		perror_msg("read");
+		err = -1;
+	}
+	if (err == 0 && ret != 0) {
+		error_msg("Truncated lz4 data");
+		err = -1;
+	}
+
+done:
+	LZ4F_freeDecompressionContext(dctx);
+	free(inbuf);
+	free(outbuf);
+	return err;
+}
+#else
+#define unlz4 NULL
+#endif
+
+/*
+ * Best first, so that a feed index is fetched in the best compression
+ * which is both supported and published. Each is known whether or not its
+ * backend was compiled in, so that a package needing one which was not
+ * can be told from a broken one.
+ */
+const struct decompressor decompressors[] = {
+	{ "zstd", ".zst", "\x28\xb5\x2f\xfd", 4, unzstd },
+	{ "xz", ".xz", "\xfd" "7zXZ\0", 6, unxz },
+	{ "lz4", ".lz4", "\x04\x22\x4d\x18", 4, unlz4 },
+	{ "gzip", ".gz", "\x1f\x8b", 2, unzip },
+	{ "uncompressed", "", NULL, 0, uncompressed },
+	{ NULL, NULL, NULL, 0, NULL }
+};
+
+/*
+ * The decompressor for name, which is base followed by the suffix of one,
+ * such as "data.tar.zst" for base "data.tar", or NULL if it is not.
+ */
+const struct decompressor *
+decompressor_by_name(const char *name, const char *base)
+{
+	const struct decompressor *d;
+	size_t len = strlen(base);
+
+	if (strncmp(name, base, len))
+		return NULL;
+
+	for (d = decompressors; d->name; d++)
+		if (strcmp(name + len, d->suffix) == 0)
+			return d;
+
+	return NULL;
+}
+
+/* The decompressor whose magic buf starts with, or NULL. */
+const struct decompressor *
+decompressor_by_magic(const void *buf, size_t len)
+{
+	const struct decompressor *d;
+
+	for (d = decompressors; d->name; d++)
+		if (d->magic_len && len >= d->magic_len
+				&& memcmp(buf, d->magic, d->magic_len) == 0)
+			return d;
+
+	return NULL;
+}
+
+/*
+ * The decompressor for the data at the current position of stream, going
+ * by its magic where stream can be read ahead in, or d, as found by name,
+ * where it cannot or the magic is unknown.
+ */
+const struct decompressor *
+decompressor_detect(FILE *stream, const struct decompressor *d)
+{
+	const struct decompressor *found;
+	unsigned char magic[DECOMPRESSOR_MAGIC_MAX];
+	off_t pos;
+	size_t n;
+
+	pos = ftello(stream);
+	if (pos == -1)
+		return d;
+
+	n = fread(magic, 1, sizeof(magic), stream);
+	if (fseeko(stream, pos, SEEK_SET) == -1) {
+		perror_msg("fseek");
+		return d;
+	}
+
+	found = decompressor_by_magic(magic, n);
+
+	return found ? found : d;
+}
+
+/*
+ * Like gz_open(), a stream of the decompressed data read from
+ * compressed_file by a child process, for any of the decompressors.
+ */
+FILE *
+decompress_open(const struct decompressor *d, FILE *compressed_file,
+		int *pid)
+{
+	int unzip_pipe[2];
+	FILE *out;
+	int err;
+
+	if (d->decompress == unzip)
+		return gz_open(compressed_file, pid);
+
+	if (pipe(unzip_pipe) != 0) {
+		perror_msg("pipe");
+		return NULL;
+	}
+
+	/* If we don't flush, we end up with two copies of anything pending,
+	   one from the parent, one from the child */
+	fflush(stdout);
+	fflush(stderr);
+
+	*pid = fork();
+	if (*pid < 0) {
+		perror_msg("fork");
+		close(unzip_pipe[0]);
+		close(unzip_pipe[1]);
+		return NULL;
+	}
+
+	if (*pid == 0) {
+		/* child process */
+		close(unzip_pipe[0]);
+		/* Only report our own errors. */
+		free_error_list();
+		signal(SIGPIPE, SIG_IGN);
+		out = fdopen(unzip_pipe[1], "w");
+		err = out ? d->decompress(compressed_file, out) : -1;
+		if (out && fclose(out) && errno != EPIPE)
+			err = -1;
+		print_error_list();
+		fflush(stdout);
+		_exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(unzip_pipe[1]);
+	return fdopen(unzip_pipe[0], "r");
+}
+
+int
+decompress_close(const struct decompressor *d, int pid)
+{
+	int status;
+	int ret;
+
+	if (d->decompress == unzip)
+		return gz_close(pid);
+
+	if (waitpid(pid, &status, 0) == -1) {
+		perror_msg("waitpid");
+		return -1;
+	}
+
+	if (WIFSIGNALED(status)) {
+		error_msg("Decompressing %s killed by signal %d.",
+				d->name, WTERMSIG(status));
+		return -1;
+	}
+
+	if (!WIFEXITED(status)) {
+		/* shouldn't happen */
+		error_msg("Your system is broken: got status %d from waitpid.",
+				status);
+		return -1;
+	}
+
+	if ((ret = WEXITSTATUS(status))) {
+		error_msg("Decompressing %s failed with return code %d.",
+				d->name, ret);
+		return -1;
+	}
+
+	return 0;
+}
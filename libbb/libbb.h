@@ -100,13 +100,45 @@ enum extract_functions_e {
 	extract_unconditional = 512,
 	extract_create_leading_dirs = 1024,
 	extract_quiet = 2048,
-	extract_exclude_list = 4096
+	extract_exclude_list = 4096,
+	/* from an archive which has not been verified yet */
+	extract_untrusted = 8192
 };
 
+extern int unarchive_writers;
+
 char *deb_extract(const char *package_filename, FILE *out_stream,
 		const int extract_function, const char *prefix,
 		const char *filename, int *err);
 
+/* Longest magic of any decompressor. */
+#define DECOMPRESSOR_MAGIC_MAX 6
+
+struct decompressor {
+	const char *name;
+	const char *suffix;	/* of a file or package member */
+	const char *magic;
+	size_t magic_len;
+	/* NULL if support for it was not compiled in */
+	int (*decompress)(FILE *in, FILE *out);
+};
+
+extern const struct decompressor decompressors[];
+
+const struct decompressor *decompressor_by_name(const char *name,
+		const char *base);
+const struct decompressor *decompressor_by_magic(const void *buf,
+		size_t len);
+const struct decompressor *decompressor_detect(FILE *stream,
+		const struct decompressor *d);
+FILE *decompress_open(const struct decompressor *d, FILE *compressed_file,
+		int *pid);
+int decompress_close(const struct decompressor *d, int pid);
+
+int tar_extract(FILE *src_stream, FILE *out_stream,
+		const struct decompressor *d,
+		const int extract_function, const char *prefix);
+
 extern int unzip(FILE *l_in_file, FILE *l_out_file);
 extern int gz_close(int gunzip_pid);
 extern FILE *gz_open(FILE *compressed_file, int *pid);
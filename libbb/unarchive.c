@@ -19,6 +19,8 @@
  *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include "config.h"
+
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -26,8 +28,14 @@
 #include <unistd.h>
 #include <utime.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "libbb.h"
+#include "../libopkg/opkg_profile.h"
 
 #define CONFIG_FEATURE_TAR_OLDGNU_COMPATABILITY 1
 #define CONFIG_FEATURE_TAR_GNU_EXTENSIONS
@@ -37,8 +45,17 @@ static char *longname = NULL;
 static char *linkname = NULL;
 #endif
 
+/* The last directory created by extract_create_leading_dirs. Archive
+ * members are grouped by directory, so this saves most of the calls to
+ * make_directory(). */
+static char *leading_dir = NULL;
+
 off_t archive_offset;
 
+/* Number of threads used to write out regular files when extracting to
+ * the filesystem. Values below 2 extract serially. */
+int unarchive_writers = 0;
+
 #define SEEK_BUF 4096
 static ssize_t
 seek_by_read(FILE* fd, size_t len)
@@ -73,6 +90,308 @@ seek_sub_file(FILE *fd, const int count)
 	return;
 }
 
+#ifdef HAVE_PTHREAD
+/* Regular files up to this size are read into memory by the decompressing
+ * thread and handed to a pool of writers, so that the create/write/close
+ * and metadata syscalls of many small files overlap. Larger files are
+ * streamed out directly. */
+#define WRITER_MAX_FILE_SIZE	(256 * 1024)
+/* Upper bound on the payload bytes waiting for a writer. */
+#define WRITER_MAX_QUEUED	(4 * 1024 * 1024)
+
+struct write_job {
+	struct write_job *next;
+	char *name;
+	char *data;
+	size_t size;
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	time_t mtime;
+	int preserve_date;
+	const char *failed_op;
+	int failed_errno;
+};
+
+struct writer_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* a job was queued, or we are shutting down */
+	pthread_cond_t idle;	/* a job was completed */
+	struct write_job *head, *tail;
+	struct write_job *failed;
+	size_t queued;
+	int busy;
+	int shutdown;
+	int nthreads;
+	pthread_t *threads;
+};
+
+/* Create the file and apply ownership, mode and times through the open
+ * descriptor, rather than by path once it has been closed. Runs on a
+ * writer thread, so errors are only recorded here and reported later. */
+static void
+write_job_run(struct write_job *job)
+{
+	struct timespec times[2];
+	size_t done = 0;
+	ssize_t n;
+	int fd;
+
+	/* Never write through a symlink made after the job was queued. */
+	fd = open(job->name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0666);
+	if (fd == -1) {
+		job->failed_op = "create";
+		job->failed_errno = errno;
+		return;
+	}
+
+	while (done < job->size) {
+		n = write(fd, job->data + done, job->size - done);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			job->failed_op = "write";
+			job->failed_errno = errno;
+			close(fd);
+			return;
+		}
+		done += n;
+	}
+
+	fchown(fd, job->uid, job->gid);
+	fchmod(fd, job->mode);
+	if (job->preserve_date) {
+		times[0].tv_sec = times[1].tv_sec = job->mtime;
+		times[0].tv_nsec = times[1].tv_nsec = 0;
+		futimens(fd, times);
+	}
+
+	if (close(fd) == -1) {
+		job->failed_op = "close";
+		job->failed_errno = errno;
+	}
+}
+
+static void *
+writer_thread(void *arg)
+{
+	struct writer_pool *pool = arg;
+	struct write_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (pool->head == NULL && !pool->shutdown)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->head == NULL)
+			break;
+
+		job = pool->head;
+		pool->head = job->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+		pool->busy++;
+		pthread_mutex_unlock(&pool->lock);
+
+		write_job_run(job);
+		free(job->data);
+		job->data = NULL;
+
+		pthread_mutex_lock(&pool->lock);
+		pool->busy--;
+		pool->queued -= job->size;
+		if (job->failed_op) {
+			job->next = pool->failed;
+			pool->failed = job;
+		} else {
+			free(job->name);
+			free(job);
+		}
+		pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static struct writer_pool *
+writer_pool_new(int nthreads)
+{
+	struct writer_pool *pool;
+	int i;
+
+	pool = xcalloc(1, sizeof(struct writer_pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pool->threads = xcalloc(nthreads, sizeof(pthread_t));
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, writer_thread, pool))
+			break;
+	}
+	pool->nthreads = i;
+
+	if (pool->nthreads == 0) {
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/* Report and discard the jobs that failed so far. Called with the lock
+ * held, from the extracting thread only. */
+static int
+writer_pool_report(struct writer_pool *pool)
+{
+	struct write_job *job;
+	int err = 0;
+
+	while ((job = pool->failed) != NULL) {
+		pool->failed = job->next;
+		error_msg("Cannot %s %s: %s", job->failed_op, job->name,
+				strerror(job->failed_errno));
+		free(job->name);
+		free(job);
+		err = -1;
+	}
+
+	return err;
+}
+
+/* Wait for every queued file to be written, e.g. before creating a hard
+ * link to one of them. */
+static int
+writer_pool_drain(struct writer_pool *pool)
+{
+	int err;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->head || pool->busy)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	err = writer_pool_report(pool);
+	pthread_mutex_unlock(&pool->lock);
+
+	return err;
+}
+
+/* Read the payload of file_entry from src_stream and queue it for writing
+ * to full_name, which the pool takes ownership of. */
+static int
+writer_pool_queue(struct writer_pool *pool, FILE *src_stream,
+		char *full_name, const file_header_t *file_entry,
+		int preserve_date)
+{
+	struct write_job *job;
+
+	job = xcalloc(1, sizeof(struct write_job));
+	job->data = xmalloc(file_entry->size ? file_entry->size : 1);
+	if (fread(job->data, 1, file_entry->size, src_stream)
+			!= file_entry->size) {
+		error_msg("Short read extracting %s", full_name);
+		free(job->data);
+		free(job);
+		return -1;
+	}
+
+	job->name = full_name;
+	job->size = file_entry->size;
+	job->mode = file_entry->mode;
+	job->uid = file_entry->uid;
+	job->gid = file_entry->gid;
+	job->mtime = file_entry->mtime;
+	job->preserve_date = preserve_date;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->queued && pool->queued + job->size > WRITER_MAX_QUEUED)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pool->queued += job->size;
+	if (pool->tail)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+static int
+writer_pool_free(struct writer_pool *pool)
+{
+	int i, err;
+
+	err = writer_pool_drain(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+
+	return err;
+}
+#else
+struct writer_pool;
+#endif
+
+/* Whether name, of a member of an archive which has not been verified,
+ * would be extracted outside prefix: if it is absolute, has a ".."
+ * component, or has as a leading directory something other than a
+ * directory, such as a symlink made by an earlier member. */
+static int
+name_escapes(const char *prefix, const char *name)
+{
+	char *path, *p;
+	struct stat st;
+	size_t prefix_len, len;
+	int escapes = 0;
+
+	if (name[0] == '/')
+		return 1;
+
+	if (prefix == NULL)
+		prefix = "";
+	prefix_len = strlen(prefix);
+	path = xmalloc(prefix_len + strlen(name) + 1);
+	strcpy(path, prefix);
+	strcat(path, name);
+
+	p = path + prefix_len;
+	while (*p && !escapes) {
+		len = strcspn(p, "/");
+		if (len == 2 && p[0] == '.' && p[1] == '.') {
+			escapes = 1;
+			break;
+		}
+		p += len;
+		if (*p == '\0')
+			break;
+
+		/* Directories are never removed while extracting, so one
+		 * checked here stays one. */
+		*p = '\0';
+		if (lstat(path, &st) == 0 && !S_ISDIR(st.st_mode))
+			escapes = 1;
+		*p = '/';
+		p += strspn(p, "/");
+	}
+
+	free(path);
+
+	return escapes;
+}
+
 
 /* Extract the data postioned at src_stream to either filesystem, stdout or
  * buffer depending on the value of 'function' which is defined in libbb.h
@@ -89,7 +408,7 @@ seek_sub_file(FILE *fd, const int count)
 static char *
 extract_archive(FILE *src_stream, FILE *out_stream,
 		const file_header_t *file_entry, const int function,
-		const char *prefix,
+		const char *prefix, struct writer_pool *writers,
 		int *err)
 {
 	FILE *dst_stream = NULL;
@@ -97,6 +416,8 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 	char *full_link_name = NULL;
 	char *buffer = NULL;
 	struct utimbuf t;
+	int queued = 0;
+	int fd;
 
 	*err = 0;
 
@@ -164,17 +485,30 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 			char *buf, *parent;
 			buf = xstrdup(full_name);
 			parent = dirname(buf);
-			if (make_directory (parent, -1, FILEUTILS_RECUR) != 0) {
+			if (leading_dir && strcmp(leading_dir, parent) == 0) {
+				/* Already done for the previous member. */
+			} else if (make_directory (parent, -1, FILEUTILS_RECUR) != 0) {
 				if ((function & extract_quiet) != extract_quiet) {
 					*err = -1;
 					error_msg("couldn't create leading directories");
 				}
+			} else {
+				free(leading_dir);
+				leading_dir = xstrdup(parent);
 			}
 			free (buf);
 		}
 		switch(file_entry->mode & S_IFMT) {
 			case S_IFREG:
+				opkg_profile_count(OPKG_PROFILE_FILES, 1);
+				opkg_profile_count(OPKG_PROFILE_BYTES,
+						file_entry->size);
 				if (file_entry->link_name) { /* Found a cpio hard link */
+#ifdef HAVE_PTHREAD
+					/* The target may still be queued. */
+					if (writers)
+						writer_pool_drain(writers);
+#endif
 					if (link(full_link_name, full_name) != 0) {
 						if ((function & extract_quiet) != extract_quiet) {
 							*err = -1;
@@ -182,8 +516,29 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 								file_entry->name, file_entry->link_name);
 						}
 					}
-				} else {
-					if ((dst_stream = wfopen(full_name, "w")) == NULL) {
+				}
+#ifdef HAVE_PTHREAD
+				else if (writers
+					&& file_entry->size <= WRITER_MAX_FILE_SIZE) {
+					archive_offset += file_entry->size;
+					*err = writer_pool_queue(writers, src_stream,
+							full_name, file_entry,
+							function & extract_preserve_date);
+					if (*err)
+						goto cleanup;
+					/* Ownership, mode and times are set by the writer. */
+					full_name = NULL;
+					queued = 1;
+				}
+#endif
+				else {
+					fd = open(full_name, O_WRONLY | O_CREAT
+							| O_TRUNC | O_NOFOLLOW, 0666);
+					if (fd == -1 || (dst_stream =
+							fdopen(fd, "w")) == NULL) {
+						perror_msg("%s", full_name);
+						if (fd != -1)
+							close(fd);
 						*err = -1;
 						seek_sub_file(src_stream, file_entry->size);
 						goto cleanup;
@@ -233,7 +588,9 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 		/* Changing a symlink's properties normally changes the properties of the
 		 * file pointed to, so dont try and change the date or mode, lchown does
 		 * does the right thing, but isnt available in older versions of libc */
-		if (S_ISLNK(file_entry->mode)) {
+		if (queued) {
+			/* Nothing to do until the file has been written. */
+		} else if (S_ISLNK(file_entry->mode)) {
 #if (__GLIBC__ > 2) && (__GLIBC_MINOR__ > 1)
 			lchown(full_name, file_entry->uid, file_entry->gid);
 #endif
@@ -286,9 +643,25 @@ unarchive(FILE *src_stream, FILE *out_stream,
 	int extract_flag;
 	int i;
 	char *buffer = NULL;
+	struct writer_pool *writers = NULL;
+	struct timeval start, end;
+	unsigned long files = 0;
+	unsigned long long bytes = 0;
+	int nwriters = 0;
+	double secs;
 
 	*err = 0;
 
+	if (extract_function & extract_all_to_fs) {
+		gettimeofday(&start, NULL);
+#ifdef HAVE_PTHREAD
+		if (unarchive_writers > 1)
+			writers = writer_pool_new(unarchive_writers);
+		if (writers)
+			nwriters = writers->nthreads;
+#endif
+	}
+
 	archive_offset = 0;
 	while ((file_entry = get_headers(src_stream)) != NULL) {
 		extract_flag = TRUE;
@@ -318,10 +691,28 @@ unarchive(FILE *src_stream, FILE *out_stream,
 			}
 		}
 
+		if (extract_flag == TRUE
+				&& (extract_function & extract_untrusted)
+				&& (name_escapes(prefix, file_entry->name)
+					|| (S_ISREG(file_entry->mode)
+						&& file_entry->link_name
+						&& name_escapes(prefix,
+							file_entry->link_name)))) {
+			error_msg("Refusing to extract %s outside %s",
+					file_entry->name, prefix ? prefix : ".");
+			*err = -1;
+			free_headers(file_entry);
+			break;
+		}
+
 		if (extract_flag == TRUE) {
 			buffer = extract_archive(src_stream, out_stream,
 					file_entry, extract_function,
-					prefix, err);
+					prefix, writers, err);
+			if (S_ISREG(file_entry->mode)) {
+				files++;
+				bytes += file_entry->size;
+			}
 			*err = 0; /* XXX: ignore extraction errors */
 			if (*err) {
 				free_headers(file_entry);
@@ -334,6 +725,24 @@ unarchive(FILE *src_stream, FILE *out_stream,
 		free_headers(file_entry);
 	}
 
+	if (extract_function & extract_all_to_fs) {
+#ifdef HAVE_PTHREAD
+		if (writers)
+			writer_pool_free(writers);
+#endif
+		free(leading_dir);
+		leading_dir = NULL;
+
+		gettimeofday(&end, NULL);
+		secs = (end.tv_sec - start.tv_sec)
+			+ (end.tv_usec - start.tv_usec) / 1000000.0;
+		opkg_msg(DEBUG, "Extracted %lu files, %llu bytes in %.3fs "
+				"(%.1f KiB/s, %d writer threads).\n",
+				files, bytes, secs,
+				secs > 0 ? bytes / 1024.0 / secs : 0.0,
+				nwriters);
+	}
+
 	return buffer;
 }
 
@@ -639,23 +1048,27 @@ deb_extract(const char *package_filename, FILE *out_stream,
 	file_header_t *ar_header = NULL;
 	const char **file_list = NULL;
 	char *output_buffer = NULL;
-	char *ared_file = NULL;
+	const char *ared_base = NULL;
+	const struct decompressor *d;
 	char ar_magic[8];
 	int gz_err;
 
 	*err = 0;
 
+	opkg_profile_begin("extract", package_filename);
+
 	if (filename != NULL) {
 		file_list = xmalloc(sizeof(char *) * 2);
 		file_list[0] = filename;
 		file_list[1] = NULL;
 	}
 
+	/* The member may be compressed with any of the decompressors. */
 	if (extract_function & extract_control_tar_gz) {
-		ared_file = "control.tar.gz";
+		ared_base = "control.tar";
 	}
 	else if (extract_function & extract_data_tar_gz) {
-		ared_file = "data.tar.gz";
+		ared_base = "data.tar";
 	} else {
                 opkg_msg(ERROR, "Internal error: extract_function=%x\n",
 				extract_function);
@@ -679,13 +1092,26 @@ deb_extract(const char *package_filename, FILE *out_stream,
 		archive_offset = 8;
 
 		while ((ar_header = get_header_ar(deb_stream)) != NULL) {
-			if (strcmp(ared_file, ar_header->name) == 0) {
+			d = decompressor_by_name(ar_header->name, ared_base);
+			if (d) {
 				int gunzip_pid = 0;
 				FILE *uncompressed_stream;
+				d = decompressor_detect(deb_stream, d);
+				if (d->decompress == NULL) {
+					error_msg("%s: %s needs %s support, "
+						"which was not compiled in",
+						package_filename,
+						ar_header->name, d->name);
+					*err = -1;
+					free_header_ar(ar_header);
+					goto cleanup;
+				}
 				/* open a stream of decompressed data */
-				uncompressed_stream = gz_open(deb_stream, &gunzip_pid);
+				uncompressed_stream = decompress_open(d,
+						deb_stream, &gunzip_pid);
 				if (uncompressed_stream == NULL) {
 					*err = -1;
+					free_header_ar(ar_header);
 					goto cleanup;
 				}
 
@@ -696,7 +1122,7 @@ deb_extract(const char *package_filename, FILE *out_stream,
 						extract_function, prefix,
 						file_list, err);
 				fclose(uncompressed_stream);
-				gz_err = gz_close(gunzip_pid);
+				gz_err = decompress_close(d, gunzip_pid);
 				if (gz_err)
 					*err = -1;
 				free_header_ar(ar_header);
@@ -728,16 +1154,28 @@ deb_extract(const char *package_filename, FILE *out_stream,
 			goto cleanup;
 		}
 
-		/* walk through outer tar file to find ared_file */
+		/* walk through outer tar file to find the member */
 		while ((tar_header = get_header_tar(unzipped_opkg_stream)) != NULL) {
                         int name_offset = 0;
                         if (strncmp(tar_header->name, "./", 2) == 0)
                                 name_offset = 2;
-			if (strcmp(ared_file, tar_header->name+name_offset) == 0) {
+			d = decompressor_by_name(tar_header->name + name_offset,
+					ared_base);
+			if (d) {
 				int gunzip_pid = 0;
 				FILE *uncompressed_stream;
+				if (d->decompress == NULL) {
+					error_msg("%s: %s needs %s support, "
+						"which was not compiled in",
+						package_filename,
+						tar_header->name, d->name);
+					*err = -1;
+					free_header_tar(tar_header);
+					break;
+				}
 				/* open a stream of decompressed data */
-				uncompressed_stream = gz_open(unzipped_opkg_stream, &gunzip_pid);
+				uncompressed_stream = decompress_open(d,
+						unzipped_opkg_stream, &gunzip_pid);
 				if (uncompressed_stream == NULL) {
 					*err = -1;
 					goto cleanup;
@@ -755,7 +1193,7 @@ deb_extract(const char *package_filename, FILE *out_stream,
 
 				free_header_tar(tar_header);
 				fclose(uncompressed_stream);
-				gz_err = gz_close(gunzip_pid);
+				gz_err = decompress_close(d, gunzip_pid);
 				if (gz_err)
 					*err = -1;
 				break;
@@ -780,5 +1218,39 @@ cleanup:
 	if (file_list)
 		free(file_list);
 
+	opkg_profile_end();
+
 	return output_buffer;
 }
+
+/*
+ * Extract the tar archive read from src_stream, compressed as d, as
+ * deb_extract() does one member of a package. This is for a member which
+ * is read from a pipe as the package is downloaded.
+ */
+int
+tar_extract(FILE *src_stream, FILE *out_stream,
+	const struct decompressor *d,
+	const int extract_function, const char *prefix)
+{
+	FILE *uncompressed_stream;
+	char *output_buffer;
+	int gunzip_pid = 0;
+	int err;
+
+	uncompressed_stream = decompress_open(d, src_stream, &gunzip_pid);
+	if (uncompressed_stream == NULL)
+		return -1;
+
+	archive_offset = 0;
+	output_buffer = unarchive(uncompressed_stream, out_stream,
+			get_header_tar, free_header_tar,
+			extract_function, prefix, NULL, &err);
+	free(output_buffer);
+
+	fclose(uncompressed_stream);
+	if (decompress_close(d, gunzip_pid))
+		err = -1;
+
+	return err;
+}
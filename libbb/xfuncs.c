@@ -24,11 +24,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include "libbb.h"
+#include "../libopkg/opkg_profile.h"
 
 
 extern void *xmalloc(size_t size)
 {
 	void *ptr = malloc(size);
+	opkg_profile_count(OPKG_PROFILE_ALLOCS, 1);
 	if (ptr == NULL && size != 0)
 		perror_msg_and_die("malloc");
 	return ptr;
@@ -37,6 +39,7 @@ extern void *xmalloc(size_t size)
 extern void *xrealloc(void *ptr, size_t size)
 {
 	ptr = realloc(ptr, size);
+	opkg_profile_count(OPKG_PROFILE_ALLOCS, 1);
 	if (ptr == NULL && size != 0)
 		perror_msg_and_die("realloc");
 	return ptr;
@@ -45,6 +48,7 @@ extern void *xrealloc(void *ptr, size_t size)
 extern void *xcalloc(size_t nmemb, size_t size)
 {
 	void *ptr = calloc(nmemb, size);
+	opkg_profile_count(OPKG_PROFILE_ALLOCS, 1);
 	if (ptr == NULL && nmemb != 0 && size != 0)
 		perror_msg_and_die("calloc");
 	return ptr;
@@ -57,6 +61,7 @@ extern char * xstrdup (const char *s) {
 		return NULL;
 
 	t = strdup (s);
+	opkg_profile_count(OPKG_PROFILE_ALLOCS, 1);
 
 	if (t == NULL)
 		perror_msg_and_die("strdup");
@@ -17,12 +17,38 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "opkg_message.h"
 #include "conffile.h"
 #include "file_util.h"
 #include "sprintf_alloc.h"
 #include "opkg_conf.h"
+#include "hash_table.h"
+#include "libbb/libbb.h"
+
+#define DIGESTS_MAGIC "opkg-conffile-md5 1"
+
+/*
+ * The md5sums of conffiles, by the identity of each file when it was
+ * summed, kept in conffiles.md5 next to the status file of the default
+ * dest. A digest is only used while the device, inode, size and both
+ * times of the file are all unchanged.
+ */
+struct conffile_digest {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime, ctime;
+    char md5sum[33];
+};
+
+static hash_table_t digests;
+static char *digests_file;
+static int digests_changed;
 
 int conffile_init(conffile_t *conffile, const char *file_name, const char *md5sum)
 {
@@ -38,7 +64,6 @@ int conffile_has_been_modified(conffile_t *conffile)
 {
     char *md5sum;
     char *filename = conffile->name;
-    char *root_filename;
     int ret = 1;
 
     if (conffile->value == NULL) {
@@ -46,18 +71,189 @@ int conffile_has_been_modified(conffile_t *conffile)
 	 return 1;
     }
 
-    root_filename = root_filename_alloc(filename);
-
-    md5sum = file_md5sum_alloc(root_filename);
+    md5sum = conffile_md5sum_alloc(filename);
 
     if (md5sum && (ret = strcmp(md5sum, conffile->value))) {
         opkg_msg(INFO, "Conffile %s:\n\told md5=%s\n\tnew md5=%s\n",
 		conffile->name, md5sum, conffile->value);
     }
 
-    free(root_filename);
     if (md5sum)
         free(md5sum);
 
     return ret;
 }
+
+static int
+digest_matches(const struct conffile_digest *d, const struct stat *st)
+{
+    return d->dev == st->st_dev && d->ino == st->st_ino
+	    && d->size == st->st_size
+	    && d->mtime.tv_sec == st->st_mtim.tv_sec
+	    && d->mtime.tv_nsec == st->st_mtim.tv_nsec
+	    && d->ctime.tv_sec == st->st_ctim.tv_sec
+	    && d->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+static void
+digests_load(void)
+{
+    struct conffile_digest d, *entry;
+    unsigned long dev, ino;
+    long long size;
+    char *line;
+    FILE *fp;
+    int n;
+
+    hash_table_init("conffile-digests", &digests, 256);
+    sprintf_alloc(&digests_file, "%s/conffiles.md5",
+	    conf->default_dest->opkg_dir);
+
+    fp = fopen(digests_file, "r");
+    if (fp == NULL)
+	return;
+
+    line = file_read_line_alloc(fp);
+    if (line == NULL || strcmp(line, DIGESTS_MAGIC)) {
+	free(line);
+	fclose(fp);
+	return;
+    }
+    free(line);
+
+    while ((line = file_read_line_alloc(fp))) {
+	memset(&d, 0, sizeof(d));
+	if (sscanf(line, "%32s %lu %lu %lld %ld.%ld %ld.%ld %n", d.md5sum,
+		    &dev, &ino, &size, &d.mtime.tv_sec, &d.mtime.tv_nsec,
+		    &d.ctime.tv_sec, &d.ctime.tv_nsec, &n) == 8
+		&& line[n]) {
+	    d.dev = dev;
+	    d.ino = ino;
+	    d.size = size;
+	    entry = xmalloc(sizeof(*entry));
+	    *entry = d;
+	    free(hash_table_get(&digests, line + n));
+	    hash_table_insert(&digests, line + n, entry);
+	}
+	free(line);
+    }
+
+    fclose(fp);
+}
+
+/*
+ * Returns the md5sum of the installed conffile file_name, without reading
+ * it if it has not changed since it was last summed.
+ */
+char *
+conffile_md5sum_alloc(const char *file_name)
+{
+    struct conffile_digest *d;
+    struct stat st;
+    char *root_filename, *md5sum;
+
+    if (digests_file == NULL)
+	digests_load();
+
+    root_filename = root_filename_alloc((char *)file_name);
+
+    if (stat(root_filename, &st) == -1) {
+	md5sum = file_md5sum_alloc(root_filename);
+	free(root_filename);
+	return md5sum;
+    }
+
+    d = hash_table_get(&digests, file_name);
+    if (d && digest_matches(d, &st)) {
+	free(root_filename);
+	return xstrdup(d->md5sum);
+    }
+
+    md5sum = file_md5sum_alloc(root_filename);
+    free(root_filename);
+
+    /* A file changed within the second it was summed in could change
+       again without its times doing so, where they are in seconds. */
+    if (md5sum == NULL || st.st_mtime >= time(NULL)
+	    || st.st_ctime >= time(NULL))
+	return md5sum;
+
+    if (d == NULL) {
+	d = xmalloc(sizeof(*d));
+	hash_table_insert(&digests, file_name, d);
+    }
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    d->size = st.st_size;
+    d->mtime = st.st_mtim;
+    d->ctime = st.st_ctim;
+    strncpy(d->md5sum, md5sum, sizeof(d->md5sum) - 1);
+    d->md5sum[sizeof(d->md5sum) - 1] = '\0';
+    digests_changed = 1;
+
+    return md5sum;
+}
+
+static void
+digests_write(const char *key, void *entry, void *data)
+{
+    struct conffile_digest *d = entry;
+    FILE *fp = data;
+    struct stat st;
+    char *root_filename = root_filename_alloc((char *)key);
+
+    /* Those of files removed or changed since are forgotten. */
+    if (stat(root_filename, &st) == 0 && digest_matches(d, &st))
+	fprintf(fp, "%s %lu %lu %lld %ld.%09ld %ld.%09ld %s\n", d->md5sum,
+		(unsigned long)d->dev, (unsigned long)d->ino,
+		(long long)d->size, (long)d->mtime.tv_sec,
+		(long)d->mtime.tv_nsec, (long)d->ctime.tv_sec,
+		(long)d->ctime.tv_nsec, key);
+
+    free(root_filename);
+}
+
+static void
+digests_free(const char *key, void *entry, void *data)
+{
+    free(entry);
+}
+
+/*
+ * Save any new digests, as a query may do too under the shared lock.
+ */
+void
+conffile_md5sum_cache_deinit(void)
+{
+    char *tmp;
+    FILE *fp;
+    int fd;
+
+    if (digests_file == NULL)
+	return;
+
+    if (digests_changed && !conf->noaction) {
+	sprintf_alloc(&tmp, "%s.XXXXXX", digests_file);
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+	    opkg_msg(DEBUG, "Not saving conffile md5sums to %s.\n",
+		    digests_file);
+	} else {
+	    fchmod(fd, 0644);
+	    fp = fdopen(fd, "w");
+	    fprintf(fp, "%s\n", DIGESTS_MAGIC);
+	    hash_table_foreach(&digests, digests_write, fp);
+	    if (fclose(fp) == EOF || rename(tmp, digests_file) == -1) {
+		opkg_perror(ERROR, "Failed to write %s", digests_file);
+		unlink(tmp);
+	    }
+	}
+	free(tmp);
+    }
+
+    hash_table_foreach(&digests, digests_free, NULL);
+    hash_table_deinit(&digests);
+    free(digests_file);
+    digests_file = NULL;
+    digests_changed = 0;
+}
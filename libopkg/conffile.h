@@ -24,6 +24,8 @@ typedef struct nv_pair conffile_t;
 int conffile_init(conffile_t *conffile, const char *file_name, const char *md5sum);
 void conffile_deinit(conffile_t *conffile);
 int conffile_has_been_modified(conffile_t *conffile);
+char *conffile_md5sum_alloc(const char *file_name);
+void conffile_md5sum_cache_deinit(void);
 
 #endif
 
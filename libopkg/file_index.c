@@ -0,0 +1,456 @@
+/* file_index.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include "file_index.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "pkg_hash.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+/* Followed by the size and modification time, to the nanosecond, of the
+ * status file, which may be rewritten within a second by opkg flag. */
+#define FILE_INDEX_MAGIC "opkg-file-index 1"
+
+/*
+ * After the header, each line is the path of a file, as in the file hash,
+ * and the name of the package which owns it, separated by a tab and sorted
+ * by path.
+ */
+struct file_index {
+	pkg_dest_t *dest;
+	char *buf;
+	char **paths;	/* each followed by the name of its owner */
+	int count;
+};
+
+struct index_file {
+	const char *path;
+	pkg_t *owner;
+};
+
+struct index_files {
+	pkg_dest_t *dest;
+	struct index_file *files;
+	int len, size;
+};
+
+static char *
+file_index_name(pkg_dest_t *dest)
+{
+	char *path;
+
+	sprintf_alloc(&path, "%s/files.idx", dest->opkg_dir);
+	return path;
+}
+
+static void
+index_file_gather(const char *key, void *entry, void *data)
+{
+	struct index_files *files = data;
+	pkg_t *owner = entry;
+
+	/* Those whose files opkg search and the preinstall check look at. */
+	if (owner->dest != files->dest
+			|| (owner->state_status != SS_INSTALLED
+			&& owner->state_status != SS_UNPACKED))
+		return;
+
+	if (files->len == files->size) {
+		files->size = files->size ? 2 * files->size : 1024;
+		files->files = xrealloc(files->files,
+				files->size * sizeof(struct index_file));
+	}
+	files->files[files->len].path = key;
+	files->files[files->len].owner = owner;
+	files->len++;
+}
+
+static int
+index_file_cmp(const void *a, const void *b)
+{
+	const struct index_file *x = a, *y = b;
+
+	return strcmp(x->path, y->path);
+}
+
+/*
+ * Write the index of the files of dest from the file hash, which must
+ * have every installed file in it, after the status file of dest.
+ */
+int
+file_index_write(pkg_dest_t *dest)
+{
+	struct index_files files;
+	struct stat st;
+	char *path, *tmp;
+	FILE *fp;
+	int i, fd, err = -1;
+
+	if (stat(dest->status_file_name, &st) == -1) {
+		opkg_perror(ERROR, "Failed to stat %s",
+				dest->status_file_name);
+		return -1;
+	}
+
+	memset(&files, 0, sizeof(files));
+	files.dest = dest;
+	hash_table_foreach(&conf->file_hash, index_file_gather, &files);
+	qsort(files.files, files.len, sizeof(struct index_file),
+			index_file_cmp);
+
+	path = file_index_name(dest);
+	sprintf_alloc(&tmp, "%s.XXXXXX", path);
+
+	/* A query may be writing it too, under the shared lock. */
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		opkg_perror(ERROR, "Failed to create %s", tmp);
+		goto cleanup;
+	}
+	fchmod(fd, 0644);
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to fdopen %s", tmp);
+		close(fd);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	fprintf(fp, "%s %lld %ld.%09ld\n", FILE_INDEX_MAGIC,
+			(long long)st.st_size, (long)st.st_mtime,
+			(long)st.st_mtim.tv_nsec);
+	for (i = 0; i < files.len; i++)
+		fprintf(fp, "%s\t%s\n", files.files[i].path,
+				files.files[i].owner->name);
+
+	if (fclose(fp) == EOF) {
+		opkg_perror(ERROR, "Failed to write %s", tmp);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	if (rename(tmp, path) == -1) {
+		opkg_perror(ERROR, "Failed to rename %s to %s", tmp, path);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	err = 0;
+
+cleanup:
+	free(files.files);
+	free(tmp);
+	free(path);
+
+	return err;
+}
+
+static void
+file_index_close(struct file_index *index)
+{
+	free(index->paths);
+	free(index->buf);
+	free(index);
+}
+
+/*
+ * Returns the index of dest, or NULL if there is none or the status file
+ * has changed since it was written.
+ */
+static struct file_index *
+file_index_open(pkg_dest_t *dest)
+{
+	struct file_index *index;
+	struct stat status_st, st;
+	char *path, *header, *p, *nl, *tab;
+	FILE *fp;
+	int n;
+
+	if (stat(dest->status_file_name, &status_st) == -1)
+		return NULL;
+
+	path = file_index_name(dest);
+	fp = fopen(path, "r");
+	free(path);
+	if (fp == NULL)
+		return NULL;
+
+	if (fstat(fileno(fp), &st) == -1) {
+		fclose(fp);
+		return NULL;
+	}
+
+	index = xcalloc(1, sizeof(*index));
+	index->dest = dest;
+	index->buf = xmalloc(st.st_size + 1);
+	if (fread(index->buf, 1, st.st_size, fp) != st.st_size) {
+		opkg_perror(ERROR, "Failed to read file index of %s",
+				dest->name);
+		fclose(fp);
+		file_index_close(index);
+		return NULL;
+	}
+	index->buf[st.st_size] = '\0';
+	fclose(fp);
+
+	sprintf_alloc(&header, "%s %lld %ld.%09ld\n", FILE_INDEX_MAGIC,
+			(long long)status_st.st_size, (long)status_st.st_mtime,
+			(long)status_st.st_mtim.tv_nsec);
+	n = strlen(header);
+	if (strncmp(index->buf, header, n)) {
+		opkg_msg(INFO, "File index of %s is out of date.\n",
+				dest->name);
+		free(header);
+		file_index_close(index);
+		return NULL;
+	}
+	free(header);
+
+	p = index->buf + n;
+	for (n = 0, nl = p; (nl = strchr(nl, '\n')); nl++)
+		n++;
+	index->paths = xcalloc(n, sizeof(char *));
+
+	/* A path may have a tab in it, but a package name may not. */
+	for (; (nl = strchr(p, '\n')); p = nl + 1) {
+		*nl = '\0';
+		if ((tab = strrchr(p, '\t')) == NULL)
+			continue;
+		*tab = '\0';
+		index->paths[index->count++] = p;
+	}
+
+	return index;
+}
+
+/*
+ * Open the index of every dest, or none of them if any is missing or out
+ * of date.
+ */
+static struct file_index **
+file_index_open_all(int *count)
+{
+	pkg_dest_list_elt_t *iter;
+	struct file_index **indexes = NULL;
+	int n = 0;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		indexes = xrealloc(indexes,
+				(n + 1) * sizeof(struct file_index *));
+		indexes[n] = file_index_open((pkg_dest_t *)iter->data);
+		if (indexes[n] == NULL) {
+			while (n--)
+				file_index_close(indexes[n]);
+			free(indexes);
+			return NULL;
+		}
+		n++;
+	}
+
+	*count = n;
+	return indexes;
+}
+
+static void
+file_index_close_all(struct file_index **indexes, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		file_index_close(indexes[i]);
+	free(indexes);
+}
+
+/* Returns the owner of paths[i], which often owns paths[i - 1] too. */
+static pkg_t *
+file_index_owner(struct file_index *index, int i, pkg_t *last)
+{
+	const char *name = index->paths[i] + strlen(index->paths[i]) + 1;
+	pkg_t *owner;
+
+	if (last && strcmp(last->name, name) == 0)
+		return last;
+
+	owner = pkg_hash_fetch_installed_by_name_dest(name, index->dest);
+	if (owner == NULL)
+		opkg_msg(DEBUG, "%s owns %s but is not installed in %s.\n",
+				name, index->paths[i], index->dest->name);
+
+	return owner;
+}
+
+static int
+path_cmp(const void *path, const void *entry)
+{
+	return strcmp(path, *(char **)entry);
+}
+
+/* Returns the position of path in index, or -1. */
+static int
+file_index_find(struct file_index *index, const char *path)
+{
+	char **entry;
+
+	entry = bsearch(path, index->paths, index->count, sizeof(char *),
+			path_cmp);
+
+	return entry ? entry - index->paths : -1;
+}
+
+/*
+ * Put the owner of every installed file into the file hash from the
+ * indexes, instead of reading every .list file. Returns -1, having done
+ * nothing, if any index is missing or out of date.
+ */
+int
+file_index_load_owners(void)
+{
+	struct file_index **indexes, *index;
+	pkg_t *owner;
+	int count, i, j;
+
+	indexes = file_index_open_all(&count);
+	if (indexes == NULL)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		index = indexes[i];
+		owner = NULL;
+		for (j = 0; j < index->count; j++) {
+			owner = file_index_owner(index, j, owner);
+			if (owner && file_hash_get_file_owner(index->paths[j])
+					!= owner)
+				file_hash_set_file_owner(index->paths[j],
+						owner);
+		}
+	}
+
+	file_index_close_all(indexes, count);
+
+	return 0;
+}
+
+/*
+ * Returns the longest run of pattern which a file must have in it as it
+ * is to match, for a cheap test before fnmatch().
+ */
+static char *
+longest_literal(const char *pattern)
+{
+	const char *p, *start = pattern, *best = pattern;
+	size_t len = 0;
+
+	for (p = pattern; ; p++) {
+		if (*p && !strchr("*?[\\", *p))
+			continue;
+
+		if (p - start > len) {
+			best = start;
+			len = p - start;
+		}
+		if (*p == '\0')
+			break;
+
+		if (*p == '[') {
+			/* Skip the whole bracket expression. */
+			if (p[1] == '!' || p[1] == '^')
+				p++;
+			if (p[1] == ']')
+				p++;
+			while (p[1] && p[1] != ']')
+				p++;
+			if (p[1] == '\0')
+				break;
+			p++;
+		} else if (*p == '\\' && p[1]) {
+			p++;
+		}
+		start = p + 1;
+	}
+
+	return xstrndup(best, len);
+}
+
+/*
+ * Add the owner of every installed file which matches pattern, as opkg
+ * search does, to matches. Returns -1, having added nothing, if any index
+ * is missing or out of date.
+ */
+int
+file_index_search(const char *pattern, pkg_vec_t *matches)
+{
+	struct file_index **indexes, *index;
+	const char *root = conf->offline_root ? conf->offline_root : "";
+	char *literal, *file_name = NULL;
+	size_t root_len = strlen(root), size = 0, len;
+	pkg_t *owner;
+	int count, i, j;
+
+	indexes = file_index_open_all(&count);
+	if (indexes == NULL)
+		return -1;
+
+	literal = longest_literal(pattern);
+
+	for (i = 0; i < count; i++) {
+		index = indexes[i];
+		owner = NULL;
+
+		/* A plain path is looked up rather than matched. */
+		if (strcmp(literal, pattern) == 0) {
+			if (strncmp(pattern, root, root_len) == 0) {
+				j = file_index_find(index, pattern + root_len);
+				if (j >= 0 && (owner = file_index_owner(index,
+								j, NULL)))
+					pkg_vec_insert(matches, owner);
+			}
+			continue;
+		}
+
+		for (j = 0; j < index->count; j++) {
+			/* Files are matched with the offline root on. */
+			len = root_len + strlen(index->paths[j]) + 1;
+			if (len > size) {
+				size = 2 * len;
+				file_name = xrealloc(file_name, size);
+			}
+			strcpy(file_name, root);
+			strcpy(file_name + root_len, index->paths[j]);
+
+			if (!strstr(file_name, literal)
+					|| fnmatch(pattern, file_name, 0))
+				continue;
+
+			owner = file_index_owner(index, j, owner);
+			if (owner)
+				pkg_vec_insert(matches, owner);
+		}
+	}
+
+	free(file_name);
+	free(literal);
+	file_index_close_all(indexes, count);
+
+	return 0;
+}
@@ -0,0 +1,30 @@
+/* file_index.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include "pkg_dest.h"
+#include "pkg_vec.h"
+
+/*
+ * Every installed file of a dest and the package which owns it, sorted by
+ * path, so that finding the owners of files needs neither the package
+ * .list files nor the file hash. It is written with the status file, and
+ * not used once the status file has changed without it.
+ */
+int file_index_write(pkg_dest_t *dest);
+int file_index_load_owners(void);
+int file_index_search(const char *pattern, pkg_vec_t *matches);
+
+#endif
@@ -19,6 +19,8 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -129,17 +131,32 @@ file_copy(const char *src, const char *dest)
 	return err;
 }
 
+/*
+ * For a copy of src which will only be read: hard link it where possible,
+ * otherwise copy it.
+ */
+int
+file_link(const char *src, const char *dest)
+{
+	if (link(src, dest) == 0)
+		return 0;
+
+	return file_copy(src, dest);
+}
+
 int
 file_mkdir_hier(const char *path, long mode)
 {
 	return make_directory(path, mode, FILEUTILS_RECUR);
 }
 
-char *file_md5sum_alloc(const char *file_name)
-{
-    static const int md5sum_bin_len = 16;
-    static const int md5sum_hex_len = 32;
+/* Large enough that reading a package takes few system calls, and a
+   multiple of the block size of both digests. */
+#define DIGEST_BUF_LEN (128 * 1024)
 
+static char *
+digest_hex_alloc(const unsigned char *bin, int len)
+{
     static const unsigned char bin2hex[16] = {
 	'0', '1', '2', '3',
 	'4', '5', '6', '7',
@@ -147,87 +164,186 @@ char *file_md5sum_alloc(const char *file_name)
 	'c', 'd', 'e', 'f'
     };
 
-    int i, err;
-    FILE *file;
-    char *md5sum_hex;
-    unsigned char md5sum_bin[md5sum_bin_len];
+    int i;
+    char *hex;
 
-    md5sum_hex = xcalloc(1, md5sum_hex_len + 1);
+    hex = xcalloc(1, len * 2 + 1);
 
-    file = fopen(file_name, "r");
-    if (file == NULL) {
-	opkg_perror(ERROR, "Failed to open file %s", file_name);
-	free(md5sum_hex);
-	return NULL;
+    for (i=0; i < len; i++) {
+	hex[i*2] = bin2hex[bin[i] >> 4];
+	hex[i*2+1] = bin2hex[bin[i] & 0xf];
     }
 
-    err = md5_stream(file, md5sum_bin);
-    if (err) {
-	opkg_msg(ERROR, "Could't compute md5sum for %s.\n", file_name);
-	fclose(file);
-	free(md5sum_hex);
-	return NULL;
-    }
+    hex[len * 2] = '\0';
 
-    fclose(file);
+    return hex;
+}
 
-    for (i=0; i < md5sum_bin_len; i++) {
-	md5sum_hex[i*2] = bin2hex[md5sum_bin[i] >> 4];
-	md5sum_hex[i*2+1] = bin2hex[md5sum_bin[i] & 0xf];
-    }
+struct digests_ctx {
+    int md5;
+    struct md5_ctx md5_ctx;
+#ifdef HAVE_SHA256
+    int sha256;
+    struct sha256_ctx sha256_ctx;
+#endif
+};
+
+/*
+ * Start computing the digests asked for by md5 and sha256 of data which is
+ * passed to digests_ctx_update() a piece at a time, as it is read.
+ */
+struct digests_ctx *
+digests_ctx_alloc(int md5, int sha256)
+{
+    struct digests_ctx *ctx;
 
-    md5sum_hex[md5sum_hex_len] = '\0';
+    ctx = xcalloc(1, sizeof(*ctx));
+
+    ctx->md5 = md5;
+    if (md5)
+	md5_init_ctx(&ctx->md5_ctx);
+#ifdef HAVE_SHA256
+    ctx->sha256 = sha256;
+    if (sha256)
+	sha256_init_ctx(&ctx->sha256_ctx);
+#endif
 
-    return md5sum_hex;
+    return ctx;
 }
 
+void
+digests_ctx_update(struct digests_ctx *ctx, const void *buf, size_t len)
+{
+    if (ctx->md5)
+	md5_process_bytes(buf, len, &ctx->md5_ctx);
 #ifdef HAVE_SHA256
-char *file_sha256sum_alloc(const char *file_name)
+    if (ctx->sha256)
+	sha256_process_bytes(buf, len, &ctx->sha256_ctx);
+#endif
+}
+
+/*
+ * Finish the digests of ctx and free it. A non-NULL md5sum or sha256sum is
+ * set to that digest, or to NULL if it was not computed.
+ */
+void
+digests_ctx_finish(struct digests_ctx *ctx, char **md5sum, char **sha256sum)
 {
-    static const int sha256sum_bin_len = 32;
-    static const int sha256sum_hex_len = 64;
+    unsigned char bin[32];
 
-    static const unsigned char bin2hex[16] = {
-	'0', '1', '2', '3',
-	'4', '5', '6', '7',
-	'8', '9', 'a', 'b',
-	'c', 'd', 'e', 'f'
-    };
+    if (md5sum)
+	*md5sum = NULL;
+    if (sha256sum)
+	*sha256sum = NULL;
 
-    int i, err;
-    FILE *file;
-    char *sha256sum_hex;
-    unsigned char sha256sum_bin[sha256sum_bin_len];
+    if (ctx->md5) {
+	md5_finish_ctx(&ctx->md5_ctx, bin);
+	if (md5sum)
+	    *md5sum = digest_hex_alloc(bin, 16);
+    }
+#ifdef HAVE_SHA256
+    if (ctx->sha256) {
+	sha256_finish_ctx(&ctx->sha256_ctx, bin);
+	if (sha256sum)
+	    *sha256sum = digest_hex_alloc(bin, 32);
+    }
+#endif
 
-    sha256sum_hex = xcalloc(1, sha256sum_hex_len + 1);
+    free(ctx);
+}
+
+/*
+ * Compute each digest of file_name which is asked for, by a non-NULL
+ * md5sum or sha256sum, in a single read of the file. A sha256sum is left
+ * NULL without sha256 support. Returns -1, having set neither, on error.
+ */
+int
+file_digests_alloc(const char *file_name, char **md5sum, char **sha256sum)
+{
+    struct digests_ctx *ctx;
+    void *buf;
+    ssize_t n = 0;
+    size_t len;
+    int fd;
+
+    if (md5sum)
+	*md5sum = NULL;
+    if (sha256sum)
+	*sha256sum = NULL;
+#ifndef HAVE_SHA256
+    sha256sum = NULL;
+#endif
+    if (md5sum == NULL && sha256sum == NULL)
+	return 0;
 
-    file = fopen(file_name, "r");
-    if (file == NULL) {
+    fd = open(file_name, O_RDONLY);
+    if (fd == -1) {
 	opkg_perror(ERROR, "Failed to open file %s", file_name);
-	free(sha256sum_hex);
-	return NULL;
+	return -1;
     }
 
-    err = sha256_stream(file, sha256sum_bin);
-    if (err) {
-	opkg_msg(ERROR, "Could't compute sha256sum for %s.\n", file_name);
-	fclose(file);
-	free(sha256sum_hex);
-	return NULL;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if ((errno = posix_memalign(&buf, 4096, DIGEST_BUF_LEN))) {
+	opkg_perror(ERROR, "Failed to allocate a buffer for %s", file_name);
+	close(fd);
+	return -1;
     }
 
-    fclose(file);
+    ctx = digests_ctx_alloc(md5sum != NULL, sha256sum != NULL);
+
+    do {
+	/* Fill the buffer, so that whole blocks are hashed at a time. */
+	len = 0;
+	while (len < DIGEST_BUF_LEN) {
+	    n = read(fd, (char *)buf + len, DIGEST_BUF_LEN - len);
+	    if (n == -1 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		break;
+	    len += n;
+	}
+	if (n == -1) {
+	    opkg_perror(ERROR, "Failed to read %s", file_name);
+	    digests_ctx_finish(ctx, NULL, NULL);
+	    free(buf);
+	    close(fd);
+	    return -1;
+	}
 
-    for (i=0; i < sha256sum_bin_len; i++) {
-	sha256sum_hex[i*2] = bin2hex[sha256sum_bin[i] >> 4];
-	sha256sum_hex[i*2+1] = bin2hex[sha256sum_bin[i] & 0xf];
-    }
+	digests_ctx_update(ctx, buf, len);
+    } while (len == DIGEST_BUF_LEN);
 
-    sha256sum_hex[sha256sum_hex_len] = '\0';
+    digests_ctx_finish(ctx, md5sum, sha256sum);
 
-    return sha256sum_hex;
+    free(buf);
+    close(fd);
+
+    return 0;
+}
+
+char *file_md5sum_alloc(const char *file_name)
+{
+    char *md5sum;
+
+    if (file_digests_alloc(file_name, &md5sum, NULL))
+	return NULL;
+
+    return md5sum;
 }
 
+#ifdef HAVE_SHA256
+char *file_sha256sum_alloc(const char *file_name)
+{
+    char *sha256sum;
+
+    if (file_digests_alloc(file_name, NULL, &sha256sum))
+	return NULL;
+
+    return sha256sum;
+}
 #endif
 
 
@@ -23,7 +23,12 @@ int file_is_dir(const char *file_name);
 char *file_read_line_alloc(FILE *file);
 int file_move(const char *src, const char *dest);
 int file_copy(const char *src, const char *dest);
+int file_link(const char *src, const char *dest);
 int file_mkdir_hier(const char *path, long mode);
+struct digests_ctx *digests_ctx_alloc(int md5, int sha256);
+void digests_ctx_update(struct digests_ctx *ctx, const void *buf, size_t len);
+void digests_ctx_finish(struct digests_ctx *ctx, char **md5sum, char **sha256sum);
+int file_digests_alloc(const char *file_name, char **md5sum, char **sha256sum);
 char *file_md5sum_alloc(const char *file_name);
 char *file_sha256sum_alloc(const char *file_name);
 int rm_r(const char *path);
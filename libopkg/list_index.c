@@ -0,0 +1,392 @@
+/* list_index.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "list_index.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "opkg_utils.h"
+#include "hash_table.h"
+#include "parse_util.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+/* Followed by the size and modification time of the list. */
+#define LIST_INDEX_MAGIC "opkg-list-index 1"
+
+/*
+ * After the header, each line is a name, the offsets of its stanzas and the
+ * packages which provide or replace it, separated by tabs and sorted by
+ * name.
+ */
+struct list_index {
+	char *buf;
+	char **names;	/* each followed by its offsets, then its others */
+	int count;
+};
+
+struct index_entry {
+	const char *name;	/* the key in the table */
+	char *offsets;
+	char *others;
+};
+
+struct stanza {
+	char *name;
+	char **provides;
+	unsigned int provides_count;
+	char **replaces;
+	unsigned int replaces_count;
+};
+
+static char *
+index_file_name(const char *list_file)
+{
+	char *path;
+
+	sprintf_alloc(&path, "%s.idx", list_file);
+	return path;
+}
+
+static int
+stanza_parse_line(void *ptr, const char *line, uint mask)
+{
+	struct stanza *s = ptr;
+
+	if (line_is_blank(line))
+		return 1;
+
+	if (is_field("Package:", line) && s->name == NULL)
+		s->name = parse_simple("Package", line);
+	else if (is_field("Provides:", line) && s->provides == NULL)
+		s->provides = parse_list(line, &s->provides_count, ',', 0);
+	else if (is_field("Replaces:", line) && s->replaces == NULL)
+		s->replaces = parse_list(line, &s->replaces_count, ',', 0);
+
+	return 0;
+}
+
+static void
+append(char **field, const char *value)
+{
+	char *old = *field;
+
+	if (old == NULL) {
+		*field = xstrdup(value);
+		return;
+	}
+
+	sprintf_alloc(field, "%s %s", old, value);
+	free(old);
+}
+
+static struct index_entry *
+index_entry_get(hash_table_t *table, const char *name)
+{
+	struct index_entry *entry;
+
+	entry = hash_table_get(table, name);
+	if (entry == NULL) {
+		entry = xcalloc(1, sizeof(*entry));
+		hash_table_insert(table, name, entry);
+	}
+
+	return entry;
+}
+
+/* Returns 1 if the last word in the list words is word. */
+static int
+last_word_is(const char *words, const char *word)
+{
+	size_t len = strlen(words), n = strlen(word);
+
+	return len >= n && !strcmp(words + len - n, word)
+		&& (len == n || words[len - n - 1] == ' ');
+}
+
+/* Record pkg_name under each of names, which are freed. */
+static void
+index_add_others(hash_table_t *table, char **names, unsigned int count,
+		const char *pkg_name)
+{
+	struct index_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (pkg_name) {
+			entry = index_entry_get(table, names[i]);
+			/* The versions of a package are usually together. */
+			if (!entry->others
+					|| !last_word_is(entry->others, pkg_name))
+				append(&entry->others, pkg_name);
+		}
+		free(names[i]);
+	}
+	free(names);
+}
+
+struct index_entries {
+	struct index_entry **entries;
+	int count;
+};
+
+static void
+index_entry_count(const char *key, void *entry, void *data)
+{
+	(*(int *)data)++;
+}
+
+static void
+index_entry_collect(const char *key, void *entry, void *data)
+{
+	struct index_entries *all = data;
+	struct index_entry *e = entry;
+
+	e->name = key;
+	all->entries[all->count++] = e;
+}
+
+static int
+index_entry_cmp(const void *a, const void *b)
+{
+	const struct index_entry *x = *(struct index_entry **)a;
+	const struct index_entry *y = *(struct index_entry **)b;
+
+	return strcmp(x->name, y->name);
+}
+
+static void
+index_entry_free(const char *key, void *entry, void *data)
+{
+	struct index_entry *e = entry;
+
+	free(e->offsets);
+	free(e->others);
+	free(e);
+}
+
+/*
+ * Write the index of list_file to list_file.idx.
+ */
+int
+list_index_write(const char *list_file)
+{
+	hash_table_t table;
+	struct index_entries all;
+	struct stanza s;
+	struct stat st;
+	char *path = NULL, *tmp = NULL, *buf, offset[32];
+	const size_t len = 4096;
+	FILE *fp, *out;
+	long pos;
+	int i, n = 0, err = -1;
+
+	fp = fopen(list_file, "r");
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", list_file);
+		return -1;
+	}
+	if (fstat(fileno(fp), &st) == -1) {
+		opkg_perror(ERROR, "Failed to stat %s", list_file);
+		fclose(fp);
+		return -1;
+	}
+
+	memset(&table, 0, sizeof(table));
+	hash_table_init("list-index", &table, OPKG_CONF_DEFAULT_HASH_LEN);
+	buf = xmalloc(len);
+
+	while (!feof(fp)) {
+		memset(&s, 0, sizeof(s));
+		pos = ftell(fp);
+		if (parse_from_stream_nomalloc(stanza_parse_line, &s, fp, 0,
+					&buf, len))
+			break;
+
+		if (s.name == NULL) {
+			/* probably just a blank line */
+			index_add_others(&table, s.provides, s.provides_count,
+					NULL);
+			index_add_others(&table, s.replaces, s.replaces_count,
+					NULL);
+			continue;
+		}
+
+		snprintf(offset, sizeof(offset), "%ld", pos);
+		append(&index_entry_get(&table, s.name)->offsets, offset);
+		index_add_others(&table, s.provides, s.provides_count, s.name);
+		index_add_others(&table, s.replaces, s.replaces_count, s.name);
+		free(s.name);
+	}
+	if (ferror(fp))
+		goto cleanup;
+
+	hash_table_foreach(&table, index_entry_count, &n);
+	all.entries = xcalloc(n, sizeof(struct index_entry *));
+	all.count = 0;
+	hash_table_foreach(&table, index_entry_collect, &all);
+	qsort(all.entries, all.count, sizeof(struct index_entry *),
+			index_entry_cmp);
+
+	path = index_file_name(list_file);
+	sprintf_alloc(&tmp, "%s.tmp", path);
+
+	out = fopen(tmp, "w");
+	if (out == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", tmp);
+		free(all.entries);
+		goto cleanup;
+	}
+	fprintf(out, "%s %lld %ld\n", LIST_INDEX_MAGIC,
+			(long long)st.st_size, (long)st.st_mtime);
+	for (i = 0; i < all.count; i++) {
+		struct index_entry *e = all.entries[i];
+		fprintf(out, "%s\t%s\t%s\n", e->name,
+				e->offsets ? e->offsets : "",
+				e->others ? e->others : "");
+	}
+	free(all.entries);
+	if (fclose(out) == EOF) {
+		opkg_perror(ERROR, "Failed to write %s", tmp);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	if (rename(tmp, path) == -1) {
+		opkg_perror(ERROR, "Failed to rename %s to %s", tmp, path);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	err = 0;
+
+cleanup:
+	hash_table_foreach(&table, index_entry_free, NULL);
+	hash_table_deinit(&table);
+	free(buf);
+	free(tmp);
+	free(path);
+	fclose(fp);
+
+	return err;
+}
+
+/*
+ * Returns the index of list_file, or NULL if there is none or it was made
+ * from a different version of the list.
+ */
+list_index_t *
+list_index_open(const char *list_file)
+{
+	list_index_t *index;
+	struct stat list_st, st;
+	char *path, *header, *p, *nl, *tab;
+	FILE *fp;
+	int n;
+
+	if (stat(list_file, &list_st) == -1)
+		return NULL;
+
+	path = index_file_name(list_file);
+	fp = fopen(path, "r");
+	free(path);
+	if (fp == NULL)
+		return NULL;
+
+	if (fstat(fileno(fp), &st) == -1) {
+		fclose(fp);
+		return NULL;
+	}
+
+	index = xcalloc(1, sizeof(*index));
+	index->buf = xmalloc(st.st_size + 1);
+	if (fread(index->buf, 1, st.st_size, fp) != st.st_size) {
+		opkg_perror(ERROR, "Failed to read index of %s", list_file);
+		fclose(fp);
+		list_index_close(index);
+		return NULL;
+	}
+	index->buf[st.st_size] = '\0';
+	fclose(fp);
+
+	sprintf_alloc(&header, "%s %lld %ld\n", LIST_INDEX_MAGIC,
+			(long long)list_st.st_size, (long)list_st.st_mtime);
+	n = strlen(header);
+	if (strncmp(index->buf, header, n)) {
+		opkg_msg(INFO, "Index of %s is out of date.\n", list_file);
+		free(header);
+		list_index_close(index);
+		return NULL;
+	}
+	free(header);
+
+	p = index->buf + n;
+	for (n = 0, nl = p; (nl = strchr(nl, '\n')); nl++)
+		n++;
+	index->names = xcalloc(n, sizeof(char *));
+
+	for (; (nl = strchr(p, '\n')); p = nl + 1) {
+		*nl = '\0';
+		if ((tab = strchr(p, '\t')) == NULL)
+			continue;
+		*tab++ = '\0';
+		if ((tab = strchr(tab, '\t')) == NULL)
+			continue;
+		*tab = '\0';
+		index->names[index->count++] = p;
+	}
+
+	return index;
+}
+
+static int
+name_cmp(const void *name, const void *entry)
+{
+	return strcmp(name, *(char **)entry);
+}
+
+/*
+ * Returns 1 if name is in the index, with the offsets of its stanzas and the
+ * packages which provide or replace it, each separated by spaces.
+ */
+int
+list_index_lookup(list_index_t *index, const char *name,
+		const char **offsets, const char **others)
+{
+	char **entry;
+
+	entry = bsearch(name, index->names, index->count, sizeof(char *),
+			name_cmp);
+	if (entry == NULL)
+		return 0;
+
+	*offsets = *entry + strlen(*entry) + 1;
+	*others = *offsets + strlen(*offsets) + 1;
+
+	return 1;
+}
+
+void
+list_index_close(list_index_t *index)
+{
+	free(index->names);
+	free(index->buf);
+	free(index);
+}
@@ -0,0 +1,31 @@
+/* list_index.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef LIST_INDEX_H
+#define LIST_INDEX_H
+
+/*
+ * The index opkg update writes next to each package list, so that a command
+ * which needs only a few packages can parse just their stanzas. For every
+ * package name it gives the offsets of its stanzas in the list, and for
+ * every name which is provided or replaced, the packages which do so.
+ */
+typedef struct list_index list_index_t;
+
+int list_index_write(const char *list_file);
+list_index_t *list_index_open(const char *list_file);
+int list_index_lookup(list_index_t *index, const char *name,
+		const char **offsets, const char **others);
+void list_index_close(list_index_t *index);
+
+#endif
@@ -32,6 +32,8 @@
 
 #include "sprintf_alloc.h"
 #include "file_util.h"
+#include "list_index.h"
+#include "opkg_trigger.h"
 
 #include <libbb/libbb.h>
 
@@ -54,6 +56,8 @@ opkg_configure_packages(char *pkg_name)
 	all = pkg_vec_alloc();
 	pkg_hash_fetch_available(all);
 
+	opkg_trigger_begin();
+
 	for (i = 0; i < all->len; i++) {
 		pkg = all->pkgs[i];
 
@@ -66,6 +70,7 @@ opkg_configure_packages(char *pkg_name)
 				pkg->state_status = SS_INSTALLED;
 				pkg->parent->state_status = SS_INSTALLED;
 				pkg->state_flag &= ~SF_PREFER;
+				opkg_trigger_activate_pkg(pkg);
 			} else {
 				if (!err)
 					err = r;
@@ -73,6 +78,8 @@ opkg_configure_packages(char *pkg_name)
 		}
 	}
 
+	opkg_trigger_end();
+
 	pkg_vec_free(all);
 	return err;
 }
@@ -132,6 +139,8 @@ opkg_new()
 	if (pkg_hash_load_status_files())
 		goto err1;
 
+	pkg_hash_build_graph();
+
 	return 0;
 
 err1:
@@ -365,9 +374,11 @@ opkg_install_package(const char *package_name,
 	progress(pdata, 75);
 
 	/* unpack the package */
+	opkg_trigger_begin();
 	err = opkg_install_pkg(new, 0);
 
 	if (err) {
+		opkg_trigger_end();
 		return -1;
 	}
 
@@ -375,6 +386,7 @@ opkg_install_package(const char *package_name,
 
 	/* run configure scripts, etc. */
 	err = opkg_configure_packages(NULL);
+	opkg_trigger_end();
 	if (err) {
 		return -1;
 	}
@@ -421,7 +433,9 @@ opkg_remove_package(const char *package_name,
 
 	progress(pdata, 75);
 
+	opkg_trigger_begin();
 	err = opkg_remove_pkg(pkg_to_remove, 0);
+	opkg_trigger_end();
 
 	/* write out status files and file lists */
 	opkg_conf_write_status_files();
@@ -461,13 +475,16 @@ opkg_upgrade_package(const char *package_name,
 	pdata.pkg = pkg;
 	progress(pdata, 0);
 
+	opkg_trigger_begin();
 	err = opkg_upgrade_pkg(pkg);
 	if (err) {
+		opkg_trigger_end();
 		return -1;
 	}
 	progress(pdata, 75);
 
 	err = opkg_configure_packages(NULL);
+	opkg_trigger_end();
 	if (err) {
 		return -1;
 	}
@@ -498,6 +515,7 @@ opkg_upgrade_all(opkg_progress_callback_t progress_callback, void *user_data)
 	pkg_info_preinstall_check();
 
 	pkg_hash_fetch_all_installed(installed);
+	opkg_trigger_begin();
 	for (i = 0; i < installed->len; i++) {
 		pkg = installed->pkgs[i];
 
@@ -508,10 +526,13 @@ opkg_upgrade_all(opkg_progress_callback_t progress_callback, void *user_data)
 	}
 	pkg_vec_free(installed);
 
-	if (err)
+	if (err) {
+		opkg_trigger_end();
 		return 1;
+	}
 
 	err = opkg_configure_packages(NULL);
+	opkg_trigger_end();
 	if (err)
 		return 1;
 
@@ -582,23 +603,16 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 
 		if (src->extra_data)	/* debian style? */
 			sprintf_alloc(&url, "%s/%s/%s", src->value,
-				      src->extra_data,
-				      src->gzip ? "Packages.gz" : "Packages");
+				      src->extra_data, "Packages");
 		else
-			sprintf_alloc(&url, "%s/%s", src->value,
-				      src->gzip ? "Packages.gz" : "Packages");
+			sprintf_alloc(&url, "%s/%s", src->value, "Packages");
 
 		sprintf_alloc(&list_file_name, "%s/%s", lists_dir, src->name);
 		if (src->gzip) {
-			FILE *in, *out;
 			struct _curl_cb_data cb_data;
 			char *tmp_file_name = NULL;
 
-			sprintf_alloc(&tmp_file_name, "%s/%s.gz", tmp,
-				      src->name);
-
-			opkg_msg(INFO, "Downloading %s to %s...\n", url,
-					tmp_file_name);
+			sprintf_alloc(&tmp_file_name, "%s/%s", tmp, src->name);
 
 			cb_data.cb = progress_callback;
 			cb_data.progress_data = &pdata;
@@ -608,25 +622,10 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 			cb_data.finish_range =
 			    100 * (sources_done + 1) / sources_list_count;
 
-			err = opkg_download(url, tmp_file_name,
-					  (curl_progress_func) curl_progress_cb,
-					  &cb_data, 0);
-
-			if (err == 0) {
-				opkg_msg(INFO, "Inflating %s...\n",
-						tmp_file_name);
-				in = fopen(tmp_file_name, "r");
-				out = fopen(list_file_name, "w");
-				if (in && out)
-					unzip(in, out);
-				else
-					err = 1;
-				if (in)
-					fclose(in);
-				if (out)
-					fclose(out);
-				unlink(tmp_file_name);
-			}
+			err = opkg_download_index(url, list_file_name,
+					tmp_file_name,
+					(curl_progress_func) curl_progress_cb,
+					&cb_data);
 			free(tmp_file_name);
 		} else
 			err = opkg_download(url, list_file_name, NULL, NULL, 0);
@@ -634,7 +633,8 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 		if (err) {
 			opkg_msg(ERROR, "Couldn't retrieve %s\n", url);
 			result = -1;
-		}
+		} else
+			list_index_write(list_file_name);
 		free(url);
 
 #if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
@@ -763,55 +763,61 @@ opkg_list_upgradable_packages(opkg_package_callback_t callback, void *user_data)
 	return 0;
 }
 
+static int
+opkg_find_package_matches(pkg_t *pkg, const char *name, const char *ver,
+		const char *arch, const char *repo)
+{
+	if (name && strcmp(pkg->name, name))
+		return 0;
+	if (ver && !pkg_version_str_matches(pkg, ver))
+		return 0;
+	if (arch && pkg->architecture && strcmp(pkg->architecture, arch))
+		return 0;
+	if (repo && pkg->src && pkg->src->name && strcmp(pkg->src->name, repo))
+		return 0;
+
+	return 1;
+}
+
 pkg_t *
 opkg_find_package(const char *name, const char *ver, const char *arch,
 		const char *repo)
 {
-	int pkg_found = 0;
 	pkg_t *pkg = NULL;
 	pkg_vec_t *all;
+	abstract_pkg_t *ab_pkg;
 	int i;
-#define sstrcmp(x,y) (x && y) ? strcmp (x, y) : 0
 
-	all = pkg_vec_alloc();
-	pkg_hash_fetch_available(all);
-	for (i = 0; i < all->len; i++) {
-		char *pkgv;
-
-		pkg = all->pkgs[i];
-
-		/* check name */
-		if (sstrcmp(pkg->name, name))
-			continue;
+	/* Only the versions of name need to be looked at. */
+	if (name) {
+		ab_pkg = abstract_pkg_fetch_by_name(name);
+		if (ab_pkg == NULL || ab_pkg->pkgs == NULL)
+			return NULL;
 
-		/* check version */
-		pkgv = pkg_version_str_alloc(pkg);
-		if (sstrcmp(pkgv, ver)) {
-			free(pkgv);
-			continue;
+		for (i = 0; i < ab_pkg->pkgs->len; i++) {
+			pkg = ab_pkg->pkgs->pkgs[i];
+			if (opkg_find_package_matches(pkg, name, ver, arch, repo))
+				return pkg;
 		}
-		free(pkgv);
 
-		/* check architecture */
-		if (arch) {
-			if (sstrcmp(pkg->architecture, arch))
-				continue;
-		}
+		return NULL;
+	}
 
-		/* check repository */
-		if (repo) {
-			if (sstrcmp(pkg->src->name, repo))
-				continue;
+	all = pkg_vec_alloc();
+	pkg_hash_fetch_available(all);
+	for (i = 0; i < all->len; i++) {
+		if (opkg_find_package_matches(all->pkgs[i], name, ver, arch,
+					repo)) {
+			pkg = all->pkgs[i];
+			break;
 		}
-
-		/* match found */
-		pkg_found = 1;
-		break;
 	}
+	if (i == all->len)
+		pkg = NULL;
 
 	pkg_vec_free(all);
 
-	return pkg_found ? pkg : NULL;
+	return pkg;
 }
 
 /**
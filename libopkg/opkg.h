@@ -20,6 +20,7 @@
 
 #include "pkg.h"
 #include "opkg_message.h"
+#include "opkg_profile.h"
 
 typedef struct _opkg_progress_data_t opkg_progress_data_t;
 
@@ -0,0 +1,308 @@
+/* opkg_cache.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "opkg_cache.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "hash_table.h"
+#include "sprintf_alloc.h"
+#include "file_util.h"
+#include "libbb/libbb.h"
+
+#define OPKG_CACHE_INDEX "index"
+
+struct cache_entry {
+	const char *digest;	/* the key in cache_index */
+	unsigned long long size;
+	time_t last_use;
+	int in_use;		/* looked up or added by this run */
+};
+
+static hash_table_t cache_index;
+static int cache_index_loaded;
+static int cache_index_changed;
+static int cache_detached;
+
+static struct cache_entry *
+cache_entry_set(const char *digest, unsigned long long size, time_t last_use)
+{
+	struct cache_entry *entry;
+
+	entry = hash_table_get(&cache_index, digest);
+	if (entry == NULL) {
+		entry = xcalloc(1, sizeof(*entry));
+		hash_table_insert(&cache_index, digest, entry);
+	}
+	entry->size = size;
+	entry->last_use = last_use;
+
+	return entry;
+}
+
+static void
+cache_index_load(void)
+{
+	char *path, *line;
+	char digest[129];
+	unsigned long long size;
+	long last_use;
+	FILE *fp;
+
+	if (cache_index_loaded)
+		return;
+	cache_index_loaded = 1;
+
+	cache_index.entries = NULL;
+	hash_table_init("cache-index", &cache_index, 256);
+
+	sprintf_alloc(&path, "%s/%s", conf->cache, OPKG_CACHE_INDEX);
+	fp = fopen(path, "r");
+	free(path);
+	if (fp == NULL)
+		return;
+
+	while ((line = file_read_line_alloc(fp))) {
+		if (sscanf(line, "%128s %llu %ld", digest, &size,
+					&last_use) == 3)
+			cache_entry_set(digest, size, last_use);
+		free(line);
+	}
+
+	fclose(fp);
+}
+
+static void
+cache_entry_write(const char *key, void *entry, void *data)
+{
+	struct cache_entry *e = entry;
+
+	fprintf(data, "%s %llu %ld\n", key, e->size, (long)e->last_use);
+}
+
+static void
+cache_index_save(void)
+{
+	char *path, *tmp;
+	FILE *fp;
+
+	if (!cache_index_changed || cache_detached)
+		return;
+
+	sprintf_alloc(&path, "%s/%s", conf->cache, OPKG_CACHE_INDEX);
+	sprintf_alloc(&tmp, "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", tmp);
+		goto cleanup;
+	}
+	hash_table_foreach(&cache_index, cache_entry_write, fp);
+	if (fclose(fp) == EOF) {
+		opkg_perror(ERROR, "Failed to write %s", tmp);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	if (rename(tmp, path) == -1) {
+		opkg_perror(ERROR, "Failed to rename %s to %s", tmp, path);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	cache_index_changed = 0;
+
+cleanup:
+	free(tmp);
+	free(path);
+}
+
+/*
+ * Returns 1 and the name of the cached file for digest if it is in the index
+ * and still has its recorded size, in which case it needn't be verified
+ * again. Otherwise returns 0 with the name the file should be cached as.
+ */
+int
+opkg_cache_lookup(const char *digest, char **file_name)
+{
+	struct cache_entry *entry;
+	struct stat st;
+
+	cache_index_load();
+
+	sprintf_alloc(file_name, "%s/%s", conf->cache, digest);
+
+	entry = hash_table_get(&cache_index, digest);
+	if (entry == NULL)
+		return 0;
+
+	if (stat(*file_name, &st) == -1 || st.st_size != entry->size) {
+		opkg_msg(INFO, "Dropping stale cache entry %s.\n", *file_name);
+		hash_table_remove(&cache_index, digest);
+		free(entry);
+		cache_index_changed = 1;
+		return 0;
+	}
+
+	entry->last_use = time(NULL);
+	entry->in_use = 1;
+	cache_index_changed = 1;
+
+	return 1;
+}
+
+struct cache_usage {
+	struct cache_entry **entries;
+	int count;
+	unsigned long long size;
+};
+
+static void
+cache_entry_collect(const char *key, void *entry, void *data)
+{
+	struct cache_usage *usage = data;
+	struct cache_entry *e = entry;
+
+	e->digest = key;
+	usage->entries[usage->count++] = e;
+	usage->size += e->size;
+}
+
+static int
+cache_entry_cmp(const void *a, const void *b)
+{
+	const struct cache_entry *x = *(struct cache_entry **)a;
+	const struct cache_entry *y = *(struct cache_entry **)b;
+
+	if (x->last_use != y->last_use)
+		return x->last_use < y->last_use ? -1 : 1;
+	return strcmp(x->digest, y->digest);
+}
+
+/*
+ * Remove the least recently used packages until the cache fits in
+ * conf->cache_size kilobytes. Packages in use by this run may still be
+ * installed from, so they are kept unless all is set, once it is done.
+ */
+static void
+cache_evict(int all)
+{
+	struct cache_usage usage;
+	unsigned long long budget;
+	char *path;
+	int i;
+
+	if (conf->cache_size <= 0)
+		return;
+	budget = (unsigned long long)conf->cache_size * 1024;
+
+	usage.entries = xcalloc(cache_index.n_elements + 1,
+			sizeof(struct cache_entry *));
+	usage.count = 0;
+	usage.size = 0;
+	hash_table_foreach(&cache_index, cache_entry_collect, &usage);
+
+	qsort(usage.entries, usage.count, sizeof(struct cache_entry *),
+			cache_entry_cmp);
+
+	for (i = 0; i < usage.count && usage.size > budget; i++) {
+		struct cache_entry *e = usage.entries[i];
+		char *digest;
+
+		if (e->in_use && !all)
+			continue;
+
+		digest = xstrdup(e->digest);
+		sprintf_alloc(&path, "%s/%s", conf->cache, digest);
+		opkg_msg(INFO, "Evicting %s from the cache.\n", path);
+		if (unlink(path) == -1)
+			opkg_perror(ERROR, "Failed to remove %s", path);
+		free(path);
+
+		usage.size -= e->size;
+		hash_table_remove(&cache_index, digest);
+		free(digest);
+		free(e);
+		cache_index_changed = 1;
+	}
+
+	free(usage.entries);
+}
+
+/*
+ * Record the file for digest, which has just been verified, as used now.
+ */
+void
+opkg_cache_add(const char *digest)
+{
+	char *path;
+	struct stat st;
+
+	if (cache_detached)
+		return;
+
+	cache_index_load();
+
+	sprintf_alloc(&path, "%s/%s", conf->cache, digest);
+	if (stat(path, &st) == -1) {
+		opkg_perror(ERROR, "Failed to stat %s", path);
+		free(path);
+		return;
+	}
+	free(path);
+
+	cache_entry_set(digest, st.st_size, time(NULL))->in_use = 1;
+	cache_index_changed = 1;
+
+	cache_evict(0);
+	cache_index_save();
+}
+
+/*
+ * For a child process which fills the cache for its parent: leave the index
+ * and the eviction of files to the parent, which adds what the child fetched.
+ */
+void
+opkg_cache_detach(void)
+{
+	cache_detached = 1;
+}
+
+static void
+cache_entry_free(const char *key, void *entry, void *data)
+{
+	free(entry);
+}
+
+void
+opkg_cache_deinit(void)
+{
+	if (!cache_index_loaded)
+		return;
+
+	if (!cache_detached)
+		cache_evict(1);
+	cache_index_save();
+
+	hash_table_foreach(&cache_index, cache_entry_free, NULL);
+	hash_table_deinit(&cache_index);
+	cache_index_loaded = 0;
+}
@@ -0,0 +1,27 @@
+/* opkg_cache.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_CACHE_H
+#define OPKG_CACHE_H
+
+/*
+ * Packages in conf->cache are stored by the digest given for them in the
+ * Packages index. The cache index records the size and last use of every
+ * package whose digest has been verified.
+ */
+int opkg_cache_lookup(const char *digest, char **file_name);
+void opkg_cache_add(const char *digest);
+void opkg_cache_detach(void);
+void opkg_cache_deinit(void);
+
+#endif
@@ -42,14 +42,18 @@
 #include "opkg_upgrade.h"
 #include "opkg_remove.h"
 #include "opkg_configure.h"
-#include "xsystem.h"
+#include "opkg_profile.h"
+#include "list_index.h"
+#include "file_index.h"
+#include "opkg_trigger.h"
 
 static void
 print_pkg(pkg_t *pkg)
 {
 	char *version = pkg_version_str_alloc(pkg);
-	if (pkg->description)
-		printf("%s - %s - %s\n", pkg->name, version, pkg->description);
+	if (pkg_cold_get(pkg, description))
+		printf("%s - %s - %s\n", pkg->name, version,
+				pkg_cold_get(pkg, description));
 	else
 		printf("%s - %s\n", pkg->name, version);
 	free(version);
@@ -62,9 +66,11 @@ write_status_files_if_changed(void)
 {
      if (opkg_state_changed && !conf->noaction) {
 	  opkg_msg(INFO, "Writing status file.\n");
+	  opkg_profile_begin("write status", NULL);
 	  opkg_conf_write_status_files();
 	  pkg_write_changed_filelists();
 	  sync();
+	  opkg_profile_end();
      } else {
 	  opkg_msg(DEBUG, "Nothing to be done.\n");
      }
@@ -75,6 +81,7 @@ sigint_handler(int sig)
 {
      signal(sig, SIG_DFL);
      opkg_msg(NOTICE, "Interrupted. Writing out status database.\n");
+     opkg_install_bulk_end();
      write_status_files_if_changed();
      exit(128 + sig);
 }
@@ -158,31 +165,17 @@ opkg_update_cmd(int argc, char **argv)
 
 	  if (src->extra_data)	/* debian style? */
 	      sprintf_alloc(&url, "%s/%s/%s", src->value, src->extra_data,
-			    src->gzip ? "Packages.gz" : "Packages");
+			    "Packages");
 	  else
-	      sprintf_alloc(&url, "%s/%s", src->value, src->gzip ? "Packages.gz" : "Packages");
+	      sprintf_alloc(&url, "%s/%s", src->value, "Packages");
 
 	  sprintf_alloc(&list_file_name, "%s/%s", lists_dir, src->name);
 	  if (src->gzip) {
 	      char *tmp_file_name;
-	      FILE *in, *out;
-
-	      sprintf_alloc (&tmp_file_name, "%s/%s.gz", tmp, src->name);
-	      err = opkg_download(url, tmp_file_name, NULL, NULL, 0);
-	      if (err == 0) {
-		   opkg_msg(NOTICE, "Inflating %s.\n", url);
-		   in = fopen (tmp_file_name, "r");
-		   out = fopen (list_file_name, "w");
-		   if (in && out)
-			unzip (in, out);
-		   else
-			err = 1;
-		   if (in)
-			fclose (in);
-		   if (out)
-			fclose (out);
-		   unlink (tmp_file_name);
-	      }
+
+	      sprintf_alloc (&tmp_file_name, "%s/%s", tmp, src->name);
+	      err = opkg_download_index(url, list_file_name, tmp_file_name,
+			      NULL, NULL);
 	      free(tmp_file_name);
 	  } else
 	      err = opkg_download(url, list_file_name, NULL, NULL, 0);
@@ -234,6 +227,9 @@ opkg_update_cmd(int argc, char **argv)
 #else
           // Do nothing
 #endif
+	  /* So that opkg install can parse just the stanzas it needs. */
+	  if (err == 0)
+	       list_index_write(list_file_name);
 	  free(list_file_name);
      }
      rmdir (tmp);
@@ -244,77 +240,6 @@ opkg_update_cmd(int argc, char **argv)
 }
 
 
-struct opkg_intercept
-{
-    char *oldpath;
-    char *statedir;
-};
-
-typedef struct opkg_intercept *opkg_intercept_t;
-
-static opkg_intercept_t
-opkg_prep_intercepts(void)
-{
-    opkg_intercept_t ctx;
-    char *newpath;
-
-    ctx = xcalloc(1, sizeof (*ctx));
-    ctx->oldpath = xstrdup(getenv("PATH"));
-    sprintf_alloc(&newpath, "%s/opkg/intercept:%s", DATADIR, ctx->oldpath);
-    sprintf_alloc(&ctx->statedir, "%s/opkg-intercept-XXXXXX", conf->tmp_dir);
-
-    if (mkdtemp(ctx->statedir) == NULL) {
-        opkg_perror(ERROR,"Failed to make temp dir %s", ctx->statedir);
-	free(ctx->oldpath);
-	free(ctx->statedir);
-        free(newpath);
-	free(ctx);
-	return NULL;
-    }
-
-    setenv("OPKG_INTERCEPT_DIR", ctx->statedir, 1);
-    setenv("PATH", newpath, 1);
-    free(newpath);
-
-    return ctx;
-}
-
-static int
-opkg_finalize_intercepts(opkg_intercept_t ctx)
-{
-    DIR *dir;
-    int err = 0;
-
-    setenv ("PATH", ctx->oldpath, 1);
-    free (ctx->oldpath);
-
-    dir = opendir (ctx->statedir);
-    if (dir) {
-	struct dirent *de;
-	while (de = readdir (dir), de != NULL) {
-	    char *path;
-
-	    if (de->d_name[0] == '.')
-		continue;
-
-	    sprintf_alloc (&path, "%s/%s", ctx->statedir, de->d_name);
-	    if (access (path, X_OK) == 0) {
-		const char *argv[] = {"sh", "-c", path, NULL};
-		xsystem (argv);
-	    }
-	    free (path);
-	}
-        closedir(dir);
-    } else
-	opkg_perror(ERROR, "Failed to open dir %s", ctx->statedir);
-
-    rm_r(ctx->statedir);
-    free (ctx->statedir);
-    free (ctx);
-
-    return err;
-}
-
 /* For package pkg do the following: If it is already visited, return. If not,
    add it in visited list and recurse to its deps. Finally, add it to ordered
    list.
@@ -331,7 +256,7 @@ opkg_recurse_pkgs_in_order(pkg_t *pkg, pkg_vec_t *all,
     int count;
     pkg_t *dep;
     compound_depend_t * compound_depend;
-    depend_t ** possible_satisfiers;
+    depend_t * possible_satisfiers;
     abstract_pkg_t *abpkg;
     abstract_pkg_t **dependents;
 
@@ -367,7 +292,7 @@ opkg_recurse_pkgs_in_order(pkg_t *pkg, pkg_vec_t *all,
         compound_depend = &pkg->depends[j];
         possible_satisfiers = compound_depend->possibilities;
         for (k=0; k < compound_depend->possibility_count ; k++) {
-            abpkg = possible_satisfiers[k]->pkg;
+            abpkg = possible_satisfiers[k].pkg;
             dependents = abpkg->provided_by->pkgs;
             l = 0;
             if (dependents != NULL)
@@ -406,11 +331,10 @@ opkg_recurse_pkgs_in_order(pkg_t *pkg, pkg_vec_t *all,
 static int
 opkg_configure_packages(char *pkg_name)
 {
-     pkg_vec_t *all, *ordered, *visited;
-     int i;
+     pkg_vec_t *all, *ordered, *visited, *pending;
+     int i, *results;
      pkg_t *pkg;
-     opkg_intercept_t ic;
-     int r, err = 0;
+     int err = 0;
 
      opkg_msg(INFO, "Configuring unpacked packages.\n");
 
@@ -428,36 +352,50 @@ opkg_configure_packages(char *pkg_name)
          opkg_recurse_pkgs_in_order(pkg, all, visited, ordered);
      }
 
-     ic = opkg_prep_intercepts();
-     if (ic == NULL) {
-	     err = -1;
-	     goto error;
-     }
+     opkg_trigger_begin();
 
+     pending = pkg_vec_alloc();
      for(i = 0; i < ordered->len; i++) {
 	  pkg = ordered->pkgs[i];
 
 	  if (pkg_name && fnmatch(pkg_name, pkg->name, 0))
 	       continue;
 
-	  if (pkg->state_status == SS_UNPACKED) {
+	  if (pkg->state_status == SS_UNPACKED)
+	       pkg_vec_insert(pending, pkg);
+     }
+
+     results = xcalloc(pending->len + 1, sizeof(int));
+     if (conf->configure_jobs > 1) {
+	  opkg_configure_parallel(pending, results);
+     } else {
+	  for(i = 0; i < pending->len; i++) {
+	       pkg = pending->pkgs[i];
 	       opkg_msg(NOTICE, "Configuring %s.\n", pkg->name);
-	       r = opkg_configure(pkg);
-	       if (r == 0) {
-		    pkg->state_status = SS_INSTALLED;
-		    pkg->parent->state_status = SS_INSTALLED;
-		    pkg->state_flag &= ~SF_PREFER;
-		    opkg_state_changed++;
-	       } else {
-		    err = -1;
-	       }
+	       opkg_profile_begin("configure", pkg->name);
+	       results[i] = opkg_configure(pkg);
+	       opkg_profile_end();
+	  }
+     }
+
+     for(i = 0; i < pending->len; i++) {
+	  pkg = pending->pkgs[i];
+	  if (results[i] == 0) {
+	       pkg->state_status = SS_INSTALLED;
+	       pkg->parent->state_status = SS_INSTALLED;
+	       pkg->state_flag &= ~SF_PREFER;
+	       opkg_state_changed++;
+	       opkg_trigger_activate_pkg(pkg);
+	  } else {
+	       err = -1;
 	  }
      }
 
-     if (opkg_finalize_intercepts (ic))
-	 err = -1;
+     free(results);
+     pkg_vec_free(pending);
+
+     opkg_trigger_end();
 
-error:
      pkg_vec_free(all);
      pkg_vec_free(ordered);
      pkg_vec_free(visited);
@@ -497,6 +435,9 @@ opkg_install_cmd(int argc, char **argv)
      }
      pkg_info_preinstall_check();
 
+     opkg_install_prefetch_begin(argv, argc);
+     opkg_install_bulk_begin();
+
      for (i=0; i < argc; i++) {
 	  arg = argv[i];
           if (opkg_install_by_name(arg)) {
@@ -505,6 +446,10 @@ opkg_install_cmd(int argc, char **argv)
 	  }
      }
 
+     if (opkg_install_bulk_end())
+	  err = -1;
+     opkg_install_prefetch_end();
+
      if (opkg_configure_packages(NULL))
 	  err = -1;
 
@@ -1058,7 +1003,7 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 					continue;
 
 				for (l=0; l<cdep->possibility_count; l++) {
-					possibility = cdep->possibilities[l];
+					possibility = &cdep->possibilities[l];
 
 					if ((possibility->pkg->state_flag
 								& SF_MARKED)
@@ -1187,40 +1132,60 @@ opkg_whatreplaces_cmd(int argc, char **argv)
      return opkg_what_provides_replaces_cmd(WHATREPLACES, argc, argv);
 }
 
+struct search_data {
+     const char *pattern;
+     pkg_vec_t *matches;
+};
+
+static void
+opkg_search_helper(const char *file_name, void *entry, void *data_)
+{
+     struct search_data *data = data_;
+     char *installed_file = root_filename_alloc((char *)file_name);
+
+     if (fnmatch(data->pattern, installed_file, 0) == 0)
+	  pkg_vec_insert(data->matches, entry);
+
+     free(installed_file);
+}
+
 static int
 opkg_search_cmd(int argc, char **argv)
 {
      int i;
-
-     pkg_vec_t *installed;
-     pkg_t *pkg;
-     str_list_t *installed_files;
-     str_list_elt_t *iter;
-     char *installed_file;
+     pkg_vec_t *matches;
+     pkg_dest_list_elt_t *iter;
+     pkg_dest_t *dest;
+     struct search_data data;
 
      if (argc < 1) {
 	  return -1;
      }
 
-     installed = pkg_vec_alloc();
-     pkg_hash_fetch_all_installed(installed);
-     pkg_vec_sort(installed, pkg_compare_names);
-
-     for (i=0; i < installed->len; i++) {
-	  pkg = installed->pkgs[i];
-
-	  installed_files = pkg_get_installed_files(pkg);
+     matches = pkg_vec_alloc();
 
-	  for (iter = str_list_first(installed_files); iter; iter = str_list_next(installed_files, iter)) {
-	       installed_file = (char *)iter->data;
-	       if (fnmatch(argv[0], installed_file, 0)==0)
-	            print_pkg(pkg);
+     if (file_index_search(argv[0], matches)) {
+	  /* Read every .list file, and index them for next time. */
+	  pkg_info_preinstall_check();
+	  list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+	       dest = (pkg_dest_t *)iter->data;
+	       if (conf->file_hash_complete && !conf->noaction
+			       && file_exists(dest->status_file_name)
+			       && access(dest->opkg_dir, W_OK) == 0)
+		    file_index_write(dest);
 	  }
 
-	  pkg_free_installed_files(pkg);
+	  data.pattern = argv[0];
+	  data.matches = matches;
+	  hash_table_foreach(&conf->file_hash, opkg_search_helper, &data);
      }
 
-     pkg_vec_free(installed);
+     /* Once for each file which matches, by package name. */
+     pkg_vec_sort(matches, pkg_compare_names);
+     for (i = 0; i < matches->len; i++)
+	  print_pkg(matches->pkgs[i]);
+
+     pkg_vec_free(matches);
 
      return 0;
 }
@@ -1258,38 +1223,38 @@ opkg_print_architecture_cmd(int argc, char **argv)
 /* XXX: CLEANUP: The usage strings should be incorporated into this
    array for easier maintenance */
 static opkg_cmd_t cmds[] = {
-     {"update", 0, (opkg_cmd_fun_t)opkg_update_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"upgrade", 0, (opkg_cmd_fun_t)opkg_upgrade_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"list", 0, (opkg_cmd_fun_t)opkg_list_cmd, PFM_SOURCE},
-     {"list_installed", 0, (opkg_cmd_fun_t)opkg_list_installed_cmd, PFM_SOURCE},
-     {"list-installed", 0, (opkg_cmd_fun_t)opkg_list_installed_cmd, PFM_SOURCE},
-     {"list_upgradable", 0, (opkg_cmd_fun_t)opkg_list_upgradable_cmd, PFM_SOURCE},
-     {"list-upgradable", 0, (opkg_cmd_fun_t)opkg_list_upgradable_cmd, PFM_SOURCE},
-     {"list_changed_conffiles", 0, (opkg_cmd_fun_t)opkg_list_changed_conffiles_cmd, PFM_SOURCE},
-     {"list-changed-conffiles", 0, (opkg_cmd_fun_t)opkg_list_changed_conffiles_cmd, PFM_SOURCE},
-     {"info", 0, (opkg_cmd_fun_t)opkg_info_cmd, 0},
-     {"flag", 1, (opkg_cmd_fun_t)opkg_flag_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"status", 0, (opkg_cmd_fun_t)opkg_status_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"install", 1, (opkg_cmd_fun_t)opkg_install_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"remove", 1, (opkg_cmd_fun_t)opkg_remove_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"configure", 0, (opkg_cmd_fun_t)opkg_configure_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"files", 1, (opkg_cmd_fun_t)opkg_files_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"search", 1, (opkg_cmd_fun_t)opkg_search_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"download", 1, (opkg_cmd_fun_t)opkg_download_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"compare_versions", 1, (opkg_cmd_fun_t)opkg_compare_versions_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"compare-versions", 1, (opkg_cmd_fun_t)opkg_compare_versions_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"print-architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"print_architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"print-installation-architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"print_installation_architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"depends", 1, (opkg_cmd_fun_t)opkg_depends_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"whatdepends", 1, (opkg_cmd_fun_t)opkg_whatdepends_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"whatdependsrec", 1, (opkg_cmd_fun_t)opkg_whatdepends_recursively_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"whatrecommends", 1, (opkg_cmd_fun_t)opkg_whatrecommends_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"whatsuggests", 1, (opkg_cmd_fun_t)opkg_whatsuggests_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"whatprovides", 1, (opkg_cmd_fun_t)opkg_whatprovides_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"whatreplaces", 1, (opkg_cmd_fun_t)opkg_whatreplaces_cmd, PFM_DESCRIPTION|PFM_SOURCE},
-     {"whatconflicts", 1, (opkg_cmd_fun_t)opkg_whatconflicts_cmd, PFM_DESCRIPTION|PFM_SOURCE},
+     {"update", 0, (opkg_cmd_fun_t)opkg_update_cmd, PFM_DESCRIPTION|PFM_SOURCE, 0, 0},
+     {"upgrade", 0, (opkg_cmd_fun_t)opkg_upgrade_cmd, PFM_DESCRIPTION|PFM_SOURCE, 0, 0},
+     {"list", 0, (opkg_cmd_fun_t)opkg_list_cmd, PFM_SOURCE, 1, 1},
+     {"list_installed", 0, (opkg_cmd_fun_t)opkg_list_installed_cmd, PFM_SOURCE, 1, 1},
+     {"list-installed", 0, (opkg_cmd_fun_t)opkg_list_installed_cmd, PFM_SOURCE, 1, 1},
+     {"list_upgradable", 0, (opkg_cmd_fun_t)opkg_list_upgradable_cmd, PFM_SOURCE, 1, 0},
+     {"list-upgradable", 0, (opkg_cmd_fun_t)opkg_list_upgradable_cmd, PFM_SOURCE, 1, 0},
+     {"list_changed_conffiles", 0, (opkg_cmd_fun_t)opkg_list_changed_conffiles_cmd, PFM_SOURCE, 1, 1},
+     {"list-changed-conffiles", 0, (opkg_cmd_fun_t)opkg_list_changed_conffiles_cmd, PFM_SOURCE, 1, 1},
+     {"info", 0, (opkg_cmd_fun_t)opkg_info_cmd, 0, 1, 1},
+     {"flag", 1, (opkg_cmd_fun_t)opkg_flag_cmd, PFM_DESCRIPTION|PFM_SOURCE, 0, 0},
+     {"status", 0, (opkg_cmd_fun_t)opkg_status_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"install", 1, (opkg_cmd_fun_t)opkg_install_cmd, PFM_DESCRIPTION|PFM_SOURCE, 0, 0},
+     {"remove", 1, (opkg_cmd_fun_t)opkg_remove_cmd, PFM_DESCRIPTION|PFM_SOURCE, 0, 0},
+     {"configure", 0, (opkg_cmd_fun_t)opkg_configure_cmd, PFM_DESCRIPTION|PFM_SOURCE, 0, 0},
+     {"files", 1, (opkg_cmd_fun_t)opkg_files_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"search", 1, (opkg_cmd_fun_t)opkg_search_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"download", 1, (opkg_cmd_fun_t)opkg_download_cmd, PFM_DESCRIPTION|PFM_SOURCE, 0, 0},
+     {"compare_versions", 1, (opkg_cmd_fun_t)opkg_compare_versions_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"compare-versions", 1, (opkg_cmd_fun_t)opkg_compare_versions_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"print-architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"print_architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"print-installation-architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"print_installation_architecture", 0, (opkg_cmd_fun_t)opkg_print_architecture_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 1},
+     {"depends", 1, (opkg_cmd_fun_t)opkg_depends_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
+     {"whatdepends", 1, (opkg_cmd_fun_t)opkg_whatdepends_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
+     {"whatdependsrec", 1, (opkg_cmd_fun_t)opkg_whatdepends_recursively_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
+     {"whatrecommends", 1, (opkg_cmd_fun_t)opkg_whatrecommends_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
+     {"whatsuggests", 1, (opkg_cmd_fun_t)opkg_whatsuggests_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
+     {"whatprovides", 1, (opkg_cmd_fun_t)opkg_whatprovides_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
+     {"whatreplaces", 1, (opkg_cmd_fun_t)opkg_whatreplaces_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
+     {"whatconflicts", 1, (opkg_cmd_fun_t)opkg_whatconflicts_cmd, PFM_DESCRIPTION|PFM_SOURCE, 1, 0},
 };
 
 opkg_cmd_t *
@@ -1311,5 +1276,18 @@ opkg_cmd_find(const char *name)
 int
 opkg_cmd_exec(opkg_cmd_t *cmd, int argc, const char **argv)
 {
-	return (cmd->fun)(argc, argv);
+	int err;
+
+	if (!cmd->lazy_graph)
+		pkg_hash_build_graph();
+
+	opkg_profile_begin(cmd->name, NULL);
+	if (!cmd->read_only)
+		opkg_trigger_begin();
+	err = (cmd->fun)(argc, argv);
+	if (!cmd->read_only)
+		opkg_trigger_end();
+	opkg_profile_end();
+
+	return err;
 }
@@ -26,6 +26,8 @@ struct opkg_cmd
     int requires_args;
     opkg_cmd_fun_t fun;
     unsigned int pfm; /* package field mask */
+    int read_only; /* only reads the package database */
+    int lazy_graph; /* only looks at the dependencies of packages it shows */
 };
 typedef struct opkg_cmd opkg_cmd_t;
 
@@ -19,6 +19,9 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -26,6 +29,10 @@
 #include <unistd.h>
 
 #include "opkg_conf.h"
+#include "opkg_cache.h"
+#include "conffile.h"
+#include "opkg_download.h"
+#include "file_index.h"
 #include "pkg_vec.h"
 #include "pkg.h"
 #include "xregex.h"
@@ -35,9 +42,52 @@
 #include "opkg_defines.h"
 #include "libbb/libbb.h"
 
-static int lock_fd;
+static int lock_fd = -1;
 static char *lock_file = NULL;
 
+static void
+lock_timeout(int sig)
+{
+}
+
+/*
+ * Commands which only read the package database share the lock, so they
+ * can run alongside each other but never while it is being changed. If
+ * wait is set, wait up to that many seconds for the lock, failing with
+ * EINTR once they are up.
+ */
+static int
+lock_set(short type, int wait)
+{
+	struct flock fl;
+	struct sigaction sa, old_sa;
+	int err;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+
+	err = fcntl(lock_fd, F_SETLK, &fl);
+	if (err == 0 || wait <= 0 || (errno != EACCES && errno != EAGAIN))
+		return err;
+
+	opkg_msg(INFO, "Waiting for the lock on %s.\n", lock_file);
+
+	/* Without SA_RESTART, so that the alarm ends the wait. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = lock_timeout;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGALRM, &sa, &old_sa);
+	alarm(wait);
+
+	err = fcntl(lock_fd, F_SETLKW, &fl);
+
+	alarm(0);
+	sigaction(SIGALRM, &old_sa, NULL);
+
+	return err;
+}
+
 static opkg_conf_t _conf;
 opkg_conf_t *conf = &_conf;
 
@@ -46,6 +96,8 @@ opkg_conf_t *conf = &_conf;
  */
 opkg_option_t options[] = {
 	  { "cache", OPKG_OPT_TYPE_STRING, &_conf.cache},
+	  { "cache_size", OPKG_OPT_TYPE_INT, &_conf.cache_size},
+	  { "configure_jobs", OPKG_OPT_TYPE_INT, &_conf.configure_jobs },
 	  { "force_defaults", OPKG_OPT_TYPE_BOOL, &_conf.force_defaults },
           { "force_maintainer", OPKG_OPT_TYPE_BOOL, &_conf.force_maintainer },
 	  { "force_depends", OPKG_OPT_TYPE_BOOL, &_conf.force_depends },
@@ -61,13 +113,18 @@ opkg_option_t options[] = {
 	  { "test", OPKG_OPT_TYPE_BOOL, &_conf.noaction },
 	  { "noaction", OPKG_OPT_TYPE_BOOL, &_conf.noaction },
 	  { "download_only", OPKG_OPT_TYPE_BOOL, &_conf.download_only },
+	  { "extract_threads", OPKG_OPT_TYPE_INT, &_conf.extract_threads },
 	  { "nodeps", OPKG_OPT_TYPE_BOOL, &_conf.nodeps },
 	  { "offline_root", OPKG_OPT_TYPE_STRING, &_conf.offline_root },
 	  { "overlay_root", OPKG_OPT_TYPE_STRING, &_conf.overlay_root },
 	  { "proxy_passwd", OPKG_OPT_TYPE_STRING, &_conf.proxy_passwd },
 	  { "proxy_user", OPKG_OPT_TYPE_STRING, &_conf.proxy_user },
+	  { "read_ahead", OPKG_OPT_TYPE_INT, &_conf.read_ahead },
 	  { "query-all", OPKG_OPT_TYPE_BOOL, &_conf.query_all },
+	  { "staged_install", OPKG_OPT_TYPE_BOOL, &_conf.staged_install },
+	  { "stream_install", OPKG_OPT_TYPE_BOOL, &_conf.stream_install },
 	  { "tmp_dir", OPKG_OPT_TYPE_STRING, &_conf.tmp_dir },
+	  { "unpack_jobs", OPKG_OPT_TYPE_INT, &_conf.unpack_jobs },
 	  { "verbosity", OPKG_OPT_TYPE_INT, &_conf.verbosity },
 #if defined(HAVE_OPENSSL)
 	  { "signature_ca_file", OPKG_OPT_TYPE_STRING, &_conf.signature_ca_file },
@@ -407,7 +464,10 @@ opkg_conf_write_status_files(void)
           if (dest->status_fp && fclose(dest->status_fp) == EOF) {
                opkg_perror(ERROR, "Couldn't close %s", dest->status_file_name);
 	       ret = -1;
-          }
+          } else if (dest->status_fp && conf->file_hash_complete) {
+	       /* Otherwise it is out of date until it can be rewritten. */
+	       file_index_write(dest);
+	  }
      }
 
      return ret;
@@ -512,14 +572,21 @@ opkg_conf_load(void)
 	else
 		sprintf_alloc (&lock_file, "%s", OPKGLOCKFILE);
 
-	lock_fd = creat(lock_file, S_IRUSR | S_IWUSR | S_IRGRP);
+	lock_fd = open(lock_file, (conf->lock_shared ? O_RDONLY : O_WRONLY)
+			| O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
 	if (lock_fd == -1) {
 		opkg_perror(ERROR, "Could not create lock file %s", lock_file);
 		goto err2;
 	}
 
-	if (lockf(lock_fd, F_TLOCK, (off_t)0) == -1) {
-		opkg_perror(ERROR, "Could not lock %s", lock_file);
+	if (lock_set(conf->lock_shared ? F_RDLCK : F_WRLCK,
+				conf->lock_shared ? conf->lock_wait : 0) == -1) {
+		if (errno == EINTR)
+			opkg_msg(ERROR, "Gave up waiting for the lock on %s "
+					"after %d seconds.\n", lock_file,
+					conf->lock_wait);
+		else
+			opkg_perror(ERROR, "Could not lock %s", lock_file);
 		if (close(lock_fd) == -1)
 			opkg_perror(ERROR, "Couldn't close descriptor %d (%s)",
 				lock_fd, lock_file);
@@ -545,11 +612,16 @@ opkg_conf_load(void)
 
 	pkg_hash_init();
 	hash_table_init("file-hash", &conf->file_hash, OPKG_CONF_DEFAULT_HASH_LEN);
+	conf->file_hash_complete = 0;
 	hash_table_init("obs-file-hash", &conf->obs_file_hash, OPKG_CONF_DEFAULT_HASH_LEN/16);
 
 	if (conf->lists_dir == NULL)
 		conf->lists_dir = xstrdup(OPKG_CONF_LISTS_DIR);
 
+	if (conf->extract_threads <= 0)
+		conf->extract_threads = OPKG_CONF_DEFAULT_EXTRACT_THREADS;
+	unarchive_writers = conf->extract_threads;
+
 	if (conf->offline_root) {
 		sprintf_alloc(&tmp, "%s/%s", conf->offline_root, conf->lists_dir);
 		free(conf->lists_dir);
@@ -588,14 +660,7 @@ err4:
 	if (rmdir(conf->tmp_dir) == -1)
 		opkg_perror(ERROR, "Couldn't remove dir %s", conf->tmp_dir);
 err3:
-	if (lockf(lock_fd, F_ULOCK, (off_t)0) == -1)
-		opkg_perror(ERROR, "Couldn't unlock %s", lock_file);
-
-	if (close(lock_fd) == -1)
-		opkg_perror(ERROR, "Couldn't close descriptor %d (%s)",
-				lock_fd, lock_file);
-	if (unlink(lock_file) == -1)
-		opkg_perror(ERROR, "Couldn't unlink %s", lock_file);
+	opkg_conf_unlock();
 err2:
 	if (lock_file) {
 		free(lock_file);
@@ -635,6 +700,10 @@ opkg_conf_deinit(void)
 	if (conf->tmp_dir)
 		rm_r(conf->tmp_dir);
 
+	opkg_cache_deinit();
+	opkg_verify_deinit();
+	conffile_md5sum_cache_deinit();
+
 	if (conf->lists_dir)
 		free(conf->lists_dir);
 
@@ -669,20 +738,31 @@ opkg_conf_deinit(void)
 	hash_table_deinit(&conf->file_hash);
 	hash_table_deinit(&conf->obs_file_hash);
 
+	opkg_conf_unlock();
+}
+
+/*
+ * Release the lock taken by opkg_conf_load(), for a process which goes on
+ * only to read the state it has loaded.
+ */
+void
+opkg_conf_unlock(void)
+{
 	if (lock_fd != -1) {
-		if (lockf(lock_fd, F_ULOCK, (off_t)0) == -1)
+		if (lock_set(F_UNLCK, 0) == -1)
 			opkg_perror(ERROR, "Couldn't unlock %s", lock_file);
 
 		if (close(lock_fd) == -1)
 			opkg_perror(ERROR, "Couldn't close descriptor %d (%s)",
 					lock_fd, lock_file);
-
+		lock_fd = -1;
 	}
 
+	/* The lock file is left in place: removing it while another
+	   process holds a shared lock on it would let a writer lock a new
+	   file in its place. */
 	if (lock_file) {
-		if (unlink(lock_file) == -1)
-			opkg_perror(ERROR, "Couldn't unlink %s", lock_file);
-
 		free(lock_file);
+		lock_file = NULL;
 	}
 }
@@ -42,6 +42,12 @@ extern opkg_conf_t *conf;
 
 #define OPKG_CONF_DEFAULT_HASH_LEN 1024
 
+/* Threads writing out package data files, unless set by extract_threads */
+#define OPKG_CONF_DEFAULT_EXTRACT_THREADS 4
+
+/* Seconds a read-only command waits for one changing the database */
+#define OPKG_CONF_DEFAULT_LOCK_WAIT 600
+
 struct opkg_conf
 {
      pkg_src_list_t pkg_src_list;
@@ -60,6 +66,8 @@ struct opkg_conf
      char *lists_dir;
 
      unsigned int pfm; /* package field mask */
+     int lock_shared; /* only read the package database */
+     int lock_wait; /* seconds a shared lock waits for a writer, 0 for none */
 
      /* For libopkg users to capture messages. */
      void (*opkg_vmessage)(int, const char *fmt, va_list ap);
@@ -85,7 +93,14 @@ struct opkg_conf
      int verbosity;
      int noaction;
      int download_only;
+     int extract_threads;
+     int unpack_jobs; /* parallel unpacking for offline root installs */
+     int configure_jobs; /* postinst scripts run at once when configuring */
+     int read_ahead; /* packages fetched ahead of the one being installed */
+     int staged_install;
+     int stream_install; /* unpack packages as they are downloaded */
      char *cache;
+     int cache_size; /* in kilobytes, 0 for no limit */
 
 #ifdef HAVE_SSLCURL
      /* some options could be used by
@@ -119,6 +134,7 @@ struct opkg_conf
      hash_table_t pkg_hash;
      hash_table_t file_hash;
      hash_table_t obs_file_hash;
+     int file_hash_complete;	/* every installed file is in file_hash */
 };
 
 enum opkg_option_type {
@@ -138,6 +154,7 @@ struct opkg_option {
 int opkg_conf_init(void);
 int opkg_conf_load(void);
 void opkg_conf_deinit(void);
+void opkg_conf_unlock(void);
 
 int opkg_conf_write_status_files(void);
 char *root_filename_alloc(char *filename);
@@ -15,12 +15,26 @@
    General Public License for more details.
 */
 
+#include "config.h"
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #include "sprintf_alloc.h"
 #include "opkg_configure.h"
 #include "opkg_message.h"
 #include "opkg_cmd.h"
+#include "opkg_profile.h"
+#include "pkg_hash.h"
+#include "hash_table.h"
+#include "xsystem.h"
+#include "libbb/libbb.h"
 
 int
 opkg_configure(pkg_t *pkg)
@@ -42,3 +56,283 @@ opkg_configure(pkg_t *pkg)
     return 0;
 }
 
+
+/*
+ * Parallel configuring.
+ *
+ * The packages are given in the order they would be configured one by one,
+ * each after the packages it depends on. The postinst of a package is
+ * started once those of every earlier package it depends on, directly or
+ * through installed packages, have finished, with up to
+ * conf->configure_jobs of them running at once. The output of each is kept
+ * in a file and printed when it finishes, so that it is not interleaved
+ * with that of the others.
+ */
+enum configure_state {
+    CONFIGURE_WAITING,
+    CONFIGURE_RUNNING,
+    CONFIGURE_DONE
+};
+
+struct configure_job {
+    pkg_t *pkg;
+    enum configure_state state;
+    pid_t pid;
+    int log_fd;
+    int err;
+    /* earlier in the order, and depended on */
+    struct configure_job **after;
+    int after_count;
+};
+
+static void
+configure_job_add_after(struct configure_job *job, struct configure_job *prev)
+{
+    int i;
+
+    for (i = 0; i < job->after_count; i++)
+	if (job->after[i] == prev)
+	    return;
+
+    job->after = xrealloc(job->after,
+	    (job->after_count + 1) * sizeof(struct configure_job *));
+    job->after[job->after_count++] = prev;
+}
+
+/* Find the jobs which job must wait for among the dependencies of pkg. */
+static void
+configure_job_find_after(struct configure_job *job, pkg_t *pkg,
+	hash_table_t *jobs, hash_table_t *visited)
+{
+    struct configure_job *prev;
+    compound_depend_t *cdep;
+    abstract_pkg_t *ab_pkg;
+    pkg_t *dep;
+    int i, j, k, count;
+
+    count = pkg->pre_depends_count + pkg->depends_count
+	    + pkg->recommends_count + pkg->suggests_count;
+
+    for (i = 0; i < count; i++) {
+	cdep = &pkg->depends[i];
+	for (j = 0; j < cdep->possibility_count; j++) {
+	    ab_pkg = cdep->possibilities[j].pkg;
+	    if (ab_pkg->provided_by == NULL)
+		continue;
+	    for (k = 0; k < ab_pkg->provided_by->len; k++) {
+		dep = pkg_hash_fetch_installed_by_name(
+			ab_pkg->provided_by->pkgs[k]->name);
+		if (dep == NULL || hash_table_get(visited, dep->name))
+		    continue;
+		hash_table_insert(visited, dep->name, dep);
+
+		prev = hash_table_get(jobs, dep->name);
+		if (prev) {
+		    /* Those later in the order are on a cycle with job,
+		       and are configured after it one by one too. */
+		    if (prev < job)
+			configure_job_add_after(job, prev);
+		    continue;
+		}
+
+		configure_job_find_after(job, dep, jobs, visited);
+	    }
+	}
+    }
+}
+
+static int
+configure_job_ready(struct configure_job *job)
+{
+    int i;
+
+    for (i = 0; i < job->after_count; i++)
+	if (job->after[i]->state != CONFIGURE_DONE)
+	    return 0;
+
+    return 1;
+}
+
+static void
+configure_job_start(struct configure_job *job)
+{
+    char *log;
+
+    sprintf_alloc(&log, "%s/configure-XXXXXX", conf->tmp_dir);
+    /* Not to be inherited by the scripts started after this one. */
+    job->log_fd = mkostemp(log, O_CLOEXEC);
+    if (job->log_fd == -1)
+	opkg_perror(INFO, "Failed to create %s, not keeping the output of "
+		"%s apart", log, job->pkg->name);
+    else
+	unlink(log);
+    free(log);
+
+    fflush(stdout);
+    fflush(stderr);
+
+    job->pid = pkg_start_script(job->pkg, "postinst", "configure",
+	    job->log_fd, &job->err);
+    job->state = job->pid ? CONFIGURE_RUNNING : CONFIGURE_DONE;
+}
+
+static void
+configure_job_finish(struct configure_job *job)
+{
+    char buf[4096];
+    ssize_t n;
+
+    opkg_msg(NOTICE, "Configuring %s.\n", job->pkg->name);
+
+    if (job->log_fd != -1) {
+	fflush(stdout);
+	lseek(job->log_fd, 0, SEEK_SET);
+	while ((n = read(job->log_fd, buf, sizeof(buf))) > 0)
+	    fwrite(buf, 1, n, stdout);
+	fflush(stdout);
+	close(job->log_fd);
+    }
+
+    if (job->err)
+	opkg_msg(ERROR, "%s.postinst returned %d.\n", job->pkg->name,
+		job->err);
+}
+
+static void
+configure_sigchld(int sig)
+{
+}
+
+/*
+ * Wait for one of the running jobs among jobs[first..len-1] to finish, and
+ * return it with its wait status in *status. Only the pids of the jobs are
+ * waited for, so that other children, such as those prefetching packages,
+ * are left to whoever started them. Returns NULL if waitpid failed.
+ */
+static struct configure_job *
+configure_job_wait(struct configure_job *jobs, int first, int len,
+	int *status)
+{
+    struct configure_job *job, *done = NULL;
+    struct sigaction sa, old_sa;
+    sigset_t chld, old_mask, wait_mask;
+    pid_t pid;
+    int i;
+
+    /* SIGCHLD is ignored by default, and so would not end sigsuspend(). */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = configure_sigchld;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, &old_sa);
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+
+    while (!done) {
+	/* Blocked between the check and sigsuspend(), so that a job which
+	 * finishes in between is not missed. */
+	sigprocmask(SIG_BLOCK, &chld, &old_mask);
+	for (i = first; i < len; i++) {
+	    job = &jobs[i];
+	    if (job->state != CONFIGURE_RUNNING)
+		continue;
+	    pid = waitpid(job->pid, status, WNOHANG);
+	    if (pid == job->pid) {
+		done = job;
+		break;
+	    }
+	    if (pid == -1 && errno != EINTR) {
+		opkg_perror(ERROR, "waitpid failed");
+		sigprocmask(SIG_SETMASK, &old_mask, NULL);
+		goto out;
+	    }
+	}
+	if (!done) {
+	    wait_mask = old_mask;
+	    sigdelset(&wait_mask, SIGCHLD);
+	    sigsuspend(&wait_mask);
+	}
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    }
+
+out:
+    sigaction(SIGCHLD, &old_sa, NULL);
+    return done;
+}
+
+/*
+ * Configure each package of pkgs, setting results[i] to what
+ * opkg_configure() would have returned for pkgs->pkgs[i].
+ */
+void
+opkg_configure_parallel(pkg_vec_t *pkgs, int *results)
+{
+    struct configure_job *jobs, *job;
+    hash_table_t by_name, visited;
+    int i, first = 0, running = 0, status;
+
+    jobs = xcalloc(pkgs->len, sizeof(struct configure_job));
+
+    memset(&by_name, 0, sizeof(by_name));
+    hash_table_init("configure-jobs", &by_name, OPKG_CONF_DEFAULT_HASH_LEN);
+    for (i = 0; i < pkgs->len; i++) {
+	jobs[i].pkg = pkgs->pkgs[i];
+	jobs[i].log_fd = -1;
+	hash_table_insert(&by_name, jobs[i].pkg->name, &jobs[i]);
+    }
+
+    for (i = 0; i < pkgs->len; i++) {
+	memset(&visited, 0, sizeof(visited));
+	hash_table_init("configure-visited", &visited, 64);
+	hash_table_insert(&visited, jobs[i].pkg->name, jobs[i].pkg);
+	configure_job_find_after(&jobs[i], jobs[i].pkg, &by_name, &visited);
+	hash_table_deinit(&visited);
+	opkg_msg(DEBUG, "%s waits for %d other package(s).\n",
+		jobs[i].pkg->name, jobs[i].after_count);
+    }
+
+    opkg_profile_begin("configure queued", NULL);
+
+    while (first < pkgs->len) {
+	for (i = first; i < pkgs->len && running < conf->configure_jobs; i++) {
+	    job = &jobs[i];
+	    if (job->state != CONFIGURE_WAITING || !configure_job_ready(job))
+		continue;
+	    configure_job_start(job);
+	    if (job->state == CONFIGURE_RUNNING)
+		running++;
+	    else
+		configure_job_finish(job);
+	}
+
+	if (running) {
+	    job = configure_job_wait(jobs, first, pkgs->len, &status);
+	    if (!job)
+		break;
+	    job->err = pkg_finish_script(job->pkg, "postinst",
+		    xsystem_status("sh", status));
+	    job->state = CONFIGURE_DONE;
+	    configure_job_finish(job);
+	    running--;
+	}
+
+	while (first < pkgs->len && jobs[first].state == CONFIGURE_DONE)
+	    first++;
+    }
+
+    opkg_profile_end();
+
+    for (i = 0; i < pkgs->len; i++) {
+	/* Only if waitpid failed. */
+	if (jobs[i].state != CONFIGURE_DONE) {
+	    opkg_msg(ERROR, "Failed to configure %s.\n", jobs[i].pkg->name);
+	    jobs[i].err = -1;
+	}
+	results[i] = jobs[i].err;
+	free(jobs[i].after);
+    }
+
+    hash_table_deinit(&by_name);
+    free(jobs);
+}
@@ -21,5 +21,6 @@
 #include "pkg.h"
 
 int opkg_configure(pkg_t *pkg);
+void opkg_configure_parallel(pkg_vec_t *pkgs, int *results);
 
 #endif
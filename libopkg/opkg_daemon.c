@@ -0,0 +1,339 @@
+/* opkg_daemon.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "opkg_daemon.h"
+#include "opkg_message.h"
+#include "libbb/libbb.h"
+
+#define OPKGD_MAX_REQUEST	65536
+#define OPKGD_MAX_ARGS		1024
+
+static int
+opkg_daemon_sockaddr(const char *socket_path, struct sockaddr_un *addr)
+{
+	if (socket_path == NULL)
+		socket_path = OPKGDSOCKET;
+
+	if (strlen(socket_path) >= sizeof(addr->sun_path))
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, socket_path);
+
+	return 0;
+}
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Send fds along with the first byte of buf, and the rest after it.
+ */
+static int
+send_with_fds(int fd, const char *buf, size_t len, const int *fds, int nfds)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	union {
+		char buf[CMSG_SPACE(OPKGD_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = (char *)buf;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+	do
+		n = sendmsg(fd, &msg, 0);
+	while (n == -1 && errno == EINTR);
+	if (n != 1)
+		return -1;
+
+	return write_all(fd, buf + 1, len - 1);
+}
+
+/*
+ * Run a query through opkgd, which writes its output to our own stdout and
+ * stderr, passed to it with the query. Returns the exit status of the
+ * query, or -1 if there is no daemon to answer it and nothing has been
+ * output.
+ */
+int
+opkg_daemon_query(const char *socket_path, int argc, const char **argv)
+{
+	struct sockaddr_un addr;
+	const int fds[OPKGD_FDS] = { STDOUT_FILENO, STDERR_FILENO };
+	char *request, *p, trailer[2];
+	size_t len = 0, held = 0;
+	ssize_t n;
+	int fd, i, status = -1;
+
+	if (argc == 0 || opkg_daemon_sockaddr(socket_path, &addr))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		goto out;
+
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	p = request = xmalloc(len);
+	for (i = 0; i < argc; i++) {
+		strcpy(p, argv[i]);
+		p += strlen(p) + 1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	i = send_with_fds(fd, request, len, fds, OPKGD_FDS);
+	free(request);
+	if (i)
+		goto out;
+	shutdown(fd, SHUT_WR);
+
+	while (held < sizeof(trailer)
+			&& (n = read(fd, trailer + held,
+					sizeof(trailer) - held)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		held += n;
+	}
+
+	if (held == sizeof(trailer) && trailer[0] == OPKGD_EXIT)
+		status = (unsigned char)trailer[1];
+	else if (held != sizeof(trailer) || trailer[0] != OPKGD_UNAVAILABLE) {
+		/* The query may have output something already. */
+		fprintf(stderr, "opkgd did not complete the query.\n");
+		status = 255;
+	}
+
+out:
+	close(fd);
+	return status;
+}
+
+int
+opkg_daemon_listen(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd, err;
+
+	if (opkg_daemon_sockaddr(socket_path, &addr)) {
+		opkg_msg(ERROR, "Socket path %s is too long.\n", socket_path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		opkg_perror(ERROR, "Failed to create socket");
+		return -1;
+	}
+
+	/* Only the daemon's group may query it. Others run their queries
+	   themselves. */
+	unlink(addr.sun_path);
+	mask = umask(0117);
+	err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (err == -1) {
+		opkg_perror(ERROR, "Failed to bind to %s", addr.sun_path);
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, 16) == -1) {
+		opkg_perror(ERROR, "Failed to listen on %s", addr.sun_path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Close the fds of a request, after a failure to read it. */
+static void
+close_fds(int *fds, int nfds)
+{
+	int i;
+
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+}
+
+/*
+ * Read a request from a client into a NULL terminated argv, and the stdout
+ * and stderr it was sent with into fds. argv and its strings are allocated
+ * in one block, which the caller frees with free(*argv), and the caller
+ * closes the fds. A client which has not sent all of its request within
+ * timeout seconds is dropped, so that it cannot hold up the others.
+ */
+int
+opkg_daemon_read_request(int fd, int timeout, int *argc, char ***argv,
+		int *fds)
+{
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	union {
+		char buf[CMSG_SPACE(OPKGD_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	char *buf, *p, **args;
+	size_t len = 0;
+	time_t deadline = time(NULL) + timeout, left;
+	ssize_t n;
+	int count = 0, nfds = 0, received, extra, i;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	buf = xmalloc(OPKGD_MAX_REQUEST);
+	while (len < OPKGD_MAX_REQUEST) {
+		left = deadline - time(NULL);
+		n = left > 0 ? poll(&pfd, 1, left * 1000) : 0;
+		if (n == 0) {
+			opkg_msg(INFO, "Dropped a client which did not send "
+					"its request in time.\n");
+			goto err;
+		}
+		if (n == 1) {
+			memset(&msg, 0, sizeof(msg));
+			iov.iov_base = buf + len;
+			iov.iov_len = OPKGD_MAX_REQUEST - len;
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control.buf;
+			msg.msg_controllen = sizeof(control.buf);
+			n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		}
+		if (n == 0)
+			break;
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			goto err;
+		}
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET
+					|| cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			received = (cmsg->cmsg_len - CMSG_LEN(0))
+				/ sizeof(int);
+			if (nfds + received > OPKGD_FDS) {
+				for (i = 0; i < received; i++) {
+					memcpy(&extra, CMSG_DATA(cmsg)
+						+ i * sizeof(int), sizeof(int));
+					close(extra);
+				}
+				goto err;
+			}
+			memcpy(fds + nfds, CMSG_DATA(cmsg),
+					received * sizeof(int));
+			nfds += received;
+		}
+		if (msg.msg_flags & MSG_CTRUNC)
+			goto err;
+		len += n;
+	}
+
+	if (nfds != OPKGD_FDS || len == 0 || len == OPKGD_MAX_REQUEST
+			|| buf[len - 1] != '\0')
+		goto err;
+
+	for (p = buf; p < buf + len; p += strlen(p) + 1)
+		count++;
+	if (count > OPKGD_MAX_ARGS)
+		goto err;
+
+	args = xmalloc((count + 1) * sizeof(char *) + len);
+	memcpy(args + count + 1, buf, len);
+	free(buf);
+
+	p = (char *)(args + count + 1);
+	for (*argc = 0; *argc < count; (*argc)++) {
+		args[*argc] = p;
+		p += strlen(p) + 1;
+	}
+	args[count] = NULL;
+	*argv = args;
+
+	return 0;
+
+err:
+	close_fds(fds, nfds);
+	free(buf);
+	return -1;
+}
+
+int
+opkg_daemon_reply(int fd, char kind, int status)
+{
+	char trailer[2];
+
+	trailer[0] = kind;
+	trailer[1] = (char)status;
+
+	return write_all(fd, trailer, sizeof(trailer));
+}
@@ -0,0 +1,38 @@
+/* opkg_daemon.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_DAEMON_H
+#define OPKG_DAEMON_H
+
+/*
+ * opkgd keeps the package database loaded and answers read-only queries
+ * on a Unix socket. A client sends the sub-command and its arguments as
+ * NUL terminated strings, with its stdout and stderr passed along with the
+ * first byte by SCM_RIGHTS, then shuts down its side of the connection.
+ * The command writes its output and errors to those, and the reply on the
+ * socket is a two byte trailer: OPKGD_EXIT and the exit status, or
+ * OPKGD_UNAVAILABLE and 0 if the query should be run locally instead.
+ */
+#define OPKGD_EXIT		'x'
+#define OPKGD_UNAVAILABLE	'u'
+/* The stdout and stderr of the client. */
+#define OPKGD_FDS		2
+
+int opkg_daemon_query(const char *socket_path, int argc, const char **argv);
+
+int opkg_daemon_listen(const char *socket_path);
+int opkg_daemon_read_request(int fd, int timeout, int *argc, char ***argv,
+		int *fds);
+int opkg_daemon_reply(int fd, char kind, int status);
+
+#endif
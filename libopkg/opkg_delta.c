@@ -0,0 +1,233 @@
+/* opkg_delta.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "opkg_delta.h"
+#include "opkg_message.h"
+#include "libbb/libbb.h"
+
+#define DELTA_BUF_LEN (64 * 1024)
+
+/*
+ * The file name of the delta from version in deltas, the value of a Deltas
+ * field, or NULL if there is none.
+ */
+char *
+opkg_delta_find(const char *deltas, const char *version)
+{
+	size_t version_len = strlen(version), len;
+	const char *p = deltas, *end;
+
+	while (*p) {
+		p += strspn(p, " ,");
+		end = p + strcspn(p, ",");
+
+		if (strncmp(p, version, version_len) == 0
+				&& p[version_len] == ' ') {
+			p += version_len;
+			p += strspn(p, " ");
+			for (len = end - p; len && p[len - 1] == ' '; len--)
+				;
+			if (len)
+				return xstrndup(p, len);
+		}
+
+		p = end;
+	}
+
+	return NULL;
+}
+
+static int
+read_u64(FILE *fp, uint64_t *val)
+{
+	unsigned char buf[8];
+	int i;
+
+	if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf))
+		return -1;
+
+	*val = 0;
+	for (i = 0; i < sizeof(buf); i++)
+		*val = (*val << 8) | buf[i];
+
+	return 0;
+}
+
+/* Copy len bytes from in to out. */
+static int
+copy_bytes(FILE *in, FILE *out, uint64_t len, char *buf)
+{
+	size_t want;
+
+	while (len) {
+		want = len > DELTA_BUF_LEN ? DELTA_BUF_LEN : len;
+		if (fread(buf, 1, want, in) != want)
+			return -1;
+		if (fwrite(buf, 1, want, out) != want)
+			return -1;
+		len -= want;
+	}
+
+	return 0;
+}
+
+/* Add len to the size of the package being made, unless it would then be
+   larger than max_size, if that is known. */
+static int
+too_large(uint64_t *size, uint64_t len, uint64_t max_size,
+		const char *delta_file_name)
+{
+	if (max_size && (len > max_size || *size > max_size - len)) {
+		opkg_msg(ERROR, "Delta %s makes a package larger than its "
+				"size of %llu bytes.\n", delta_file_name,
+				(unsigned long long)max_size);
+		return 1;
+	}
+
+	*size += len;
+
+	return 0;
+}
+
+static int
+apply(FILE *old, FILE *delta, FILE *new, uint64_t max_size,
+		const char *delta_file_name, const char *old_file_name)
+{
+	char magic[OPKG_DELTA_MAGIC_LEN];
+	uint64_t offset, len, size = 0;
+	char *buf;
+	int op, err = -1;
+
+	if (fread(magic, 1, sizeof(magic), delta) != sizeof(magic)
+			|| memcmp(magic, OPKG_DELTA_MAGIC, sizeof(magic))) {
+		opkg_msg(ERROR, "%s is not a delta.\n", delta_file_name);
+		return -1;
+	}
+
+	buf = xmalloc(DELTA_BUF_LEN);
+
+	while ((op = fgetc(delta)) != EOF) {
+		switch (op) {
+		case 'C':
+			if (read_u64(delta, &offset) || read_u64(delta, &len))
+				goto truncated;
+			if (too_large(&size, len, max_size, delta_file_name))
+				goto cleanup;
+			if (offset > INT64_MAX
+					|| fseeko(old, offset, SEEK_SET) == -1
+					|| copy_bytes(old, new, len, buf)) {
+				opkg_msg(ERROR, "Delta %s does not fit %s.\n",
+						delta_file_name, old_file_name);
+				goto cleanup;
+			}
+			break;
+		case 'A':
+			if (read_u64(delta, &len))
+				goto truncated;
+			if (too_large(&size, len, max_size, delta_file_name))
+				goto cleanup;
+			if (copy_bytes(delta, new, len, buf))
+				goto truncated;
+			break;
+		case 'E':
+			err = 0;
+			goto cleanup;
+		default:
+			opkg_msg(ERROR, "Invalid instruction %#x in delta %s.\n",
+					op, delta_file_name);
+			goto cleanup;
+		}
+	}
+
+truncated:
+	opkg_msg(ERROR, "Delta %s is truncated, or its output could not "
+			"be written.\n", delta_file_name);
+cleanup:
+	free(buf);
+	return err;
+}
+
+/*
+ * Write the package which the delta in delta_file_name turns the one in
+ * old_file_name into to new_file_name, failing if it grows beyond max_size
+ * bytes, unless that is 0. The result is only as good as the delta and the
+ * old package, and must be verified by the caller.
+ */
+int
+opkg_delta_apply(const char *old_file_name, const char *delta_file_name,
+		const char *new_file_name, uint64_t max_size)
+{
+	const struct decompressor *d;
+	FILE *old = NULL, *delta = NULL, *in = NULL, *new = NULL;
+	int pid = 0, err = -1;
+
+	old = fopen(old_file_name, "r");
+	if (old == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", old_file_name);
+		goto cleanup;
+	}
+
+	delta = fopen(delta_file_name, "r");
+	if (delta == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", delta_file_name);
+		goto cleanup;
+	}
+
+	new = fopen(new_file_name, "w");
+	if (new == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", new_file_name);
+		goto cleanup;
+	}
+
+	/* The magic of a delta is not that of any compression. */
+	d = decompressor_detect(delta, NULL);
+	if (d && d->decompress == NULL) {
+		opkg_msg(ERROR, "%s needs %s support, which was not "
+				"compiled in.\n", delta_file_name, d->name);
+		goto cleanup;
+	}
+	if (d) {
+		in = decompress_open(d, delta, &pid);
+		if (in == NULL)
+			goto cleanup;
+	} else
+		in = delta;
+
+	err = apply(old, in, new, max_size, delta_file_name, old_file_name);
+
+	if (d) {
+		fclose(in);
+		if (decompress_close(d, pid))
+			err = -1;
+	}
+
+cleanup:
+	if (new && fclose(new) == EOF && err == 0) {
+		opkg_perror(ERROR, "Failed to write %s", new_file_name);
+		err = -1;
+	}
+	if (delta)
+		fclose(delta);
+	if (old)
+		fclose(old);
+
+	return err;
+}
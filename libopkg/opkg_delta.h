@@ -0,0 +1,45 @@
+/* opkg_delta.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_DELTA_H
+#define OPKG_DELTA_H
+
+#include <stdint.h>
+
+/*
+ * A feed may publish deltas which turn the package of one version into that
+ * of another, named in the Deltas field of the newer one as
+ *
+ *	Deltas: <version> <file name>, ...
+ *
+ * where <version> is as pkg_version_str_alloc() gives it, and <file name>
+ * is relative to the feed, as Filename is.
+ *
+ * A delta is OPKG_DELTA_MAGIC followed by instructions, each a byte and
+ * its operands, as 64 bit big-endian numbers:
+ *
+ *	'C' offset length	copy length bytes of the old package at offset
+ *	'A' length data		add the length bytes of data which follow
+ *	'E'			the end of the new package
+ *
+ * The whole of a delta may be compressed with any of the decompressors of
+ * libbb.
+ */
+#define OPKG_DELTA_MAGIC "OPKDELTA1\n"
+#define OPKG_DELTA_MAGIC_LEN 10
+
+char *opkg_delta_find(const char *deltas, const char *version);
+int opkg_delta_apply(const char *old_file_name, const char *delta_file_name,
+		const char *new_file_name, uint64_t max_size);
+
+#endif
@@ -20,11 +20,21 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "opkg_download.h"
+#include "opkg_cache.h"
+#include "opkg_delta.h"
 #include "opkg_message.h"
+#include "opkg_profile.h"
+#include "pkg_hash.h"
 
 #include "sprintf_alloc.h"
 #include "xsystem.h"
@@ -80,6 +90,26 @@ str_starts_with(const char *str, const char *prefix)
     return (strncmp(str, prefix, strlen(prefix)) == 0);
 }
 
+static void
+set_proxy_env(void)
+{
+    if (conf->http_proxy) {
+	opkg_msg(DEBUG, "Setting environment variable: http_proxy = %s.\n",
+		conf->http_proxy);
+	setenv("http_proxy", conf->http_proxy, 1);
+    }
+    if (conf->ftp_proxy) {
+	opkg_msg(DEBUG, "Setting environment variable: ftp_proxy = %s.\n",
+		conf->ftp_proxy);
+	setenv("ftp_proxy", conf->ftp_proxy, 1);
+    }
+    if (conf->no_proxy) {
+	opkg_msg(DEBUG,"Setting environment variable: no_proxy = %s.\n",
+		conf->no_proxy);
+	setenv("no_proxy", conf->no_proxy, 1);
+    }
+}
+
 int
 opkg_download(const char *src, const char *dest_file_name,
 	curl_progress_func cb, void *data, const short hide_error)
@@ -94,6 +124,11 @@ opkg_download(const char *src, const char *dest_file_name,
 
     if (str_starts_with(src, "file:")) {
 	const char *file_src = src + 5;
+	if (hide_error && !file_exists(file_src)) {
+	    opkg_msg(DEBUG2, "%s does not exist.\n", file_src);
+	    free(src_basec);
+	    return -1;
+	}
 	opkg_msg(INFO, "Copying %s to %s...", file_src, dest_file_name);
 	err = file_copy(file_src, dest_file_name);
 	opkg_msg(INFO, "Done.\n");
@@ -110,21 +145,7 @@ opkg_download(const char *src, const char *dest_file_name,
 	return -1;
     }
 
-    if (conf->http_proxy) {
-	opkg_msg(DEBUG, "Setting environment variable: http_proxy = %s.\n",
-		conf->http_proxy);
-	setenv("http_proxy", conf->http_proxy, 1);
-    }
-    if (conf->ftp_proxy) {
-	opkg_msg(DEBUG, "Setting environment variable: ftp_proxy = %s.\n",
-		conf->ftp_proxy);
-	setenv("ftp_proxy", conf->ftp_proxy, 1);
-    }
-    if (conf->no_proxy) {
-	opkg_msg(DEBUG,"Setting environment variable: no_proxy = %s.\n",
-		conf->no_proxy);
-	setenv("no_proxy", conf->no_proxy, 1);
-    }
+    set_proxy_env();
 
 #ifdef HAVE_CURL
     CURLcode res;
@@ -173,7 +194,8 @@ opkg_download(const char *src, const char *dest_file_name,
       res = xsystem(argv);
 
       if (res) {
-	opkg_msg(ERROR, "Failed to download %s, wget returned %d.\n", src, res);
+	opkg_msg(hide_error?DEBUG2:ERROR,
+		"Failed to download %s, wget returned %d.\n", src, res);
 	free(tmp_file_location);
 	return -1;
       }
@@ -187,33 +209,384 @@ opkg_download(const char *src, const char *dest_file_name,
     return err;
 }
 
+/*
+ * Download the package index url, such as ".../Packages", of a feed which
+ * publishes it compressed, and decompress it to list_file_name. Each
+ * compression libbb supports is tried in turn, best first, by appending
+ * its suffix to url and to tmp_file_name, which it is downloaded to. The
+ * last is gzip, which such a feed always has.
+ */
+int
+opkg_download_index(const char *url, const char *list_file_name,
+	const char *tmp_file_name, curl_progress_func cb, void *data)
+{
+    const struct decompressor *d, *found;
+    char *src, *tmp;
+    FILE *in, *out;
+    int err = -1;
+
+    for (d = decompressors; d->name; d++) {
+	if (d->decompress == NULL || d->magic_len == 0)
+	    continue;
+
+	sprintf_alloc(&src, "%s%s", url, d->suffix);
+	sprintf_alloc(&tmp, "%s%s", tmp_file_name, d->suffix);
+
+	err = opkg_download(src, tmp, cb, data, d->decompress != unzip);
+	if (err) {
+	    free(src);
+	    free(tmp);
+	    continue;
+	}
+
+	opkg_msg(NOTICE, "Inflating %s.\n", src);
+	in = fopen(tmp, "r");
+	out = fopen(list_file_name, "w");
+	if (in && out) {
+	    found = decompressor_detect(in, d);
+	    err = found->decompress ? found->decompress(in, out) : -1;
+	    if (err)
+		opkg_msg(ERROR, "Failed to decompress %s.\n", src);
+	} else {
+	    opkg_perror(ERROR, "Failed to open %s or %s", tmp, list_file_name);
+	    err = -1;
+	}
+	if (in)
+	    fclose(in);
+	if (out && fclose(out))
+	    err = -1;
+	unlink(tmp);
+	free(src);
+	free(tmp);
+	/* The others are only tried for an index which is not there. */
+	break;
+    }
+
+    return err;
+}
+
+/*
+ * Start downloading src to be read as it arrives, rather than from a file.
+ * Returns a descriptor to read it from, or -1 on error. The download runs
+ * in a child process, whose pid is returned in *pid, except that a file:
+ * src is just opened and *pid set to 0. Finish with opkg_download_close().
+ */
+int
+opkg_download_open(const char *src, pid_t *pid)
+{
+    int fds[2];
+
+    *pid = 0;
+
+    opkg_msg(NOTICE,"Downloading %s.\n", src);
+
+    if (str_starts_with(src, "file:")) {
+	fds[0] = open(src + 5, O_RDONLY);
+	if (fds[0] == -1)
+	    opkg_perror(ERROR, "Failed to open %s", src + 5);
+	return fds[0];
+    }
+
+    set_proxy_env();
+
+    if (pipe(fds) == -1) {
+	opkg_perror(ERROR, "Failed to create pipe for %s", src);
+	return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    *pid = fork();
+    if (*pid == -1) {
+	opkg_perror(ERROR, "Failed to fork to download %s", src);
+	close(fds[0]);
+	close(fds[1]);
+	return -1;
+    }
+
+    if (*pid == 0) {
+	close(fds[0]);
+#ifdef HAVE_CURL
+	CURLcode res = CURLE_FAILED_INIT;
+	FILE *file;
+
+	opkg_download_detach();
+	file = fdopen(fds[1], "w");
+	curl = opkg_curl_init(NULL, NULL);
+	if (file && curl) {
+	    curl_easy_setopt(curl, CURLOPT_URL, src);
+	    curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
+	    res = curl_easy_perform(curl);
+	    if (fclose(file) && res == CURLE_OK)
+		res = CURLE_WRITE_ERROR;
+	}
+	/* The parent turns this back into a message. */
+	_exit(res);
+#else
+	const char *argv[8];
+	int i = 0;
+
+	argv[i++] = "wget";
+	argv[i++] = "-q";
+	if (conf->http_proxy || conf->ftp_proxy) {
+	    argv[i++] = "-Y";
+	    argv[i++] = "on";
+	}
+	argv[i++] = "-O";
+	argv[i++] = "-";
+	argv[i++] = src;
+	argv[i++] = NULL;
+
+	dup2(fds[1], STDOUT_FILENO);
+	close(fds[1]);
+	execvp(argv[0], (char *const *)argv);
+	_exit(-1);
+#endif
+    }
+
+    close(fds[1]);
+
+    return fds[0];
+}
+
+/*
+ * Finish reading fd, from opkg_download_open(). Unless it was read to the
+ * end, which complete says, the download is abandoned. Returns 0 if all of
+ * src was downloaded.
+ */
+int
+opkg_download_close(const char *src, int fd, pid_t pid, int complete)
+{
+    int status, res;
+
+    close(fd);
+
+    if (pid == 0)
+	return complete ? 0 : -1;
+
+    if (!complete)
+	kill(pid, SIGTERM);
+
+    if (waitpid(pid, &status, 0) == -1) {
+	opkg_perror(ERROR, "Failed to wait for the download of %s", src);
+	return -1;
+    }
+
+    if (!complete)
+	return -1;
+
+#ifdef HAVE_CURL
+    res = xsystem_status("curl", status);
+    if (res) {
+	opkg_msg(ERROR, "Failed to download %s: %s.\n", src,
+		res == -1 ? "unknown error" : curl_easy_strerror(res));
+	return -1;
+    }
+#else
+    res = xsystem_status("wget", status);
+    if (res) {
+	opkg_msg(ERROR, "Failed to download %s, wget returned %d.\n",
+		src, res);
+	return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * The digest a package is cached under, or NULL if the Packages index gave
+ * none that is usable as a file name.
+ */
+static const char *
+pkg_cache_digest(pkg_t *pkg)
+{
+    const char *digest = pkg->md5sum, *p;
+
+#ifdef HAVE_SHA256
+    if (pkg->sha256sum)
+	digest = pkg->sha256sum;
+#endif
+    if (digest == NULL || *digest == '\0')
+	return NULL;
+
+    for (p = digest; *p; p++)
+	if (!isxdigit(*p))
+	    return NULL;
+
+    return digest;
+}
+
 static int
-opkg_download_cache(const char *src, const char *dest_file_name,
-	curl_progress_func cb, void *data)
+pkg_verify_digests(pkg_t *pkg, const char *file_name)
 {
-    char *cache_name = xstrdup(src);
-    char *cache_location, *p;
-    int err = 0;
+    char *md5sum = NULL, *sha256sum = NULL;
+    int err;
+
+    err = file_digests_alloc(file_name, pkg->md5sum ? &md5sum : NULL,
+#ifdef HAVE_SHA256
+	    pkg->sha256sum ? &sha256sum :
+#endif
+	    NULL);
+    if (err)
+	return -1;
+
+    if (pkg->md5sum && (md5sum == NULL || strcmp(md5sum, pkg->md5sum)))
+	err = -1;
+#ifdef HAVE_SHA256
+    if (pkg->sha256sum
+	    && (sha256sum == NULL || strcmp(sha256sum, pkg->sha256sum)))
+	err = -1;
+#endif
 
-    if (!conf->cache || str_starts_with(src, "file:")) {
-	err = opkg_download(src, dest_file_name, cb, data, 0);
-	goto out1;
+    free(md5sum);
+    free(sha256sum);
+
+    return err;
+}
+
+/*
+ * Make file_name from a delta named by the Deltas field of pkg, against the
+ * cached copy of the version which is installed, instead of downloading
+ * all of pkg. The result must match the digests of pkg, and the caller
+ * downloads all of it when it does not.
+ */
+static int
+opkg_download_delta(pkg_t *pkg, const char *file_name)
+{
+    pkg_t *old;
+    const char *old_digest;
+    char *version, *delta, *delta_src, *delta_file, *old_file = NULL;
+    int err = -1;
+
+    if (pkg->deltas == NULL || pkg->src == NULL)
+	return -1;
+
+    old = pkg_hash_fetch_installed_by_name(pkg->name);
+    if (old == NULL || old == pkg)
+	return -1;
+
+    version = pkg_version_str_alloc(old);
+    delta = opkg_delta_find(pkg->deltas, version);
+    free(version);
+    if (delta == NULL)
+	return -1;
+
+    /* Only a copy which is known to match its digest will do. */
+    old_digest = pkg_cache_digest(old);
+    if (old_digest == NULL || !opkg_cache_lookup(old_digest, &old_file)) {
+	opkg_msg(INFO, "No cached copy of %s %s to apply %s to.\n",
+		old->name, old->version, delta);
+	free(old_file);
+	free(delta);
+	return -1;
     }
 
-    if(!file_is_dir(conf->cache)){
-	    opkg_msg(ERROR, "%s is not a directory.\n",
-			    conf->cache);
-	    err = 1;
-	    goto out1;
+    sprintf_alloc(&delta_src, "%s/%s", pkg->src->value, delta);
+    sprintf_alloc(&delta_file, "%s.delta", file_name);
+
+    if (opkg_download(delta_src, delta_file, NULL, NULL, 1) == 0) {
+	opkg_profile_begin("delta", pkg->name);
+	err = opkg_delta_apply(old_file, delta_file, file_name, pkg->size);
+	opkg_profile_end();
+
+	if (err == 0 && pkg_verify_digests(pkg, file_name)) {
+	    opkg_msg(ERROR, "Package %s made from %s does not match its "
+		    "checksum.\n", pkg->name, delta_src);
+	    err = -1;
+	}
+	if (err == 0)
+	    opkg_msg(NOTICE, "Made %s from %s.\n", file_name, old_file);
     }
 
+    (void) unlink(delta_file);
+    if (err) {
+	(void) unlink(file_name);
+	opkg_msg(NOTICE, "Downloading all of %s instead.\n", pkg->name);
+    }
+
+    free(delta_file);
+    free(delta_src);
+    free(old_file);
+    free(delta);
+
+    return err;
+}
+
+/*
+ * Packages with a digest are cached under it, so identical packages from
+ * different feeds share an entry. They are verified once, when they are
+ * added to the cache index.
+ */
+static int
+opkg_download_digest_cache(pkg_t *pkg, const char *digest, const char *src,
+	char **cache_location, curl_progress_func cb, void *data)
+{
+    int err;
+
+    if (opkg_cache_lookup(digest, cache_location)) {
+	opkg_msg(NOTICE, "Using %s.\n", *cache_location);
+	pkg->digest_verified = 1;
+	return 0;
+    }
+
+    /* Left over from an interrupted download, or from before the index. */
+    if (file_exists(*cache_location)
+	    && pkg_verify_digests(pkg, *cache_location))
+	(void) unlink(*cache_location);
+
+    if (!file_exists(*cache_location)
+	    && opkg_download_delta(pkg, *cache_location) == 0) {
+	opkg_cache_add(digest);
+	pkg->digest_verified = 1;
+	return 0;
+    }
+
+    if (!file_exists(*cache_location)) {
+	err = opkg_download(src, *cache_location, cb, data, 0);
+	if (err)
+	    goto err;
+
+	if (pkg_verify_digests(pkg, *cache_location)) {
+	    opkg_msg(ERROR, "Package %s downloaded from %s does not match "
+		    "its checksum. Try 'opkg update'.\n", pkg->name, src);
+	    err = -1;
+	    goto err;
+	}
+    } else
+	opkg_msg(NOTICE, "Using %s.\n", *cache_location);
+
+    opkg_cache_add(digest);
+    pkg->digest_verified = 1;
+    return 0;
+
+err:
+    (void) unlink(*cache_location);
+    free(*cache_location);
+    *cache_location = NULL;
+    return err;
+}
+
+/*
+ * Packages without a digest are cached by their URL, or failing that
+ * their file name.
+ */
+static int
+opkg_download_name_cache(const char *src, const char *dest_file_name,
+	char **cache_location, curl_progress_func cb, void *data)
+{
+    char *cache_name = xstrdup(src);
+    char *p;
+    int err = 0;
+
     for (p = cache_name; *p; p++)
 	if (*p == '/')
 	    *p = ',';	/* looks nicer than | or # */
 
-    sprintf_alloc(&cache_location, "%s/%s", conf->cache, cache_name);
-    if (file_exists(cache_location))
-	opkg_msg(NOTICE, "Copying %s.\n", cache_location);
+    sprintf_alloc(cache_location, "%s/%s", conf->cache, cache_name);
+    if (file_exists(*cache_location))
+	opkg_msg(NOTICE, "Using %s.\n", *cache_location);
     else {
        /* cache file with funky name not found, try simple name */
         free(cache_name);
@@ -222,26 +595,64 @@ opkg_download_cache(const char *src, const char *dest_file_name,
            cache_name = xstrdup(filename+1); // strip leading '/'
         else
            cache_name = xstrdup(dest_file_name);
-        free(cache_location);
-        sprintf_alloc(&cache_location, "%s/%s", conf->cache, cache_name);
-        if (file_exists(cache_location))
-           opkg_msg(NOTICE, "Copying %s.\n", cache_location);
+        free(*cache_location);
+        sprintf_alloc(cache_location, "%s/%s", conf->cache, cache_name);
+        if (file_exists(*cache_location))
+           opkg_msg(NOTICE, "Using %s.\n", *cache_location);
         else  {
- 	    err = opkg_download(src, cache_location, cb, data, 0);
+ 	    err = opkg_download(src, *cache_location, cb, data, 0);
 	    if (err) {
-	       (void) unlink(cache_location);
-	       goto out2;
+	       (void) unlink(*cache_location);
+	       free(*cache_location);
+	       *cache_location = NULL;
 	  }
 	}
     }
 
-    err = file_copy(cache_location, dest_file_name);
+    free(cache_name);
+    return err;
+}
+
+/*
+ * Download pkg from src through the cache in conf->cache, if there is one.
+ * When cache_file is not NULL and the package was cached, the name of the
+ * cached copy is returned in it instead of creating dest_file_name. That
+ * copy is shared and must only be read.
+ */
+static int
+opkg_download_cache(pkg_t *pkg, const char *src, const char *dest_file_name,
+	char **cache_file, curl_progress_func cb, void *data)
+{
+    char *cache_location;
+    const char *digest;
+    int err;
+
+    if (!conf->cache || str_starts_with(src, "file:"))
+	return opkg_download(src, dest_file_name, cb, data, 0);
+
+    if(!file_is_dir(conf->cache)){
+	    opkg_msg(ERROR, "%s is not a directory.\n",
+			    conf->cache);
+	    return 1;
+    }
+
+    digest = pkg_cache_digest(pkg);
+    if (digest)
+	err = opkg_download_digest_cache(pkg, digest, src, &cache_location,
+		cb, data);
+    else
+	err = opkg_download_name_cache(src, dest_file_name, &cache_location,
+		cb, data);
+    if (err)
+	return err;
 
+    if (cache_file) {
+	*cache_file = cache_location;
+	return 0;
+    }
 
-out2:
+    err = file_link(cache_location, dest_file_name);
     free(cache_location);
-out1:
-    free(cache_name);
     return err;
 }
 
@@ -251,6 +662,7 @@ opkg_download_pkg(pkg_t *pkg, const char *dir)
     int err;
     char *url;
     char *stripped_filename;
+    char *cached = NULL;
 
     if (pkg->src == NULL) {
 	opkg_msg(ERROR, "Package %s is not available from any configured src.\n",
@@ -276,12 +688,62 @@ opkg_download_pkg(pkg_t *pkg, const char *dir)
 
     sprintf_alloc(&pkg->local_filename, "%s/%s", dir, stripped_filename);
 
-    err = opkg_download_cache(url, pkg->local_filename, NULL, NULL);
+    opkg_profile_begin("download", pkg->name);
+
+    /* Packages fetched to tmp_dir for installation are only read from,
+       so they can be used from the cache in place. */
+    if (conf->cache && strcmp(dir, conf->tmp_dir) == 0)
+	err = opkg_download_cache(pkg, url, pkg->local_filename, &cached,
+		NULL, NULL);
+    else
+	err = opkg_download_cache(pkg, url, pkg->local_filename, NULL,
+		NULL, NULL);
+    if (!err)
+	opkg_profile_count(OPKG_PROFILE_BYTES, pkg->size);
+
+    opkg_profile_end();
+
+    if (cached) {
+	free(pkg->local_filename);
+	pkg->local_filename = cached;
+    }
     free(url);
 
     return err;
 }
 
+/*
+ * For a child process which downloads packages for its parent: leave the
+ * curl handle, which the parent may still be using, and the cache index to
+ * the parent.
+ */
+void
+opkg_download_detach(void)
+{
+#ifdef HAVE_CURL
+    /* Its connection belongs to the parent, so just forget it. */
+    curl = NULL;
+#endif
+    opkg_cache_detach();
+}
+
+/*
+ * Add pkg to the cache index, after a detached child has verified it and
+ * put it in the cache.
+ */
+void
+opkg_download_pkg_cached(pkg_t *pkg)
+{
+    const char *digest;
+
+    if (!conf->cache || !pkg->digest_verified)
+	return;
+
+    digest = pkg_cache_digest(pkg);
+    if (digest)
+	opkg_cache_add(digest);
+}
+
 /*
  * Downloads file from url, installs in package database, return package name.
  */
@@ -339,46 +801,74 @@ opkg_prepare_url_for_install(const char *url, char **namep)
      return 0;
 }
 
-int
-opkg_verify_file (char *text_file, char *sig_file)
-{
 #if defined HAVE_GPGME
-    if (conf->check_signature == 0 )
-        return 0;
-    int status = -1;
-    gpgme_ctx_t ctx;
-    gpgme_data_t sig, text, key;
+/* With the trusted keys imported, once for every signature checked. */
+static gpgme_ctx_t verify_ctx;
+
+static gpgme_ctx_t
+verify_ctx_get(void)
+{
+    gpgme_data_t key;
     gpgme_error_t err;
-    gpgme_verify_result_t result;
-    gpgme_signature_t s;
     char *trusted_path = NULL;
 
+    if (verify_ctx)
+	return verify_ctx;
+
     gpgme_check_version (NULL);
 
-    err = gpgme_new (&ctx);
+    err = gpgme_new (&verify_ctx);
 
-    if (err)
-	return -1;
+    if (err) {
+	verify_ctx = NULL;
+	return NULL;
+    }
 
     trusted_path = root_filename_alloc("/etc/opkg/trusted.gpg");
     err = gpgme_data_new_from_file (&key, trusted_path, 1);
     free (trusted_path);
     if (err)
     {
-      return -1;
+      gpgme_release (verify_ctx);
+      verify_ctx = NULL;
+      return NULL;
     }
-    err = gpgme_op_import (ctx, key);
+    err = gpgme_op_import (verify_ctx, key);
+    gpgme_data_release (key);
     if (err)
     {
-      gpgme_data_release (key);
-      return -1;
+      gpgme_release (verify_ctx);
+      verify_ctx = NULL;
+      return NULL;
     }
-    gpgme_data_release (key);
+
+    return verify_ctx;
+}
+#elif defined HAVE_OPENSSL
+/* The CA certificates, loaded once for every signature checked. */
+static X509_STORE *verify_store;
+#endif
+
+static int
+verify_signature (char *text_file, char *sig_file)
+{
+#if defined HAVE_GPGME
+    if (conf->check_signature == 0 )
+        return 0;
+    int status = -1;
+    gpgme_ctx_t ctx;
+    gpgme_data_t sig, text;
+    gpgme_error_t err;
+    gpgme_verify_result_t result;
+    gpgme_signature_t s;
+
+    ctx = verify_ctx_get();
+    if (ctx == NULL)
+	return -1;
 
     err = gpgme_data_new_from_file (&sig, sig_file, 1);
     if (err)
     {
-	gpgme_release (ctx);
 	return -1;
     }
 
@@ -386,15 +876,17 @@ opkg_verify_file (char *text_file, char *sig_file)
     if (err)
     {
         gpgme_data_release (sig);
-	gpgme_release (ctx);
 	return -1;
     }
 
     err = gpgme_op_verify (ctx, sig, text, NULL);
 
     result = gpgme_op_verify_result (ctx);
-    if (!result)
+    if (!result) {
+	gpgme_data_release (sig);
+	gpgme_data_release (text);
 	return -1;
+    }
 
     /* see if any of the signitures matched */
     s = result->signatures;
@@ -409,11 +901,9 @@ opkg_verify_file (char *text_file, char *sig_file)
 
     gpgme_data_release (sig);
     gpgme_data_release (text);
-    gpgme_release (ctx);
 
     return status;
 #elif defined HAVE_OPENSSL
-    X509_STORE *store = NULL;
     PKCS7 *p7 = NULL;
     BIO *in = NULL, *indata = NULL;
 
@@ -423,7 +913,10 @@ opkg_verify_file (char *text_file, char *sig_file)
     openssl_init();
 
     // Set-up the key store
-    if(!(store = setup_verify(conf->signature_ca_file, conf->signature_ca_path))){
+    if (verify_store == NULL)
+	verify_store = setup_verify(conf->signature_ca_file,
+			conf->signature_ca_path);
+    if (verify_store == NULL) {
         opkg_msg(ERROR, "Can't open CA certificates.\n");
         goto verify_file_end;
     }
@@ -458,7 +951,7 @@ opkg_verify_file (char *text_file, char *sig_file)
     }
 
     // Let's verify the autenticity !
-    if (PKCS7_verify(p7, NULL, store, indata, NULL, PKCS7_BINARY) != 1){
+    if (PKCS7_verify(p7, NULL, verify_store, indata, NULL, PKCS7_BINARY) != 1){
         // Get Off My Lawn!
         opkg_msg(ERROR, "Verification failure.\n");
     }else{
@@ -470,7 +963,6 @@ verify_file_end:
     BIO_free(in);
     BIO_free(indata);
     PKCS7_free(p7);
-    X509_STORE_free(store);
 
     return status;
 #else
@@ -482,6 +974,209 @@ verify_file_end:
 #endif
 }
 
+#if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
+/*
+ * The result of checking each signature this session, by the identity of
+ * the list, the signature and the trusted keys, so that a list is verified
+ * once rather than for every package installed from it.
+ */
+struct verified_file {
+    char *stamp;
+    int status;
+    struct verified_file *next;
+};
+
+static struct verified_file *verified_files;
+
+static void
+stamp_append(char **stamp, const char *path)
+{
+    struct stat st;
+    char *old = *stamp;
+
+    if (path == NULL || stat(path, &st) == -1)
+	sprintf_alloc(stamp, "%s%s -\n", old, path ? path : "-");
+    else
+	sprintf_alloc(stamp, "%s%s %lu %lu %lld %ld.%09ld %ld.%09ld\n",
+		old, path, (unsigned long)st.st_dev,
+		(unsigned long)st.st_ino, (long long)st.st_size,
+		(long)st.st_mtime, (long)st.st_mtim.tv_nsec,
+		(long)st.st_ctime, (long)st.st_ctim.tv_nsec);
+    free(old);
+}
+
+#ifndef HAVE_GPGME
+/*
+ * A directory of CA certificates changes with the files in it, which can be
+ * replaced without the directory itself changing.
+ */
+static void
+stamp_append_dir(char **stamp, const char *dir)
+{
+    struct dirent **names;
+    char *path;
+    int i, n;
+
+    stamp_append(stamp, dir);
+    if (dir == NULL)
+	return;
+
+    n = scandir(dir, &names, NULL, alphasort);
+    for (i = 0; i < n; i++) {
+	if (names[i]->d_name[0] != '.') {
+	    sprintf_alloc(&path, "%s/%s", dir, names[i]->d_name);
+	    stamp_append(stamp, path);
+	    free(path);
+	}
+	free(names[i]);
+    }
+    if (n > 0)
+	free(names);
+}
+#endif
+
+/*
+ * The change time is in it as well as the modification time, as only
+ * the kernel can set it back.
+ */
+static char *
+verify_stamp_alloc(const char *text_file, const char *sig_file)
+{
+    char *stamp = xstrdup("opkg-verified 2\n");
+#if defined HAVE_GPGME
+    char *trusted_path = root_filename_alloc("/etc/opkg/trusted.gpg");
+#endif
+
+    stamp_append(&stamp, text_file);
+    stamp_append(&stamp, sig_file);
+#if defined HAVE_GPGME
+    stamp_append(&stamp, trusted_path);
+    free(trusted_path);
+#else
+    stamp_append(&stamp, conf->signature_ca_file);
+    stamp_append_dir(&stamp, conf->signature_ca_path);
+#endif
+
+    return stamp;
+}
+
+/* Whether text_file was verified by an earlier run, with nothing changed. */
+static int
+verify_stamp_saved(const char *text_file, const char *stamp)
+{
+    char *path, *saved;
+    FILE *fp;
+    size_t len = strlen(stamp);
+    int match;
+
+    sprintf_alloc(&path, "%s.verified", text_file);
+    fp = fopen(path, "r");
+    free(path);
+    if (fp == NULL)
+	return 0;
+
+    saved = xmalloc(len + 1);
+    match = fread(saved, 1, len + 1, fp) == len
+	    && memcmp(saved, stamp, len) == 0;
+    free(saved);
+    fclose(fp);
+
+    return match;
+}
+
+static void
+verify_stamp_save(const char *text_file, const char *stamp)
+{
+    char *path, *tmp;
+    FILE *fp;
+
+    sprintf_alloc(&path, "%s.verified", text_file);
+    sprintf_alloc(&tmp, "%s.tmp", path);
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+	opkg_msg(DEBUG, "Not saving verification of %s.\n", text_file);
+    } else if (fputs(stamp, fp) == EOF || fclose(fp) == EOF
+	    || rename(tmp, path) == -1) {
+	opkg_msg(DEBUG, "Not saving verification of %s.\n", text_file);
+	unlink(tmp);
+    }
+
+    free(tmp);
+    free(path);
+}
+#endif
+
+int
+opkg_verify_file (char *text_file, char *sig_file)
+{
+#if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
+    struct verified_file *v;
+    char *stamp;
+    int status;
+
+    if (conf->check_signature == 0)
+	return verify_signature(text_file, sig_file);
+
+    stamp = verify_stamp_alloc(text_file, sig_file);
+
+    for (v = verified_files; v; v = v->next) {
+	if (strcmp(v->stamp, stamp) == 0) {
+	    opkg_msg(DEBUG, "Signature of %s already checked.\n", text_file);
+	    free(stamp);
+	    return v->status;
+	}
+    }
+
+    if (verify_stamp_saved(text_file, stamp)) {
+	opkg_msg(DEBUG, "Signature of %s checked by an earlier run.\n",
+		text_file);
+	status = 0;
+    } else {
+	status = verify_signature(text_file, sig_file);
+	if (status == 0)
+	    verify_stamp_save(text_file, stamp);
+    }
+
+    v = xmalloc(sizeof(*v));
+    v->stamp = stamp;
+    v->status = status;
+    v->next = verified_files;
+    verified_files = v;
+
+    return status;
+#else
+    return verify_signature(text_file, sig_file);
+#endif
+}
+
+/*
+ * Forget the signatures checked and the keys they were checked with, as
+ * the configuration may name others.
+ */
+void
+opkg_verify_deinit(void)
+{
+#if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
+    struct verified_file *v;
+
+    while ((v = verified_files)) {
+	verified_files = v->next;
+	free(v->stamp);
+	free(v);
+    }
+#endif
+#if defined HAVE_GPGME
+    if (verify_ctx) {
+	gpgme_release (verify_ctx);
+	verify_ctx = NULL;
+    }
+#elif defined HAVE_OPENSSL
+    X509_STORE_free(verify_store);
+    verify_store = NULL;
+#endif
+}
+
 
 #if defined(HAVE_OPENSSL) || defined(HAVE_SSLCURL)
 static void openssl_init(void){
@@ -26,13 +26,19 @@ typedef int (*curl_progress_func)(void *data, double t, double d, double ultotal
 
 
 int opkg_download(const char *src, const char *dest_file_name, curl_progress_func cb, void *data, const short hide_error);
+int opkg_download_index(const char *url, const char *list_file_name, const char *tmp_file_name, curl_progress_func cb, void *data);
+int opkg_download_open(const char *src, pid_t *pid);
+int opkg_download_close(const char *src, int fd, pid_t pid, int complete);
 int opkg_download_pkg(pkg_t *pkg, const char *dir);
+void opkg_download_detach(void);
+void opkg_download_pkg_cached(pkg_t *pkg);
 /*
  * Downloads file from url, installs in package database, return package name.
  */
 int opkg_prepare_url_for_install(const char *url, char **namep);
 
 int opkg_verify_file (char *text_file, char *sig_file);
+void opkg_verify_deinit(void);
 #ifdef HAVE_CURL
 void opkg_curl_cleanup(void);
 #endif
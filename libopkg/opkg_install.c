@@ -18,14 +18,20 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <errno.h>
 #include <time.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include "pkg.h"
 #include "pkg_hash.h"
 #include "pkg_extract.h"
+#include "pkg_stream.h"
 
 #include "opkg_install.h"
 #include "opkg_configure.h"
@@ -36,12 +42,54 @@
 #include "opkg_message.h"
 #include "opkg_cmd.h"
 #include "opkg_defines.h"
+#include "opkg_profile.h"
 
 #include "sprintf_alloc.h"
 #include "file_util.h"
 #include "xsystem.h"
 #include "libbb/libbb.h"
 
+/*
+ * Bulk unpacking, for offline root installs.
+ *
+ * No maintainer scripts are run for an offline root, so nothing done to
+ * install one package depends on the data files of another package being
+ * on disk. Between opkg_install_bulk_begin() and opkg_install_bulk_end(),
+ * packages are resolved and checked for file clashes as usual, but their
+ * data files are only queued. They are then unpacked by up to
+ * conf->unpack_jobs worker processes. Packages which write the same path
+ * are unpacked in install order, so the result is the same as that of a
+ * serial install.
+ */
+enum bulk_state {
+     BULK_QUEUED,
+     BULK_RUNNING,
+     BULK_DONE,
+     BULK_FAILED
+};
+
+struct bulk_unpack {
+     pkg_t *pkg;
+     pkg_t *old_pkg;
+     enum bulk_state state;
+     pid_t pid;
+     /* queued earlier, writing some of the same paths */
+     struct bulk_unpack **after;
+     int after_count;
+};
+
+static int bulk_active;
+static struct bulk_unpack **bulk_queue;
+static int bulk_len, bulk_size;
+/* non-directory paths of the queued packages, to their last writer */
+static hash_table_t bulk_files;
+
+static int
+bulk_unpack_pending(const char *file_name)
+{
+     return bulk_active && hash_table_get(&bulk_files, file_name) != NULL;
+}
+
 static int
 satisfy_dependencies_for(pkg_t *pkg)
 {
@@ -51,8 +99,10 @@ satisfy_dependencies_for(pkg_t *pkg)
      char **tmp, **unresolved = NULL;
      int ndepends;
 
+     opkg_profile_begin("solve", pkg->name);
      ndepends = pkg_hash_fetch_unsatisfied_dependencies(pkg, depends,
 							&unresolved);
+     opkg_profile_end();
 
      if (unresolved) {
 	  opkg_msg(ERROR, "Cannot satisfy the following dependencies for %s:\n",
@@ -226,13 +276,8 @@ verify_pkg_installable(pkg_t *pkg)
 }
 
 static int
-unpack_pkg_control_files(pkg_t *pkg)
+extract_pkg_control_files(pkg_t *pkg)
 {
-     int err;
-     char *conffiles_file_name;
-     char *root_dir;
-     FILE *conffiles_file;
-
      sprintf_alloc(&pkg->tmp_unpack_dir, "%s/%s-XXXXXX", conf->tmp_dir, pkg->name);
 
      pkg->tmp_unpack_dir = mkdtemp(pkg->tmp_unpack_dir);
@@ -242,10 +287,16 @@ unpack_pkg_control_files(pkg_t *pkg)
 	  return -1;
      }
 
-     err = pkg_extract_control_files_to_dir(pkg, pkg->tmp_unpack_dir);
-     if (err) {
-	  return err;
-     }
+     return pkg_extract_control_files_to_dir(pkg, pkg->tmp_unpack_dir);
+}
+
+/* Read the conffiles of pkg from its unpacked control files. */
+static int
+read_pkg_conffiles(pkg_t *pkg)
+{
+     char *conffiles_file_name;
+     char *root_dir;
+     FILE *conffiles_file;
 
      /* XXX: CLEANUP: There might be a cleaner place to read in the
 	conffiles. Seems like I should be able to get everything to go
@@ -305,6 +356,111 @@ unpack_pkg_control_files(pkg_t *pkg)
      return 0;
 }
 
+static int
+unpack_pkg_control_files(pkg_t *pkg)
+{
+     int err;
+
+     err = extract_pkg_control_files(pkg);
+     if (err) {
+	  return err;
+     }
+
+     return read_pkg_conffiles(pkg);
+}
+
+/* Check the md5sum and sha256sum computed of pkg, and free them. */
+static int
+check_pkg_digests(pkg_t *pkg, char *file_md5, char *file_sha256)
+{
+     int err = 0;
+
+     if (file_md5 && strcmp(file_md5, pkg->md5sum))
+     {
+	  opkg_msg(ERROR, "Package %s md5sum mismatch. "
+			  "Either the opkg or the package index are corrupt. "
+			  "Try 'opkg update'.\n",
+			  pkg->name);
+	  err = -1;
+     }
+#ifdef HAVE_SHA256
+     else if (file_sha256 && strcmp(file_sha256, pkg->sha256sum))
+     {
+	  opkg_msg(ERROR, "Package %s sha256sum mismatch. "
+			  "Either the opkg or the package index are corrupt. "
+			  "Try 'opkg update'.\n",
+			  pkg->name);
+	  err = -1;
+     }
+#endif
+
+     free(file_md5);
+     free(file_sha256);
+
+     return err;
+}
+
+/* Check the signature of the package list pkg came from. */
+static int
+verify_pkg_feed(pkg_t *pkg)
+{
+#if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
+     char *list_file_name, *sig_file_name, *lists_dir;
+     int err = 0;
+
+     /* check to ensure the package has come from a repository */
+     if (!conf->check_signature || pkg->src == NULL)
+	  return 0;
+
+     sprintf_alloc (&lists_dir, "%s",
+		     (conf->restrict_to_default_dest)
+		     ? conf->default_dest->lists_dir
+		     : conf->lists_dir);
+     sprintf_alloc (&list_file_name, "%s/%s", lists_dir, pkg->src->name);
+     sprintf_alloc (&sig_file_name, "%s/%s.sig", lists_dir, pkg->src->name);
+
+     if (file_exists (sig_file_name))
+     {
+	  if (opkg_verify_file (list_file_name, sig_file_name)){
+	       opkg_msg(ERROR, "Failed to verify the signature of %s.\n",
+			       list_file_name);
+	       err = -1;
+	  }
+     }else{
+	  opkg_msg(ERROR, "Signature file is missing for %s. "
+			  "Perhaps you need to run 'opkg update'?\n",
+			  pkg->name);
+	  err = -1;
+     }
+
+     free (lists_dir);
+     free (list_file_name);
+     free (sig_file_name);
+
+     return err;
+#else
+     return 0;
+#endif
+}
+
+/* Check the md5sum and sha256sum of pkg, both computed in a single read. */
+static int
+verify_pkg_digests(pkg_t *pkg)
+{
+     char *file_md5 = NULL;
+     char *file_sha256 = NULL;
+
+     file_digests_alloc(pkg->local_filename,
+		     pkg->md5sum ? &file_md5 : NULL,
+#ifdef HAVE_SHA256
+		     pkg->sha256sum ? &file_sha256 : NULL);
+#else
+		     NULL);
+#endif
+
+     return check_pkg_digests(pkg, file_md5, file_sha256);
+}
+
 /*
  * Remove packages which were auto_installed due to a dependency by old_pkg,
  * which are no longer a dependency in the new (upgraded) pkg.
@@ -340,8 +496,8 @@ pkg_remove_orphan_dependent(pkg_t *pkg, pkg_t *old_pkg)
 				if (cd1->type != DEPEND)
 					continue;
 				for (l=0; l<cd1->possibility_count; l++) {
-					if (cd0->possibilities[j]
-					 == cd1->possibilities[l]) {
+					if (cd0->possibilities[j].pkg
+					 == cd1->possibilities[l].pkg) {
 						found = 1;
 						break;
 					}
@@ -357,7 +513,7 @@ pkg_remove_orphan_dependent(pkg_t *pkg, pkg_t *old_pkg)
 			 * old_pkg has a dependency that pkg does not.
 			 */
 			p = pkg_hash_fetch_installed_by_name(
-					cd0->possibilities[j]->pkg->name);
+					cd0->possibilities[j].pkg->name);
 
 			if (!p)
 				continue;
@@ -765,7 +921,9 @@ check_data_file_clashes(pkg_t *pkg, pkg_t *old_pkg)
              iter;
              iter = niter, niter = str_list_next(files_list, iter)) {
 	  filename = (char *) iter->data;
-	  if (file_exists(filename) && (! file_is_dir(filename))) {
+	  /* Files of queued packages clash as if already unpacked. */
+	  if ((file_exists(filename) || bulk_unpack_pending(filename))
+			  && (! file_is_dir(filename))) {
 	       pkg_t *owner;
 	       pkg_t *obs;
 
@@ -1086,7 +1244,7 @@ resolve_conffiles(pkg_t *pkg)
 
 	  /* Might need to initialize the md5sum for each conffile */
 	  if (cf->value == NULL) {
-	       cf->value = file_md5sum_alloc(root_filename);
+	       cf->value = conffile_md5sum_alloc(cf->name);
 	  }
 
 	  if (!file_exists(root_filename)) {
@@ -1127,6 +1285,978 @@ resolve_conffiles(pkg_t *pkg)
      return 0;
 }
 
+static void
+finish_data_files(pkg_t *pkg, pkg_t *old_pkg)
+{
+     int err;
+
+     err = check_data_file_clashes_change(pkg, old_pkg);
+     if (err) {
+	   opkg_msg(ERROR, "check_data_file_clashes_change() failed for "
+			  "for files belonging to %s.\n",
+			  pkg->name);
+     }
+
+     opkg_msg(INFO, "Resolving conf files for %s\n", pkg->name);
+     resolve_conffiles(pkg);
+}
+
+/*
+ * Staged installs, with conf->staged_install.
+ *
+ * The data files are extracted to a staging directory in the root of the
+ * destination before the point of no return, so a failed extraction can
+ * still be unwound. After that the staging directory is synced once and
+ * its contents renamed into place. A replaced file is exchanged into the
+ * staging directory where the kernel supports it, so it is unlinked only
+ * once the commit is complete, along with the staging directory itself.
+ * The sync is per package rather than per transaction: the scripts and
+ * conffile checks of the next package expect this one's files in place.
+ */
+static int
+stage_data_files(pkg_t *pkg, char **stage_dir)
+{
+     char *dir, *prefix;
+     int err;
+
+     *stage_dir = NULL;
+
+     if (!conf->staged_install || bulk_active)
+	  return 0;
+
+     sprintf_alloc(&dir, "%s.opkg-stage-XXXXXX", pkg->dest->root_dir);
+     if (mkdtemp(dir) == NULL) {
+	  opkg_perror(ERROR, "Failed to create staging dir %s", dir);
+	  free(dir);
+	  return -1;
+     }
+     *stage_dir = dir;
+
+     opkg_msg(INFO, "Staging data files for %s in %s.\n", pkg->name, dir);
+     sprintf_alloc(&prefix, "%s/", dir);
+     err = pkg_extract_data_files_to_dir(pkg, prefix);
+     free(prefix);
+     if (err) {
+	  opkg_msg(ERROR, "Failed to stage data files for %s.\n", pkg->name);
+	  return err;
+     }
+
+     return 0;
+}
+
+static void
+stage_data_files_unwind(pkg_t *pkg, char **stage_dir)
+{
+     int cwd;
+
+     if (*stage_dir == NULL)
+	  return;
+
+     /* rm_r() leaves us in the parent of the directory it removed. */
+     cwd = open(".", O_RDONLY);
+     rm_r(*stage_dir);
+     if (cwd != -1) {
+	  if (fchdir(cwd) == -1)
+	       opkg_perror(ERROR, "Failed to return to working dir");
+	  close(cwd);
+     }
+
+     free(*stage_dir);
+     *stage_dir = NULL;
+}
+
+/*
+ * Streamed installs, with conf->stream_install.
+ *
+ * A package is unpacked as it is downloaded rather than from a copy in
+ * tmp_dir. Its control members are kept in a skeleton package, which
+ * stands in for it from then on, and its data files are extracted straight
+ * into a staging directory, to be committed as for a staged install once
+ * the digests of the whole download have been checked. Streamed packages
+ * are on a stack, so that a circular dependency installing one for us
+ * still finds its data files.
+ */
+struct streamed {
+     pkg_t *pkg;
+     char *stage_dir;	/* until install_pkg() takes it */
+     int files_held;	/* pkg->installed_files is from the stream */
+     int skeleton;	/* pkg->local_filename has no data files */
+     struct streamed *next;
+};
+
+static struct streamed *streamed_pkgs;
+
+static int
+stream_pkg_wanted(pkg_t *pkg)
+{
+     return conf->stream_install && !conf->cache && !conf->download_only
+	     && !conf->noaction && !bulk_active
+	     && pkg->src && pkg->filename;
+}
+
+static int
+stream_pkg(pkg_t *pkg)
+{
+     struct streamed *streamed;
+     char *url, *stripped_filename, *prefix, *list_file_name;
+     char *md5sum, *sha256sum;
+     FILE *list_file;
+     int fd, err;
+
+     streamed = xcalloc(1, sizeof(*streamed));
+     streamed->pkg = pkg;
+     streamed->skeleton = 1;
+     streamed->next = streamed_pkgs;
+     streamed_pkgs = streamed;
+
+     stripped_filename = strrchr(pkg->filename, '/');
+     if (stripped_filename)
+	  stripped_filename++;
+     else
+	  stripped_filename = pkg->filename;
+     sprintf_alloc(&pkg->local_filename, "%s/%s", conf->tmp_dir,
+		     stripped_filename);
+
+     sprintf_alloc(&streamed->stage_dir, "%s.opkg-stage-XXXXXX",
+		     pkg->dest->root_dir);
+     if (mkdtemp(streamed->stage_dir) == NULL) {
+	  opkg_perror(ERROR, "Failed to create staging dir %s",
+			  streamed->stage_dir);
+	  free(streamed->stage_dir);
+	  streamed->stage_dir = NULL;
+	  return -1;
+     }
+
+     sprintf_alloc(&list_file_name, "%s/%s.list.XXXXXX", conf->tmp_dir,
+		     pkg->name);
+     fd = mkstemp(list_file_name);
+     if (fd == -1) {
+	  opkg_perror(ERROR, "Failed to make temp file %s.", list_file_name);
+	  free(list_file_name);
+	  return -1;
+     }
+     close(fd);
+
+     opkg_msg(INFO, "Staging data files for %s in %s.\n", pkg->name,
+		     streamed->stage_dir);
+     sprintf_alloc(&url, "%s/%s", pkg->src->value, pkg->filename);
+     sprintf_alloc(&prefix, "%s/", streamed->stage_dir);
+
+     opkg_profile_begin("download", pkg->name);
+     err = pkg_stream_unpack(pkg, url, pkg->local_filename, prefix,
+		     list_file_name, &md5sum, &sha256sum);
+     if (err != -1)
+	  opkg_profile_count(OPKG_PROFILE_BYTES, pkg->size);
+     opkg_profile_end();
+
+     if (err != -1 && check_pkg_digests(pkg, md5sum, sha256sum))
+	  err = -1;
+
+     if (err == 1) {
+	  /* Not an ar archive, so it was saved whole instead, to be
+	     installed as if it had been downloaded. */
+	  stage_data_files_unwind(pkg, &streamed->stage_dir);
+	  streamed->skeleton = 0;
+	  err = 0;
+     } else if (err == 0) {
+	  list_file = fopen(list_file_name, "r");
+	  if (list_file == NULL) {
+	       opkg_perror(ERROR, "Failed to open %s", list_file_name);
+	       err = -1;
+	  } else {
+	       pkg_get_installed_files_from_list(pkg, list_file);
+	       streamed->files_held = 1;
+	       fclose(list_file);
+	  }
+     }
+
+     if (err == 0)
+	  pkg->digest_verified = 1;
+
+     unlink(list_file_name);
+     free(list_file_name);
+     free(prefix);
+     free(url);
+
+     return err;
+}
+
+/* The data files streamed for pkg, if it was streamed and they have not
+   been taken yet. */
+static char *
+stream_pkg_take(pkg_t *pkg)
+{
+     struct streamed *streamed;
+     char *stage_dir;
+
+     for (streamed = streamed_pkgs; streamed; streamed = streamed->next) {
+	  if (streamed->pkg == pkg) {
+	       stage_dir = streamed->stage_dir;
+	       streamed->stage_dir = NULL;
+	       return stage_dir;
+	  }
+     }
+
+     return NULL;
+}
+
+/* Finish with the package streamed last, after its install returned err. */
+static void
+stream_pkg_release(int err)
+{
+     struct streamed *streamed = streamed_pkgs;
+     pkg_t *pkg = streamed->pkg;
+
+     streamed_pkgs = streamed->next;
+
+     stage_data_files_unwind(pkg, &streamed->stage_dir);
+     if (streamed->files_held)
+	  pkg_free_installed_files(pkg);
+
+     /* The skeleton cannot be installed from again. */
+     if (err && streamed->skeleton && pkg->local_filename) {
+	  unlink(pkg->local_filename);
+	  free(pkg->local_filename);
+	  pkg->local_filename = NULL;
+	  pkg->digest_verified = 0;
+     }
+
+     free(streamed);
+}
+
+static int
+sync_staged_files(const char *stage_dir)
+{
+#ifdef HAVE_SYNCFS
+     int fd, err;
+
+     opkg_msg(DEBUG, "Syncing %s.\n", stage_dir);
+     fd = open(stage_dir, O_RDONLY);
+     if (fd == -1) {
+	  opkg_perror(ERROR, "Failed to open %s", stage_dir);
+	  return -1;
+     }
+
+     err = syncfs(fd);
+     if (err)
+	  opkg_perror(ERROR, "Failed to sync %s", stage_dir);
+
+     close(fd);
+     return err;
+#else
+     opkg_msg(DEBUG, "Syncing %s.\n", stage_dir);
+     sync();
+     return 0;
+#endif
+}
+
+static int
+commit_staged_file(const char *src, const char *dest)
+{
+#ifdef HAVE_RENAMEAT2
+     struct stat st;
+
+     /* Swap the installed file into the staging directory rather than
+	unlinking it while we are still committing. */
+     if (lstat(dest, &st) == 0 && !S_ISDIR(st.st_mode)) {
+	  if (renameat2(AT_FDCWD, src, AT_FDCWD, dest, RENAME_EXCHANGE) == 0)
+	       return 0;
+	  if (errno != EINVAL && errno != ENOSYS && errno != EXDEV) {
+	       opkg_perror(ERROR, "Failed to exchange %s with %s", src, dest);
+	       return -1;
+	  }
+     }
+#endif
+     return file_move(src, dest);
+}
+
+static int
+commit_staged_dir(const char *src_dir, const char *dest_dir)
+{
+     DIR *dir;
+     struct dirent *dent;
+     struct stat src_st, dest_st;
+     char *src, *dest;
+     int err = 0;
+
+     dir = opendir(src_dir);
+     if (dir == NULL) {
+	  opkg_perror(ERROR, "Failed to open dir %s", src_dir);
+	  return -1;
+     }
+
+     while (err == 0 && (dent = readdir(dir)) != NULL) {
+	  if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+	       continue;
+
+	  sprintf_alloc(&src, "%s/%s", src_dir, dent->d_name);
+	  sprintf_alloc(&dest, "%s/%s", dest_dir, dent->d_name);
+
+	  if (lstat(src, &src_st) == -1) {
+	       opkg_perror(ERROR, "Failed to lstat %s", src);
+	       err = -1;
+	  } else if (!S_ISDIR(src_st.st_mode)) {
+	       err = commit_staged_file(src, dest);
+	  } else if (stat(dest, &dest_st) == -1) {
+	       /* A new directory is moved in whole. */
+	       if (rename(src, dest) == -1) {
+		    if (errno == EXDEV
+			      && mkdir(dest, src_st.st_mode) == 0)
+			 err = commit_staged_dir(src, dest);
+		    else {
+			 opkg_perror(ERROR, "Failed to rename %s to %s",
+					 src, dest);
+			 err = -1;
+		    }
+	       }
+	  } else if (S_ISDIR(dest_st.st_mode)) {
+	       /* Merge into the existing directory, or the directory a
+		  symlink points to, as a direct extraction would. */
+	       chown(dest, src_st.st_uid, src_st.st_gid);
+	       chmod(dest, src_st.st_mode);
+	       err = commit_staged_dir(src, dest);
+	  } else {
+	       opkg_msg(ERROR, "Cannot replace %s with a directory.\n", dest);
+	       err = -1;
+	  }
+
+	  free(src);
+	  free(dest);
+     }
+
+     closedir(dir);
+     return err;
+}
+
+static int
+commit_staged_files(pkg_t *pkg, const char *stage_dir)
+{
+     char *root;
+     int err;
+
+     /* Before the first rename, so that no path is ever left pointing to
+	data which has not been written back. */
+     if (sync_staged_files(stage_dir))
+	  return -1;
+
+     opkg_msg(INFO, "Committing data files for %s to %s.\n",
+		     pkg->name, pkg->dest->root_dir);
+
+     /* Strip the trailing '/' of the root. */
+     root = xstrdup(pkg->dest->root_dir);
+     root[strlen(root) - 1] = '\0';
+     err = commit_staged_dir(stage_dir, root);
+     free(root);
+
+     return err;
+}
+
+
+static int
+conffiles_pending(pkg_t *pkg)
+{
+     conffile_list_elt_t *iter;
+     conffile_t *cf;
+     char *cf_name;
+     int pending = 0;
+
+     for (iter = nv_pair_list_first(&pkg->conffiles); iter && !pending;
+		     iter = nv_pair_list_next(&pkg->conffiles, iter)) {
+	  cf = (conffile_t *)iter->data;
+	  cf_name = root_filename_alloc(cf->name);
+	  pending = bulk_unpack_pending(cf_name);
+	  free(cf_name);
+     }
+
+     return pending;
+}
+
+static int
+bulk_unpack_queue(pkg_t *pkg, pkg_t *old_pkg)
+{
+     struct bulk_unpack *b, *prev;
+     str_list_t *files;
+     str_list_elt_t *iter;
+     char *path;
+     int i;
+
+     files = pkg_get_installed_files(pkg);
+     if (files == NULL)
+	  return -1;
+
+     b = xcalloc(1, sizeof(struct bulk_unpack));
+     b->pkg = pkg;
+     b->old_pkg = old_pkg;
+     b->state = BULK_QUEUED;
+
+     for (iter = str_list_first(files); iter; iter = str_list_next(files, iter)) {
+	  path = (char *)iter->data;
+
+	  /* Directories may be shared by any number of packages. */
+	  if (*path == '\0' || path[strlen(path)-1] == '/')
+	       continue;
+
+	  prev = hash_table_get(&bulk_files, path);
+	  if (prev && prev != b) {
+	       for (i = 0; i < b->after_count; i++)
+		    if (b->after[i] == prev)
+			 break;
+	       if (i == b->after_count) {
+		    b->after = xrealloc(b->after,
+			      (b->after_count + 1) * sizeof(struct bulk_unpack *));
+		    b->after[b->after_count++] = prev;
+	       }
+	  }
+	  hash_table_insert(&bulk_files, path, b);
+     }
+
+     pkg_free_installed_files(pkg);
+
+     if (bulk_len == bulk_size) {
+	  bulk_size = bulk_size ? 2 * bulk_size : 64;
+	  bulk_queue = xrealloc(bulk_queue,
+			  bulk_size * sizeof(struct bulk_unpack *));
+     }
+     bulk_queue[bulk_len++] = b;
+
+     opkg_msg(DEBUG, "Queued data files of %s, after %d other package(s).\n",
+		     pkg->name, b->after_count);
+
+     return 0;
+}
+
+static int
+bulk_unpack_ready(struct bulk_unpack *b)
+{
+     int i;
+
+     for (i = 0; i < b->after_count; i++)
+	  if (b->after[i]->state == BULK_QUEUED
+			  || b->after[i]->state == BULK_RUNNING)
+	       return 0;
+
+     return 1;
+}
+
+static void
+bulk_unpack_start(struct bulk_unpack *b)
+{
+     int err;
+
+     fflush(stdout);
+     fflush(stderr);
+
+     b->pid = fork();
+     if (b->pid == 0) {
+	  /* Only report our own errors. */
+	  free_error_list();
+	  err = pkg_extract_data_files_to_dir(b->pkg, b->pkg->dest->root_dir);
+	  print_error_list();
+	  fflush(stdout);
+	  _exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+     }
+
+     if (b->pid == -1) {
+	  opkg_perror(INFO, "Failed to fork, unpacking %s in place",
+			  b->pkg->name);
+	  err = pkg_extract_data_files_to_dir(b->pkg, b->pkg->dest->root_dir);
+	  b->state = err ? BULK_FAILED : BULK_DONE;
+	  return;
+     }
+
+     b->state = BULK_RUNNING;
+}
+
+/* Unpack everything queued so far, then finish installing it. */
+static int
+bulk_unpack_flush(void)
+{
+     struct bulk_unpack *b;
+     sigset_t newset, oldset;
+     struct timeval start, end;
+     int i, first = 0, running = 0, status, err = 0;
+     pid_t pid;
+
+     if (bulk_len == 0)
+	  return 0;
+
+     sigemptyset(&newset);
+     sigaddset(&newset, SIGINT);
+     sigprocmask(SIG_BLOCK, &newset, &oldset);
+
+     gettimeofday(&start, NULL);
+     opkg_profile_begin("unpack queued", NULL);
+
+     while (first < bulk_len) {
+	  for (i = first; i < bulk_len && running < conf->unpack_jobs; i++) {
+	       b = bulk_queue[i];
+	       if (b->state != BULK_QUEUED || !bulk_unpack_ready(b))
+		    continue;
+	       opkg_msg(INFO, "Unpacking data files for %s.\n", b->pkg->name);
+	       bulk_unpack_start(b);
+	       if (b->state == BULK_RUNNING)
+		    running++;
+	  }
+
+	  if (running) {
+	       pid = waitpid(-1, &status, 0);
+	       if (pid == -1) {
+		    if (errno == EINTR)
+			 continue;
+		    opkg_perror(ERROR, "waitpid failed");
+		    break;
+	       }
+	       for (i = first; i < bulk_len; i++) {
+		    b = bulk_queue[i];
+		    if (b->state == BULK_RUNNING && b->pid == pid) {
+			 if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			      b->state = BULK_DONE;
+			 else
+			      b->state = BULK_FAILED;
+			 running--;
+			 break;
+		    }
+	       }
+	  }
+
+	  while (first < bulk_len && (bulk_queue[first]->state == BULK_DONE
+			  || bulk_queue[first]->state == BULK_FAILED))
+	       first++;
+     }
+
+     opkg_profile_end();
+     gettimeofday(&end, NULL);
+     opkg_msg(DEBUG, "Unpacked %d packages in %.3fs with %d jobs.\n",
+		     bulk_len, (end.tv_sec - start.tv_sec)
+		     + (end.tv_usec - start.tv_usec) / 1000000.0,
+		     conf->unpack_jobs);
+
+     for (i = 0; i < bulk_len; i++) {
+	  b = bulk_queue[i];
+	  if (b->state != BULK_DONE) {
+	       opkg_msg(ERROR, "Failed to extract data files for %s. "
+			       "Package debris may remain!\n",
+			       b->pkg->name);
+	       b->pkg->state_status = SS_NOT_INSTALLED;
+	       if (b->pkg->parent)
+		    b->pkg->parent->state_status = SS_NOT_INSTALLED;
+	       err = -1;
+	  }
+     }
+
+     /* One walk of the file hash for all of the new filelists, which
+	finish_data_files() reads back. */
+     if (pkg_write_changed_filelists())
+	  err = -1;
+
+     /* Finish each package in the order it was installed. */
+     for (i = 0; i < bulk_len; i++) {
+	  b = bulk_queue[i];
+	  if (b->state == BULK_DONE) {
+	       set_flags_from_control(b->pkg);
+	       finish_data_files(b->pkg, b->old_pkg);
+	  }
+	  free(b->after);
+	  free(b);
+     }
+
+     bulk_len = 0;
+     hash_table_deinit(&bulk_files);
+     hash_table_init("bulk-files", &bulk_files, OPKG_CONF_DEFAULT_HASH_LEN);
+
+     sigprocmask(SIG_SETMASK, &oldset, NULL);
+
+     return err;
+}
+
+void
+opkg_install_bulk_begin(void)
+{
+     if (!conf->offline_root || conf->force_postinstall
+		     || conf->unpack_jobs < 2 || bulk_active)
+	  return;
+
+     hash_table_init("bulk-files", &bulk_files, OPKG_CONF_DEFAULT_HASH_LEN);
+     bulk_active = 1;
+}
+
+int
+opkg_install_bulk_end(void)
+{
+     int err;
+
+     if (!bulk_active)
+	  return 0;
+
+     err = bulk_unpack_flush();
+
+     hash_table_deinit(&bulk_files);
+     free(bulk_queue);
+     bulk_queue = NULL;
+     bulk_size = 0;
+     bulk_active = 0;
+
+     return err;
+}
+
+/*
+ * Read-ahead, for installs which download packages.
+ *
+ * Between opkg_install_prefetch_begin() and opkg_install_prefetch_end(),
+ * the packages an install is expected to need are downloaded, checked
+ * against their digests and have their control files unpacked by child
+ * processes, up to conf->read_ahead of them ahead of install_pkg(). So the
+ * network, the digests and unpacking data files are all busy at once.
+ * install_pkg() takes each result as it gets to the package, in whatever
+ * order it does so, and fetches the package itself as usual if it was not
+ * expected or its child failed, so that errors are reported as before.
+ */
+enum prefetch_state {
+     PREFETCH_QUEUED,
+     PREFETCH_RUNNING,
+     PREFETCH_TAKEN
+};
+
+struct prefetch {
+     pkg_t *pkg;
+     enum prefetch_state state;
+     int fd;		/* the result, written by the child */
+     int log_fd;	/* what the child printed */
+};
+
+static struct prefetch *prefetch_queue;
+static int prefetch_len, prefetch_next;
+/* started and not yet taken */
+static int prefetch_ahead;
+
+/*
+ * In the child: fetch, verify and unpack the control files of pkg, then
+ * write where they are to fd.
+ */
+static int
+prefetch_run(pkg_t *pkg, int fd)
+{
+     char *result;
+     int len, err;
+
+     opkg_download_detach();
+
+     if (opkg_download_pkg(pkg, conf->tmp_dir))
+	  return -1;
+
+     if (!pkg->digest_verified && verify_pkg_digests(pkg))
+	  return -1;
+
+     if (extract_pkg_control_files(pkg)) {
+	  if (pkg->tmp_unpack_dir)
+	       rm_r(pkg->tmp_unpack_dir);
+	  return -1;
+     }
+
+     sprintf_alloc(&result, "%s\n%s\n", pkg->local_filename,
+		     pkg->tmp_unpack_dir);
+     len = strlen(result);
+     err = write(fd, result, len) == len ? 0 : -1;
+     free(result);
+
+     return err;
+}
+
+static void
+prefetch_start(struct prefetch *p)
+{
+     char *log_name;
+     int fds[2];
+     pid_t pid;
+
+     /* Neither is to be inherited by the children started after this
+	one, nor by the maintainer scripts. */
+     if (pipe2(fds, O_CLOEXEC) == -1) {
+	  opkg_perror(INFO, "Failed to create pipe, not fetching %s ahead",
+			  p->pkg->name);
+	  return;
+     }
+
+     sprintf_alloc(&log_name, "%s/prefetch-XXXXXX", conf->tmp_dir);
+     p->log_fd = mkostemp(log_name, O_CLOEXEC);
+     if (p->log_fd != -1)
+	  unlink(log_name);
+     free(log_name);
+
+     fflush(stdout);
+     fflush(stderr);
+
+     pid = fork();
+     if (pid == 0) {
+	  close(fds[0]);
+	  /* Leave the grandchild to init, so that the waitpid(-1) of bulk
+	     unpacking and of triggers never reaps it. */
+	  if (fork() != 0)
+	       _exit(EXIT_SUCCESS);
+	  if (p->log_fd != -1) {
+	       dup2(p->log_fd, STDOUT_FILENO);
+	       dup2(p->log_fd, STDERR_FILENO);
+	  }
+	  free_error_list();
+	  _exit(prefetch_run(p->pkg, fds[1]) ? EXIT_FAILURE : EXIT_SUCCESS);
+     }
+
+     close(fds[1]);
+     if (pid == -1) {
+	  opkg_perror(INFO, "Failed to fork, not fetching %s ahead",
+			  p->pkg->name);
+	  close(fds[0]);
+	  if (p->log_fd != -1)
+	       close(p->log_fd);
+	  return;
+     }
+     waitpid(pid, NULL, 0);
+
+     p->fd = fds[0];
+     p->state = PREFETCH_RUNNING;
+     prefetch_ahead++;
+}
+
+/* Start fetching packages until conf->read_ahead of them are ahead. */
+static void
+prefetch_fill(void)
+{
+     struct prefetch *p;
+
+     while (prefetch_next < prefetch_len
+		     && prefetch_ahead < conf->read_ahead) {
+	  p = &prefetch_queue[prefetch_next++];
+	  if (p->state == PREFETCH_QUEUED)
+	       prefetch_start(p);
+     }
+}
+
+/*
+ * Wait for the child of p to finish, and return the local file name and
+ * the control directory it wrote, or NULL if it failed.
+ */
+static char *
+prefetch_wait(struct prefetch *p, char **control_dir)
+{
+     char *result = NULL, *nl;
+     size_t len = 0;
+     ssize_t n;
+
+     opkg_profile_begin("read ahead wait", p->pkg->name);
+     for (;;) {
+	  result = xrealloc(result, len + 4096 + 1);
+	  n = read(p->fd, result + len, 4096);
+	  if (n == -1 && errno == EINTR)
+	       continue;
+	  if (n <= 0)
+	       break;
+	  len += n;
+     }
+     opkg_profile_end();
+     result[len] = '\0';
+
+     close(p->fd);
+     p->state = PREFETCH_TAKEN;
+     prefetch_ahead--;
+
+     nl = strchr(result, '\n');
+     if (nl == NULL || len == 0 || result[len - 1] != '\n') {
+	  free(result);
+	  return NULL;
+     }
+     *nl = '\0';
+     result[len - 1] = '\0';
+     *control_dir = nl + 1;
+
+     return result;
+}
+
+static void
+prefetch_discard(struct prefetch *p)
+{
+     char *result, *control_dir;
+
+     result = prefetch_wait(p, &control_dir);
+     if (result) {
+	  rm_r(control_dir);
+	  free(result);
+     }
+     if (p->log_fd != -1)
+	  close(p->log_fd);
+}
+
+static void
+prefetch_print_log(struct prefetch *p)
+{
+     char buf[4096];
+     ssize_t n;
+
+     fflush(stdout);
+     lseek(p->log_fd, 0, SEEK_SET);
+     while ((n = read(p->log_fd, buf, sizeof(buf))) > 0)
+	  fwrite(buf, 1, n, stdout);
+     fflush(stdout);
+}
+
+/*
+ * Give pkg what was fetched ahead for it, if anything was. pkg->dest must
+ * be set, for its conffiles.
+ */
+static void
+prefetch_take(pkg_t *pkg)
+{
+     struct prefetch *p = NULL;
+     char *local_filename, *control_dir;
+     int i;
+
+     for (i = 0; i < prefetch_len; i++) {
+	  if (prefetch_queue[i].pkg == pkg
+			  && prefetch_queue[i].state != PREFETCH_TAKEN) {
+	       p = &prefetch_queue[i];
+	       break;
+	  }
+	  /* Fetched ahead for nothing, as the package got installed
+	     some other way. */
+	  if (prefetch_queue[i].state == PREFETCH_RUNNING
+			  && (prefetch_queue[i].pkg->state_status == SS_INSTALLED
+			  || prefetch_queue[i].pkg->state_status == SS_UNPACKED))
+	       prefetch_discard(&prefetch_queue[i]);
+     }
+     if (p == NULL)
+	  return;
+
+     if (p->state == PREFETCH_QUEUED) {
+	  p->state = PREFETCH_TAKEN;
+	  prefetch_fill();
+	  return;
+     }
+
+     local_filename = prefetch_wait(p, &control_dir);
+     if (local_filename == NULL) {
+	  opkg_msg(INFO, "Fetching %s ahead failed.\n", pkg->name);
+	  free(local_filename);
+	  if (p->log_fd != -1)
+	       close(p->log_fd);
+	  prefetch_fill();
+	  return;
+     }
+
+     if (p->log_fd != -1) {
+	  prefetch_print_log(p);
+	  close(p->log_fd);
+     }
+
+     pkg->local_filename = local_filename;
+     pkg->digest_verified = 1;
+     opkg_download_pkg_cached(pkg);
+
+     pkg->tmp_unpack_dir = xstrdup(control_dir);
+     if (read_pkg_conffiles(pkg)) {
+	  rm_r(pkg->tmp_unpack_dir);
+	  free(pkg->tmp_unpack_dir);
+	  pkg->tmp_unpack_dir = NULL;
+     }
+
+     prefetch_fill();
+}
+
+/*
+ * Add pkg and then what it is expected to need to plan, in the order
+ * install_pkg() downloads them: each package before its dependencies.
+ */
+static void
+prefetch_plan(pkg_t *pkg, hash_table_t *seen, pkg_vec_t *plan)
+{
+     compound_depend_t *cdep;
+     pkg_t *dep;
+     int i, j, count;
+
+     if (pkg == NULL || hash_table_get(seen, pkg->name))
+	  return;
+     hash_table_insert(seen, pkg->name, pkg);
+
+     if (pkg->local_filename == NULL && pkg->src
+		     && pkg->state_status != SS_INSTALLED
+		     && pkg->state_status != SS_UNPACKED)
+	  pkg_vec_insert(plan, pkg);
+
+     count = pkg->pre_depends_count + pkg->depends_count
+	     + pkg->recommends_count + pkg->suggests_count;
+     for (i = 0; i < count; i++) {
+	  cdep = &pkg->depends[i];
+	  if (cdep->type != PREDEPEND && cdep->type != DEPEND
+			  && cdep->type != RECOMMEND)
+	       continue;
+
+	  for (j = 0; j < cdep->possibility_count; j++)
+	       if (pkg_dependence_satisfied(&cdep->possibilities[j]))
+		    break;
+	  if (j < cdep->possibility_count || cdep->possibility_count == 0)
+	       continue;
+
+	  dep = pkg_hash_fetch_best_installation_candidate_by_name(
+			  cdep->possibilities[0].pkg->name);
+	  prefetch_plan(dep, seen, plan);
+     }
+}
+
+void
+opkg_install_prefetch_begin(char **names, int count)
+{
+     hash_table_t seen;
+     pkg_vec_t *plan;
+     pkg_t *old, *new;
+     int i;
+
+     if (conf->read_ahead < 1 || conf->noaction || conf->download_only
+		     || prefetch_queue)
+	  return;
+
+     memset(&seen, 0, sizeof(seen));
+     hash_table_init("read-ahead", &seen, OPKG_CONF_DEFAULT_HASH_LEN);
+     plan = pkg_vec_alloc();
+
+     for (i = 0; i < count; i++) {
+	  new = pkg_hash_fetch_best_installation_candidate_by_name(names[i]);
+	  if (new == NULL)
+	       continue;
+	  /* opkg_install_by_name() would leave it alone. */
+	  old = pkg_hash_fetch_installed_by_name(names[i]);
+	  if (old && pkg_compare_versions(old, new) >= 0)
+	       continue;
+	  prefetch_plan(new, &seen, plan);
+     }
+
+     hash_table_deinit(&seen);
+
+     if (plan->len) {
+	  opkg_msg(DEBUG, "Reading %d packages ahead.\n", plan->len);
+	  prefetch_queue = xcalloc(plan->len, sizeof(struct prefetch));
+	  for (i = 0; i < plan->len; i++) {
+	       prefetch_queue[i].pkg = plan->pkgs[i];
+	       prefetch_queue[i].log_fd = -1;
+	  }
+	  prefetch_len = plan->len;
+	  prefetch_fill();
+     }
+
+     pkg_vec_free(plan);
+}
+
+void
+opkg_install_prefetch_end(void)
+{
+     int i;
+
+     /* Don't leave children writing to tmp_dir as it is removed. */
+     for (i = 0; i < prefetch_len; i++)
+	  if (prefetch_queue[i].state == PREFETCH_RUNNING)
+	       prefetch_discard(&prefetch_queue[i]);
+
+     free(prefetch_queue);
+     prefetch_queue = NULL;
+     prefetch_len = prefetch_next = prefetch_ahead = 0;
+}
 
 int
 opkg_install_by_name(const char *pkg_name)
@@ -1140,7 +2270,9 @@ opkg_install_by_name(const char *pkg_name)
         opkg_msg(DEBUG2, "Old versions from pkg_hash_fetch %s.\n",
 			old->version);
 
+     opkg_profile_begin("select", pkg_name);
      new = pkg_hash_fetch_best_installation_candidate_by_name(pkg_name);
+     opkg_profile_end();
      if (new == NULL) {
 	opkg_msg(NOTICE, "Unknown package '%s'.\n", pkg_name);
 	return -1;
@@ -1197,8 +2329,8 @@ opkg_install_by_name(const char *pkg_name)
 /**
  *  @brief Really install a pkg_t
  */
-int
-opkg_install_pkg(pkg_t *pkg, int from_upgrade)
+static int
+install_pkg(pkg_t *pkg, int from_upgrade)
 {
      int err = 0;
      int message = 0;
@@ -1206,11 +2338,8 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
      pkg_vec_t *replacees;
      abstract_pkg_t *ab_pkg = NULL;
      int old_state_flag;
-     char* file_md5;
-#ifdef HAVE_SHA256
-     char* file_sha256;
-#endif
      sigset_t newset, oldset;
+     char *stage_dir = NULL;
 
      if ( from_upgrade )
         message = 1;            /* Coming from an upgrade, and should change the output message */
@@ -1262,6 +2391,23 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
      if (err)
 	     return -1;
 
+     /* The feed is checked before anything of the package is, so that
+	nothing of a streamed package is unpacked from an unverified feed. */
+     if (verify_pkg_feed(pkg))
+	  return -1;
+
+     if (pkg->local_filename == NULL && prefetch_queue)
+	  prefetch_take(pkg);
+
+     if (pkg->local_filename == NULL && stream_pkg_wanted(pkg)) {
+	  if (stream_pkg(pkg)) {
+	       opkg_msg(ERROR, "Failed to download %s. "
+			       "Perhaps you need to run 'opkg update'?\n",
+			    pkg->name);
+	       return -1;
+	  }
+     }
+
      if (pkg->local_filename == NULL) {
          if(!conf->cache && conf->download_only){
              char cwd[4096];
@@ -1280,75 +2426,11 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
 	  }
      }
 
-     /* check that the repository is valid */
-     #if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
-     char *list_file_name, *sig_file_name, *lists_dir;
-
-     /* check to ensure the package has come from a repository */
-     if (conf->check_signature && pkg->src)
-     {
-       sprintf_alloc (&lists_dir, "%s",
-                     (conf->restrict_to_default_dest)
-                      ? conf->default_dest->lists_dir
-                      : conf->lists_dir);
-       sprintf_alloc (&list_file_name, "%s/%s", lists_dir, pkg->src->name);
-       sprintf_alloc (&sig_file_name, "%s/%s.sig", lists_dir, pkg->src->name);
-
-       if (file_exists (sig_file_name))
-       {
-         if (opkg_verify_file (list_file_name, sig_file_name)){
-           opkg_msg(ERROR, "Failed to verify the signature of %s.\n",
-                           list_file_name);
-           return -1;
-         }
-       }else{
-         opkg_msg(ERROR, "Signature file is missing for %s. "
-                         "Perhaps you need to run 'opkg update'?\n",
-			 pkg->name);
-         return -1;
-       }
-
-       free (lists_dir);
-       free (list_file_name);
-       free (sig_file_name);
-     }
-     #endif
-
-     /* Check for md5 values */
-     if (pkg->md5sum)
-     {
-         file_md5 = file_md5sum_alloc(pkg->local_filename);
-         if (file_md5 && strcmp(file_md5, pkg->md5sum))
-         {
-              opkg_msg(ERROR, "Package %s md5sum mismatch. "
-			"Either the opkg or the package index are corrupt. "
-			"Try 'opkg update'.\n",
-			pkg->name);
-              free(file_md5);
-              return -1;
-         }
-	 if (file_md5)
-              free(file_md5);
-     }
+     /* Check for md5 and sha256 values, unless the package came verified
+	from the cache. */
+     if (!pkg->digest_verified && verify_pkg_digests(pkg))
+	  return -1;
 
-#ifdef HAVE_SHA256
-     /* Check for sha256 value */
-     if(pkg->sha256sum)
-     {
-         file_sha256 = file_sha256sum_alloc(pkg->local_filename);
-         if (file_sha256 && strcmp(file_sha256, pkg->sha256sum))
-         {
-              opkg_msg(ERROR, "Package %s sha256sum mismatch. "
-			"Either the opkg or the package index are corrupt. "
-			"Try 'opkg update'.\n",
-			pkg->name);
-              free(file_sha256);
-              return -1;
-         }
-	 if (file_sha256)
-              free(file_sha256);
-     }
-#endif
      if(conf->download_only) {
          if (conf->nodeps == 0) {
              err = satisfy_dependencies_for(pkg);
@@ -1382,6 +2464,12 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
      replacees = pkg_vec_alloc();
      pkg_get_installed_replacees(pkg, replacees);
 
+     /* Queued packages must be on disk before anything installed is
+	removed or backed up. */
+     if (bulk_active && (old_pkg || replacees->len
+			     || conffiles_pending(pkg)))
+	  bulk_unpack_flush();
+
      /* this next section we do with SIGINT blocked to prevent inconsistency between opkg database and filesystem */
 
 	  sigemptyset(&newset);
@@ -1428,7 +2516,22 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
 	  if (conf->noaction)
 		  return 0;
 
+	  /* A streamed package was staged as it was downloaded. */
+	  stage_dir = stream_pkg_take(pkg);
+	  if (stage_dir == NULL) {
+		  err = stage_data_files(pkg, &stage_dir);
+		  if (err)
+			  goto UNWIND_STAGE_DATA_FILES;
+	  }
+
 	  /* point of no return: no unwinding after this */
+	  if (stage_dir && commit_staged_files(pkg, stage_dir)) {
+		opkg_msg(ERROR, "Failed to commit data files for %s. "
+				"Package debris may remain!\n",
+				pkg->name);
+		goto pkg_is_hosed;
+	  }
+
 	  if (old_pkg) {
 	       old_pkg->state_want = SW_DEINSTALL;
 
@@ -1463,24 +2566,36 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
 	  /* the following just returns 0 */
 	  remove_disappeared(pkg);
 
-	  opkg_msg(INFO, "Installing data files for %s.\n", pkg->name);
+	  if (bulk_active) {
+		/* Unpacked and finished by bulk_unpack_flush(). */
+		if (bulk_unpack_queue(pkg, old_pkg)) {
+		     opkg_msg(ERROR, "Failed to queue data files for %s.\n",
+				     pkg->name);
+		     goto pkg_is_hosed;
+		}
+	  } else if (stage_dir) {
+		/* Committed above, before the old files were removed. */
+		set_flags_from_control(pkg);
+		if (pkg_write_filelist(pkg)) {
+		     opkg_msg(ERROR, "Failed to write file list for %s.\n",
+				     pkg->name);
+		     goto pkg_is_hosed;
+		}
 
-	  if (install_data_files(pkg)) {
-		opkg_msg(ERROR, "Failed to extract data files for %s. "
-				"Package debris may remain!\n",
-			       pkg->name);
-		goto pkg_is_hosed;
-	  }
+		finish_data_files(pkg, old_pkg);
+		stage_data_files_unwind(pkg, &stage_dir);
+	  } else {
+		opkg_msg(INFO, "Installing data files for %s.\n", pkg->name);
 
-	  err = check_data_file_clashes_change(pkg, old_pkg);
-	  if (err) {
-		opkg_msg(ERROR, "check_data_file_clashes_change() failed for "
-			       "for files belonging to %s.\n",
-			       pkg->name);
-	  }
+		if (install_data_files(pkg)) {
+		     opkg_msg(ERROR, "Failed to extract data files for %s. "
+				     "Package debris may remain!\n",
+				     pkg->name);
+		     goto pkg_is_hosed;
+		}
 
-	  opkg_msg(INFO, "Resolving conf files for %s\n", pkg->name);
-	  resolve_conffiles(pkg);
+		finish_data_files(pkg, old_pkg);
+	  }
 
 	  pkg->state_status = SS_UNPACKED;
 	  old_state_flag = pkg->state_flag;
@@ -1502,6 +2617,8 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
 	  return 0;
 
 
+     UNWIND_STAGE_DATA_FILES:
+	  stage_data_files_unwind(pkg, &stage_dir);
      UNWIND_POSTRM_UPGRADE_OLD_PKG:
 	  postrm_upgrade_old_pkg_unwind(pkg, old_pkg);
      UNWIND_CHECK_DATA_FILE_CLASHES:
@@ -1518,8 +2635,24 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
 	  pkg_remove_installed_replacees_unwind(replacees);
 
 pkg_is_hosed:
+	  stage_data_files_unwind(pkg, &stage_dir);
 	  sigprocmask(SIG_UNBLOCK, &newset, &oldset);
 
           pkg_vec_free (replacees);
 	  return -1;
 }
+
+int
+opkg_install_pkg(pkg_t *pkg, int from_upgrade)
+{
+     struct streamed *outer = streamed_pkgs;
+     int err;
+
+     opkg_profile_begin("install", pkg->name);
+     err = install_pkg(pkg, from_upgrade);
+     while (streamed_pkgs != outer)
+	  stream_pkg_release(err);
+     opkg_profile_end();
+
+     return err;
+}
@@ -24,4 +24,20 @@
 int opkg_install_by_name(const char *pkg_name);
 int opkg_install_pkg(pkg_t *pkg, int from_upgrading);
 
+/*
+ * For offline roots: defer unpacking data files until
+ * opkg_install_bulk_end(), then unpack up to conf->unpack_jobs
+ * packages at once.
+ */
+void opkg_install_bulk_begin(void);
+int opkg_install_bulk_end(void);
+
+/*
+ * Download and verify the packages which installing names is expected to
+ * need, and unpack their control files, up to conf->read_ahead of them
+ * ahead of opkg_install_pkg().
+ */
+void opkg_install_prefetch_begin(char **names, int count);
+void opkg_install_prefetch_end(void);
+
 #endif
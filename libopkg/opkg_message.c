@@ -56,6 +56,8 @@ free_error_list(void)
 		err = err->next;
 		free(err_tmp);
 	}
+
+	error_list_head = error_list_tail = NULL;
 }
 
 void
@@ -78,7 +80,7 @@ opkg_message (message_level_t level, const char *fmt, ...)
 {
 	va_list ap;
 
-	if (conf->verbosity < level)
+	if (!opkg_msg_enabled(level))
 		return;
 
 	if (conf->opkg_vmessage) {
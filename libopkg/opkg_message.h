@@ -33,9 +33,23 @@ void print_error_list(void);
 void opkg_message(message_level_t level, const char *fmt, ...)
 				__attribute__ ((format (printf, 2, 3)));
 
+/* The most verbose level that is compiled in. */
+#ifdef OPKG_DISABLE_DEBUG2
+#define OPKG_MSG_MAX_LEVEL DEBUG
+#else
+#define OPKG_MSG_MAX_LEVEL DEBUG2
+#endif
+
+/* Levels above OPKG_MSG_MAX_LEVEL fold away at compile time, and messages
+   above the verbosity cost a comparison, not a call. */
+#define opkg_msg_enabled(l) \
+	((l) <= OPKG_MSG_MAX_LEVEL && (int)(l) <= conf->verbosity)
+
 #define opkg_msg(l, fmt, args...) \
 	do { \
-		if (l == NOTICE) \
+		if (!opkg_msg_enabled(l)) \
+			break; \
+		if ((l) == NOTICE) \
 			opkg_message(l, fmt, ##args); \
 		else \
 			opkg_message(l, "%s: "fmt, __FUNCTION__, ##args); \
@@ -44,4 +58,6 @@ void opkg_message(message_level_t level, const char *fmt, ...)
 #define opkg_perror(l, fmt, args...) \
 	opkg_msg(l, fmt": %s.\n", ##args, strerror(errno))
 
+#include "opkg_conf.h"
+
 #endif /* _OPKG_MESSAGE_H_ */
@@ -0,0 +1,252 @@
+/* opkg_profile.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "opkg_profile.h"
+#include "opkg_message.h"
+
+#define PROFILE_MAX_DEPTH	32
+#define PROFILE_MAX_SUBJECT	128
+
+struct open_span {
+	opkg_profile_span_t span;
+	char subject[PROFILE_MAX_SUBJECT];
+	struct rusage self, children;
+};
+
+int opkg_profile_active;
+unsigned long long opkg_profile_counters[OPKG_PROFILE_COUNTERS];
+
+static FILE *profile_fp;
+static int profile_events;
+static opkg_profile_callback_t profile_cb;
+static void *profile_cb_data;
+
+static unsigned long long profile_epoch;
+static struct open_span open_spans[PROFILE_MAX_DEPTH];
+static int profile_depth;
+
+static const char *counter_names[OPKG_PROFILE_COUNTERS] = {
+	"bytes",
+	"files",
+	"allocs",
+	"user_us",
+	"system_us",
+	"child_us",
+	"inblock",
+	"oublock",
+	"minflt",
+	"csw",
+};
+
+const char *
+opkg_profile_counter_name(int counter)
+{
+	if (counter < 0 || counter >= OPKG_PROFILE_COUNTERS)
+		return NULL;
+
+	return counter_names[counter];
+}
+
+static unsigned long long
+now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static unsigned long long
+tv_us(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static void
+update_active(void)
+{
+	opkg_profile_active = (profile_fp || profile_cb);
+
+	if (opkg_profile_active && profile_epoch == 0)
+		profile_epoch = now_us();
+}
+
+static void
+write_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+/* A Chrome trace "complete" event. */
+static void
+write_event(const opkg_profile_span_t *span)
+{
+	int i;
+
+	fprintf(profile_fp, "%s\n{\"name\":", profile_events++ ? "," : "");
+	write_json_string(profile_fp, span->name);
+	fprintf(profile_fp, ",\"cat\":\"opkg\",\"ph\":\"X\",\"ts\":%llu,"
+			"\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{",
+			span->start_us, span->duration_us, (int)getpid(),
+			(int)getpid());
+	if (span->subject) {
+		fprintf(profile_fp, "\"subject\":");
+		write_json_string(profile_fp, span->subject);
+		fputc(',', profile_fp);
+	}
+	for (i = 0; i < OPKG_PROFILE_COUNTERS; i++)
+		fprintf(profile_fp, "%s\"%s\":%llu", i ? "," : "",
+				counter_names[i], span->counters[i]);
+	fprintf(profile_fp, "}}");
+
+	/* Nothing may be left buffered for a forked child to flush again. */
+	fflush(profile_fp);
+}
+
+/*
+ * Write a Chrome trace, which chrome://tracing and Perfetto can load, of
+ * every span to file_name.
+ */
+int
+opkg_profile_open(const char *file_name)
+{
+	opkg_profile_close();
+
+	profile_fp = fopen(file_name, "w");
+	if (profile_fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", file_name);
+		return -1;
+	}
+
+	fprintf(profile_fp, "{\"traceEvents\":[");
+	fflush(profile_fp);
+	profile_events = 0;
+	update_active();
+
+	return 0;
+}
+
+/*
+ * Have callback called with every span as it ends, or stop it with NULL.
+ */
+void
+opkg_profile_set_callback(opkg_profile_callback_t callback, void *user_data)
+{
+	profile_cb = callback;
+	profile_cb_data = user_data;
+	update_active();
+}
+
+void
+opkg_profile_close(void)
+{
+	while (profile_depth)
+		opkg_profile_span_end();
+
+	if (profile_fp) {
+		fprintf(profile_fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		if (fclose(profile_fp) == EOF)
+			opkg_perror(ERROR, "Failed to write profile");
+		profile_fp = NULL;
+	}
+
+	update_active();
+}
+
+void
+opkg_profile_span_begin(const char *name, const char *subject)
+{
+	struct open_span *o;
+
+	/* Deeper spans are counted in their parents. */
+	if (profile_depth++ >= PROFILE_MAX_DEPTH)
+		return;
+
+	o = &open_spans[profile_depth - 1];
+	memset(&o->span, 0, sizeof(o->span));
+	o->span.name = name;
+	if (subject) {
+		strncpy(o->subject, subject, sizeof(o->subject) - 1);
+		o->subject[sizeof(o->subject) - 1] = '\0';
+		o->span.subject = o->subject;
+	}
+	o->span.depth = profile_depth - 1;
+	memcpy(o->span.counters, opkg_profile_counters,
+			sizeof(o->span.counters));
+	getrusage(RUSAGE_SELF, &o->self);
+	getrusage(RUSAGE_CHILDREN, &o->children);
+	o->span.start_us = now_us() - profile_epoch;
+}
+
+void
+opkg_profile_span_end(void)
+{
+	opkg_profile_span_t *span;
+	struct rusage self, children;
+	unsigned long long *c;
+	struct open_span *o;
+	int i;
+
+	if (profile_depth == 0)
+		return;
+	if (profile_depth-- > PROFILE_MAX_DEPTH)
+		return;
+
+	o = &open_spans[profile_depth];
+	span = &o->span;
+	c = span->counters;
+
+	span->duration_us = now_us() - profile_epoch - span->start_us;
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	/* Those counted by opkg come first, then those from getrusage(). */
+	for (i = 0; i < OPKG_PROFILE_USER_US; i++)
+		c[i] = opkg_profile_counters[i] - c[i];
+
+	c[OPKG_PROFILE_USER_US] = tv_us(&self.ru_utime)
+		- tv_us(&o->self.ru_utime);
+	c[OPKG_PROFILE_SYSTEM_US] = tv_us(&self.ru_stime)
+		- tv_us(&o->self.ru_stime);
+	c[OPKG_PROFILE_CHILD_US] = tv_us(&children.ru_utime)
+		+ tv_us(&children.ru_stime)
+		- tv_us(&o->children.ru_utime)
+		- tv_us(&o->children.ru_stime);
+	c[OPKG_PROFILE_INBLOCK] = self.ru_inblock - o->self.ru_inblock;
+	c[OPKG_PROFILE_OUBLOCK] = self.ru_oublock - o->self.ru_oublock;
+	c[OPKG_PROFILE_MINFLT] = self.ru_minflt - o->self.ru_minflt;
+	c[OPKG_PROFILE_CSW] = self.ru_nvcsw + self.ru_nivcsw
+		- o->self.ru_nvcsw - o->self.ru_nivcsw;
+
+	if (profile_fp)
+		write_event(span);
+	if (profile_cb)
+		profile_cb(span, profile_cb_data);
+}
@@ -0,0 +1,81 @@
+/* opkg_profile.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_PROFILE_H
+#define OPKG_PROFILE_H
+
+/*
+ * The phases of a run are timed as nested spans, each with the work counted
+ * while it was open. Spans are opened and closed on the main thread only.
+ * Unless a profile has been asked for, the macros below cost a single test.
+ */
+enum opkg_profile_counter {
+	OPKG_PROFILE_BYTES,	/* bytes downloaded, parsed or extracted */
+	OPKG_PROFILE_FILES,	/* files extracted */
+	OPKG_PROFILE_ALLOCS,	/* calls to xmalloc() and friends */
+	OPKG_PROFILE_USER_US,	/* user CPU time */
+	OPKG_PROFILE_SYSTEM_US,	/* system CPU time */
+	OPKG_PROFILE_CHILD_US,	/* CPU time of decompressors and scripts */
+	OPKG_PROFILE_INBLOCK,	/* blocks read from the filesystem */
+	OPKG_PROFILE_OUBLOCK,	/* blocks written to the filesystem */
+	OPKG_PROFILE_MINFLT,	/* page faults */
+	OPKG_PROFILE_CSW,	/* context switches, i.e. blocking syscalls */
+	OPKG_PROFILE_COUNTERS
+};
+
+typedef struct opkg_profile_span opkg_profile_span_t;
+
+struct opkg_profile_span {
+	const char *name;
+	const char *subject;	/* package, feed or file, or NULL */
+	int depth;
+	unsigned long long start_us;	/* since the profile was started */
+	unsigned long long duration_us;
+	unsigned long long counters[OPKG_PROFILE_COUNTERS];
+};
+
+typedef void (*opkg_profile_callback_t)(const opkg_profile_span_t *span,
+		void *user_data);
+
+extern int opkg_profile_active;
+extern unsigned long long opkg_profile_counters[];
+
+const char *opkg_profile_counter_name(int counter);
+
+int opkg_profile_open(const char *file_name);
+void opkg_profile_set_callback(opkg_profile_callback_t callback,
+		void *user_data);
+void opkg_profile_close(void);
+
+void opkg_profile_span_begin(const char *name, const char *subject);
+void opkg_profile_span_end(void);
+
+#define opkg_profile_begin(name, subject) \
+	do { \
+		if (opkg_profile_active) \
+			opkg_profile_span_begin(name, subject); \
+	} while (0)
+
+#define opkg_profile_end() \
+	do { \
+		if (opkg_profile_active) \
+			opkg_profile_span_end(); \
+	} while (0)
+
+#define opkg_profile_count(counter, n) \
+	do { \
+		if (opkg_profile_active) \
+			opkg_profile_counters[counter] += (n); \
+	} while (0)
+
+#endif
@@ -22,6 +22,7 @@
 #include "opkg_message.h"
 #include "opkg_remove.h"
 #include "opkg_cmd.h"
+#include "opkg_trigger.h"
 #include "file_util.h"
 #include "sprintf_alloc.h"
 #include "libbb/libbb.h"
@@ -189,7 +190,7 @@ remove_autoinstalled(pkg_t *pkg)
 			continue;
 		for (j=0; j<cdep->possibility_count; j++) {
 			p = pkg_hash_fetch_installed_by_name(
-					cdep->possibilities[j]->pkg->name);
+					cdep->possibilities[j].pkg->name);
 
 			/* If the package is not installed, this could have
 			 * been a circular dependency and the package has
@@ -314,6 +315,7 @@ opkg_remove_pkg(pkg_t *pkg, int from_upgrade)
 
      err = pkg_run_script(pkg, "postrm", "remove");
 
+     opkg_trigger_activate_pkg(pkg);
      remove_maintainer_scripts(pkg);
      pkg->state_status = SS_NOT_INSTALLED;
 
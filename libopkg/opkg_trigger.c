@@ -0,0 +1,464 @@
+/* opkg_trigger.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "opkg_trigger.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "opkg_profile.h"
+#include "pkg_hash.h"
+#include "hash_table.h"
+#include "file_util.h"
+#include "sprintf_alloc.h"
+#include "xsystem.h"
+#include "libbb/libbb.h"
+
+struct trigger {
+	char *name;
+	char *path;
+	int is_script;		/* an old style intercept */
+	char **args;		/* each distinct line, in the order given */
+	int args_count;
+	pkg_vec_t *interested;
+	pid_t pid;
+	int log_fd;
+	int err;
+};
+
+static int trigger_depth;
+static char *trigger_dir;
+static char *trigger_oldpath;
+
+void
+opkg_trigger_begin(void)
+{
+	const char *path;
+	char *newpath;
+
+	if (trigger_depth++)
+		return;
+
+	sprintf_alloc(&trigger_dir, "%s/opkg-intercept-XXXXXX", conf->tmp_dir);
+	if (mkdtemp(trigger_dir) == NULL) {
+		opkg_perror(ERROR, "Failed to make temp dir %s", trigger_dir);
+		free(trigger_dir);
+		trigger_dir = NULL;
+		return;
+	}
+
+	path = getenv("PATH");
+	trigger_oldpath = xstrdup(path ? path : "/usr/bin:/bin");
+	sprintf_alloc(&newpath, "%s/opkg/intercept:%s", DATADIR,
+			trigger_oldpath);
+
+	setenv("OPKG_INTERCEPT_DIR", trigger_dir, 1);
+	setenv("PATH", newpath, 1);
+	free(newpath);
+}
+
+void
+opkg_trigger_activate(const char *name, const char *args)
+{
+	char *path;
+	FILE *fp;
+
+	if (trigger_dir == NULL)
+		return;
+
+	if (*name == '\0' || *name == '.' || strchr(name, '/')) {
+		opkg_msg(ERROR, "Invalid trigger name %s.\n", name);
+		return;
+	}
+
+	sprintf_alloc(&path, "%s/%s", trigger_dir, name);
+	fp = fopen(path, "a");
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", path);
+		free(path);
+		return;
+	}
+	fprintf(fp, "%s\n", args);
+	fclose(fp);
+	free(path);
+}
+
+/* Call fn with the argument of each line of the triggers file of pkg which
+ * starts with keyword. */
+static void
+pkg_triggers_foreach(pkg_t *pkg, const char *keyword,
+		void (*fn)(const char *arg, void *data), void *data)
+{
+	char *path, *line, *arg;
+	size_t len = strlen(keyword);
+	FILE *fp;
+
+	if (pkg->dest == NULL)
+		return;
+
+	sprintf_alloc(&path, "%s/%s.triggers", pkg->dest->info_dir, pkg->name);
+	fp = fopen(path, "r");
+	free(path);
+	if (fp == NULL)
+		return;
+
+	while ((line = file_read_line_alloc(fp))) {
+		if (strncmp(line, keyword, len) == 0
+				&& (line[len] == ' ' || line[len] == '\t')) {
+			for (arg = line + len; *arg == ' ' || *arg == '\t'; arg++)
+				;
+			if (*arg)
+				fn(arg, data);
+		}
+		free(line);
+	}
+
+	fclose(fp);
+}
+
+static void
+trigger_activate_helper(const char *name, void *data)
+{
+	opkg_trigger_activate(name, "");
+}
+
+/*
+ * Activate each trigger named by an activate line of the triggers file of
+ * pkg, which must still be installed.
+ */
+void
+opkg_trigger_activate_pkg(pkg_t *pkg)
+{
+	pkg_triggers_foreach(pkg, "activate", trigger_activate_helper, NULL);
+}
+
+static void
+trigger_free(struct trigger *t)
+{
+	int i;
+
+	for (i = 0; i < t->args_count; i++)
+		free(t->args[i]);
+	free(t->args);
+	if (t->interested)
+		pkg_vec_free(t->interested);
+	free(t->path);
+	free(t->name);
+	free(t);
+}
+
+/* Read the distinct lines of arguments of t. */
+static void
+trigger_read_args(struct trigger *t)
+{
+	hash_table_t seen;
+	char *line;
+	FILE *fp;
+
+	fp = fopen(t->path, "r");
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", t->path);
+		return;
+	}
+
+	memset(&seen, 0, sizeof(seen));
+	hash_table_init("trigger-args", &seen, 64);
+
+	while ((line = file_read_line_alloc(fp))) {
+		if (hash_table_get(&seen, line)) {
+			free(line);
+			continue;
+		}
+		hash_table_insert(&seen, line, t);
+		t->args = xrealloc(t->args, (t->args_count + 1) * sizeof(char *));
+		t->args[t->args_count++] = line;
+	}
+
+	hash_table_deinit(&seen);
+	fclose(fp);
+}
+
+/*
+ * Returns the path of the command called name in the PATH of scripts, or
+ * in the sbin directories, which the PATH of a user may not have, or NULL.
+ */
+static char *
+trigger_find_command(const char *name)
+{
+	char *dirs, *dir, *save = NULL, *path = NULL;
+
+	sprintf_alloc(&dirs, "%s:/usr/sbin:/sbin", trigger_oldpath);
+	for (dir = strtok_r(dirs, ":", &save); dir;
+			dir = strtok_r(NULL, ":", &save)) {
+		sprintf_alloc(&path, "%s/%s", dir, name);
+		if (access(path, X_OK) == 0 && !file_is_dir(path))
+			break;
+		free(path);
+		path = NULL;
+	}
+	free(dirs);
+
+	return path;
+}
+
+struct trigger_interest {
+	pkg_t *pkg;
+	struct trigger **triggers;
+	int count;
+};
+
+static void
+trigger_interest_helper(const char *name, void *data)
+{
+	struct trigger_interest *ti = data;
+	int i;
+
+	for (i = 0; i < ti->count; i++) {
+		if (strcmp(ti->triggers[i]->name, name))
+			continue;
+		if (ti->triggers[i]->interested == NULL)
+			ti->triggers[i]->interested = pkg_vec_alloc();
+		pkg_vec_insert(ti->triggers[i]->interested, ti->pkg);
+	}
+}
+
+/* Find the installed packages interested in each of triggers. */
+static void
+trigger_find_interested(struct trigger **triggers, int count)
+{
+	struct trigger_interest ti;
+	pkg_vec_t *installed;
+	int i;
+
+	installed = pkg_vec_alloc();
+	pkg_hash_fetch_all_installed(installed);
+
+	ti.triggers = triggers;
+	ti.count = count;
+	for (i = 0; i < installed->len; i++) {
+		ti.pkg = installed->pkgs[i];
+		if (ti.pkg->state_status == SS_INSTALLED)
+			pkg_triggers_foreach(ti.pkg, "interest",
+					trigger_interest_helper, &ti);
+	}
+
+	pkg_vec_free(installed);
+}
+
+/* Run everything t does, in a child with its output going to the log. */
+static int
+trigger_run(struct trigger *t)
+{
+	char *command, *cmd, *args;
+	int i, err = 0;
+
+	if (t->is_script) {
+		const char *argv[] = {"sh", "-c", t->path, NULL};
+		return xsystem(argv) ? -1 : 0;
+	}
+
+	command = t->args_count ? trigger_find_command(t->name) : NULL;
+	for (i = 0; command && i < t->args_count; i++) {
+		const char *argv[] = {"sh", "-c", NULL, NULL};
+
+		sprintf_alloc(&cmd, "%s %s", command, t->args[i]);
+		argv[2] = cmd;
+		if (xsystem(argv)) {
+			opkg_msg(ERROR, "%s failed.\n", cmd);
+			err = -1;
+		}
+		free(cmd);
+	}
+	free(command);
+
+	if (t->interested) {
+		sprintf_alloc(&args, "triggered %s", t->name);
+		for (i = 0; i < t->interested->len; i++)
+			if (pkg_run_script(t->interested->pkgs[i], "postinst",
+						args))
+				err = -1;
+		free(args);
+	}
+
+	return err;
+}
+
+static void
+trigger_start(struct trigger *t)
+{
+	char *log;
+	int err;
+
+	sprintf_alloc(&log, "%s/trigger-XXXXXX", conf->tmp_dir);
+	/* Not to be inherited by the triggers started after this one. */
+	t->log_fd = mkostemp(log, O_CLOEXEC);
+	if (t->log_fd != -1)
+		unlink(log);
+	free(log);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	t->pid = fork();
+	if (t->pid == 0) {
+		if (t->log_fd != -1) {
+			dup2(t->log_fd, STDOUT_FILENO);
+			dup2(t->log_fd, STDERR_FILENO);
+		}
+		/* Only report our own errors. */
+		free_error_list();
+		err = trigger_run(t);
+		print_error_list();
+		fflush(stdout);
+		_exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	if (t->pid == -1) {
+		opkg_perror(INFO, "Failed to fork, running trigger %s in place",
+				t->name);
+		t->err = trigger_run(t);
+	}
+}
+
+static void
+trigger_finish(struct trigger *t)
+{
+	char buf[4096];
+	ssize_t n;
+
+	opkg_msg(INFO, "Ran trigger %s.\n", t->name);
+
+	if (t->log_fd != -1) {
+		fflush(stdout);
+		lseek(t->log_fd, 0, SEEK_SET);
+		while ((n = read(t->log_fd, buf, sizeof(buf))) > 0)
+			fwrite(buf, 1, n, stdout);
+		fflush(stdout);
+		close(t->log_fd);
+	}
+
+	if (t->err)
+		opkg_msg(ERROR, "Trigger %s failed.\n", t->name);
+}
+
+static void
+triggers_run(void)
+{
+	struct trigger **triggers = NULL, *t;
+	struct dirent *de;
+	DIR *dir;
+	int i, count = 0, status;
+
+	dir = opendir(trigger_dir);
+	if (dir == NULL) {
+		opkg_perror(ERROR, "Failed to open dir %s", trigger_dir);
+		return;
+	}
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		t = xcalloc(1, sizeof(struct trigger));
+		t->name = xstrdup(de->d_name);
+		sprintf_alloc(&t->path, "%s/%s", trigger_dir, de->d_name);
+		t->log_fd = -1;
+		t->is_script = access(t->path, X_OK) == 0;
+		if (!t->is_script)
+			trigger_read_args(t);
+
+		triggers = xrealloc(triggers,
+				(count + 1) * sizeof(struct trigger *));
+		triggers[count++] = t;
+	}
+	closedir(dir);
+
+	if (count == 0)
+		return;
+
+	if (conf->noaction
+			|| (conf->offline_root && !conf->force_postinstall)) {
+		for (i = 0; i < count; i++) {
+			opkg_msg(INFO, "Offline root mode: not running trigger "
+					"%s.\n", triggers[i]->name);
+			trigger_free(triggers[i]);
+		}
+		free(triggers);
+		return;
+	}
+
+	trigger_find_interested(triggers, count);
+
+	opkg_profile_begin("triggers", NULL);
+
+	for (i = 0; i < count; i++) {
+		trigger_start(triggers[i]);
+		if (triggers[i]->pid <= 0)
+			trigger_finish(triggers[i]);
+	}
+
+	/* Only our own children are waited for, not those of others, such
+	   as the workers fetching packages ahead. */
+	for (i = 0; i < count; i++) {
+		t = triggers[i];
+		if (t->pid <= 0)
+			continue;
+		while (waitpid(t->pid, &status, 0) == -1) {
+			if (errno != EINTR) {
+				opkg_perror(ERROR, "waitpid failed");
+				status = -1;
+				break;
+			}
+		}
+		t->err = status != -1 && WIFEXITED(status)
+			&& WEXITSTATUS(status) == 0 ? 0 : -1;
+		t->pid = 0;
+		trigger_finish(t);
+	}
+
+	opkg_profile_end();
+
+	for (i = 0; i < count; i++)
+		trigger_free(triggers[i]);
+	free(triggers);
+}
+
+/*
+ * Run the triggers activated since the outermost opkg_trigger_begin().
+ */
+void
+opkg_trigger_end(void)
+{
+	if (--trigger_depth > 0 || trigger_dir == NULL)
+		return;
+
+	setenv("PATH", trigger_oldpath, 1);
+	unsetenv("OPKG_INTERCEPT_DIR");
+
+	triggers_run();
+
+	rm_r(trigger_dir);
+	free(trigger_dir);
+	trigger_dir = NULL;
+	free(trigger_oldpath);
+	trigger_oldpath = NULL;
+}
@@ -0,0 +1,50 @@
+/* opkg_trigger.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_TRIGGER_H
+#define OPKG_TRIGGER_H
+
+#include "pkg.h"
+
+/*
+ * Triggers are actions which maintainer scripts ask for, but which only
+ * need doing once at the end of a transaction, such as ldconfig.
+ *
+ * Between opkg_trigger_begin() and opkg_trigger_end(), the intercept
+ * directory is at the front of the PATH of maintainer scripts, and
+ * $OPKG_INTERCEPT_DIR names a directory in which a trigger is activated
+ * by appending a line of arguments to the file named after it. The
+ * intercepts of ldconfig, depmod and update-modules do so instead of
+ * running them, and any script may do the same for a trigger of its own.
+ * A package also activates each trigger named by an "activate <trigger>"
+ * line of its triggers control file when it is configured or removed.
+ *
+ * At the end, each trigger runs the command of the same name, if there is
+ * one in the PATH, once for each distinct line of arguments, then the
+ * postinst of every installed package whose triggers file has an
+ * "interest <trigger>" line, as "postinst triggered <trigger>". Triggers
+ * are independent of each other and run at the same time. An executable
+ * file in the directory is run as a script, as intercepts used to be.
+ *
+ * A trigger which fails is reported, but does not fail the transaction,
+ * whose packages are installed all the same.
+ *
+ * Calls nest, so a transaction may be made of several which each use
+ * triggers, and they are only run at the end of the outermost one.
+ */
+void opkg_trigger_begin(void);
+void opkg_trigger_end(void);
+void opkg_trigger_activate(const char *name, const char *args);
+void opkg_trigger_activate_pkg(pkg_t *pkg);
+
+#endif
@@ -35,6 +35,8 @@
 #include "file_util.h"
 #include "xsystem.h"
 #include "opkg_conf.h"
+#include "opkg_profile.h"
+#include "file_index.h"
 
 typedef struct enum_map enum_map_t;
 struct enum_map
@@ -82,9 +84,6 @@ pkg_init(pkg_t *pkg)
      pkg->dest = NULL;
      pkg->src = NULL;
      pkg->architecture = NULL;
-     pkg->maintainer = NULL;
-     pkg->section = NULL;
-     pkg->description = NULL;
      pkg->state_want = SW_UNKNOWN;
      pkg->state_flag = SF_OK;
      pkg->state_status = SS_NOT_INSTALLED;
@@ -110,6 +109,7 @@ pkg_init(pkg_t *pkg)
      pkg->provides_count = 0;
      pkg->provides = NULL;
      pkg->filename = NULL;
+     pkg->deltas = NULL;
      pkg->local_filename = NULL;
      pkg->tmp_unpack_dir = NULL;
      pkg->md5sum = NULL;
@@ -118,13 +118,12 @@ pkg_init(pkg_t *pkg)
 #endif
      pkg->size = 0;
      pkg->installed_size = 0;
-     pkg->priority = NULL;
-     pkg->source = NULL;
      conffile_list_init(&pkg->conffiles);
      pkg->installed_files = NULL;
      pkg->installed_files_ref_cnt = 0;
      pkg->essential = 0;
      pkg->provided_by_hand = 0;
+     pkg->cold = NULL;
 }
 
 pkg_t *
@@ -138,25 +137,49 @@ pkg_new(void)
      return pkg;
 }
 
+struct pkg_cold *
+pkg_cold_alloc(pkg_t *pkg)
+{
+     if (pkg->cold == NULL)
+	  pkg->cold = xcalloc(1, sizeof(struct pkg_cold));
+
+     return pkg->cold;
+}
+
 static void
-compound_depend_deinit(compound_depend_t *depends)
+pkg_cold_free(pkg_t *pkg)
 {
-    int i;
-    for (i = 0; i < depends->possibility_count; i++)
-    {
-        depend_t *d;
-        d = depends->possibilities[i];
-        free (d->version);
-        free (d);
-    }
-    free (depends->possibilities);
+	struct pkg_cold *cold = pkg->cold;
+
+	if (cold == NULL)
+		return;
+
+	free(cold->section);
+	free(cold->maintainer);
+	free(cold->description);
+	free(cold->tags);
+	free(cold->priority);
+	free(cold->source);
+	free(cold);
+	pkg->cold = NULL;
+}
+
+static void
+free_strs(char **strs, unsigned int count)
+{
+	unsigned int i;
+
+	if (strs == NULL)
+		return;
+
+	for (i = 0; i < count; i++)
+		free(strs[i]);
+	free(strs);
 }
 
 void
 pkg_deinit(pkg_t *pkg)
 {
-	int i;
-
 	if (pkg->name)
 		free(pkg->name);
 	pkg->name = NULL;
@@ -178,17 +201,7 @@ pkg_deinit(pkg_t *pkg)
 		free(pkg->architecture);
 	pkg->architecture = NULL;
 
-	if (pkg->maintainer)
-		free(pkg->maintainer);
-	pkg->maintainer = NULL;
-
-	if (pkg->section)
-		free(pkg->section);
-	pkg->section = NULL;
-
-	if (pkg->description)
-		free(pkg->description);
-	pkg->description = NULL;
+	pkg_cold_free(pkg);
 
 	pkg->state_want = SW_UNKNOWN;
 	pkg->state_flag = SF_OK;
@@ -200,22 +213,25 @@ pkg_deinit(pkg_t *pkg)
 		free (pkg->replaces);
 	pkg->replaces = NULL;
 
-	if (pkg->depends) {
-		int count = pkg->pre_depends_count
-				+ pkg->depends_count
-				+ pkg->recommends_count
-				+ pkg->suggests_count;
-
-		for (i=0; i<count; i++)
-			compound_depend_deinit (&pkg->depends[i]);
+	/* along with their possibilities */
+	if (pkg->depends)
 		free (pkg->depends);
-	}
 
-	if (pkg->conflicts) {
-		for (i=0; i<pkg->conflicts_count; i++)
-			compound_depend_deinit (&pkg->conflicts[i]);
+	if (pkg->conflicts)
 		free (pkg->conflicts);
-	}
+
+	/* still there if the graph was never built */
+	free_strs(pkg->pre_depends_str, pkg->pre_depends_count);
+	free_strs(pkg->depends_str, pkg->depends_count);
+	free_strs(pkg->recommends_str, pkg->recommends_count);
+	free_strs(pkg->suggests_str, pkg->suggests_count);
+	free_strs(pkg->provides_str, pkg->provides_count);
+	free_strs(pkg->conflicts_str, pkg->conflicts_count);
+	free_strs(pkg->replaces_str, pkg->replaces_count);
+	pkg->pre_depends_str = pkg->depends_str = NULL;
+	pkg->recommends_str = pkg->suggests_str = NULL;
+	pkg->provides_str = pkg->conflicts_str = pkg->replaces_str = NULL;
+	pkg->graph_built = 0;
 
 	if (pkg->provides)
 		free (pkg->provides);
@@ -227,6 +243,9 @@ pkg_deinit(pkg_t *pkg)
 		free(pkg->filename);
 	pkg->filename = NULL;
 
+	free(pkg->deltas);
+	pkg->deltas = NULL;
+
 	if (pkg->local_filename)
 		free(pkg->local_filename);
 	pkg->local_filename = NULL;
@@ -248,14 +267,6 @@ pkg_deinit(pkg_t *pkg)
 	pkg->sha256sum = NULL;
 #endif
 
-	if (pkg->priority)
-		free(pkg->priority);
-	pkg->priority = NULL;
-
-	if (pkg->source)
-		free(pkg->source);
-	pkg->source = NULL;
-
 	conffile_list_deinit(&pkg->conffiles);
 
 	/* XXX: QUESTION: Is forcing this to 1 correct? I suppose so,
@@ -264,10 +275,6 @@ pkg_deinit(pkg_t *pkg)
 	pkg->installed_files_ref_cnt = 1;
 	pkg_free_installed_files(pkg);
 	pkg->essential = 0;
-
-	if (pkg->tags)
-		free (pkg->tags);
-	pkg->tags = NULL;
 }
 
 int
@@ -328,6 +335,46 @@ err0:
 	return err;
 }
 
+static void
+take_strs(char ***old_strs, unsigned int *old_count,
+		char ***new_strs, unsigned int *new_count)
+{
+     free(*old_strs);
+     *old_strs = *new_strs;
+     *old_count = *new_count;
+     *new_strs = NULL;
+     *new_count = 0;
+}
+
+/* As below, for packages whose graphs have not been built yet. */
+static void
+pkg_merge_strs(pkg_t *oldpkg, pkg_t *newpkg)
+{
+     if (!oldpkg->depends_count && !oldpkg->pre_depends_count && !oldpkg->recommends_count && !oldpkg->suggests_count) {
+	  take_strs(&oldpkg->depends_str, &oldpkg->depends_count,
+			  &newpkg->depends_str, &newpkg->depends_count);
+	  take_strs(&oldpkg->pre_depends_str, &oldpkg->pre_depends_count,
+			  &newpkg->pre_depends_str, &newpkg->pre_depends_count);
+	  take_strs(&oldpkg->recommends_str, &oldpkg->recommends_count,
+			  &newpkg->recommends_str, &newpkg->recommends_count);
+	  take_strs(&oldpkg->suggests_str, &oldpkg->suggests_count,
+			  &newpkg->suggests_str, &newpkg->suggests_count);
+     }
+
+     /* Unlike below, the package does not provide itself yet. */
+     if (!oldpkg->provides_count)
+	  take_strs(&oldpkg->provides_str, &oldpkg->provides_count,
+			  &newpkg->provides_str, &newpkg->provides_count);
+
+     if (!oldpkg->conflicts_count)
+	  take_strs(&oldpkg->conflicts_str, &oldpkg->conflicts_count,
+			  &newpkg->conflicts_str, &newpkg->conflicts_count);
+
+     if (!oldpkg->replaces_count)
+	  take_strs(&oldpkg->replaces_str, &oldpkg->replaces_count,
+			  &newpkg->replaces_str, &newpkg->replaces_count);
+}
+
 /* Merge any new information in newpkg into oldpkg */
 int
 pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
@@ -336,6 +383,11 @@ pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
 	  return 0;
      }
 
+     if (oldpkg->graph_built != newpkg->graph_built) {
+	  pkg_build_graph(oldpkg);
+	  pkg_build_graph(newpkg);
+     }
+
      if (!oldpkg->auto_installed)
 	  oldpkg->auto_installed = newpkg->auto_installed;
 
@@ -347,58 +399,72 @@ pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
 	  oldpkg->architecture = xstrdup(newpkg->architecture);
      if (!oldpkg->arch_priority)
 	  oldpkg->arch_priority = newpkg->arch_priority;
-     if (!oldpkg->section)
-	  oldpkg->section = xstrdup(newpkg->section);
-     if(!oldpkg->maintainer)
-	  oldpkg->maintainer = xstrdup(newpkg->maintainer);
-     if(!oldpkg->description)
-	  oldpkg->description = xstrdup(newpkg->description);
+     if (newpkg->cold) {
+	  struct pkg_cold *cold = pkg_cold_alloc(oldpkg);
+
+	  if (!cold->section)
+	       cold->section = xstrdup(newpkg->cold->section);
+	  if (!cold->maintainer)
+	       cold->maintainer = xstrdup(newpkg->cold->maintainer);
+	  if (!cold->description)
+	       cold->description = xstrdup(newpkg->cold->description);
+	  if (!cold->priority)
+	       cold->priority = xstrdup(newpkg->cold->priority);
+	  if (!cold->source)
+	       cold->source = xstrdup(newpkg->cold->source);
+     }
 
-     if (!oldpkg->depends_count && !oldpkg->pre_depends_count && !oldpkg->recommends_count && !oldpkg->suggests_count) {
-	  oldpkg->depends_count = newpkg->depends_count;
-	  newpkg->depends_count = 0;
+     if (!oldpkg->graph_built) {
+	  pkg_merge_strs(oldpkg, newpkg);
+     } else {
+	  if (!oldpkg->depends_count && !oldpkg->pre_depends_count && !oldpkg->recommends_count && !oldpkg->suggests_count) {
+	       oldpkg->depends_count = newpkg->depends_count;
+	       newpkg->depends_count = 0;
 
-	  oldpkg->depends = newpkg->depends;
-	  newpkg->depends = NULL;
+	       oldpkg->depends = newpkg->depends;
+	       newpkg->depends = NULL;
 
-	  oldpkg->pre_depends_count = newpkg->pre_depends_count;
-	  newpkg->pre_depends_count = 0;
+	       oldpkg->pre_depends_count = newpkg->pre_depends_count;
+	       newpkg->pre_depends_count = 0;
 
-	  oldpkg->recommends_count = newpkg->recommends_count;
-	  newpkg->recommends_count = 0;
+	       oldpkg->recommends_count = newpkg->recommends_count;
+	       newpkg->recommends_count = 0;
 
-	  oldpkg->suggests_count = newpkg->suggests_count;
-	  newpkg->suggests_count = 0;
-     }
+	       oldpkg->suggests_count = newpkg->suggests_count;
+	       newpkg->suggests_count = 0;
+	  }
 
-     if (oldpkg->provides_count <= 1) {
-	  oldpkg->provides_count = newpkg->provides_count;
-	  newpkg->provides_count = 0;
+	  if (oldpkg->provides_count <= 1) {
+	       oldpkg->provides_count = newpkg->provides_count;
+	       newpkg->provides_count = 0;
 
-	  if (!oldpkg->provides) {
-		oldpkg->provides = newpkg->provides;
-		newpkg->provides = NULL;
+	       if (!oldpkg->provides) {
+		     oldpkg->provides = newpkg->provides;
+		     newpkg->provides = NULL;
+	       }
 	  }
-     }
 
-     if (!oldpkg->conflicts_count) {
-	  oldpkg->conflicts_count = newpkg->conflicts_count;
-	  newpkg->conflicts_count = 0;
+	  if (!oldpkg->conflicts_count) {
+	       oldpkg->conflicts_count = newpkg->conflicts_count;
+	       newpkg->conflicts_count = 0;
 
-	  oldpkg->conflicts = newpkg->conflicts;
-	  newpkg->conflicts = NULL;
-     }
+	       oldpkg->conflicts = newpkg->conflicts;
+	       newpkg->conflicts = NULL;
+	  }
 
-     if (!oldpkg->replaces_count) {
-	  oldpkg->replaces_count = newpkg->replaces_count;
-	  newpkg->replaces_count = 0;
+	  if (!oldpkg->replaces_count) {
+	       oldpkg->replaces_count = newpkg->replaces_count;
+	       newpkg->replaces_count = 0;
 
-	  oldpkg->replaces = newpkg->replaces;
-	  newpkg->replaces = NULL;
+	       oldpkg->replaces = newpkg->replaces;
+	       newpkg->replaces = NULL;
+	  }
      }
 
      if (!oldpkg->filename)
 	  oldpkg->filename = xstrdup(newpkg->filename);
+     if (!oldpkg->deltas)
+	  oldpkg->deltas = xstrdup(newpkg->deltas);
      if (!oldpkg->local_filename)
 	  oldpkg->local_filename = xstrdup(newpkg->local_filename);
      if (!oldpkg->tmp_unpack_dir)
@@ -413,10 +479,6 @@ pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
 	  oldpkg->size = newpkg->size;
      if (!oldpkg->installed_size)
 	  oldpkg->installed_size = newpkg->installed_size;
-     if (!oldpkg->priority)
-	  oldpkg->priority = xstrdup(newpkg->priority);
-     if (!oldpkg->source)
-	  oldpkg->source = xstrdup(newpkg->source);
 
      if (nv_pair_list_empty(&oldpkg->conffiles)){
 	  list_splice_init(&newpkg->conffiles.head, &oldpkg->conffiles.head);
@@ -607,10 +669,13 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
 {
      int i, j;
      char *str;
-     int depends_count = pkg->pre_depends_count +
-			 pkg->depends_count +
-			 pkg->recommends_count +
-			 pkg->suggests_count;
+     int depends_count;
+
+     pkg_build_graph(pkg);
+     depends_count = pkg->pre_depends_count +
+		     pkg->depends_count +
+		     pkg->recommends_count +
+		     pkg->suggests_count;
 
      if (strlen(field) < PKG_MINIMUM_FIELD_NAME_LEN) {
 	  goto UNKNOWN_FMT_FIELD;
@@ -652,7 +717,7 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
 	       if (pkg->conflicts_count) {
                     fprintf(fp, "Conflicts:");
 		    for(i = 0; i < pkg->conflicts_count; i++) {
-			cdep = pkg->conflicts[i].possibilities[0];
+			cdep = &pkg->conflicts[i].possibilities[0];
                         fprintf(fp, "%s %s", i == 0 ? "" : ",",
 				cdep->pkg->name);
 			if (cdep->version) {
@@ -682,9 +747,13 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
                     }
 		    fprintf(fp, "\n");
 	       }
+	  } else if (strcasecmp(field, "Deltas") == 0) {
+	       if (pkg->deltas) {
+                   fprintf(fp, "Deltas: %s\n", pkg->deltas);
+	       }
 	  } else if (strcasecmp(field, "Description") == 0) {
-	       if (pkg->description) {
-                   fprintf(fp, "Description: %s\n", pkg->description);
+	       if (pkg_cold_get(pkg, description)) {
+                   fprintf(fp, "Description: %s\n", pkg_cold_get(pkg, description));
 	       }
 	  } else {
 	       goto UNKNOWN_FMT_FIELD;
@@ -713,8 +782,8 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
      case 'm':
      case 'M':
 	  if (strcasecmp(field, "Maintainer") == 0) {
-	       if (pkg->maintainer) {
-                   fprintf(fp, "Maintainer: %s\n", pkg->maintainer);
+	       if (pkg_cold_get(pkg, maintainer)) {
+                   fprintf(fp, "Maintainer: %s\n", pkg_cold_get(pkg, maintainer));
 	       }
 	  } else if (strcasecmp(field, "MD5sum") == 0) {
 	       if (pkg->md5sum) {
@@ -729,7 +798,7 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
 	  if (strcasecmp(field, "Package") == 0) {
                fprintf(fp, "Package: %s\n", pkg->name);
 	  } else if (strcasecmp(field, "Priority") == 0) {
-               fprintf(fp, "Priority: %s\n", pkg->priority);
+               fprintf(fp, "Priority: %s\n", pkg_cold_get(pkg, priority));
 	  } else if (strcasecmp(field, "Provides") == 0) {
 	       if (pkg->provides_count) {
                   fprintf(fp, "Provides:");
@@ -774,8 +843,8 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
      case 's':
      case 'S':
 	  if (strcasecmp(field, "Section") == 0) {
-	       if (pkg->section) {
-                   fprintf(fp, "Section: %s\n", pkg->section);
+	       if (pkg_cold_get(pkg, section)) {
+                   fprintf(fp, "Section: %s\n", pkg_cold_get(pkg, section));
 	       }
 #if defined HAVE_SHA256
 	  } else if (strcasecmp(field, "SHA256sum") == 0) {
@@ -788,8 +857,8 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
                    fprintf(fp, "Size: %ld\n", pkg->size);
 	       }
 	  } else if (strcasecmp(field, "Source") == 0) {
-	       if (pkg->source) {
-                   fprintf(fp, "Source: %s\n", pkg->source);
+	       if (pkg_cold_get(pkg, source)) {
+                   fprintf(fp, "Source: %s\n", pkg_cold_get(pkg, source));
                }
 	  } else if (strcasecmp(field, "Status") == 0) {
                char *pflag = pkg_state_flag_to_str(pkg->state_flag);
@@ -818,8 +887,8 @@ pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field)
      case 't':
      case 'T':
 	  if (strcasecmp(field, "Tags") == 0) {
-	       if (pkg->tags) {
-                   fprintf(fp, "Tags: %s\n", pkg->tags);
+	       if (pkg_cold_get(pkg, tags)) {
+                   fprintf(fp, "Tags: %s\n", pkg_cold_get(pkg, tags));
 	       }
 	  }
 	  break;
@@ -862,6 +931,7 @@ pkg_formatted_info(FILE *fp, pkg_t *pkg)
 	pkg_formatted_field(fp, pkg, "MD5sum");
 	pkg_formatted_field(fp, pkg, "Size");
 	pkg_formatted_field(fp, pkg, "Filename");
+	pkg_formatted_field(fp, pkg, "Deltas");
 	pkg_formatted_field(fp, pkg, "Conffiles");
 	pkg_formatted_field(fp, pkg, "Source");
 	pkg_formatted_field(fp, pkg, "Description");
@@ -888,6 +958,11 @@ pkg_print_status(pkg_t * pkg, FILE * file)
      pkg_formatted_field(file, pkg, "Status");
      pkg_formatted_field(file, pkg, "Essential");
      pkg_formatted_field(file, pkg, "Architecture");
+     /* The package the files came from, which a delta may be against. */
+     pkg_formatted_field(file, pkg, "MD5sum");
+#if defined HAVE_SHA256
+     pkg_formatted_field(file, pkg, "SHA256sum");
+#endif
      pkg_formatted_field(file, pkg, "Conffiles");
      pkg_formatted_field(file, pkg, "Installed-Time");
      pkg_formatted_field(file, pkg, "Auto-Installed");
@@ -936,24 +1011,25 @@ verrevcmp(const char *val, const char *ref) {
 }
 
 int
-pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg)
+pkg_compare_version_parts(const pkg_t *pkg, unsigned long epoch,
+		const char *version, const char *revision)
 {
      int r;
 
-     if (pkg->epoch > ref_pkg->epoch) {
+     if (pkg->epoch > epoch) {
 	  return 1;
      }
 
-     if (pkg->epoch < ref_pkg->epoch) {
+     if (pkg->epoch < epoch) {
 	  return -1;
      }
 
-     r = verrevcmp(pkg->version, ref_pkg->version);
+     r = verrevcmp(pkg->version, version);
      if (r) {
 	  return r;
      }
 
-     r = verrevcmp(pkg->revision, ref_pkg->revision);
+     r = verrevcmp(pkg->revision, revision);
      if (r) {
 	  return r;
      }
@@ -961,6 +1037,13 @@ pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg)
      return r;
 }
 
+int
+pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg)
+{
+     return pkg_compare_version_parts(pkg, ref_pkg->epoch, ref_pkg->version,
+		     ref_pkg->revision);
+}
+
 
 int
 pkg_version_satisfied(pkg_t *it, pkg_t *ref, const char *op)
@@ -1061,6 +1144,81 @@ pkg_version_str_alloc(pkg_t *pkg)
 	return version;
 }
 
+/*
+ * Whether version, written as by pkg_version_str_alloc(), is that of pkg.
+ * This is for lookups, so it doesn't allocate.
+ */
+int
+pkg_version_str_matches(pkg_t *pkg, const char *version)
+{
+	const char *v = version;
+	char *end;
+	size_t len;
+
+	if (pkg->epoch) {
+		if (*v < '1' || *v > '9'
+				|| strtoul(v, &end, 10) != pkg->epoch
+				|| *end != ':')
+			return 0;
+		v = end + 1;
+	}
+
+	len = pkg->version ? strlen(pkg->version) : 0;
+	if (strncmp(v, pkg->version ? pkg->version : "", len))
+		return 0;
+	v += len;
+
+	if (pkg->revision)
+		return *v == '-' && !strcmp(v + 1, pkg->revision);
+
+	return *v == '\0';
+}
+
+/* Append the files named in list_file to pkg->installed_files. */
+static void
+read_installed_files(pkg_t *pkg, FILE *list_file, int list_from_package)
+{
+     char *line;
+     char *installed_file_name;
+     unsigned int rootdirlen = 0;
+
+     if (conf->offline_root)
+          rootdirlen = strlen(conf->offline_root);
+
+     while (1) {
+	  char *file_name;
+
+	  line = file_read_line_alloc(list_file);
+	  if (line == NULL) {
+	       break;
+	  }
+	  file_name = line;
+
+	  if (list_from_package) {
+	       if (*file_name == '.') {
+		    file_name++;
+	       }
+	       if (*file_name == '/') {
+		    file_name++;
+	       }
+	       sprintf_alloc(&installed_file_name, "%s%s",
+			       pkg->dest->root_dir, file_name);
+	  } else {
+	       if (conf->offline_root &&
+	               strncmp(conf->offline_root, file_name, rootdirlen)) {
+	            sprintf_alloc(&installed_file_name, "%s%s",
+				    conf->offline_root, file_name);
+	       } else {
+	            // already contains root_dir as header -> ABSOLUTE
+	            sprintf_alloc(&installed_file_name, "%s", file_name);
+	       }
+	  }
+	  str_list_append(pkg->installed_files, installed_file_name);
+          free(installed_file_name);
+	  free(line);
+     }
+}
+
 /*
  * XXX: this should be broken into two functions
  */
@@ -1070,9 +1228,6 @@ pkg_get_installed_files(pkg_t *pkg)
      int err, fd;
      char *list_file_name = NULL;
      FILE *list_file = NULL;
-     char *line;
-     char *installed_file_name;
-     unsigned int rootdirlen = 0;
      int list_from_package;
 
      pkg->installed_files_ref_cnt++;
@@ -1143,41 +1298,7 @@ pkg_get_installed_files(pkg_t *pkg)
 	  free(list_file_name);
      }
 
-     if (conf->offline_root)
-          rootdirlen = strlen(conf->offline_root);
-
-     while (1) {
-	  char *file_name;
-
-	  line = file_read_line_alloc(list_file);
-	  if (line == NULL) {
-	       break;
-	  }
-	  file_name = line;
-
-	  if (list_from_package) {
-	       if (*file_name == '.') {
-		    file_name++;
-	       }
-	       if (*file_name == '/') {
-		    file_name++;
-	       }
-	       sprintf_alloc(&installed_file_name, "%s%s",
-			       pkg->dest->root_dir, file_name);
-	  } else {
-	       if (conf->offline_root &&
-	               strncmp(conf->offline_root, file_name, rootdirlen)) {
-	            sprintf_alloc(&installed_file_name, "%s%s",
-				    conf->offline_root, file_name);
-	       } else {
-	            // already contains root_dir as header -> ABSOLUTE
-	            sprintf_alloc(&installed_file_name, "%s", file_name);
-	       }
-	  }
-	  str_list_append(pkg->installed_files, installed_file_name);
-          free(installed_file_name);
-	  free(line);
-     }
+     read_installed_files(pkg, list_file, list_from_package);
 
      fclose(list_file);
 
@@ -1189,6 +1310,26 @@ pkg_get_installed_files(pkg_t *pkg)
      return pkg->installed_files;
 }
 
+/*
+ * Like pkg_get_installed_files() for a package which is not installed, but
+ * taking its files from list_file, a list of its data files such as
+ * pkg_extract_data_file_names_to_stream() writes, instead of the package.
+ */
+str_list_t *
+pkg_get_installed_files_from_list(pkg_t *pkg, FILE *list_file)
+{
+     pkg->installed_files_ref_cnt++;
+
+     if (pkg->installed_files) {
+	  return pkg->installed_files;
+     }
+
+     pkg->installed_files = str_list_alloc();
+     read_installed_files(pkg, list_file, 1);
+
+     return pkg->installed_files;
+}
+
 /* XXX: CLEANUP: This function and it's counterpart,
    (pkg_get_installed_files), do not match our init/deinit naming
    convention. Nor the alloc/free convention. But, then again, neither
@@ -1244,22 +1385,28 @@ pkg_get_conffile(pkg_t *pkg, const char *file_name)
      return NULL;
 }
 
-int
-pkg_run_script(pkg_t *pkg, const char *script, const char *args)
+/*
+ * Returns the command which runs script of pkg with args, or NULL, with
+ * *err set to the result, if there is nothing to run.
+ */
+static char *
+pkg_script_cmd_alloc(pkg_t *pkg, const char *script, const char *args,
+		int *err)
 {
-     int err;
      char *path;
      char *cmd;
 
+     *err = 0;
+
      if (conf->noaction)
-	     return 0;
+	     return NULL;
 
      /* XXX: FEATURE: When conf->offline_root is set, we should run the
 	maintainer script within a chroot environment. */
      if (conf->offline_root && !conf->force_postinstall) {
           opkg_msg(INFO, "Offline root mode: not running %s.%s.\n",
 			  pkg->name, script);
-	  return 0;
+	  return NULL;
      }
 
      /* Installed packages have scripts in pkg->dest->info_dir, uninstalled packages
@@ -1268,14 +1415,16 @@ pkg_run_script(pkg_t *pkg, const char *script, const char *args)
 	  if (pkg->dest == NULL) {
 	       opkg_msg(ERROR, "Internal error: %s has a NULL dest.\n",
 		       pkg->name);
-	       return -1;
+	       *err = -1;
+	       return NULL;
 	  }
 	  sprintf_alloc(&path, "%s/%s.%s", pkg->dest->info_dir, pkg->name, script);
      } else {
 	  if (pkg->tmp_unpack_dir == NULL) {
 	       opkg_msg(ERROR, "Internal error: %s has a NULL tmp_unpack_dir.\n",
 		       pkg->name);
-	       return -1;
+	       *err = -1;
+	       return NULL;
 	  }
 	  sprintf_alloc(&path, "%s/%s", pkg->tmp_unpack_dir, script);
      }
@@ -1287,17 +1436,73 @@ pkg_run_script(pkg_t *pkg, const char *script, const char *args)
 
      if (! file_exists(path)) {
 	  free(path);
-	  return 0;
+	  return NULL;
      }
 
      sprintf_alloc(&cmd, "%s %s", path, args);
      free(path);
+
+     return cmd;
+}
+
+int
+pkg_run_script(pkg_t *pkg, const char *script, const char *args)
+{
+     int err;
+     char *cmd;
+
+     cmd = pkg_script_cmd_alloc(pkg, script, args, &err);
+     if (cmd == NULL)
+	  return err;
+
      {
 	  const char *argv[] = {"sh", "-c", cmd, NULL};
+	  opkg_profile_begin(script, pkg->name);
 	  err = xsystem(argv);
+	  opkg_profile_end();
      }
      free(cmd);
 
+     return pkg_finish_script(pkg, script, err);
+}
+
+/*
+ * Start script of pkg with args, as pkg_run_script() would run it, with its
+ * output going to out_fd. Returns the pid of the script, or 0, with *err
+ * set to what pkg_run_script() would have returned, if none was started.
+ */
+pid_t
+pkg_start_script(pkg_t *pkg, const char *script, const char *args,
+		int out_fd, int *err)
+{
+     char *cmd;
+     pid_t pid;
+
+     cmd = pkg_script_cmd_alloc(pkg, script, args, err);
+     if (cmd == NULL)
+	  return 0;
+
+     {
+	  const char *argv[] = {"sh", "-c", cmd, NULL};
+	  pid = xsystem_start(argv, out_fd);
+     }
+     free(cmd);
+
+     if (pid == -1) {
+	  *err = -1;
+	  return 0;
+     }
+
+     return pid;
+}
+
+/*
+ * Report the result of running script of pkg, err being what xsystem()
+ * returned for it, and return it as pkg_run_script() does.
+ */
+int
+pkg_finish_script(pkg_t *pkg, const char *script, int err)
+{
      if (err) {
 	  opkg_msg(ERROR, "package \"%s\" %s script returned status %d.\n", 
                pkg->name, script, err);
@@ -1333,10 +1538,21 @@ void
 pkg_info_preinstall_check(void)
 {
      int i;
-     pkg_vec_t *installed_pkgs = pkg_vec_alloc();
+     pkg_vec_t *installed_pkgs;
 
      /* update the file owner data structure */
      opkg_msg(INFO, "Updating file owner list.\n");
+     opkg_profile_begin("preinstall check", NULL);
+
+     /* Kept up to date since, or the same as reading every .list file if
+      * the indexes are current. */
+     if (conf->file_hash_complete || file_index_load_owners() == 0) {
+	  conf->file_hash_complete = 1;
+	  opkg_profile_end();
+	  return;
+     }
+
+     installed_pkgs = pkg_vec_alloc();
      pkg_hash_fetch_all_installed(installed_pkgs);
      for (i = 0; i < installed_pkgs->len; i++) {
 	  pkg_t *pkg = installed_pkgs->pkgs[i];
@@ -1355,7 +1571,10 @@ pkg_info_preinstall_check(void)
 	  }
 	  pkg_free_installed_files(pkg);
      }
+     if (i == installed_pkgs->len)
+	  conf->file_hash_complete = 1;
      pkg_vec_free(installed_pkgs);
+     opkg_profile_end();
 }
 
 struct pkg_write_filelist_data {
@@ -1373,10 +1592,10 @@ pkg_write_filelist_helper(const char *key, void *entry_, void *data_)
      }
 }
 
-int
-pkg_write_filelist(pkg_t *pkg)
+static FILE *
+pkg_open_filelist(pkg_t *pkg)
 {
-	struct pkg_write_filelist_data data;
+	FILE *stream;
 	char *list_file_name;
 
 	sprintf_alloc(&list_file_name, "%s/%s.list",
@@ -1385,29 +1604,76 @@ pkg_write_filelist(pkg_t *pkg)
 	opkg_msg(INFO, "Creating %s file for pkg %s.\n",
 			list_file_name, pkg->name);
 
-	data.stream = fopen(list_file_name, "w");
-	if (!data.stream) {
+	stream = fopen(list_file_name, "w");
+	if (!stream)
 		opkg_perror(ERROR, "Failed to open %s",
 			list_file_name);
-		free(list_file_name);
+
+	free(list_file_name);
+
+	return stream;
+}
+
+int
+pkg_write_filelist(pkg_t *pkg)
+{
+	struct pkg_write_filelist_data data;
+
+	data.stream = pkg_open_filelist(pkg);
+	if (!data.stream)
 		return -1;
-	}
 
 	data.pkg = pkg;
 	hash_table_foreach(&conf->file_hash, pkg_write_filelist_helper, &data);
 	fclose(data.stream);
-	free(list_file_name);
 
 	pkg->state_flag &= ~SF_FILELIST_CHANGED;
 
 	return 0;
 }
 
+/*
+ * The files of a package whose filelist is to be written, gathered in
+ * a single walk of the file hash.
+ */
+struct pkg_filelist {
+	pkg_t *pkg;
+	const char **files;
+	int len, size;
+	struct pkg_filelist *next;	/* another package of the same name */
+};
+
+static void
+pkg_gather_filelists_helper(const char *key, void *entry_, void *data_)
+{
+	hash_table_t *lists = data_;
+	pkg_t *entry = entry_;
+	struct pkg_filelist *fl;
+
+	if (!(entry->state_flag & SF_FILELIST_CHANGED))
+		return;
+
+	for (fl = hash_table_get(lists, entry->name); fl; fl = fl->next)
+		if (fl->pkg == entry)
+			break;
+	if (fl == NULL)
+		return;
+
+	if (fl->len == fl->size) {
+		fl->size = fl->size ? 2 * fl->size : 64;
+		fl->files = xrealloc(fl->files, fl->size * sizeof(char *));
+	}
+	fl->files[fl->len++] = key;
+}
+
 int
 pkg_write_changed_filelists(void)
 {
 	pkg_vec_t *installed_pkgs = pkg_vec_alloc();
-	int i, err, ret = 0;
+	struct pkg_filelist **filelists;
+	hash_table_t lists;
+	FILE *stream;
+	int i, j, count = 0, ret = 0;
 
 	if (conf->noaction)
 		return 0;
@@ -1415,15 +1681,49 @@ pkg_write_changed_filelists(void)
 	opkg_msg(INFO, "Saving changed filelists.\n");
 
 	pkg_hash_fetch_all_installed(installed_pkgs);
+	filelists = xcalloc(installed_pkgs->len + 1,
+			sizeof(struct pkg_filelist *));
+	lists.entries = NULL;
+	hash_table_init("filelists", &lists, installed_pkgs->len + 1);
+
 	for (i = 0; i < installed_pkgs->len; i++) {
 		pkg_t *pkg = installed_pkgs->pkgs[i];
-		if (pkg->state_flag & SF_FILELIST_CHANGED) {
-			err = pkg_write_filelist(pkg);
-			if (err)
-				ret = -1;
+		struct pkg_filelist *fl;
+
+		if (!(pkg->state_flag & SF_FILELIST_CHANGED))
+			continue;
+
+		fl = xcalloc(1, sizeof(struct pkg_filelist));
+		fl->pkg = pkg;
+		fl->next = hash_table_get(&lists, pkg->name);
+		hash_table_insert(&lists, pkg->name, fl);
+		filelists[count++] = fl;
+	}
+
+	/* Rather than walking the file hash once for each package. */
+	if (count)
+		hash_table_foreach(&conf->file_hash,
+				pkg_gather_filelists_helper, &lists);
+
+	for (i = 0; i < count; i++) {
+		struct pkg_filelist *fl = filelists[i];
+
+		stream = pkg_open_filelist(fl->pkg);
+		if (stream) {
+			for (j = 0; j < fl->len; j++)
+				fprintf(stream, "%s\n", fl->files[j]);
+			fclose(stream);
+			fl->pkg->state_flag &= ~SF_FILELIST_CHANGED;
+		} else {
+			ret = -1;
 		}
+
+		free(fl->files);
+		free(fl);
 	}
 
+	hash_table_deinit(&lists);
+	free(filelists);
 	pkg_vec_free (installed_pkgs);
 
 	return ret;
@@ -115,48 +115,72 @@ struct abstract_pkg{
    storage and use less memory. We might even do reference counting,
    but probably not since most often we only create new pkg_t structs,
    we don't often free them.  */
+/* Fields which are only read to show or write out a package. Most packages
+   in a feed are never shown, so these are kept out of the way of the ones
+   read while solving, and only allocated once one of them is set. */
+struct pkg_cold
+{
+     char *section;
+     char *maintainer;
+     char *description;
+     char *tags;
+     char *priority;
+     char *source;
+};
+
 struct pkg
 {
+     /* Hot: read for every candidate while loading feeds and solving. */
      char *name;
-     unsigned long epoch;
      char *version;
      char *revision;
-     pkg_src_t *src;
-     pkg_dest_t *dest;
+     unsigned long epoch;
+     abstract_pkg_t *parent;
      char *architecture;
-     char *section;
-     char *maintainer;
-     char *description;
-     char *tags;
-     pkg_state_want_t state_want;
-     pkg_state_flag_t state_flag;
-     pkg_state_status_t state_status;
-     char **depends_str;
+     int arch_priority;
+     pkg_state_want_t state_want:4;
+     pkg_state_status_t state_status:4;
+     pkg_state_flag_t state_flag:16;
+     unsigned int essential:1;
+/* Adding this flag, to "force" opkg to choose a "provided_by_hand" package, if there are multiple choice */
+     unsigned int provided_by_hand:1;
+     /* local_filename is known to match md5sum and sha256sum */
+     unsigned int digest_verified:1;
+     /* this flag specifies whether the package was installed to satisfy another
+      * package's dependancies */
+     unsigned int auto_installed:1;
+     /* depends, provides, conflicts and replaces are built from the
+      * *_str arrays, see pkg_build_graph() */
+     unsigned int graph_built:1;
+
      unsigned int depends_count;
-     char **pre_depends_str;
      unsigned int pre_depends_count;
-     char **recommends_str;
      unsigned int recommends_count;
-     char **suggests_str;
      unsigned int suggests_count;
-     struct active_list list; /* Used for installing|upgrading */
-     compound_depend_t * depends;
-
-     char **conflicts_str;
-     compound_depend_t * conflicts;
      unsigned int conflicts_count;
-
-     char **replaces_str;
      unsigned int replaces_count;
-     abstract_pkg_t ** replaces;
-
-     char **provides_str;
      unsigned int provides_count;
+     compound_depend_t * depends;
+     compound_depend_t * conflicts;
+     abstract_pkg_t ** replaces;
      abstract_pkg_t ** provides;
+     pkg_src_t *src;
+     pkg_dest_t *dest;
 
-     abstract_pkg_t *parent;
+     /* Warm: read when the package is installed, removed or written out. */
+     struct active_list list; /* Used for installing|upgrading */
+     char **depends_str;
+     char **pre_depends_str;
+     char **recommends_str;
+     char **suggests_str;
+     char **conflicts_str;
+     char **replaces_str;
+     char **provides_str;
 
      char *filename;
+     /* "<version> <file name>, ...": deltas to this package from other
+	versions, see opkg_delta.h */
+     char *deltas;
      char *local_filename;
      char *tmp_unpack_dir;
      char *md5sum;
@@ -165,8 +189,6 @@ struct pkg
 #endif
      unsigned long size;		/* in bytes */
      unsigned long installed_size;	/* in bytes */
-     char *priority;
-     char *source;
      conffile_list_t conffiles;
      time_t installed_time;
      /* As pointer for lazy evaluation */
@@ -176,17 +198,16 @@ struct pkg
 	installed_files list was being freed from an inner loop while
 	still being used within an outer loop. */
      int installed_files_ref_cnt;
-     int essential;
-     int arch_priority;
-/* Adding this flag, to "force" opkg to choose a "provided_by_hand" package, if there are multiple choice */
-     int provided_by_hand;
 
-     /* this flag specifies whether the package was installed to satisfy another
-      * package's dependancies */
-     int auto_installed;
+     /* Cold: NULL until one of its fields is set, see pkg_cold_alloc(). */
+     struct pkg_cold *cold;
 };
 
+/* A cold field of pkg, or NULL if it was never set. */
+#define pkg_cold_get(pkg, field) ((pkg)->cold ? (pkg)->cold->field : NULL)
+
 pkg_t *pkg_new(void);
+struct pkg_cold *pkg_cold_alloc(pkg_t *pkg);
 void pkg_deinit(pkg_t *pkg);
 int pkg_init_from_file(pkg_t *pkg, const char *filename);
 abstract_pkg_t *abstract_pkg_new(void);
@@ -198,8 +219,11 @@ abstract_pkg_t *abstract_pkg_new(void);
 int pkg_merge(pkg_t *oldpkg, pkg_t *newpkg);
 
 char *pkg_version_str_alloc(pkg_t *pkg);
+int pkg_version_str_matches(pkg_t *pkg, const char *version);
 
 int pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg);
+int pkg_compare_version_parts(const pkg_t *pkg, unsigned long epoch,
+		const char *version, const char *revision);
 int pkg_name_version_and_architecture_compare(const void *a, const void *b);
 int abstract_pkg_name_compare(const void *a, const void *b);
 
@@ -210,10 +234,14 @@ void set_flags_from_control(pkg_t *pkg);
 
 void pkg_print_status(pkg_t * pkg, FILE * file);
 str_list_t *pkg_get_installed_files(pkg_t *pkg);
+str_list_t *pkg_get_installed_files_from_list(pkg_t *pkg, FILE *list_file);
 void pkg_free_installed_files(pkg_t *pkg);
 void pkg_remove_installed_files_list(pkg_t *pkg);
 conffile_t *pkg_get_conffile(pkg_t *pkg, const char *file_name);
 int pkg_run_script(pkg_t *pkg, const char *script, const char *args);
+pid_t pkg_start_script(pkg_t *pkg, const char *script, const char *args,
+		int out_fd, int *err);
+int pkg_finish_script(pkg_t *pkg, const char *script, int err);
 
 /* enum mappings */
 pkg_state_want_t pkg_state_want_from_str(char *str);
@@ -26,8 +26,13 @@
 #include "hash_table.h"
 #include "libbb/libbb.h"
 
-static int parseDepends(compound_depend_t *compound_depend, char * depend_str);
-static depend_t * depend_init(void);
+struct depend_pool {
+     depend_t *next;
+     char *chars;
+};
+
+static int parseDepends(compound_depend_t *compound_depend, char * depend_str,
+		struct depend_pool *pool);
 static char ** add_unresolved_dep(pkg_t * pkg, char ** the_lost, int ref_ndx);
 static char ** merge_unresolved(char ** oldstuff, char ** newstuff);
 static int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg);
@@ -89,7 +94,7 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
      /* foreach dependency */
      for (i = 0; i < count; i++) {
 	  compound_depend_t * compound_depend = &pkg->depends[i];
-	  depend_t ** possible_satisfiers = compound_depend->possibilities;;
+	  depend_t * possible_satisfiers = compound_depend->possibilities;
 	  found = 0;
 	  satisfier_entry_pkg = NULL;
 
@@ -97,7 +102,7 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 	       /* foreach possible satisfier */
 	       for (j = 0; j < compound_depend->possibility_count; j++) {
 		    /* foreach provided_by, which includes the abstract_pkg itself */
-		    abstract_pkg_t *abpkg = possible_satisfiers[j]->pkg;
+		    abstract_pkg_t *abpkg = possible_satisfiers[j].pkg;
 		    abstract_pkg_vec_t *ab_provider_vec = abpkg->provided_by;
 		    int nposs = ab_provider_vec->len;
 		    abstract_pkg_t **ab_providers = ab_provider_vec->pkgs;
@@ -165,8 +170,8 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 	  /* foreach possible satisfier, look for installed package  */
 	  for (j = 0; j < compound_depend->possibility_count; j++) {
 	       /* foreach provided_by, which includes the abstract_pkg itself */
-	       depend_t *dependence_to_satisfy = possible_satisfiers[j];
-	       abstract_pkg_t *satisfying_apkg = possible_satisfiers[j]->pkg;
+	       depend_t *dependence_to_satisfy = &possible_satisfiers[j];
+	       abstract_pkg_t *satisfying_apkg = possible_satisfiers[j].pkg;
 	       pkg_t *satisfying_pkg =
 		    pkg_hash_fetch_best_installation_candidate(satisfying_apkg,
 							       pkg_installed_and_constraint_satisfied,
@@ -189,8 +194,8 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 	       /* foreach possible satisfier, look for installed package  */
 	       for (j = 0; j < compound_depend->possibility_count; j++) {
 		    /* foreach provided_by, which includes the abstract_pkg itself */
-		    depend_t *dependence_to_satisfy = possible_satisfiers[j];
-		    abstract_pkg_t *satisfying_apkg = possible_satisfiers[j]->pkg;
+		    depend_t *dependence_to_satisfy = &possible_satisfiers[j];
+		    abstract_pkg_t *satisfying_apkg = possible_satisfiers[j].pkg;
 		    pkg_t *satisfying_pkg =
 			 pkg_hash_fetch_best_installation_candidate(satisfying_apkg,
 								    pkg_constraint_satisfied,
@@ -230,7 +235,7 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 			 opkg_msg(NOTICE,
 				"%s: unsatisfied recommendation for %s\n",
 				pkg->name,
-				compound_depend->possibilities[0]->pkg->name);
+				compound_depend->possibilities[0].pkg->name);
 	       }
 	       else {
 		    if (compound_depend->type == SUGGEST) {
@@ -292,7 +297,7 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
 {
     pkg_vec_t * installed_conflicts, * test_vec;
     compound_depend_t * conflicts;
-    depend_t ** possible_satisfiers;
+    depend_t * possible_satisfiers;
     depend_t * possible_satisfier;
     int i, j, k;
     int count;
@@ -326,9 +331,7 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
 
 	/* foreach possible satisfier */
 	for(j = 0; j < conflicts->possibility_count; j++){
-            possible_satisfier = possible_satisfiers[j];
-            if (!possible_satisfier)
-                opkg_msg(ERROR, "Internal error: possible_satisfier=NULL\n");
+            possible_satisfier = &possible_satisfiers[j];
             if (!possible_satisfier->pkg)
                 opkg_msg(ERROR, "Internal error: possible_satisfier->pkg=NULL\n");
 	    test_vec = possible_satisfier->pkg->pkgs;
@@ -362,20 +365,13 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
 
 int version_constraints_satisfied(depend_t * depends, pkg_t * pkg)
 {
-    pkg_t * temp;
     int comparison;
 
     if(depends->constraint == NONE)
 	return 1;
 
-    temp = pkg_new();
-
-    parse_version(temp, depends->version);
-
-    comparison = pkg_compare_versions(pkg, temp);
-
-    free (temp->version);
-    free(temp);
+    comparison = pkg_compare_version_parts(pkg, depends->epoch,
+		    depends->upstream, depends->revision);
 
     if((depends->constraint == EARLIER) &&
        (comparison < 0))
@@ -494,9 +490,9 @@ int pkg_conflicts_abstract(pkg_t *pkg, abstract_pkg_t *conflictee)
      int i, j;
      for (i = 0; i < conflicts_count; i++) {
 	  int possibility_count = conflicts[i].possibility_count;
-	  struct depend **possibilities = conflicts[i].possibilities;
+	  struct depend *possibilities = conflicts[i].possibilities;
 	  for (j = 0; j < possibility_count; j++) {
-	       if (possibilities[j]->pkg == conflictee) {
+	       if (possibilities[j].pkg == conflictee) {
 		    return 1;
 	       }
 	  }
@@ -516,14 +512,14 @@ int pkg_conflicts(pkg_t *pkg, pkg_t *conflictee)
      int conflictee_provides_count = conflictee->provides_count;
      int i, j, k;
      int possibility_count;
-     struct depend **possibilities;
+     struct depend *possibilities;
      abstract_pkg_t *possibility ;
 
      for (i = 0; i < conflicts_count; i++) {
 	  possibility_count = conflicts[i].possibility_count;
 	  possibilities = conflicts[i].possibilities;
 	  for (j = 0; j < possibility_count; j++) {
-	       possibility = possibilities[j]->pkg;
+	       possibility = possibilities[j].pkg;
 	       for (k = 0; k < conflictee_provides_count; k++) {
 		    if (possibility == conflictee_provides[k]) {
 			 return 1;
@@ -597,25 +593,71 @@ void buildProvides(abstract_pkg_t * ab_pkg, pkg_t * pkg)
     }
     if (pkg->provides_str)
 	free(pkg->provides_str);
+    pkg->provides_str = NULL;
+}
+
+/*
+ * Add up the possibilities in each of the count dependency strings in strs,
+ * and the most bytes that their version strings can take.
+ */
+static void
+measure_depends(char **strs, unsigned int count, unsigned int *possibilities,
+		size_t *bytes)
+{
+     unsigned int i, n;
+     const char *s;
+
+     for (i = 0; i < count; i++) {
+	  n = 1;
+	  for (s = strs[i]; *s; s++)
+	       if (*s == '|')
+		    n++;
+	  *possibilities += n;
+
+	  /* Each version is kept both as written and split. */
+	  if (strchr(strs[i], '('))
+	       *bytes += 2 * (s - strs[i] + n);
+     }
+}
+
+static compound_depend_t *
+depends_alloc(unsigned int count, unsigned int possibilities, size_t bytes,
+		struct depend_pool *pool)
+{
+     compound_depend_t *depends;
+
+     depends = xcalloc(1, count * sizeof(compound_depend_t)
+		     + possibilities * sizeof(depend_t) + bytes);
+     pool->next = (depend_t *)(depends + count);
+     pool->chars = (char *)(pool->next + possibilities);
+
+     return depends;
 }
 
 void buildConflicts(pkg_t * pkg)
 {
     int i;
     compound_depend_t * conflicts;
+    struct depend_pool pool;
+    unsigned int possibilities = 0;
+    size_t bytes = 0;
 
     if (!pkg->conflicts_count)
 	return;
 
-    conflicts = pkg->conflicts = xcalloc(pkg->conflicts_count, sizeof(compound_depend_t));
+    measure_depends(pkg->conflicts_str, pkg->conflicts_count,
+		    &possibilities, &bytes);
+    conflicts = pkg->conflicts = depends_alloc(pkg->conflicts_count,
+		    possibilities, bytes, &pool);
     for (i = 0; i < pkg->conflicts_count; i++) {
+	 parseDepends(conflicts, pkg->conflicts_str[i], &pool);
 	 conflicts->type = CONFLICTS;
-	 parseDepends(conflicts, pkg->conflicts_str[i]);
 	 free(pkg->conflicts_str[i]);
 	 conflicts++;
     }
     if (pkg->conflicts_str)
 	free(pkg->conflicts_str);
+    pkg->conflicts_str = NULL;
 }
 
 void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
@@ -644,6 +686,7 @@ void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
 
      if (pkg->replaces_str)
 	     free(pkg->replaces_str);
+     pkg->replaces_str = NULL;
 }
 
 void buildDepends(pkg_t * pkg)
@@ -651,46 +694,89 @@ void buildDepends(pkg_t * pkg)
      unsigned int count;
      int i;
      compound_depend_t * depends;
+     struct depend_pool pool;
+     unsigned int possibilities = 0;
+     size_t bytes = 0;
 
      if(!(count = pkg->pre_depends_count + pkg->depends_count + pkg->recommends_count + pkg->suggests_count))
 	  return;
 
-     depends = pkg->depends = xcalloc(count, sizeof(compound_depend_t));
+     measure_depends(pkg->pre_depends_str, pkg->pre_depends_count,
+		     &possibilities, &bytes);
+     measure_depends(pkg->depends_str, pkg->depends_count,
+		     &possibilities, &bytes);
+     measure_depends(pkg->recommends_str, pkg->recommends_count,
+		     &possibilities, &bytes);
+     measure_depends(pkg->suggests_str, pkg->suggests_count,
+		     &possibilities, &bytes);
+     depends = pkg->depends = depends_alloc(count, possibilities, bytes,
+		     &pool);
 
      for(i = 0; i < pkg->pre_depends_count; i++){
-	  parseDepends(depends, pkg->pre_depends_str[i]);
+	  parseDepends(depends, pkg->pre_depends_str[i], &pool);
 	  free(pkg->pre_depends_str[i]);
 	  depends->type = PREDEPEND;
 	  depends++;
      }
      if (pkg->pre_depends_str)
 	     free(pkg->pre_depends_str);
+     pkg->pre_depends_str = NULL;
 
      for(i = 0; i < pkg->depends_count; i++){
-	  parseDepends(depends, pkg->depends_str[i]);
+	  parseDepends(depends, pkg->depends_str[i], &pool);
 	  free(pkg->depends_str[i]);
 	  depends++;
      }
      if (pkg->depends_str)
 	     free(pkg->depends_str);
+     pkg->depends_str = NULL;
 
      for(i = 0; i < pkg->recommends_count; i++){
-	  parseDepends(depends, pkg->recommends_str[i]);
+	  parseDepends(depends, pkg->recommends_str[i], &pool);
 	  free(pkg->recommends_str[i]);
 	  depends->type = RECOMMEND;
 	  depends++;
      }
      if(pkg->recommends_str)
 	  free(pkg->recommends_str);
+     pkg->recommends_str = NULL;
 
      for(i = 0; i < pkg->suggests_count; i++){
-	  parseDepends(depends, pkg->suggests_str[i]);
+	  parseDepends(depends, pkg->suggests_str[i], &pool);
 	  free(pkg->suggests_str[i]);
 	  depends->type = SUGGEST;
 	  depends++;
      }
      if(pkg->suggests_str)
 	  free(pkg->suggests_str);
+     pkg->suggests_str = NULL;
+}
+
+/*
+ * Resolve the dependencies, provides, conflicts and replaces of pkg, which
+ * until then are only parsed into strings. Until every package has been
+ * built, by pkg_hash_build_graph(), the reverse edges (provided_by,
+ * replaced_by and depended_upon_by) are incomplete.
+ */
+void
+pkg_build_graph(pkg_t *pkg)
+{
+     if (pkg->graph_built)
+	  return;
+     pkg->graph_built = 1;
+
+     buildDepends(pkg);
+
+     buildProvides(pkg->parent, pkg);
+
+     /* Need to build the conflicts graph before replaces for correct
+      * calculation of replaced_by relation.
+      */
+     buildConflicts(pkg);
+
+     buildReplaces(pkg->parent, pkg);
+
+     buildDependedUponBy(pkg, pkg->parent);
 }
 
 const char*
@@ -732,7 +818,7 @@ pkg_depend_str(pkg_t *pkg, int idx)
 
 	/* calculate string length */
 	for (i=0; i<cdep->possibility_count; i++) {
-		dep = cdep->possibilities[i];
+		dep = &cdep->possibilities[i];
 
 		if (i != 0)
 			len += 3; /* space, pipe, space */
@@ -751,7 +837,7 @@ pkg_depend_str(pkg_t *pkg, int idx)
 	str[0] = '\0';
 
 	for (i=0; i<cdep->possibility_count; i++) {
-		dep = cdep->possibilities[i];
+		dep = &cdep->possibilities[i];
 
 		if (i != 0)
 			strncat(str, " | ", len);
@@ -789,7 +875,7 @@ void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg)
 		    && depends->type != RECOMMEND)
 			continue;
 		for (j = 0; j < depends->possibility_count; j++) {
-			ab_depend = depends->possibilities[j]->pkg;
+			ab_depend = depends->possibilities[j].pkg;
 			if (!ab_depend->depended_upon_by) {
 				ab_depend->depended_upon_by =
 					xcalloc(1, sizeof(abstract_pkg_t *));
@@ -814,24 +900,58 @@ void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg)
 	}
 }
 
-static depend_t * depend_init(void)
+/* A copy of the first len chars of src, trimmed, taken from the pool. */
+static char *
+pool_strndup(struct depend_pool *pool, const char *src, size_t len)
 {
-    depend_t * d = xcalloc(1, sizeof(depend_t));
-    d->constraint = NONE;
-    d->version = NULL;
-    d->pkg = NULL;
+     char *dest = pool->chars;
+
+     while (len && isspace(*src)) {
+	  src++;
+	  len--;
+     }
+     while (len && isspace(src[len - 1]))
+	  len--;
+
+     memcpy(dest, src, len);
+     dest[len] = '\0';
+     pool->chars += len + 1;
 
-    return d;
+     return dest;
+}
+
+static void
+depend_set_version(depend_t *depend, const char *vstr, size_t len,
+		struct depend_pool *pool)
+{
+     char *colon;
+
+     depend->version = pool_strndup(pool, vstr, len);
+
+     colon = strchr(depend->version, ':');
+     if (colon) {
+	  depend->epoch = strtoul(depend->version, NULL, 10);
+	  depend->upstream = pool_strndup(pool, colon + 1, strlen(colon + 1));
+     } else {
+	  depend->epoch = 0;
+	  depend->upstream = pool_strndup(pool, depend->version,
+			  strlen(depend->version));
+     }
+
+     depend->revision = strrchr(depend->upstream, '-');
+     if (depend->revision)
+	  *depend->revision++ = '\0';
 }
 
 static int parseDepends(compound_depend_t *compound_depend,
-			char * depend_str)
+			char * depend_str, struct depend_pool *pool)
 {
      char * pkg_name, buffer[2048];
      unsigned int num_of_ors = 0;
      int i;
      char * src, * dest;
-     depend_t ** possibilities;
+     const char * vstr;
+     depend_t * possibilities;
 
      /* first count the number of ored possibilities for satisfying dependency */
      src = depend_str;
@@ -842,12 +962,13 @@ static int parseDepends(compound_depend_t *compound_depend,
      compound_depend->type = DEPEND;
 
      compound_depend->possibility_count = num_of_ors + 1;
-     possibilities = xcalloc((num_of_ors + 1), sizeof(depend_t *) );
+     possibilities = pool->next;
+     pool->next += num_of_ors + 1;
      compound_depend->possibilities = possibilities;
 
      src = depend_str;
      for(i = 0; i < num_of_ors + 1; i++){
-	  possibilities[i] = depend_init();
+	  possibilities[i].constraint = NONE;
 	  /* gobble up just the name first */
 	  dest = buffer;
 	  while(*src &&
@@ -857,7 +978,7 @@ static int parseDepends(compound_depend_t *compound_depend,
 		(*src != '|'))
 	       *dest++ = *src++;
 	  *dest = '\0';
-	  pkg_name = trim_xstrdup(buffer);
+	  pkg_name = buffer;
 
 	  /* now look at possible version info */
 
@@ -869,32 +990,32 @@ static int parseDepends(compound_depend_t *compound_depend,
 	  if(*src == '('){
 	       src++;
 	       if(!strncmp(src, "<<", 2)){
-		    possibilities[i]->constraint = EARLIER;
+		    possibilities[i].constraint = EARLIER;
 		    src += 2;
 	       }
 	       else if(!strncmp(src, "<=", 2)){
-		    possibilities[i]->constraint = EARLIER_EQUAL;
+		    possibilities[i].constraint = EARLIER_EQUAL;
 		    src += 2;
 	       }
 	       else if(!strncmp(src, ">=", 2)){
-		    possibilities[i]->constraint = LATER_EQUAL;
+		    possibilities[i].constraint = LATER_EQUAL;
 		    src += 2;
 	       }
 	       else if(!strncmp(src, ">>", 2)){
-		    possibilities[i]->constraint = LATER;
+		    possibilities[i].constraint = LATER;
 		    src += 2;
 	       }
 	       else if(!strncmp(src, "=", 1)){
-		    possibilities[i]->constraint = EQUAL;
+		    possibilities[i].constraint = EQUAL;
 		    src++;
 	       }
 	       /* should these be here to support deprecated designations; dpkg does */
 	       else if(!strncmp(src, "<", 1)){
-		    possibilities[i]->constraint = EARLIER_EQUAL;
+		    possibilities[i].constraint = EARLIER_EQUAL;
 		    src++;
 	       }
 	       else if(!strncmp(src, ">", 1)){
-		    possibilities[i]->constraint = LATER_EQUAL;
+		    possibilities[i].constraint = LATER_EQUAL;
 		    src++;
 	       }
 
@@ -902,17 +1023,14 @@ static int parseDepends(compound_depend_t *compound_depend,
 	       while(isspace(*src)) src++;
 
 	       /* this would be the version string */
-	       dest = buffer;
+	       vstr = src;
 	       while(*src && *src != ')')
-		    *dest++ = *src++;
-	       *dest = '\0';
+		    src++;
 
-	       possibilities[i]->version = trim_xstrdup(buffer);
+	       depend_set_version(&possibilities[i], vstr, src - vstr, pool);
 	  }
 	  /* hook up the dependency to its abstract pkg */
-	  possibilities[i]->pkg = ensure_abstract_pkg_by_name(pkg_name);
-
-	  free(pkg_name);
+	  possibilities[i].pkg = ensure_abstract_pkg_by_name(pkg_name);
 
 	  /* now get past the ) and any possible | chars */
 	  while(*src &&
@@ -43,15 +43,22 @@ typedef enum version_constraint version_constraint_t;
 
 struct depend{
     version_constraint_t constraint;
-    char * version;
+    char * version;		/* as written, or NULL */
+    /* version split as in pkg_t, so it is parsed only once */
+    unsigned long epoch;
+    char * upstream;
+    char * revision;
     abstract_pkg_t * pkg;
 };
 typedef struct depend depend_t;
 
+/* The compound dependencies of a package are allocated in a single block
+   with all of their possibilities and version strings after them, which is
+   freed along with pkg->depends or pkg->conflicts. */
 struct compound_depend{
     depend_type_t type;
     int possibility_count;
-    struct depend ** possibilities;
+    struct depend * possibilities;
 };
 typedef struct compound_depend compound_depend_t;
 
@@ -59,6 +66,7 @@ void buildProvides(abstract_pkg_t * ab_pkg, pkg_t * pkg);
 void buildConflicts(pkg_t * pkg);
 void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg);
 void buildDepends(pkg_t * pkg);
+void pkg_build_graph(pkg_t *pkg);
 
 /**
  * pkg_replaces returns 1 if pkg->replaces contains one of replacee's provides and 0
@@ -16,6 +16,7 @@
 */
 
 #include <stdio.h>
+#include <ctype.h>
 
 #include "hash_table.h"
 #include "release.h"
@@ -28,11 +29,17 @@
 #include "opkg_utils.h"
 #include "sprintf_alloc.h"
 #include "file_util.h"
+#include "opkg_profile.h"
+#include "list_index.h"
 #include "libbb/libbb.h"
 
+/* Set once every package has been through pkg_build_graph(). */
+static int graph_complete;
+
 void
 pkg_hash_init(void)
 {
+	graph_complete = 0;
 	hash_table_init("pkg-hash", &conf->pkg_hash,
 			OPKG_CONF_DEFAULT_HASH_LEN);
 }
@@ -96,6 +103,21 @@ dist_hash_add_from_file(const char *lists_dir, pkg_src_t *dist)
 	return 0;
 }
 
+static int
+pkg_has_valid_arch(pkg_t *pkg)
+{
+	char *version_str;
+
+	if (pkg->architecture && pkg->arch_priority)
+		return 1;
+
+	version_str = pkg_version_str_alloc(pkg);
+	opkg_msg(NOTICE, "Package %s version %s has no "
+			"valid architecture, ignoring.\n",
+			pkg->name, version_str);
+	free(version_str);
+	return 0;
+}
 
 int
 pkg_hash_add_from_file(const char *file_name,
@@ -113,6 +135,8 @@ pkg_hash_add_from_file(const char *file_name,
 		return -1;
 	}
 
+	opkg_profile_begin("parse", file_name);
+
 	buf = xmalloc(len);
 
 	do {
@@ -137,39 +161,35 @@ pkg_hash_add_from_file(const char *file_name,
 			continue;
 		}
 
-		if (!pkg->architecture || !pkg->arch_priority) {
-			char *version_str = pkg_version_str_alloc(pkg);
-			opkg_msg(NOTICE, "Package %s version %s has no "
-					"valid architecture, ignoring.\n",
-					pkg->name, version_str);
-			free(version_str);
+		if (!pkg_has_valid_arch(pkg))
 			continue;
-		}
 
 		hash_insert_pkg(pkg, is_status_file);
 
 	} while (!feof(fp));
 
+	opkg_profile_count(OPKG_PROFILE_BYTES, ftell(fp));
+	opkg_profile_end();
+
 	free(buf);
 	fclose(fp);
 
 	return ret;
 }
 
-/*
- * Load in feed files from the cached "src" and/or "src/gz" locations.
- */
-int
-pkg_hash_load_feeds(void)
+static const char *
+pkg_hash_lists_dir(void)
+{
+	return conf->restrict_to_default_dest ?
+		conf->default_dest->lists_dir : conf->lists_dir;
+}
+
+static int
+pkg_hash_load_dists(const char *lists_dir)
 {
 	pkg_src_list_elt_t *iter;
 	pkg_src_t *src, *subdist;
-	char *list_file, *lists_dir;
-
-	opkg_msg(INFO, "\n");
-
-	lists_dir = conf->restrict_to_default_dest ?
-		conf->default_dest->lists_dir : conf->lists_dir;
+	char *list_file;
 
 	for (iter = void_list_first(&conf->dist_src_list); iter;
 			iter = void_list_next(&conf->dist_src_list, iter)) {
@@ -205,6 +225,26 @@ pkg_hash_load_feeds(void)
 		free(list_file);
 	}
 
+	return 0;
+}
+
+/*
+ * Load in feed files from the cached "src" and/or "src/gz" locations.
+ */
+int
+pkg_hash_load_feeds(void)
+{
+	pkg_src_list_elt_t *iter;
+	pkg_src_t *src;
+	char *list_file;
+	const char *lists_dir;
+
+	opkg_msg(INFO, "\n");
+
+	lists_dir = pkg_hash_lists_dir();
+	if (pkg_hash_load_dists(lists_dir))
+		return -1;
+
 	for (iter = void_list_first(&conf->pkg_src_list); iter;
 			iter = void_list_next(&conf->pkg_src_list, iter)) {
 
@@ -224,6 +264,255 @@ pkg_hash_load_feeds(void)
 	return 0;
 }
 
+/* A feed loaded through its index, a stanza at a time. */
+struct partial_feed {
+	pkg_src_t *src;
+	FILE *fp;
+	list_index_t *index;
+};
+
+/* The names whose packages are to be loaded, and the feeds to look in. */
+struct closure {
+	struct partial_feed *feeds;
+	int feed_count;
+	hash_table_t seen;
+	char **names;
+	int count;
+	char *buf;
+	size_t len;
+	int loaded;
+};
+
+static void
+closure_add(struct closure *c, const char *name, size_t len)
+{
+	char *copy = xstrndup(name, len);
+
+	if (hash_table_get(&c->seen, copy)) {
+		free(copy);
+		return;
+	}
+
+	hash_table_insert(&c->seen, copy, c);
+	c->names = xrealloc(c->names, (c->count + 1) * sizeof(char *));
+	c->names[c->count++] = copy;
+}
+
+/* Add each name in a list separated by spaces. */
+static void
+closure_add_words(struct closure *c, const char *words)
+{
+	const char *end;
+
+	while (*words) {
+		end = words + strcspn(words, " ");
+		if (end > words)
+			closure_add(c, words, end - words);
+		words = *end ? end + 1 : end;
+	}
+}
+
+/* Add every alternative in unparsed dependency strings such as those of
+ * pkg->depends_str, which are "name (op version) | name ...". */
+static void
+closure_add_depends(struct closure *c, char **strs, unsigned int count)
+{
+	const char *s, *end;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		for (s = strs[i]; s; s = strchr(end, '|')) {
+			while (isspace(*s) || *s == '|')
+				s++;
+			end = s + strcspn(s, " \t\n(|*");
+			if (end > s)
+				closure_add(c, s, end - s);
+		}
+	}
+}
+
+static int
+closure_load(struct closure *c, struct partial_feed *feed, long offset)
+{
+	pkg_t *pkg;
+	int ret;
+
+	if (fseek(feed->fp, offset, SEEK_SET) == -1) {
+		opkg_perror(ERROR, "Failed to seek in list of %s",
+				feed->src->name);
+		return -1;
+	}
+
+	pkg = pkg_new();
+	pkg->src = feed->src;
+
+	ret = parse_from_stream_nomalloc(pkg_parse_line, pkg, feed->fp, 0,
+			&c->buf, c->len);
+	if (ret == -1 || pkg->name == NULL || !pkg_has_valid_arch(pkg)) {
+		pkg_deinit(pkg);
+		free(pkg);
+		return ret == -1 ? -1 : 0;
+	}
+
+	/* Before the package can be merged into another. */
+	closure_add_depends(c, pkg->pre_depends_str, pkg->pre_depends_count);
+	closure_add_depends(c, pkg->depends_str, pkg->depends_count);
+	closure_add_depends(c, pkg->recommends_str, pkg->recommends_count);
+	closure_add_depends(c, pkg->suggests_str, pkg->suggests_count);
+
+	opkg_profile_count(OPKG_PROFILE_BYTES, ftell(feed->fp) - offset);
+	c->loaded++;
+
+	hash_insert_pkg(pkg, 0);
+
+	return 0;
+}
+
+/*
+ * Returns 1 if name is a package name, rather than a file or a pattern,
+ * which the full feeds would be needed to resolve.
+ */
+static int
+is_plain_pkg_name(const char *name)
+{
+	const char *suffixes[] = { ".opk", ".ipk", ".deb", NULL };
+	size_t len = strlen(name);
+	int i;
+
+	if (strpbrk(name, "/*?[") || file_exists(name))
+		return 0;
+
+	for (i = 0; suffixes[i]; i++) {
+		size_t n = strlen(suffixes[i]);
+		if (len > n && strcmp(name + len - n, suffixes[i]) == 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Load from the feeds only the packages named and those they depend upon,
+ * or which provide or replace any of these, using the indexes written by
+ * opkg update. Feeds without an up to date index are loaded in full, and
+ * so are all of them if any name is not a plain package name.
+ */
+int
+pkg_hash_load_feeds_for(int argc, const char **names)
+{
+	pkg_src_list_elt_t *iter;
+	pkg_src_t *src;
+	struct closure c;
+	struct partial_feed *feed;
+	const char *lists_dir, *offsets, *others;
+	char *list_file, *end;
+	list_index_t *index;
+	FILE *fp;
+	long offset;
+	int i, f, err = -1;
+
+	for (i = 0; i < argc; i++)
+		if (!is_plain_pkg_name(names[i]))
+			return pkg_hash_load_feeds();
+
+	opkg_msg(INFO, "\n");
+
+	lists_dir = pkg_hash_lists_dir();
+	if (pkg_hash_load_dists(lists_dir))
+		return -1;
+
+	memset(&c, 0, sizeof(c));
+	hash_table_init("closure", &c.seen, OPKG_CONF_DEFAULT_HASH_LEN);
+	c.len = 4096;
+	c.buf = xmalloc(c.len);
+
+	for (iter = void_list_first(&conf->pkg_src_list); iter;
+			iter = void_list_next(&conf->pkg_src_list, iter)) {
+
+		src = (pkg_src_t *)iter->data;
+
+		sprintf_alloc(&list_file, "%s/%s", lists_dir, src->name);
+
+		if (!file_exists(list_file)) {
+			free(list_file);
+			continue;
+		}
+
+		index = list_index_open(list_file);
+		fp = index ? fopen(list_file, "r") : NULL;
+		if (fp == NULL) {
+			if (index)
+				list_index_close(index);
+			opkg_msg(INFO, "No index for %s, loading all of it.\n",
+					list_file);
+			if (pkg_hash_add_from_file(list_file, src, NULL, 0)) {
+				free(list_file);
+				goto cleanup;
+			}
+			free(list_file);
+			continue;
+		}
+		free(list_file);
+
+		c.feeds = xrealloc(c.feeds,
+				(c.feed_count + 1) * sizeof(struct partial_feed));
+		feed = &c.feeds[c.feed_count++];
+		feed->src = src;
+		feed->fp = fp;
+		feed->index = index;
+	}
+
+	opkg_profile_begin("parse", "indexed lists");
+
+	for (i = 0; i < argc; i++)
+		closure_add(&c, names[i], strlen(names[i]));
+
+	/* c.names grows as the packages loaded add what they depend upon. */
+	for (i = 0; i < c.count; i++) {
+		for (f = 0; f < c.feed_count; f++) {
+			feed = &c.feeds[f];
+			if (!list_index_lookup(feed->index, c.names[i],
+						&offsets, &others))
+				continue;
+
+			while (*offsets) {
+				offset = strtol(offsets, &end, 10);
+				if (end == offsets)
+					break;
+				if (closure_load(&c, feed, offset)) {
+					opkg_profile_end();
+					goto cleanup;
+				}
+				offsets = end;
+			}
+
+			closure_add_words(&c, others);
+		}
+	}
+
+	opkg_profile_end();
+
+	if (c.feed_count)
+		opkg_msg(INFO, "Loaded %d packages for %d names from %d "
+				"indexed lists.\n", c.loaded, c.count,
+				c.feed_count);
+	err = 0;
+
+cleanup:
+	for (f = 0; f < c.feed_count; f++) {
+		fclose(c.feeds[f].fp);
+		list_index_close(c.feeds[f].index);
+	}
+	free(c.feeds);
+	for (i = 0; i < c.count; i++)
+		free(c.names[i]);
+	free(c.names);
+	hash_table_deinit(&c.seen);
+	free(c.buf);
+
+	return err;
+}
+
 /*
  * Load in status files from the configured "dest"s.
  */
@@ -249,7 +538,7 @@ pkg_hash_load_status_files(void)
 	return 0;
 }
 
-static abstract_pkg_t *
+abstract_pkg_t *
 abstract_pkg_fetch_by_name(const char * pkg_name)
 {
 	return (abstract_pkg_t *)hash_table_get(&conf->pkg_hash, pkg_name);
@@ -514,24 +803,15 @@ pkg_hash_fetch_by_name_version(const char *pkg_name, const char * version)
 {
 	pkg_vec_t * vec;
 	int i;
-	char *version_str = NULL;
 
 	if(!(vec = pkg_vec_fetch_by_name(pkg_name)))
 		return NULL;
 
-	for(i = 0; i < vec->len; i++) {
-		version_str = pkg_version_str_alloc(vec->pkgs[i]);
-		if(!strcmp(version_str, version)) {
-			free(version_str);
-			break;
-		}
-		free(version_str);
-	}
-
-	if(i == vec->len)
-		return NULL;
+	for(i = 0; i < vec->len; i++)
+		if (pkg_version_str_matches(vec->pkgs[i], version))
+			return vec->pkgs[i];
 
-	return vec->pkgs[i];
+	return NULL;
 }
 
 pkg_t *
@@ -668,21 +948,40 @@ hash_insert_pkg(pkg_t *pkg, int set_status)
 		ab_pkg->state_status = SS_UNPACKED;
 	}
 
-	buildDepends(pkg);
+	pkg->parent = ab_pkg;
 
-	buildProvides(ab_pkg, pkg);
+	/* Otherwise left until the package is looked at. */
+	if (graph_complete)
+		pkg_build_graph(pkg);
 
-	/* Need to build the conflicts graph before replaces for correct
-	 * calculation of replaced_by relation.
-	 */
-	buildConflicts(pkg);
+	pkg_vec_insert_merge(ab_pkg->pkgs, pkg, set_status);
+}
 
-	buildReplaces(ab_pkg, pkg);
+/*
+ * Build the dependency graph of every package, for anything which follows
+ * the edges back from a package to those which provide, replace or depend
+ * upon it.
+ */
+void
+pkg_hash_build_graph(void)
+{
+	pkg_vec_t *all;
+	int i;
 
-	buildDependedUponBy(pkg, ab_pkg);
+	if (graph_complete)
+		return;
 
-	pkg_vec_insert_merge(ab_pkg->pkgs, pkg, set_status);
-	pkg->parent = ab_pkg;
+	opkg_profile_begin("build graph", NULL);
+
+	all = pkg_vec_alloc();
+	pkg_hash_fetch_available(all);
+	for (i = 0; i < all->len; i++)
+		pkg_build_graph(all->pkgs[i]);
+	pkg_vec_free(all);
+
+	graph_complete = 1;
+
+	opkg_profile_end();
 }
 
 static const char *
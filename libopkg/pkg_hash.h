@@ -33,11 +33,14 @@ int dist_hash_add_from_file(const char *file_name, pkg_src_t *dist);
 int pkg_hash_add_from_file(const char *file_name, pkg_src_t *src,
 		pkg_dest_t *dest, int is_status_file);
 int pkg_hash_load_feeds(void);
+int pkg_hash_load_feeds_for(int argc, const char **names);
 int pkg_hash_load_status_files(void);
 
 void hash_insert_pkg(pkg_t *pkg, int set_status);
+void pkg_hash_build_graph(void);
 
 abstract_pkg_t * ensure_abstract_pkg_by_name(const char * pkg_name);
+abstract_pkg_t * abstract_pkg_fetch_by_name(const char * pkg_name);
 void pkg_hash_fetch_all_installed(pkg_vec_t *installed);
 pkg_t * pkg_hash_fetch_by_name_version(const char *pkg_name,
 				       const char * version);
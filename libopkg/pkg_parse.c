@@ -143,12 +143,14 @@ pkg_parse_line(void *ptr, const char *line, uint mask)
 
 	case 'D':
 		if ((mask & PFM_DESCRIPTION) && is_field("Description", line)) {
-			pkg->description = parse_simple("Description", line);
+			pkg_cold_alloc(pkg)->description = parse_simple("Description", line);
 			reading_conffiles = 0;
 			reading_description = 1;
 			goto dont_reset_flags;
 		} else if ((mask & PFM_DEPENDS) && is_field("Depends", line))
 			pkg->depends_str = parse_list(line, &pkg->depends_count, ',', 0);
+		else if ((mask & PFM_DELTAS) && is_field("Deltas", line))
+			pkg->deltas = parse_simple("Deltas", line);
 		break;
 
 	case 'E':
@@ -185,14 +187,14 @@ pkg_parse_line(void *ptr, const char *line, uint mask)
 		else if ((mask & PFM_MD5SUM) && is_field("MD5Sum:", line)) 
 			pkg->md5sum = parse_simple("MD5Sum", line);
 		else if((mask & PFM_MAINTAINER) && is_field("Maintainer", line))
-			pkg->maintainer = parse_simple("Maintainer", line);
+			pkg_cold_alloc(pkg)->maintainer = parse_simple("Maintainer", line);
 		break;
 
 	case 'P':
 		if ((mask & PFM_PACKAGE) && is_field("Package", line))
 			pkg->name = parse_simple("Package", line);
 		else if ((mask & PFM_PRIORITY) && is_field("Priority", line))
-			pkg->priority = parse_simple("Priority", line);
+			pkg_cold_alloc(pkg)->priority = parse_simple("Priority", line);
 		else if ((mask & PFM_PROVIDES) && is_field("Provides", line))
 			pkg->provides_str = parse_list(line, &pkg->provides_count, ',', 0);
 		else if ((mask & PFM_PRE_DEPENDS) && is_field("Pre-Depends", line))
@@ -209,7 +211,7 @@ pkg_parse_line(void *ptr, const char *line, uint mask)
 
 	case 'S':
 		if ((mask & PFM_SECTION) && is_field("Section", line))
-			pkg->section = parse_simple("Section", line);
+			pkg_cold_alloc(pkg)->section = parse_simple("Section", line);
 #ifdef HAVE_SHA256
 		else if ((mask & PFM_SHA256SUM) && is_field("SHA256sum", line))
 			pkg->sha256sum = parse_simple("SHA256sum", line);
@@ -219,7 +221,7 @@ pkg_parse_line(void *ptr, const char *line, uint mask)
 			pkg->size = strtoul(tmp, NULL, 0);
 			free (tmp);
 		} else if ((mask & PFM_SOURCE) && is_field("Source", line))
-			pkg->source = parse_simple("Source", line);
+			pkg_cold_alloc(pkg)->source = parse_simple("Source", line);
 		else if ((mask & PFM_STATUS) && is_field("Status", line))
 			parse_status(pkg, line);
 		else if ((mask & PFM_SUGGESTS) && is_field("Suggests", line))
@@ -228,7 +230,7 @@ pkg_parse_line(void *ptr, const char *line, uint mask)
 
 	case 'T':
 		if ((mask & PFM_TAGS) && is_field("Tags", line))
-			pkg->tags = parse_simple("Tags", line);
+			pkg_cold_alloc(pkg)->tags = parse_simple("Tags", line);
 		break;
 
 	case 'V':
@@ -238,11 +240,12 @@ pkg_parse_line(void *ptr, const char *line, uint mask)
 
 	case ' ':
 		if ((mask & PFM_DESCRIPTION) && reading_description) {
-			pkg->description = xrealloc(pkg->description,
-						strlen(pkg->description)
+			char **description = &pkg_cold_alloc(pkg)->description;
+			*description = xrealloc(*description,
+						strlen(*description)
 						+ 1 + strlen(line) + 1);
-			strcat(pkg->description, "\n");
-			strcat(pkg->description, (line));
+			strcat(*description, "\n");
+			strcat(*description, (line));
 			goto dont_reset_flags;
 		} else if ((mask & PFM_CONFFILES) && reading_conffiles) {
 			parse_conffiles(pkg, line);
@@ -51,6 +51,7 @@ int pkg_parse_line(void *ptr, const char *line, uint mask);
 #define PFM_SUGGESTS		(1 << 24)
 #define PFM_TAGS		(1 << 25)
 #define PFM_VERSION		(1 << 26)
+#define PFM_DELTAS		(1 << 27)
 
 #define PFM_ALL	(~(uint)0)
 
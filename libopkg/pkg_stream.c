@@ -0,0 +1,360 @@
+/* pkg_stream.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "pkg_stream.h"
+#include "opkg_download.h"
+#include "opkg_message.h"
+#include "file_util.h"
+#include "libbb/libbb.h"
+
+/* All that is held of the package at a time, other than its control
+   members. */
+#define STREAM_BUF_LEN (64 * 1024)
+
+#define AR_MAGIC "!<arch>\n"
+#define AR_MAGIC_LEN 8
+#define AR_HEADER_LEN 60
+
+struct stream {
+	const char *src;
+	int fd;
+	struct digests_ctx *digests;
+	char *buf;
+};
+
+/* Read len bytes from s, or fewer at its end, adding them to its digests.
+   Returns the number read, or -1 on error. */
+static ssize_t
+stream_read(struct stream *s, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = read(s->fd, (char *)buf + done, len - done);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			opkg_perror(ERROR, "Failed to read %s", s->src);
+			return -1;
+		}
+		if (n == 0)
+			break;
+		done += n;
+	}
+
+	digests_ctx_update(s->digests, buf, done);
+
+	return done;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			return -1;
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Copy len bytes of s to fd, or to the end of s if len is -1. */
+static int
+stream_copy(struct stream *s, off_t len, int fd, const char *fd_name)
+{
+	ssize_t n;
+	size_t want;
+
+	while (len != 0) {
+		want = len == -1 || len > STREAM_BUF_LEN ? STREAM_BUF_LEN : len;
+		n = stream_read(s, s->buf, want);
+		if (n == -1)
+			return -1;
+		if (len != -1 && n < want) {
+			opkg_msg(ERROR, "Unexpected end of %s.\n", s->src);
+			return -1;
+		}
+		if (write_all(fd, s->buf, n)) {
+			opkg_perror(ERROR, "Failed to write %s", fd_name);
+			return -1;
+		}
+		if (len == -1) {
+			if (n < want)
+				break;
+		} else
+			len -= n;
+	}
+
+	return 0;
+}
+
+/* Skip len bytes of s, such as the padding of an ar member. */
+static int
+stream_skip(struct stream *s, off_t len)
+{
+	ssize_t n;
+	size_t want;
+
+	while (len > 0) {
+		want = len > STREAM_BUF_LEN ? STREAM_BUF_LEN : len;
+		n = stream_read(s, s->buf, want);
+		if (n == -1)
+			return -1;
+		if (n < want) {
+			opkg_msg(ERROR, "Unexpected end of %s.\n", s->src);
+			return -1;
+		}
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Start a child extracting the data member, compressed as d, written to
+   the returned descriptor under prefix, listing the files in
+   list_file_name. */
+static int
+data_extract_start(const struct decompressor *d, const char *prefix,
+		const char *list_file_name, pid_t *pid)
+{
+	FILE *in, *list;
+	int fds[2];
+	int err = -1;
+
+	if (pipe(fds) == -1) {
+		opkg_perror(ERROR, "Failed to create pipe");
+		return -1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	*pid = fork();
+	if (*pid == -1) {
+		opkg_perror(ERROR, "Failed to fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (*pid == 0) {
+		close(fds[1]);
+		/* Only report our own errors. */
+		free_error_list();
+		in = fdopen(fds[0], "r");
+		list = fopen(list_file_name, "w");
+		if (list == NULL)
+			opkg_perror(ERROR, "Failed to open %s", list_file_name);
+		if (in && list)
+			err = tar_extract(in, list, d,
+					extract_all_to_fs | extract_preserve_date
+					| extract_unconditional | extract_list
+					| extract_untrusted,
+					prefix);
+		if (list && fclose(list))
+			err = -1;
+		print_error_list();
+		fflush(stdout);
+		_exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(fds[0]);
+
+	return fds[1];
+}
+
+static int
+data_extract_finish(int fd, pid_t pid)
+{
+	int status;
+
+	close(fd);
+
+	if (waitpid(pid, &status, 0) == -1) {
+		opkg_perror(ERROR, "Failed to wait for extraction");
+		return -1;
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/* Read the members of the ar archive s, after its magic, into out or, for
+   the data member, out to be extracted. */
+static int
+stream_unpack_ar(struct stream *s, int out, const char *skeleton,
+		const char *prefix, const char *list_file_name)
+{
+	char header[AR_HEADER_LEN + 1];
+	char name[17], *p;
+	const struct decompressor *d, *found;
+	unsigned char magic[DECOMPRESSOR_MAGIC_MAX];
+	off_t size;
+	ssize_t n, magic_len;
+	pid_t pid;
+	int data_fd, err;
+
+	for (;;) {
+		n = stream_read(s, header, AR_HEADER_LEN);
+		if (n == -1)
+			return -1;
+		if (n == 0)
+			return 0;
+		if (n < AR_HEADER_LEN || memcmp(header + 58, "`\n", 2)) {
+			opkg_msg(ERROR, "Invalid ar header in %s.\n", s->src);
+			return -1;
+		}
+		header[AR_HEADER_LEN] = '\0';
+
+		memcpy(name, header, 16);
+		name[16] = '\0';
+		for (p = name + 15; p >= name && (*p == ' ' || *p == '/'); p--)
+			*p = '\0';
+		size = strtoull(header + 48, NULL, 10);
+
+		d = decompressor_by_name(name, "data.tar");
+		if (d == NULL) {
+			if (write_all(out, header, AR_HEADER_LEN)
+					|| stream_copy(s, size + (size & 1),
+						out, skeleton))
+				return -1;
+			continue;
+		}
+
+		/* Go by the magic, where it is known, over the name. */
+		magic_len = stream_read(s, magic,
+				size < sizeof(magic) ? size : sizeof(magic));
+		if (magic_len == -1)
+			return -1;
+		found = decompressor_by_magic(magic, magic_len);
+		if (found)
+			d = found;
+
+		if (d->decompress == NULL) {
+			opkg_msg(ERROR, "%s: %s needs %s support, which was "
+					"not compiled in.\n", s->src, name,
+					d->name);
+			return -1;
+		}
+
+		data_fd = data_extract_start(d, prefix, list_file_name, &pid);
+		if (data_fd == -1)
+			return -1;
+
+		if (write_all(data_fd, magic, magic_len)) {
+			opkg_perror(ERROR, "Failed to write %s", name);
+			err = -1;
+		} else
+			err = stream_copy(s, size - magic_len, data_fd, name);
+		if (data_extract_finish(data_fd, pid)) {
+			opkg_msg(ERROR, "Failed to extract data files from "
+					"%s.\n", s->src);
+			err = -1;
+		}
+		if (err || stream_skip(s, size & 1))
+			return -1;
+	}
+}
+
+int
+pkg_stream_unpack(pkg_t *pkg, const char *src, const char *skeleton,
+		const char *prefix, const char *list_file_name,
+		char **md5sum, char **sha256sum)
+{
+	struct stream s;
+	struct sigaction sa, old_sa;
+	char magic[AR_MAGIC_LEN];
+	ssize_t n;
+	pid_t pid;
+	int out, err = -1;
+
+	*md5sum = NULL;
+	*sha256sum = NULL;
+
+	s.src = src;
+	s.fd = opkg_download_open(src, &pid);
+	if (s.fd == -1)
+		return -1;
+
+	out = open(skeleton, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out == -1) {
+		opkg_perror(ERROR, "Failed to create %s", skeleton);
+		opkg_download_close(src, s.fd, pid, 0);
+		return -1;
+	}
+
+	s.digests = digests_ctx_alloc(pkg->md5sum != NULL,
+#ifdef HAVE_SHA256
+			pkg->sha256sum != NULL);
+#else
+			0);
+#endif
+	s.buf = xmalloc(STREAM_BUF_LEN);
+
+	/* An extractor which fails leaves us writing to a closed pipe. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, &old_sa);
+
+	n = stream_read(&s, magic, AR_MAGIC_LEN);
+	if (n == -1)
+		goto cleanup;
+
+	if (write_all(out, magic, n)) {
+		opkg_perror(ERROR, "Failed to write %s", skeleton);
+		goto cleanup;
+	}
+
+	if (n == AR_MAGIC_LEN && memcmp(magic, AR_MAGIC, AR_MAGIC_LEN) == 0)
+		err = stream_unpack_ar(&s, out, skeleton, prefix,
+				list_file_name);
+	else if (n == AR_MAGIC_LEN)
+		/* An outer tar.gz, which must be read from a file. */
+		err = stream_copy(&s, -1, out, skeleton) ? -1 : 1;
+	else
+		opkg_msg(ERROR, "%s is too short to be a package.\n", src);
+
+cleanup:
+	sigaction(SIGPIPE, &old_sa, NULL);
+
+	if (close(out) && err != -1) {
+		opkg_perror(ERROR, "Failed to write %s", skeleton);
+		err = -1;
+	}
+	if (opkg_download_close(src, s.fd, pid, err != -1))
+		err = -1;
+
+	if (err == -1)
+		digests_ctx_finish(s.digests, NULL, NULL);
+	else
+		digests_ctx_finish(s.digests, md5sum, sha256sum);
+	free(s.buf);
+
+	return err;
+}
@@ -0,0 +1,36 @@
+/* pkg_stream.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PKG_STREAM_H
+#define PKG_STREAM_H
+
+#include "pkg.h"
+
+/*
+ * Unpack pkg from src as it is downloaded, without a copy of the whole of
+ * it. The members of the package but the data member are written to
+ * skeleton, a package without data files, which can stand in for it from
+ * then on. The data files are extracted under prefix as they arrive, in
+ * any compression libbb supports, and their names written to
+ * list_file_name. The digests of the download, as asked for by
+ * pkg->md5sum and pkg->sha256sum, are returned in md5sum and sha256sum,
+ * for checking before any of it is used.
+ *
+ * Returns 0, or 1 if pkg is not an ar archive, in which case all of it has
+ * been written to skeleton instead, or -1 on error.
+ */
+int pkg_stream_unpack(pkg_t *pkg, const char *src, const char *skeleton,
+		const char *prefix, const char *list_file_name,
+		char **md5sum, char **sha256sum);
+
+#endif
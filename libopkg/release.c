@@ -28,6 +28,13 @@
 #include "parse_util.h"
 #include "file_util.h"
 
+/* What the Release file says of one of the files it lists. */
+struct release_file {
+     int size;
+     const char *md5;
+     const char *sha256;
+};
+
 static void
 release_init(release_t *release)
 {
@@ -39,6 +46,65 @@ release_init(release_t *release)
      release->components_count = 0;
      release->complist = NULL;
      release->complist_count = 0;
+     hash_table_init("release-files", &release->files, 64);
+}
+
+static void
+release_file_free(const char *key, void *entry, void *data)
+{
+     free(entry);
+}
+
+static struct release_file *
+release_file_get(release_t *release, const char *pathname)
+{
+     struct release_file *file;
+
+     file = hash_table_get(&release->files, pathname);
+     if (file == NULL) {
+	  file = xcalloc(1, sizeof(*file));
+	  file->size = -1;
+	  hash_table_insert(&release->files, pathname, file);
+     }
+
+     return file;
+}
+
+/*
+ * Index the checksum lists by path, as each downloaded list looks up its
+ * size and checksums. The first entry for a path is the one used.
+ */
+static void
+release_index_files(release_t *release)
+{
+     cksum_list_elt_t *iter;
+     cksum_t *cksum;
+     struct release_file *file;
+
+     if (release->md5sums) {
+	  list_for_each_entry(iter, &release->md5sums->head, node) {
+	       cksum = (cksum_t *)iter->data;
+	       file = release_file_get(release, cksum->name);
+	       if (file->md5)
+		    continue;
+	       file->size = cksum->size;
+	       file->md5 = cksum->value;
+	  }
+     }
+
+#ifdef HAVE_SHA256
+     if (release->sha256sums) {
+	  list_for_each_entry(iter, &release->sha256sums->head, node) {
+	       cksum = (cksum_t *)iter->data;
+	       file = release_file_get(release, cksum->name);
+	       if (file->sha256)
+		    continue;
+	       if (file->md5 == NULL)
+		    file->size = cksum->size;
+	       file->sha256 = cksum->value;
+	  }
+     }
+#endif
 }
 
 release_t *
@@ -75,6 +141,19 @@ release_deinit(release_t *release)
     }
     free(release->complist);
 
+    hash_table_foreach(&release->files, release_file_free, NULL);
+    hash_table_deinit(&release->files);
+
+    if (release->md5sums) {
+	cksum_list_deinit(release->md5sums);
+	free(release->md5sums);
+    }
+#ifdef HAVE_SHA256
+    if (release->sha256sums) {
+	cksum_list_deinit(release->sha256sums);
+	free(release->sha256sums);
+    }
+#endif
 }
 
 int
@@ -90,7 +169,9 @@ release_init_from_file(release_t *release, const char *filename)
 	}
 
 	err=release_parse_from_stream(release, release_file);
+	fclose(release_file);
 	if (!err) {
+		release_index_files(release);
 		if (!release_arch_supported(release)) {
 			opkg_msg(ERROR, "No valid architecture found on Release file.\n");
 			err = -1;
@@ -228,16 +309,19 @@ release_download(release_t *release, pkg_src_t *dist, char *lists_dir, char *tmp
 	       }
 
 	       if (err) {
+		    free(subpath);
+		    sprintf_alloc(&subpath, "%s/binary-%s/Packages", comps[i], nv->name);
 		    sprintf_alloc(&url, "%s-%s/Packages", prefix, nv->name);
 		    err = opkg_download(url, list_file_name, NULL, NULL, 1);
 		    if (!err) {
-			 err = release_verify_file(release, tmp_file_name, subpath);
+			 err = release_verify_file(release, list_file_name, subpath);
 			 if (err)
 			      unlink (list_file_name);
 		    }
 		    free(url);
 	       }
 
+	       free(subpath);
 	       free(tmp_file_name);
 	       free(list_file_name);
 	  }
@@ -254,48 +338,29 @@ release_download(release_t *release, pkg_src_t *dist, char *lists_dir, char *tmp
 int
 release_get_size(release_t *release, const char *pathname)
 {
-     const cksum_t *cksum;
-
-     if (release->md5sums) {
-	  cksum = cksum_list_find(release->md5sums, pathname);
-	  return cksum->size;
-     }
+     const struct release_file *file;
 
-#ifdef HAVE_SHA256
-     if (release->sha256sums) {
-	  cksum = cksum_list_find(release->sha256sums, pathname);
-	  return cksum->size;
-     }
-#endif
-
-     return -1;
+     file = hash_table_get(&release->files, pathname);
+     return file ? file->size : -1;
 }
 
 const char *
 release_get_md5(release_t *release, const char *pathname)
 {
-     const cksum_t *cksum;
-
-     if (release->md5sums) {
-	  cksum = cksum_list_find(release->md5sums, pathname);
-	  return cksum->value;
-     }
+     const struct release_file *file;
 
-     return '\0';
+     file = hash_table_get(&release->files, pathname);
+     return file ? file->md5 : NULL;
 }
 
 #ifdef HAVE_SHA256
 const char *
 release_get_sha256(release_t *release, const char *pathname)
 {
-     const cksum_t *cksum;
-
-     if (release->sha256sums) {
-	  cksum = cksum_list_find(release->sha256sums, pathname);
-	  return cksum->value;
-     }
+     const struct release_file *file;
 
-     return '\0';
+     file = hash_table_get(&release->files, pathname);
+     return file ? file->sha256 : NULL;
 }
 #endif
 
@@ -303,40 +368,34 @@ int
 release_verify_file(release_t *release, const char* file_name, const char *pathname)
 {
      struct stat f_info;
+     const struct release_file *file;
      char *f_md5 = NULL;
-     const char *md5 = release_get_md5(release, pathname);
-#ifdef HAVE_SHA256
      char *f_sha256 = NULL;
-     const char *sha256 = release_get_sha256(release, pathname);
-#endif
      int ret = 0;
 
-     if (stat(file_name, &f_info) || (f_info.st_size!=release_get_size(release, pathname))) {
+     file = hash_table_get(&release->files, pathname);
+
+     if (file == NULL || stat(file_name, &f_info)
+		     || f_info.st_size != file->size) {
 	  opkg_msg(ERROR, "Size verification failed for %s - %s.\n", release->name, pathname);
-	  ret = 1;
-     } else {
+	  return 1;
+     }
 
-     f_md5 = file_md5sum_alloc(file_name);
-#ifdef HAVE_SHA256
-     f_sha256 = file_sha256sum_alloc(file_name);
-#endif
+     /* Both checksums come from a single read of the file. */
+     if (file_digests_alloc(file_name, file->md5 ? &f_md5 : NULL,
+			     file->sha256 ? &f_sha256 : NULL))
+	  return 1;
 
-     if (md5 && strcmp(md5, f_md5)) {
+     if (f_md5 && strcmp(file->md5, f_md5)) {
 	  opkg_msg(ERROR, "MD5 verification failed for %s - %s.\n", release->name, pathname);
 	  ret = 1;
-#ifdef HAVE_SHA256
-     } else if (sha256 && strcmp(sha256, f_sha256)) {
+     } else if (f_sha256 && strcmp(file->sha256, f_sha256)) {
 	  opkg_msg(ERROR, "SHA256 verification failed for %s - %s.\n", release->name, pathname);
 	  ret = 1;
-#endif
-     }
-
      }
 
      free(f_md5);
-#ifdef HAVE_SHA256
      free(f_sha256);
-#endif
 
      return ret;
 }
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include "pkg.h"
 #include "cksum_list.h"
+#include "hash_table.h"
 
 struct release
 {
@@ -34,6 +35,7 @@ struct release
 #endif
      char **complist;
      unsigned int complist_count;
+     hash_table_t files;	/* the size and checksums of each, by path */
 };
 
 typedef struct release release_t;
@@ -22,18 +22,13 @@
 #include "xsystem.h"
 #include "libbb/libbb.h"
 
-/* Like system(3), but with error messages printed if the fork fails
-   or if the child process dies due to an uncaught signal. Also, the
-   return value is a bit simpler:
-
-   -1 if there was any problem
-   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
-   as defined in <sys/wait.h>.
+/* Start argv[0] with the given arguments, with its standard output and
+   error going to out_fd unless it is -1. Returns the pid of the child, or
+   -1 if it could not be started.
 */
-int
-xsystem(const char *argv[])
+pid_t
+xsystem_start(const char *argv[], int out_fd)
 {
-	int status;
 	pid_t pid;
 
 	pid = vfork();
@@ -44,6 +39,10 @@ xsystem(const char *argv[])
 		return -1;
 	case 0:
 		/* child */
+		if (out_fd != -1) {
+			dup2(out_fd, STDOUT_FILENO);
+			dup2(out_fd, STDERR_FILENO);
+		}
 		execvp(argv[0], (char*const*)argv);
 		_exit(-1);
 	default:
@@ -51,23 +50,53 @@ xsystem(const char *argv[])
 		break;
 	}
 
-	if (waitpid(pid, &status, 0) == -1) {
-		opkg_perror(ERROR, "%s: waitpid", argv[0]);
-		return -1;
-	}
+	return pid;
+}
 
+/* The return value of xsystem() for argv[0] having exited with status, as
+   from waitpid(2).
+*/
+int
+xsystem_status(const char *argv0, int status)
+{
 	if (WIFSIGNALED(status)) {
 		opkg_msg(ERROR, "%s: Child killed by signal %d.\n",
-			argv[0], WTERMSIG(status));
+			argv0, WTERMSIG(status));
 		return -1;
 	}
 
 	if (!WIFEXITED(status)) {
 		/* shouldn't happen */
 		opkg_msg(ERROR, "%s: Your system is broken: got status %d "
-			"from waitpid.\n", argv[0], status);
+			"from waitpid.\n", argv0, status);
 		return -1;
 	}
 
 	return WEXITSTATUS(status);
 }
+
+/* Like system(3), but with error messages printed if the fork fails
+   or if the child process dies due to an uncaught signal. Also, the
+   return value is a bit simpler:
+
+   -1 if there was any problem
+   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
+   as defined in <sys/wait.h>.
+*/
+int
+xsystem(const char *argv[])
+{
+	int status;
+	pid_t pid;
+
+	pid = xsystem_start(argv, -1);
+	if (pid == -1)
+		return -1;
+
+	if (waitpid(pid, &status, 0) == -1) {
+		opkg_perror(ERROR, "%s: waitpid", argv[0]);
+		return -1;
+	}
+
+	return xsystem_status(argv[0], status);
+}
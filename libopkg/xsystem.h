@@ -18,6 +18,8 @@
 #ifndef XSYSTEM_H
 #define XSYSTEM_H
 
+#include <sys/types.h>
+
 /* Like system(3), but with error messages printed if the fork fails
    or if the child process dies due to an uncaught signal. Also, the
    return value is a bit simpler:
@@ -28,5 +30,9 @@
 */
 int xsystem(const char *argv[]);
 
+/* xsystem() in two halves, for running several programs at once. */
+pid_t xsystem_start(const char *argv[], int out_fd);
+int xsystem_status(const char *argv0, int status);
+
 #endif
 
@@ -22,13 +22,16 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <getopt.h>
 
 #include "opkg_conf.h"
 #include "opkg_cmd.h"
+#include "opkg_daemon.h"
 #include "file_util.h"
 #include "opkg_message.h"
 #include "opkg_download.h"
+#include "opkg_profile.h"
 #include "../libbb/libbb.h"
 
 enum {
@@ -49,12 +52,23 @@ enum {
 	ARGS_OPT_NODEPS,
 	ARGS_OPT_AUTOREMOVE,
 	ARGS_OPT_CACHE,
+	ARGS_OPT_CACHE_SIZE,
+	ARGS_OPT_UNPACK_JOBS,
+	ARGS_OPT_CONFIGURE_JOBS,
+	ARGS_OPT_READ_AHEAD,
+	ARGS_OPT_STAGED_INSTALL,
+	ARGS_OPT_STREAM_INSTALL,
+	ARGS_OPT_PROFILE,
 };
 
+static char *profile_file;
+
 static struct option long_options[] = {
 	{"query-all", 0, 0, 'A'},
 	{"autoremove", 0, 0, ARGS_OPT_AUTOREMOVE},
 	{"cache", 1, 0, ARGS_OPT_CACHE},
+	{"cache-size", 1, 0, ARGS_OPT_CACHE_SIZE},
+	{"cache_size", 1, 0, ARGS_OPT_CACHE_SIZE},
 	{"conf-file", 1, 0, 'f'},
 	{"conf", 1, 0, 'f'},
 	{"dest", 1, 0, 'd'},
@@ -88,11 +102,22 @@ static struct option long_options[] = {
 	{"nodeps", 0, 0, ARGS_OPT_NODEPS},
 	{"offline", 1, 0, 'o'},
 	{"offline-root", 1, 0, 'o'},
+	{"profile", 1, 0, ARGS_OPT_PROFILE},
 	{"add-arch", 1, 0, ARGS_OPT_ADD_ARCH},
 	{"add-dest", 1, 0, ARGS_OPT_ADD_DEST},
+	{"staged-install", 0, 0, ARGS_OPT_STAGED_INSTALL},
+	{"staged_install", 0, 0, ARGS_OPT_STAGED_INSTALL},
+	{"stream-install", 0, 0, ARGS_OPT_STREAM_INSTALL},
+	{"stream_install", 0, 0, ARGS_OPT_STREAM_INSTALL},
 	{"test", 0, 0, ARGS_OPT_NOACTION},
 	{"tmp-dir", 1, 0, 't'},
 	{"tmp_dir", 1, 0, 't'},
+	{"unpack-jobs", 1, 0, ARGS_OPT_UNPACK_JOBS},
+	{"unpack_jobs", 1, 0, ARGS_OPT_UNPACK_JOBS},
+	{"configure-jobs", 1, 0, ARGS_OPT_CONFIGURE_JOBS},
+	{"configure_jobs", 1, 0, ARGS_OPT_CONFIGURE_JOBS},
+	{"read-ahead", 1, 0, ARGS_OPT_READ_AHEAD},
+	{"read_ahead", 1, 0, ARGS_OPT_READ_AHEAD},
 	{"verbosity", 2, 0, 'V'},
 	{"version", 0, 0, 'v'},
 	{0, 0, 0, 0}
@@ -143,6 +168,9 @@ args_parse(int argc, char *argv[])
 			free(conf->cache);
 			conf->cache = xstrdup(optarg);
 			break;
+		case ARGS_OPT_CACHE_SIZE:
+			conf->cache_size = atoi(optarg);
+			break;
 		case ARGS_OPT_FORCE_MAINTAINER:
 			conf->force_maintainer = 1;
 			break;
@@ -176,6 +204,24 @@ args_parse(int argc, char *argv[])
 		case ARGS_OPT_NODEPS:
 			conf->nodeps = 1;
 			break;
+		case ARGS_OPT_UNPACK_JOBS:
+			conf->unpack_jobs = atoi(optarg);
+			break;
+		case ARGS_OPT_CONFIGURE_JOBS:
+			conf->configure_jobs = atoi(optarg);
+			break;
+		case ARGS_OPT_READ_AHEAD:
+			conf->read_ahead = atoi(optarg);
+			break;
+		case ARGS_OPT_STAGED_INSTALL:
+			conf->staged_install = 1;
+			break;
+		case ARGS_OPT_STREAM_INSTALL:
+			conf->stream_install = 1;
+			break;
+		case ARGS_OPT_PROFILE:
+			profile_file = optarg;
+			break;
 		case ARGS_OPT_ADD_ARCH:
 		case ARGS_OPT_ADD_DEST:
 			tuple = xstrdup(optarg);
@@ -262,6 +308,8 @@ usage()
 	printf("\t-f <conf_file>		Use <conf_file> as the opkg configuration file\n");
 	printf("\t--conf <conf_file>\n");
 	printf("\t--cache <directory>	Use a package cache\n");
+	printf("\t--cache-size <kbytes>	Evict the least recently used packages\n");
+	printf("\t			to keep the cache within <kbytes>\n");
 	printf("\t-d <dest_name>		Use <dest_name> as the the root directory for\n");
 	printf("\t--dest <dest_name>	package installation, removal, upgrading.\n");
 	printf("				<dest_name> should be a defined dest name from\n");
@@ -269,6 +317,13 @@ usage()
 	printf("				directory name in a pinch).\n");
 	printf("\t-o <dir>		Use <dir> as the root directory for\n");
 	printf("\t--offline-root <dir>	offline installation of packages.\n");
+	printf("\t--unpack-jobs <n>	Unpack up to <n> packages at once when\n");
+	printf("\t			installing to an offline root.\n");
+	printf("\t--configure-jobs <n>	Run up to <n> postinst scripts at once,\n");
+	printf("\t			for packages not depending on each other.\n");
+	printf("\t--read-ahead <n>	Download and check up to <n> packages ahead\n");
+	printf("\t			of the one being installed.\n");
+	printf("\t--profile <file>	Write a trace of where the time went to <file>\n");
 	printf("\t--add-arch <arch>:<prio>	Register architecture with given priority\n");
 	printf("\t--add-dest <name>:<path>	Register destination with given path\n");
 
@@ -281,6 +336,9 @@ usage()
 	printf("\t--force-space		Disable free space checks\n");
 	printf("\t--force-postinstall	Run postinstall scripts even in offline mode\n");
 	printf("\t--force-remove	Remove package even if prerm script fails\n");
+	printf("\t--staged-install	Stage data files and rename them into place\n");
+	printf("\t--stream-install	Unpack packages as they are downloaded,\n");
+	printf("\t			without a copy of them in tmp-dir\n");
 	printf("\t--noaction		No action -- test only\n");
 	printf("\t--download-only	No action -- download only\n");
 	printf("\t--nodeps		Do not follow dependencies\n");
@@ -311,6 +369,7 @@ main(int argc, char *argv[])
 	opkg_cmd_t *cmd;
 	int nocheckfordirorfile = 0;
         int noreadfeedsfile = 0;
+	int partialfeeds = 0;
 
 	if (opkg_conf_init())
 		goto err0;
@@ -325,6 +384,9 @@ main(int argc, char *argv[])
 
 	cmd_name = argv[opts++];
 
+	if (profile_file && opkg_profile_open(profile_file))
+		goto err0;
+
 	if (!strcmp(cmd_name,"print-architecture") ||
 	    !strcmp(cmd_name,"print_architecture") ||
 	    !strcmp(cmd_name,"print-installation-architecture") ||
@@ -345,6 +407,11 @@ main(int argc, char *argv[])
 	    !strcmp(cmd_name,"status") )
 		noreadfeedsfile = 1;
 
+	/* These only need the packages named and what they depend upon. */
+	if (!strcmp(cmd_name,"install") ||
+	    !strcmp(cmd_name,"download") )
+		partialfeeds = 1;
+
 	cmd = opkg_cmd_find(cmd_name);
 	if (cmd == NULL) {
 		fprintf(stderr, "%s: unknown sub-command %s\n", argv[0],
@@ -353,17 +420,47 @@ main(int argc, char *argv[])
 	}
 
 	conf->pfm = cmd->pfm;
+	conf->lock_shared = cmd->read_only;
+	/* Queries wait out a command changing the database, rather than
+	   failing for the length of an upgrade. */
+	conf->lock_wait = OPKG_CONF_DEFAULT_LOCK_WAIT;
+
+	/* Queries without options can be answered by opkgd, if it is
+	   running, unless the environment points opkg at another system
+	   than the one opkgd loaded. */
+	if (opts == 2 && cmd->read_only
+			&& !(cmd->requires_args && opts == argc)
+			&& getenv("OFFLINE_ROOT") == NULL
+			&& getenv("OPKG_CONF_DIR") == NULL) {
+		err = opkg_daemon_query(NULL, argc - 1,
+				(const char **)(argv + 1));
+		if (err != -1)
+			return err;
+	}
 
-	if (opkg_conf_load())
+	opkg_profile_begin("load config", NULL);
+	err = opkg_conf_load();
+	opkg_profile_end();
+	if (err)
 		goto err0;
 
 	if (!nocheckfordirorfile) {
 		if (!noreadfeedsfile) {
-			if (pkg_hash_load_feeds())
+			opkg_profile_begin("load feeds", NULL);
+			if (partialfeeds)
+				err = pkg_hash_load_feeds_for(argc - opts,
+						(const char **)(argv + opts));
+			else
+				err = pkg_hash_load_feeds();
+			opkg_profile_end();
+			if (err)
 				goto err1;
 		}
 
-		if (pkg_hash_load_status_files())
+		opkg_profile_begin("load status", NULL);
+		err = pkg_hash_load_status_files();
+		opkg_profile_end();
+		if (err)
 			goto err1;
 	}
 
@@ -383,6 +480,7 @@ err1:
 	opkg_conf_deinit();
 
 err0:
+	opkg_profile_close();
 	print_error_list();
 	free_error_list();
 
@@ -0,0 +1,287 @@
+/* opkgd.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   opkg query daemon: keeps the package database loaded and answers
+   read-only sub-commands for opkg-cl over a Unix socket
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "opkg_conf.h"
+#include "opkg_cmd.h"
+#include "opkg_daemon.h"
+#include "opkg_message.h"
+#include "pkg_hash.h"
+#include "../libbb/libbb.h"
+
+/* Seconds a client has to send its request. */
+#define OPKGD_REQUEST_TIMEOUT 2
+
+static char *conf_file;
+static char *offline_root;
+static char *socket_path;
+
+static int loaded;
+static unsigned long long loaded_state;
+
+static struct option long_options[] = {
+	{"conf-file", 1, 0, 'f'},
+	{"conf", 1, 0, 'f'},
+	{"offline-root", 1, 0, 'o'},
+	{"socket", 1, 0, 's'},
+	{"verbosity", 2, 0, 'V'},
+	{0, 0, 0, 0}
+};
+
+static void
+usage(void)
+{
+	printf("usage: opkgd [options...]\n");
+	printf("\t-f <conf_file>		Use <conf_file> as the opkg configuration file\n");
+	printf("\t-o <dir>		Use <dir> as the root directory\n");
+	printf("\t-s <socket>		Answer queries on <socket> (default %s)\n",
+			OPKGDSOCKET);
+	printf("\t-V[<level>]		Set verbosity level to <level>.\n");
+	exit(1);
+}
+
+/*
+ * Something which changes whenever a package is installed or removed, or the
+ * package lists are updated.
+ */
+static unsigned long long
+state_signature(void)
+{
+	pkg_dest_list_elt_t *iter;
+	pkg_dest_t *dest;
+	unsigned long long sig = 0;
+	struct stat st;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *)iter->data;
+		if (stat(dest->status_file_name, &st) == 0)
+			sig = sig * 31 + st.st_ino + st.st_size
+				+ st.st_mtim.tv_sec * 1000000000ULL
+				+ st.st_mtim.tv_nsec;
+	}
+
+	if (stat(conf->lists_dir, &st) == 0)
+		sig = sig * 31 + st.st_mtim.tv_sec * 1000000000ULL
+			+ st.st_mtim.tv_nsec;
+
+	return sig;
+}
+
+static void
+unload(void)
+{
+	if (!loaded)
+		return;
+
+	opkg_conf_deinit();
+	loaded = 0;
+}
+
+static int
+load(void)
+{
+	int verbosity = conf->verbosity;
+
+	if (opkg_conf_init())
+		goto err0;
+
+	conf->verbosity = verbosity;
+	if (conf_file)
+		conf->conf_file = xstrdup(conf_file);
+	if (offline_root)
+		conf->offline_root = xstrdup(offline_root);
+
+	/* Fails while opkg-cl is changing things. */
+	conf->lock_shared = 1;
+	if (opkg_conf_load())
+		goto err0;
+
+	if (pkg_hash_load_feeds() || pkg_hash_load_status_files())
+		goto err1;
+
+	/* Paid once here rather than by whichever query comes first. */
+	pkg_hash_build_graph();
+	pkg_info_preinstall_check();
+
+	opkg_conf_unlock();
+
+	loaded_state = state_signature();
+	loaded = 1;
+	opkg_msg(INFO, "Loaded package database.\n");
+
+	return 0;
+
+err1:
+	opkg_conf_deinit();
+err0:
+	print_error_list();
+	free_error_list();
+	return -1;
+}
+
+static void
+serve(int fd)
+{
+	opkg_cmd_t *cmd;
+	char **argv;
+	int argc, err, fds[OPKGD_FDS];
+	pid_t pid;
+
+	if (opkg_daemon_read_request(fd, OPKGD_REQUEST_TIMEOUT, &argc,
+				&argv, fds)) {
+		opkg_daemon_reply(fd, OPKGD_UNAVAILABLE, 0);
+		return;
+	}
+
+	if (loaded && state_signature() != loaded_state)
+		unload();
+	if (!loaded && load())
+		goto unavailable;
+
+	cmd = opkg_cmd_find(argv[0]);
+	if (cmd == NULL || !cmd->read_only)
+		goto unavailable;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	/* The query runs on a copy of the database, so nothing it caches
+	   or changes outlives it. */
+	pid = fork();
+	if (pid == -1) {
+		opkg_perror(ERROR, "Failed to fork");
+		goto unavailable;
+	} else if (pid == 0) {
+		signal(SIGCHLD, SIG_DFL);
+		dup2(fds[0], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+
+		conf->pfm = cmd->pfm;
+		err = opkg_cmd_exec(cmd, argc - 1, (const char **)(argv + 1));
+
+		print_error_list();
+		fflush(stdout);
+		fflush(stderr);
+		opkg_daemon_reply(fd, OPKGD_EXIT, err);
+		_exit(0);
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	free(argv);
+	return;
+
+unavailable:
+	opkg_daemon_reply(fd, OPKGD_UNAVAILABLE, 0);
+	close(fds[0]);
+	close(fds[1]);
+	free(argv);
+}
+
+/* Reap finished queries as they finish, rather than on the next one. */
+static void
+reap_queries(int sig)
+{
+	int saved_errno = errno;
+
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+
+	errno = saved_errno;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	int c, option_index = 0;
+	int listen_fd, fd;
+
+	if (opkg_conf_init())
+		return 1;
+	conf->verbosity = NOTICE;
+
+	while ((c = getopt_long(argc, argv, "f:o:s:V::", long_options,
+					&option_index)) != -1) {
+		switch (c) {
+		case 'f':
+			conf_file = optarg;
+			break;
+		case 'o':
+			offline_root = optarg;
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'V':
+			if (optarg)
+				conf->verbosity = atoi(optarg);
+			else
+				conf->verbosity = INFO;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc)
+		usage();
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = reap_queries;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	if (load())
+		return 1;
+
+	listen_fd = opkg_daemon_listen(socket_path);
+	if (listen_fd == -1) {
+		print_error_list();
+		return 1;
+	}
+
+	while (1) {
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1) {
+			if (errno != EINTR)
+				opkg_perror(ERROR, "Failed to accept");
+		} else {
+			serve(fd);
+			close(fd);
+		}
+
+		print_error_list();
+		free_error_list();
+	}
+
+	return 0;
+}
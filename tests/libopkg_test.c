@@ -76,8 +76,8 @@ print_package (pkg_t *pkg)
       v,
       pkg->src->name,
       pkg->architecture,
-      pkg->description,
-      pkg->tags? pkg->tags : "",
+      pkg_cold_get(pkg, description),
+      pkg_cold_get(pkg, tags)? pkg_cold_get(pkg, tags) : "",
       pkg->size,
       pkg->state_status);
   free(v);
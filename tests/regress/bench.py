@@ -0,0 +1,96 @@
+#!/usr/bin/python3
+#
+# Time the phases of opkg against a synthetic feed, using the --profile
+# trace, and append the results to a file of JSON lines so that they can be
+# compared from run to run.
+#
+# usage: bench.py [--runs n] [--results file] [feedgen.py options]
+
+import os, json, time, argparse, subprocess
+import opk, opkgcl, feedgen
+
+TRACE = "/tmp/opkg-bench-trace.json"
+
+def profile(command, args=""):
+	"""Run the opkg-cl sub-command, and return the time in ms spent in
+	each kind of span, with the sub-command itself as "command"."""
+	status, output = opkgcl.opkgcl("--profile {} {} {}".format(TRACE,
+			command, args))
+	if status != 0:
+		print(output)
+		exit(False)
+
+	totals = {}
+	for e in json.load(open(TRACE))["traceEvents"]:
+		key = e["name"]
+		if key == command and "subject" not in e["args"]:
+			key = "command"
+		totals[key] = totals.get(key, 0) + e["dur"] / 1000.0
+	os.unlink(TRACE)
+	return totals
+
+def run_once(feed):
+	opk.regress_init()
+	names = " ".join(feed.installable_names())
+	opkgcl.update()
+
+	results = {}
+	p = profile("list")
+	results["feed load"] = p["load feeds"]
+
+	p = profile("install", names)
+	results["preinstall check"] = p["preinstall check"]
+	results["candidate selection"] = p.get("select", 0)
+	results["solve"] = p.get("solve", 0)
+	results["extract"] = p.get("extract", 0)
+	results["install"] = p["command"]
+
+	p = profile("list-installed")
+	results["status load"] = p["load status"]
+
+	p = profile("list-upgradable")
+	results["version compare"] = p["command"]
+
+	p = profile("remove", names)
+	results["remove"] = p["command"]
+
+	return results
+
+def revision():
+	status, output = subprocess.getstatusoutput(
+			"git describe --always --dirty 2>/dev/null")
+	return output if status == 0 else None
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--runs", type=int, default=3)
+parser.add_argument("--results", default="bench-results.jsonl")
+feedgen.add_arguments(parser)
+args = parser.parse_args()
+results_file = os.path.abspath(args.results)
+rev = revision()
+
+opk.regress_init()
+feed = feedgen.from_arguments(args)
+start = time.time()
+feed.write()
+print("Generated {} packages ({} installable) in {:.1f}s.".format(
+		feed.packages, feed.installable, time.time() - start))
+
+# The best of several runs is the least disturbed by anything else.
+best = {}
+for i in range(args.runs):
+	for k, v in run_once(feed).items():
+		best[k] = min(best.get(k, v), v)
+
+for k in sorted(best):
+	print("{:20} {:10.2f} ms".format(k, best[k]))
+
+params = dict(vars(args))
+del params["results"]
+record = {"time": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+		"revision": rev, "params": params,
+		"results_ms": dict((k, round(v, 3)) for k, v in best.items())}
+f = open(results_file, "a")
+f.write(json.dumps(record, sort_keys=True) + "\n")
+f.close()
+print("Results appended to {}.".format(results_file))
@@ -0,0 +1,119 @@
+#!/usr/bin/python3
+#
+# Upgrade many packages through the cache, once downloading all of each
+# new package and once making them from deltas against the installed ones,
+# and report the bytes saved and the time spent making the packages.
+#
+# usage: bench_delta.py [packages] [files per package] [changed files]
+
+import os, sys, json, time, shutil, hashlib
+import opk, cfg, opkgcl, deltafeed
+
+npkgs = int(sys.argv[1]) if len(sys.argv) > 1 else 100
+nfiles = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+nchanged = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+
+TRACE = "/tmp/opkg-bench-trace.json"
+
+def write_pkgs(version):
+	"""Write every package at version, in which the first nchanged files
+	differ from version to version, and return them."""
+	o = opk.OpkGroup()
+	for i in range(npkgs):
+		name = "bench{}".format(i)
+		os.makedirs("usr/share/{}".format(name))
+		for j in range(nfiles):
+			f = open("usr/share/{}/f{}".format(name, j), "w")
+			tag = version if j < nchanged else j
+			f.write("{} {}\n".format(name, tag) * (j * 64 + 16))
+			f.close()
+		o.add(Package=name, Version=version, Architecture="all")
+		filename = o.opk_list[-1].write(data_files=["usr"],
+				compress=False)
+		shutil.rmtree("usr")
+		o.opk_list[-1].control["MD5Sum"] = hashlib.md5(
+				open(filename, "rb").read()).hexdigest()
+	return o
+
+def install(root, url):
+	cfg.offline_root = root
+	opk.regress_init()
+	f = open("{}/etc/opkg/opkg.conf".format(root), "w")
+	f.write("arch all 1\n")
+	f.write("src test {}\n".format(url))
+	f.close()
+	opkgcl.update()
+	shutil.rmtree("{}.cache".format(root), ignore_errors=True)
+	os.makedirs("{}.cache".format(root))
+	status, output = opkgcl.opkgcl("--cache {}.cache install {}".format(
+		root, " ".join("bench{}".format(i) for i in range(npkgs))))
+	if status != 0:
+		print(output)
+		exit(False)
+
+def upgrade(root):
+	"""Upgrade root, and return the time taken and the time spent in
+	making packages from deltas, in seconds, and how many were made."""
+	cfg.offline_root = root
+	opkgcl.update()
+	start = time.time()
+	status, output = opkgcl.opkgcl("--profile {} --cache {}.cache upgrade"
+			.format(TRACE, root))
+	elapsed = time.time() - start
+	if status != 0:
+		print(output)
+		exit(False)
+	spans = [e for e in json.load(open(TRACE))["traceEvents"]
+			if e["name"] == "delta"]
+	os.unlink(TRACE)
+	return elapsed, sum(e["dur"] for e in spans) / 1e6, len(spans)
+
+url = deltafeed.serve()
+opk.regress_init()
+write_pkgs("1.0").write_list()
+old = dict(("bench{}".format(i), "bench{}_1.0_all.opk.old".format(i))
+		for i in range(npkgs))
+install("/tmp/opkg-full", url)
+install("/tmp/opkg-delta", url)
+for name, old_file in old.items():
+	os.rename("{}_1.0_all.opk".format(name), old_file)
+
+new = write_pkgs("2.0")
+new.write_list()
+full, _, _ = upgrade("/tmp/opkg-full")
+
+for o in new.opk_list:
+	o.control["Deltas"] = "1.0 {}_1.0_2.0.opkdelta".format(
+			o.control["Package"])
+new.write_list()
+full_bytes = delta_bytes = 0
+for name, old_file in old.items():
+	new_file = "{}_2.0_all.opk".format(name)
+	full_bytes += os.path.getsize(new_file)
+	delta_bytes += deltafeed.make_delta(old_file, new_file,
+			"{}_1.0_2.0.opkdelta".format(name))
+delta, made_time, made = upgrade("/tmp/opkg-delta")
+
+same = os.system("diff -r /tmp/opkg-full/usr/share "
+		"/tmp/opkg-delta/usr/share") == 0
+
+print("{} packages, {} files each, {} changed".format(npkgs, nfiles,
+		nchanged))
+print("full:      {} bytes, upgraded in {:.2f}s".format(full_bytes, full))
+print("deltas:    {} bytes, upgraded in {:.2f}s".format(delta_bytes, delta))
+print("saved:     {} bytes ({:.1f}%)".format(full_bytes - delta_bytes,
+		100.0 * (full_bytes - delta_bytes) / full_bytes))
+print("made:      {} of {} packages in {:.3f}s ({:.2f} ms each)".format(
+		made, npkgs, made_time, 1000.0 * made_time / max(made, 1)))
+print("identical: {}".format("yes" if same else "NO"))
+
+for name, old_file in old.items():
+	os.unlink(old_file)
+	os.unlink("{}_1.0_2.0.opkdelta".format(name))
+for root in ("/tmp/opkg-full", "/tmp/opkg-delta"):
+	shutil.rmtree(root)
+	shutil.rmtree("{}.cache".format(root))
+cfg.offline_root = "/tmp/opkg"
+
+if not same or made != npkgs:
+	exit(1)
@@ -0,0 +1,66 @@
+#!/usr/bin/python3
+#
+# Time an offline root install of many packages, unpacked serially and
+# with --unpack-jobs, and check that both produce the same root.
+#
+# usage: bench_unpack.py [packages] [files per package] [jobs]
+
+import os, sys, time, shutil
+import opk, cfg, opkgcl
+
+npkgs = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+nfiles = int(sys.argv[2]) if len(sys.argv) > 2 else 50
+jobs = int(sys.argv[3]) if len(sys.argv) > 3 else os.cpu_count()
+
+def install_all(root, flags):
+	cfg.offline_root = root
+	opk.regress_init()
+	opkgcl.update()
+	start = time.time()
+	status, output = opkgcl.opkgcl("{} install top".format(flags))
+	elapsed = time.time() - start
+	if status != 0:
+		print(output)
+		exit(False)
+	status = open("{}/usr/lib/opkg/status".format(root)).readlines()
+	status = [l for l in status if not l.startswith("Installed-Time:")]
+	return elapsed, status
+
+opk.regress_init()
+
+o = opk.OpkGroup()
+names = []
+for i in range(npkgs):
+	name = "bench{}".format(i)
+	os.makedirs("usr/share/{}".format(name))
+	for j in range(nfiles):
+		f = open("usr/share/{}/f{}".format(name, j), "w")
+		f.write("{} {}\n".format(name, j) * (j * 16))
+		f.close()
+	o.add(Package=name, Version="1.0", Architecture="all")
+	o.opk_list[-1].write(data_files=["usr"])
+	shutil.rmtree("usr")
+	names.append(name)
+o.add(Package="top", Version="1.0", Architecture="all",
+		Depends=", ".join(names))
+o.opk_list[-1].write()
+o.write_list()
+
+serial, serial_status = install_all("/tmp/opkg-serial", "")
+bulk, bulk_status = install_all("/tmp/opkg-bulk",
+		"--unpack-jobs {}".format(jobs))
+
+same = serial_status == bulk_status and os.system(
+		"diff -r -x status /tmp/opkg-serial /tmp/opkg-bulk") == 0
+
+print("{} packages, {} files each".format(npkgs, nfiles))
+print("serial:    {:.2f}s".format(serial))
+print("{} jobs:   {:.2f}s ({:.1f}x)".format(jobs, bulk, serial / bulk))
+print("identical: {}".format("yes" if same else "NO"))
+
+shutil.rmtree("/tmp/opkg-serial")
+shutil.rmtree("/tmp/opkg-bulk")
+cfg.offline_root = "/tmp/opkg"
+
+if not same:
+	exit(1)
@@ -0,0 +1,52 @@
+#!/usr/bin/python3
+
+import os
+import opk, cfg, opkgcl
+
+def install_all(root, flags):
+	cfg.offline_root = root
+	opk.regress_init()
+	opkgcl.update()
+	opkgcl.install("top", flags)
+	return opkgcl.tree(root)
+
+opk.regress_init()
+
+o = opk.OpkGroup()
+deps = []
+for i in range(12):
+	name = "p{}".format(i)
+	os.makedirs("usr/share/{}".format(name))
+	for j in range(20):
+		f = open("usr/share/{}/f{}".format(name, j), "w")
+		f.write("{} {}\n".format(name, j) * j)
+		f.close()
+	if i % 3 == 0:
+		f = open("usr/share/shared", "w")
+		f.write("{}\n".format(name))
+		f.close()
+	o.add(Package=name, Version="1.0", Architecture="all",
+		Replaces=",".join(deps) if deps else "none")
+	o.opk_list[-1].write(data_files=["usr"])
+	os.system("rm -rf usr")
+	deps.append(name)
+o.add(Package="top", Version="1.0", Architecture="all",
+		Depends=", ".join(deps))
+o.opk_list[-1].write()
+o.write_list()
+
+serial = install_all("/tmp/opkg-serial", "")
+bulk = install_all("/tmp/opkg-bulk", "--unpack-jobs 4")
+
+os.system("rm -fr /tmp/opkg-serial /tmp/opkg-bulk")
+cfg.offline_root = "/tmp/opkg"
+
+if "usr/share/shared" not in serial:
+	print(__file__, ": shared file not installed.")
+	exit(False)
+
+if serial != bulk:
+	for k in sorted(set(serial) | set(bulk)):
+		if serial.get(k) != bulk.get(k):
+			print(__file__, ": {} differs after parallel unpack.".format(k))
+	exit(False)
@@ -0,0 +1,96 @@
+#!/usr/bin/python3
+#
+# Packages are cached by their checksum, and the least recently used are
+# removed when the cache grows beyond --cache-size, but only once the
+# command has finished with them: a package and its dependency which do not
+# both fit are still installed. Packages from file: feeds are not cached.
+
+import os, shutil, hashlib
+import opk, cfg, opkgcl, deltafeed
+
+CACHE = "/tmp/opkg-cache"
+
+def write_pkg(name, **control):
+	"""Write package name with 200KB of data which does not compress."""
+	os.makedirs("usr/share")
+	open("usr/share/{}".format(name), "wb").write(os.urandom(200 * 1024))
+	o = opk.Opk(Package=name, Version="1.0", Architecture="all", **control)
+	filename = o.write(data_files=["usr"])
+	shutil.rmtree("usr")
+	o.control["MD5Sum"] = hashlib.md5(open(filename, "rb").read())\
+			.hexdigest()
+	return o
+
+def cached():
+	"""The checksums of the packages in the cache, by the index, after
+	checking that the files are there too."""
+	index = open("{}/index".format(CACHE)).read().split("\n")
+	digests = sorted(l.split()[0] for l in index if l)
+	files = sorted(f for f in os.listdir(CACHE) if f != "index")
+	if digests != files:
+		print(__file__, ": Cache index {} does not match files {}."
+				.format(digests, files))
+		exit(False)
+	return digests
+
+opk.regress_init()
+shutil.rmtree(CACHE, ignore_errors=True)
+os.makedirs(CACHE)
+
+pkgs = [write_pkg("a", Depends="b"), write_pkg("b"), write_pkg("c")]
+md5 = dict((o.control["Package"], o.control["MD5Sum"]) for o in pkgs)
+g = opk.OpkGroup()
+g.opk_list = pkgs
+g.write_list()
+
+# A file: feed is used where it is.
+opkgcl.update()
+status, output = opkgcl.opkgcl("--cache {} install c".format(CACHE))
+if status != 0 or not opkgcl.is_installed("c"):
+	print(__file__, ": install c failed:\n{}".format(output))
+	exit(False)
+if os.listdir(CACHE):
+	print(__file__, ": Package from a file: feed cached: {}"
+			.format(os.listdir(CACHE)))
+	exit(False)
+opkgcl.remove("c")
+
+url = deltafeed.serve()
+f = open("{}/etc/opkg/opkg.conf".format(cfg.offline_root), "w")
+f.write("arch all 1\n")
+f.write("src test {}\n".format(url))
+f.close()
+opkgcl.update()
+
+# Only one of a and b fits, but both are needed until a is installed.
+status, output = opkgcl.opkgcl("--cache {} --cache-size 250 install a"
+		.format(CACHE))
+if status != 0 or not opkgcl.is_installed("a") \
+		or not opkgcl.is_installed("b"):
+	print(__file__, ": install a failed:\n{}".format(output))
+	exit(False)
+if len(cached()) != 1:
+	print(__file__, ": Cache not cut down to 250KB: {}".format(cached()))
+	exit(False)
+
+# The package used last is kept.
+status, output = opkgcl.opkgcl("--cache {} --cache-size 250 install c"
+		.format(CACHE))
+if status != 0 or not opkgcl.is_installed("c"):
+	print(__file__, ": install c failed:\n{}".format(output))
+	exit(False)
+if cached() != [md5["c"]]:
+	print(__file__, ": c not kept in the cache: {}".format(cached()))
+	exit(False)
+
+# Without a size, the cache keeps everything.
+opkgcl.remove("a")
+opkgcl.remove("b")
+status, output = opkgcl.opkgcl("--cache {} install a".format(CACHE))
+if status != 0 or cached() != sorted(md5.values()):
+	print(__file__, ": a and b not cached:\n{}".format(output))
+	exit(False)
+
+shutil.rmtree(CACHE)
+for o in pkgs:
+	os.unlink("{}_1.0_all.opk".format(o.control["Package"]))
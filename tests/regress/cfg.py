@@ -2,4 +2,6 @@ import os
 
 opkdir = "/tmp/opk"
 offline_root = "/tmp/opkg"
-opkgcl = os.path.realpath("../../src/opkg-cl")
+# The opkg-cl of a build outside the source tree can be given in OPKGCL.
+opkgcl = os.environ.get("OPKGCL") or os.path.realpath("../../src/opkg-cl")
+opkgd = os.path.realpath("../../src/opkgd")
@@ -0,0 +1,51 @@
+#!/usr/bin/python3
+#
+# The md5sums of conffiles are kept by the identity of each file, so check
+# that a conffile changed behind opkg's back is still seen as modified, even
+# when its size and modification time are put back as they were.
+
+import os, time
+import opk, cfg, opkgcl
+
+def changed():
+	status, output = opkgcl.opkgcl("list-changed-conffiles")
+	return [l for l in output.split("\n") if l]
+
+def check(expected):
+	found = changed()
+	if found != expected:
+		print(__file__, ": list-changed-conffiles gave {} rather than {}."
+				.format(found, expected))
+		exit(False)
+
+opk.regress_init()
+
+os.makedirs("etc")
+open("etc/a.conf", "w").write("setting=1\n")
+opk.Opk(Package="a", Version="1.0", Architecture="all").write(
+		data_files=["etc"], conffiles=["/etc/a.conf"])
+os.system("rm -rf etc")
+
+opkgcl.install("a_1.0_all.opk")
+
+conffile = "{}/etc/a.conf".format(cfg.offline_root)
+digests = "{}/usr/lib/opkg/conffiles.md5".format(cfg.offline_root)
+
+# Digests of files changed within the last second are not kept.
+old = os.stat(conffile).st_mtime - 10
+os.utime(conffile, (old, old))
+time.sleep(1.1)
+
+check([])
+if not os.path.exists(digests):
+	print(__file__, ": the conffile md5sums were not saved.")
+	exit(False)
+check([])
+
+open(conffile, "w").write("setting=2\n")
+os.utime(conffile, (old, old))
+check(["/etc/a.conf"])
+
+open(conffile, "w").write("setting=1\n")
+os.utime(conffile, (old, old))
+check([])
@@ -0,0 +1,69 @@
+#!/usr/bin/python3
+#
+# With --configure-jobs, the postinst scripts of packages which do not depend
+# on each other run at the same time, while a package is still configured
+# only after those it depends on, and a failing postinst leaves just its own
+# package unconfigured.
+
+import os
+import opk, cfg, opkgcl
+
+def write_pkg(name, postinst, depends=None):
+	control = dict(Package=name, Version="1.0", Architecture="all")
+	if depends:
+		control["Depends"] = depends
+	opk.Opk(**control).write(scripts={"postinst": "#!/bin/sh\n" + postinst})
+
+def is_configured(name):
+	status, output = opkgcl.opkgcl("status {}".format(name))
+	for line in output.split("\n"):
+		if line.startswith("Status:"):
+			return line.split()[-1] == "installed"
+	return False
+
+opk.regress_init()
+
+# c and d each wait for the other to have started.
+wait_for = """touch $PKG_ROOT/started-{0}
+i=0
+while [ ! -e $PKG_ROOT/started-{1} ]; do
+	i=$((i+1))
+	[ $i -gt 100 ] && exit 1
+	sleep 0.1
+done
+echo {0} configured
+"""
+
+write_pkg("a", "sleep 0.5; touch $PKG_ROOT/done-a\n")
+write_pkg("b", "[ -e $PKG_ROOT/done-a ]\n", depends="a")
+write_pkg("c", wait_for.format("c", "d"))
+write_pkg("d", wait_for.format("d", "c"))
+write_pkg("e", "exit 3\n")
+write_pkg("f", "echo f configured\n", depends="e")
+
+status, output = opkgcl.opkgcl("--force-postinstall --configure-jobs 4 "
+		"install a_1.0_all.opk b_1.0_all.opk c_1.0_all.opk "
+		"d_1.0_all.opk e_1.0_all.opk f_1.0_all.opk")
+
+for name in "abcdf":
+	if not is_configured(name):
+		print(__file__, ": {} was not configured:\n{}".format(name,
+				output))
+		exit(False)
+
+if is_configured("e"):
+	print(__file__, ": e was configured although its postinst failed.")
+	exit(False)
+
+if status == 0 or "e.postinst returned 3" not in output:
+	print(__file__, ": the failure of e was not reported:\n" + output)
+	exit(False)
+
+# The output of each script follows the line saying it is configured.
+lines = output.split("\n")
+for name in "cdf":
+	i = lines.index("Configuring {}.".format(name))
+	if lines[i + 1] != "{} configured".format(name):
+		print(__file__, ": the output of {} was not kept together:\n{}"
+				.format(name, output))
+		exit(False)
@@ -0,0 +1,117 @@
+#!/usr/bin/python3
+#
+# Package members may be uncompressed, or compressed with any of the
+# decompressors opkg was built with, whatever their file names say, whether
+# installed from a copy or as they are downloaded with --stream-install. A
+# src/gz feed is read from the best compressed index it publishes. A
+# package needing a decompressor which was not built in fails saying so.
+
+import os, lzma, shutil, tarfile
+import opk, cfg, opkgcl
+
+def compress(name, fmt):
+	"""Compress name in place, keeping its name, with fmt."""
+	if fmt == "xz":
+		data = open(name, "rb").read()
+		open(name, "wb").write(lzma.compress(data))
+	elif fmt in ("zstd", "lz4"):
+		os.system("{} -q -c {} > {}.tmp".format(fmt, name, name))
+		os.rename("{}.tmp".format(name), name)
+
+def write_opk(name, fmt, suffix):
+	"""Write package name with members compressed with fmt but named
+	with suffix, with a file /usr/share/<name>."""
+	os.makedirs("usr/share")
+	open("usr/share/{}".format(name), "w").write("{}\n".format(name) * 100)
+	open("control", "w").write("Package: {}\nVersion: 1.0\n"
+			"Architecture: all\n".format(name))
+
+	for member, files in (("control", ["control"]), ("data", ["usr"])):
+		tar = tarfile.open("{}.tar".format(member), "w",
+				format=tarfile.GNU_FORMAT)
+		for f in files:
+			tar.add(f)
+		tar.close()
+		compress("{}.tar".format(member), fmt)
+		os.rename("{}.tar".format(member),
+				"{}.tar{}".format(member, suffix))
+
+	opk_name = "{}_1.0_all.opk".format(name)
+	if os.path.exists(opk_name):
+		os.unlink(opk_name)
+	os.system("ar q {} control.tar{} data.tar{} 2>/dev/null"
+			.format(opk_name, suffix, suffix))
+	os.unlink("control.tar{}".format(suffix))
+	os.unlink("data.tar{}".format(suffix))
+	os.unlink("control")
+	shutil.rmtree("usr")
+
+opk.regress_init()
+
+# name, compression, member suffix
+pkgs = [("plainpkg", None, ""),
+	("xzpkg", "xz", ".xz"),
+	("misnamedpkg", "xz", ".gz")]
+for fmt, suffix in (("zstd", ".zst"), ("lz4", ".lz4")):
+	if shutil.which(fmt):
+		pkgs.append(("{}pkg".format(fmt), fmt, suffix))
+
+for name, fmt, suffix in pkgs:
+	write_opk(name, fmt, suffix)
+
+# The indexes tell which one was read by the description they give.
+for fmt in ("xz", "gzip"):
+	o = opk.OpkGroup()
+	for name, f, suffix in pkgs:
+		o.add(Package=name, Version="1.0", Architecture="all",
+				Description="from {}".format(fmt))
+	o.write_list()
+	if fmt == "xz":
+		data = open("Packages", "rb").read()
+		open("Packages.xz", "wb").write(lzma.compress(data))
+		os.unlink("Packages")
+	else:
+		os.system("gzip -f Packages")
+
+f = open("{}/etc/opkg/opkg.conf".format(cfg.offline_root), "w")
+f.write("arch all 1\n")
+f.write("src/gz test file:{}\n".format(cfg.opkdir))
+f.close()
+
+status, output = opkgcl.opkgcl("update")
+if status != 0:
+	print(__file__, ": update failed:\n{}".format(output))
+	exit(False)
+
+have = set()
+for flags in ("", "--stream-install"):
+	for name, fmt, suffix in pkgs:
+		status, output = opkgcl.opkgcl("{} install {}"
+				.format(flags, name))
+		if fmt and "which was not compiled in" in output:
+			if status == 0 or opkgcl.is_installed(name):
+				print(__file__, ": {} installed without {} "
+						"support.".format(name, fmt))
+				exit(False)
+			continue
+		if status != 0:
+			print(__file__, ": install {} {} failed:\n{}"
+					.format(flags, name, output))
+			exit(False)
+		have.add(fmt)
+		path = "{}/usr/share/{}".format(cfg.offline_root, name)
+		if not os.path.exists(path) or \
+				open(path).read() != "{}\n".format(name) * 100:
+			print(__file__, ": {} not installed from {} members "
+					"with {}.".format(name, fmt, flags))
+			exit(False)
+		opkgcl.remove(name)
+
+index = "xz" if "xz" in have else "gzip"
+output = opkgcl.opkgcl("info plainpkg")[1]
+if "Description: from {}".format(index) not in output:
+	print(__file__, ": {} index not read:\n{}".format(index, output))
+	exit(False)
+
+os.unlink("Packages.xz")
+os.unlink("Packages.gz")
@@ -0,0 +1,119 @@
+#!/usr/bin/python3
+#
+# An upgrade through the cache makes the new package from a delta against
+# the cached copy of the installed one, where the feed names one in the
+# Deltas field, even when the delta is compressed. A delta which does not
+# give a package matching its checksum, or which makes one larger than its
+# Size, is dropped for the full download.
+
+import os, gzip, struct, shutil, hashlib
+import opk, cfg, opkgcl, deltafeed
+
+CACHE = "/tmp/opkg-delta-cache"
+
+def write_pkg(name, version, change, **control):
+	"""Write package name at version, with a few files of which the
+	one named change differs from version to version."""
+	os.makedirs("usr/share/{}".format(name))
+	for i in range(4):
+		f = open("usr/share/{}/{}".format(name, i), "w")
+		if i == change:
+			f.write("{} {}\n".format(name, version) * 50)
+		else:
+			f.write("{} {}\n".format(name, i) * 1000)
+		f.close()
+	o = opk.Opk(Package=name, Version=version, Architecture="all",
+			**control)
+	filename = o.write(data_files=["usr"], compress=False)
+	shutil.rmtree("usr")
+	o.control["MD5Sum"] = hashlib.md5(open(filename, "rb").read())\
+			.hexdigest()
+	o.control["Size"] = os.path.getsize(filename)
+	return o
+
+def write_list(pkgs):
+	g = opk.OpkGroup()
+	g.opk_list = pkgs
+	g.write_list()
+
+def upgrade():
+	opkgcl.update()
+	return opkgcl.opkgcl("--cache {} upgrade".format(CACHE))
+
+opk.regress_init()
+shutil.rmtree(CACHE, ignore_errors=True)
+os.makedirs(CACHE)
+
+url = deltafeed.serve()
+f = open("{}/etc/opkg/opkg.conf".format(cfg.offline_root), "w")
+f.write("arch all 1\n")
+f.write("src test {}\n".format(url))
+f.close()
+
+a1 = write_pkg("a", "1.0", 0)
+b1 = write_pkg("b", "1.0", 0)
+c1 = write_pkg("c", "1.0", 0)
+write_list([a1, b1, c1])
+opkgcl.update()
+status, output = opkgcl.opkgcl("--cache {} install a b c".format(CACHE))
+if status != 0:
+	print(__file__, ": install failed:\n{}".format(output))
+	exit(False)
+
+os.rename("a_1.0_all.opk", "a_1.0_all.opk.old")
+os.rename("b_1.0_all.opk", "b_1.0_all.opk.old")
+os.rename("c_1.0_all.opk", "c_1.0_all.opk.old")
+
+# a's delta is good, and is gzipped. There is no full package to fall
+# back to, so a can only be upgraded from its delta.
+a2 = write_pkg("a", "2.0", 1, Deltas="1.0 a_1.0_2.0.opkdelta")
+deltafeed.make_delta("a_1.0_all.opk.old", "a_2.0_all.opk", "delta")
+data = open("delta", "rb").read()
+open("a_1.0_2.0.opkdelta", "wb").write(gzip.compress(data))
+os.unlink("delta")
+os.unlink("a_2.0_all.opk")
+
+# b's delta is to another build of b 2.0 than the one in the index.
+write_pkg("b", "2.0", 2)
+deltafeed.make_delta("b_1.0_all.opk.old", "b_2.0_all.opk",
+		"b_1.0_2.0.opkdelta")
+b2 = write_pkg("b", "2.0", 1, Deltas="1.0 b_1.0_2.0.opkdelta")
+
+# c's delta copies the whole of the old package over and over.
+c2 = write_pkg("c", "2.0", 1, Deltas="1.0 c_1.0_2.0.opkdelta")
+old_size = os.path.getsize("c_1.0_all.opk.old")
+open("c_1.0_2.0.opkdelta", "wb").write(deltafeed.MAGIC
+		+ (b"C" + struct.pack(">QQ", 0, old_size)) * 1000 + b"E")
+
+write_list([a2, b2, c2])
+status, output = upgrade()
+if status != 0:
+	print(__file__, ": upgrade failed:\n{}".format(output))
+	exit(False)
+
+for name in ("a", "b", "c"):
+	if not opkgcl.is_installed(name, "2.0"):
+		print(__file__, ": {} not upgraded:\n{}".format(name, output))
+		exit(False)
+	path = "{}/usr/share/{}/1".format(cfg.offline_root, name)
+	if open(path).read() != "{} 2.0\n".format(name) * 50:
+		print(__file__, ": {} upgraded to the wrong files.".format(name))
+		exit(False)
+
+if "Downloading all of a" in output:
+	print(__file__, ": a downloaded despite its delta:\n{}".format(output))
+	exit(False)
+if "Downloading all of b" not in output:
+	print(__file__, ": b made from a bad delta:\n{}".format(output))
+	exit(False)
+if "Downloading all of c" not in output \
+		or "larger than its size" not in output:
+	print(__file__, ": c made from an oversized delta:\n{}"
+			.format(output))
+	exit(False)
+
+shutil.rmtree(CACHE)
+for f in ("a_1.0_all.opk.old", "b_1.0_all.opk.old", "b_2.0_all.opk",
+		"c_1.0_all.opk.old", "c_2.0_all.opk", "a_1.0_2.0.opkdelta",
+		"b_1.0_2.0.opkdelta", "c_1.0_2.0.opkdelta"):
+	os.unlink(f)
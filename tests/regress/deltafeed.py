@@ -0,0 +1,69 @@
+#!/usr/bin/python3
+#
+# Helpers for a feed with deltas: make a delta from one package to another
+# in the format of libopkg/opkg_delta.h, and serve the feed over HTTP, since
+# packages from file: feeds are not cached and so cannot be delta bases.
+
+import os, struct, threading, functools, http.server
+import cfg
+
+MAGIC = b"OPKDELTA1\n"
+BLOCK = 64
+
+def make_delta(old_file, new_file, delta_file):
+	"""Write a delta from old_file to new_file, made of copies of the
+	BLOCK aligned blocks of old_file, extended as far as they match, and
+	of the bytes between them. Return its size."""
+	old = open(old_file, "rb").read()
+	new = open(new_file, "rb").read()
+
+	blocks = {}
+	for off in range(0, len(old) - BLOCK + 1, BLOCK):
+		blocks.setdefault(old[off:off + BLOCK], off)
+
+	out = [MAGIC]
+	add_start = i = 0
+	while i + BLOCK <= len(new):
+		off = blocks.get(new[i:i + BLOCK])
+		if off is None:
+			i += 1
+			continue
+		while off > 0 and i > add_start and old[off - 1] == new[i - 1]:
+			off -= 1
+			i -= 1
+		n = BLOCK
+		while off + n + BLOCK <= len(old) and i + n + BLOCK <= len(new) \
+				and old[off + n:off + n + BLOCK] \
+					== new[i + n:i + n + BLOCK]:
+			n += BLOCK
+		while off + n < len(old) and i + n < len(new) \
+				and old[off + n] == new[i + n]:
+			n += 1
+		if i > add_start:
+			out.append(b"A" + struct.pack(">Q", i - add_start)
+					+ new[add_start:i])
+		out.append(b"C" + struct.pack(">QQ", off, n))
+		i += n
+		add_start = i
+	if len(new) > add_start:
+		out.append(b"A" + struct.pack(">Q", len(new) - add_start)
+				+ new[add_start:])
+	out.append(b"E")
+
+	f = open(delta_file, "wb")
+	f.write(b"".join(out))
+	f.close()
+	return os.path.getsize(delta_file)
+
+class QuietHandler(http.server.SimpleHTTPRequestHandler):
+	def log_message(self, format, *args):
+		pass
+
+def serve():
+	"""Serve cfg.opkdir on a free port in the background, and return its
+	URL."""
+	handler = functools.partial(QuietHandler, directory=cfg.opkdir)
+	server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), handler)
+	thread = threading.Thread(target=server.serve_forever, daemon=True)
+	thread.start()
+	return "http://127.0.0.1:{}".format(server.server_address[1])
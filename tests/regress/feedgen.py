@@ -0,0 +1,134 @@
+#!/usr/bin/python3
+#
+# Generate a synthetic feed in cfg.opkdir: a Packages index of many
+# packages, and .opk files for the ones which are to be installed. The
+# same parameters and seed always give the same feed.
+#
+# usage: feedgen.py [--packages n] [--installable n] [--fanout n]
+#                   [--provides n] [--versions n] [--description bytes]
+#                   [--files n] [--file-size bytes] [--seed n]
+
+import os, random, shutil, argparse
+import opk
+
+WORDS = ["package", "library", "runtime", "support", "files", "for", "the",
+		"development", "utilities", "data", "shared", "plugin", "module",
+		"documentation", "headers", "tools", "daemon", "client"]
+
+class Feed:
+	"""
+	packages of which the first installable have .opk files. Each has up
+	to fanout dependencies on later packages, every provides'th package
+	also provides a virtual package which the others depend on instead,
+	and each is in the index at versions different versions.
+	"""
+	def __init__(self, packages=1000, installable=100, fanout=3,
+			provides=10, versions=2, description=200, files=10,
+			file_size=1024, seed=1):
+		self.packages = packages
+		self.installable = min(installable, packages)
+		self.fanout = fanout
+		self.provides = provides
+		self.versions = versions
+		self.description = description
+		self.files = files
+		self.file_size = file_size
+		self.rand = random.Random(seed)
+
+	def name(self, i):
+		return "pkg{}".format(i)
+
+	def version(self, v):
+		return "1.{}-r{}".format(v, v % 3)
+
+	def latest(self):
+		return self.version(self.versions - 1)
+
+	def virtual(self, i):
+		if self.provides and i % self.provides == 0:
+			return "virtual{}".format(i // self.provides)
+		return None
+
+	def depends(self, i):
+		# Installable packages only depend on installable ones, so that
+		# each can be installed from the files which are there.
+		limit = self.installable if i < self.installable \
+				else self.packages
+		targets = range(i + 1, limit)
+		deps = []
+		for j in sorted(self.rand.sample(targets,
+				min(self.fanout, len(targets)))):
+			if self.virtual(j) and self.rand.random() < 0.5:
+				deps.append(self.virtual(j))
+			elif self.rand.random() < 0.3:
+				deps.append("{} (>= {})".format(self.name(j),
+						self.version(0)))
+			else:
+				deps.append(self.name(j))
+		return ", ".join(deps)
+
+	def text(self):
+		words = []
+		size = 0
+		while size < self.description:
+			words.append(self.rand.choice(WORDS))
+			size += len(words[-1]) + 1
+		return " ".join(words)
+
+	def write_data(self, i):
+		name = self.name(i)
+		os.makedirs("usr/share/{}".format(name))
+		for j in range(self.files):
+			f = open("usr/share/{}/f{}".format(name, j), "w")
+			f.write(("{} {}\n".format(name, j) * self.file_size)
+					[:self.file_size])
+			f.close()
+
+	def write(self):
+		o = opk.OpkGroup()
+		for i in range(self.packages):
+			control = {"Package": self.name(i),
+				"Architecture": "all",
+				"Description": self.text()}
+			deps = self.depends(i)
+			if deps:
+				control["Depends"] = deps
+			if self.virtual(i):
+				control["Provides"] = self.virtual(i)
+
+			for v in range(self.versions):
+				o.add(Version=self.version(v), **control)
+
+			if i < self.installable:
+				self.write_data(i)
+				o.opk_list[-1].write(data_files=["usr"])
+				shutil.rmtree("usr")
+		o.write_list()
+
+	def installable_names(self):
+		return [self.name(i) for i in range(self.installable)]
+
+def add_arguments(parser):
+	parser.add_argument("--packages", type=int, default=1000)
+	parser.add_argument("--installable", type=int, default=100)
+	parser.add_argument("--fanout", type=int, default=3)
+	parser.add_argument("--provides", type=int, default=10)
+	parser.add_argument("--versions", type=int, default=2)
+	parser.add_argument("--description", type=int, default=200)
+	parser.add_argument("--files", type=int, default=10)
+	parser.add_argument("--file-size", type=int, default=1024)
+	parser.add_argument("--seed", type=int, default=1)
+
+def from_arguments(args):
+	return Feed(packages=args.packages, installable=args.installable,
+			fanout=args.fanout, provides=args.provides,
+			versions=args.versions, description=args.description,
+			files=args.files, file_size=args.file_size,
+			seed=args.seed)
+
+if __name__ == '__main__':
+	parser = argparse.ArgumentParser()
+	add_arguments(parser)
+	args = parser.parse_args()
+	opk.regress_init()
+	from_arguments(args).write()
@@ -0,0 +1,58 @@
+#!/usr/bin/python3
+#
+# opkg search looks files up in the index written with the status file, so
+# check that it finds the same packages as the .list files would, as
+# packages come and go and when the status file changes without it.
+
+import os
+import opk, cfg, opkgcl
+
+def search(pattern):
+	status, output = opkgcl.opkgcl("search '{}'".format(pattern))
+	return sorted(l.split()[0] for l in output.split("\n") if l)
+
+def check(pattern, expected):
+	found = search(pattern)
+	if found != sorted(expected):
+		print(__file__, ": search '{}' found {} rather than {}.".format(
+				pattern, found, sorted(expected)))
+		exit(False)
+
+def write_pkg(name, files):
+	os.makedirs("usr/lib")
+	for f in files:
+		open("usr/lib/" + f, "w").close()
+	opk.Opk(Package=name, Version="1.0", Architecture="all").write(
+			data_files=["usr"])
+	os.system("rm -rf usr")
+
+opk.regress_init()
+
+write_pkg("a", ["libssl.so.1", "libcrypto.so.1"])
+write_pkg("b", ["libssl-extra.so", "b.conf"])
+write_pkg("c", ["libz.so"])
+
+opkgcl.install("a_1.0_all.opk")
+opkgcl.install("b_1.0_all.opk")
+
+if not os.path.exists("{}/usr/lib/opkg/files.idx".format(cfg.offline_root)):
+	print(__file__, ": the files were not indexed.")
+	exit(False)
+
+check("*/libssl*", ["a", "b"])
+check("*/lib[cz]*", ["a"])
+check("*.so", ["b"])
+check("{}/usr/lib/b.conf".format(cfg.offline_root), ["b"])
+check("/usr/lib/b.conf", [])
+
+opkgcl.install("c_1.0_all.opk")
+check("*/lib[cz]*", ["a", "c"])
+
+opkgcl.remove("b")
+check("*/libssl*", ["a"])
+check("{}/usr/lib/b.conf".format(cfg.offline_root), [])
+
+# opkg flag rewrites the status file without the index.
+opkgcl.opkgcl("flag hold a")
+check("*/libssl*", ["a"])
+check("*.so", ["c"])
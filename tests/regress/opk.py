@@ -7,7 +7,7 @@ class Opk:
 			"Section", "Architecture", "Maintainer", "MD5Sum",\
 			"Size", "InstalledSize", "Filename", "Source",\
 			"Description", "OE", "Homepage", "Priority",\
-			"Conffiles"]
+			"Conffiles", "Deltas"]
 
 	def __init__(self, **control):
 		for k in control.keys():
@@ -16,28 +16,63 @@ class Opk:
 						"{}".format(k))
 		self.control = control
 
-	def write(self, tar_not_ar=False, data_files=None):
+	def write(self, tar_not_ar=False, data_files=None, conffiles=None,
+			scripts=None, compress=True):
+		"""Write the package, with gzipped members unless compress is
+		False, and return its file name."""
 		filename = "{Package}_{Version}_{Architecture}.opk"\
 						.format(**self.control)
+		if compress:
+			control_tar, data_tar = "control.tar.gz", "data.tar.gz"
+		else:
+			control_tar, data_tar = "control.tar", "data.tar"
 		if os.path.exists(filename):
 			os.unlink(filename)
 		if os.path.exists("control"):
 			os.unlink("control")
-		if os.path.exists("control.tar.gz"):
-			os.unlink("control.tar.gz")
-		if os.path.exists("data.tar.gz"):
-			os.unlink("data.tar.gz")
+		if os.path.exists(control_tar):
+			os.unlink(control_tar)
+		if os.path.exists(data_tar):
+			os.unlink(data_tar)
 
 		f = open("control", "w")
 		for k in self.control.keys():
 			f.write("{}: {}\n".format(k, self.control[k]))
 		f.close()
 
-		tar = tarfile.open("control.tar.gz", "w:gz")
+		if conffiles:
+			f = open("conffiles", "w")
+			for cf in conffiles:
+				f.write("{}\n".format(cf))
+			f.close()
+
+		if scripts:
+			for name in scripts.keys():
+				f = open(name, "w")
+				f.write(scripts[name])
+				f.close()
+				os.chmod(name, 0o755)
+
+		if compress:
+			tar = tarfile.open(control_tar, "w:gz")
+		else:
+			tar = tarfile.open(control_tar, "w",
+					format=tarfile.GNU_FORMAT)
 		tar.add("control")
+		if conffiles:
+			tar.add("conffiles")
+			os.unlink("conffiles")
+		if scripts:
+			for name in scripts.keys():
+				tar.add(name)
+				os.unlink(name)
 		tar.close()
 
-		tar = tarfile.open("data.tar.gz", "w:gz")
+		if compress:
+			tar = tarfile.open(data_tar, "w:gz")
+		else:
+			tar = tarfile.open(data_tar, "w",
+					format=tarfile.GNU_FORMAT)
 		if data_files:
 			for df in data_files:
 				tar.add(df)
@@ -46,16 +81,17 @@ class Opk:
 
 		if tar_not_ar:
 			tar = tarfile.open(filename, "w:gz")
-			tar.add("control.tar.gz")
-			tar.add("data.tar.gz")
+			tar.add(control_tar)
+			tar.add(data_tar)
 			tar.close()
 		else:
-			os.system("ar q {} control.tar.gz data.tar.gz \
-					2>/dev/null".format(filename))
+			os.system("ar q {} {} {} 2>/dev/null".format(filename,
+					control_tar, data_tar))
 
 		os.unlink("control")
-		os.unlink("control.tar.gz")
-		os.unlink("data.tar.gz")
+		os.unlink(control_tar)
+		os.unlink(data_tar)
+		return filename
 
 class OpkGroup:
 	def __init__(self):
@@ -44,6 +44,31 @@ def is_installed(pkg_name, version=None):
 	return True
 
 
+def tree(root, ignore=()):
+	"""The mode and contents of everything under root, by path, other than
+	the names in ignore, and what differs from run to run: the status file
+	timestamps and the time in the header of the file index."""
+	t = {}
+	for dirpath, dirnames, filenames in os.walk(root):
+		for name in dirnames + filenames:
+			if name in ignore:
+				continue
+			path = os.path.join(dirpath, name)
+			st = os.lstat(path)
+			data = None
+			if os.path.islink(path):
+				data = os.readlink(path)
+			elif os.path.isfile(path):
+				data = open(path, "rb").read()
+				if name == "status":
+					data = b"\n".join([l for l in data.split(b"\n")
+						if not l.startswith(b"Installed-Time:")])
+				elif name == "files.idx":
+					data = data.split(b"\n", 1)[1]
+			t[os.path.relpath(path, root)] = (st.st_mode, data)
+	return t
+
+
 if __name__ == '__main__':
 	import sys
 	(status, output) = opkgcl(" ".join(sys.argv[1:]))
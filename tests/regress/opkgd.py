@@ -0,0 +1,114 @@
+#!/usr/bin/python3
+#
+# opkgd answers read-only queries as opkg-cl does, writing their output and
+# errors to the stdout and stderr passed with them, and runs no others. Its
+# socket is only open to its group, a client which connects without sending
+# its query does not hold up the next one, and finished queries are reaped
+# without waiting for another.
+
+import os, stat, time, socket, subprocess, tempfile
+import opk, cfg, opkgcl
+
+SOCKET = "/tmp/opkgd-test.sock"
+
+def query(*args):
+	"""Send args to opkgd, and return the kind of its reply, the exit
+	status, the output and the errors."""
+	out = tempfile.TemporaryFile()
+	err = tempfile.TemporaryFile()
+	s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+	s.settimeout(10)
+	s.connect(SOCKET)
+	request = b"".join(a.encode() + b"\0" for a in args)
+	socket.send_fds(s, [request[:1]], [out.fileno(), err.fileno()])
+	s.sendall(request[1:])
+	s.shutdown(socket.SHUT_WR)
+	data = b""
+	while True:
+		chunk = s.recv(4096)
+		if not chunk:
+			break
+		data += chunk
+	s.close()
+	out.seek(0)
+	err.seek(0)
+	return chr(data[0]), data[1], out.read().decode(), err.read().decode()
+
+def zombies(pid):
+	"""The children of pid which have finished but not been reaped."""
+	found = []
+	for p in os.listdir("/proc"):
+		if not p.isdigit():
+			continue
+		try:
+			st = open("/proc/{}/stat".format(p)).read()
+		except OSError:
+			continue
+		fields = st[st.rindex(")") + 2:].split()
+		if fields[0] == "Z" and int(fields[1]) == pid:
+			found.append(p)
+	return found
+
+opk.regress_init()
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0", Architecture="all")
+o.write_opk()
+o.write_list()
+opkgcl.update()
+opkgcl.install("a")
+
+if os.path.exists(SOCKET):
+	os.unlink(SOCKET)
+daemon = subprocess.Popen([cfg.opkgd, "-o", cfg.offline_root,
+		"-s", SOCKET])
+for i in range(100):
+	if os.path.exists(SOCKET):
+		break
+	time.sleep(0.1)
+
+def fail(msg):
+	print(__file__, ": {}".format(msg))
+	daemon.kill()
+	exit(False)
+
+mode = stat.S_IMODE(os.stat(SOCKET).st_mode)
+if mode & 0o007:
+	fail("Socket is open to everyone: {:o}.".format(mode))
+
+# A client which never sends its query.
+idle = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+idle.connect(SOCKET)
+
+try:
+	kind, status, output, errors = query("list-installed")
+except socket.timeout:
+	fail("Query held up by an idle client.")
+if kind != "x" or status != 0 or errors \
+		or output.strip() != opkgcl.opkgcl("list-installed")[1].strip():
+	fail("list-installed answered with {} {}:\n{}{}".format(kind, status,
+			output, errors))
+idle.close()
+
+# Output and errors go where those of opkg-cl would.
+kind, status, output, errors = query("compare-versions", "1.0", "<<")
+local = subprocess.run([cfg.opkgcl, "-o", cfg.offline_root,
+		"compare-versions", "1.0", "<<"], capture_output=True, text=True)
+if kind != "x" or status != local.returncode or "compare_versions" \
+		not in output + errors or output != local.stdout \
+		or errors != local.stderr:
+	fail("compare-versions answered with {} {}:\n{}\n{}\n"
+			"rather than {}:\n{}\n{}".format(kind, status, output,
+			errors, local.returncode, local.stdout, local.stderr))
+
+time.sleep(0.5)
+if zombies(daemon.pid):
+	fail("Finished queries not reaped: {}".format(zombies(daemon.pid)))
+
+kind, status, output, errors = query("remove", "a")
+if kind != "u" or not opkgcl.is_installed("a"):
+	fail("remove a not refused: {} {}:\n{}".format(kind, status, output))
+
+daemon.kill()
+daemon.wait()
+os.unlink(SOCKET)
+os.unlink("a_1.0_all.opk")
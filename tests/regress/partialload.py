@@ -0,0 +1,55 @@
+#!/usr/bin/python3
+#
+# opkg install only parses the stanzas it needs from an indexed list, so
+# check that it still finds everything the packages named depend upon,
+# whether directly, through an alternative or through a provider.
+
+import os
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0", Architecture="all",
+		Depends="b (>= 1.0) | c, v")
+o.add(Package="b", Version="1.0", Architecture="all")
+o.add(Package="b", Version="2.0", Architecture="all")
+o.add(Package="c", Version="1.0", Architecture="all")
+o.add(Package="d", Version="1.0", Architecture="all", Provides="v")
+o.add(Package="e", Version="1.0", Architecture="all")
+o.write_opk()
+o.write_list()
+
+opkgcl.update()
+
+list_file = "{}/usr/lib/opkg/lists/test".format(cfg.offline_root)
+if not os.path.exists(list_file + ".idx"):
+	print("opkg update did not index the list")
+	exit(False)
+
+opkgcl.install("a")
+if not opkgcl.is_installed("a"):
+	print("Package 'a' not installed")
+	exit(False)
+if not opkgcl.is_installed("b", "2.0"):
+	print("Package 'a' was installed without the latest 'b'")
+	exit(False)
+if not opkgcl.is_installed("d"):
+	print("Package 'a' was installed without 'd', which provides 'v'")
+	exit(False)
+if opkgcl.is_installed("e"):
+	print("Package 'e' was installed although nothing needs it")
+	exit(False)
+
+# Once the list has changed, the index is out of date and not used.
+o.add(Package="f", Version="1.0", Architecture="all", Depends="e")
+o.write_opk()
+o.write_list(list_file)
+
+opkgcl.install("f")
+if not opkgcl.is_installed("f"):
+	print("Package 'f' not installed from a list without an index")
+	exit(False)
+if not opkgcl.is_installed("e"):
+	print("Package 'f' was installed without 'e'")
+	exit(False)
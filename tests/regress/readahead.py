@@ -0,0 +1,60 @@
+#!/usr/bin/python3
+#
+# Installing with --read-ahead, which downloads, verifies and unpacks the
+# control files of packages in child processes ahead of installing them,
+# gives the same result as installing them one after another, conffiles
+# included, and downloads each package once.
+
+import os
+import opk, cfg, opkgcl
+
+def install_all(root, flags):
+	cfg.offline_root = root
+	opk.regress_init()
+	opkgcl.update()
+	status, output = opkgcl.opkgcl("{} install top".format(flags))
+	if status != 0:
+		print(__file__, ": install {} failed:\n{}".format(flags, output))
+		exit(False)
+	return opkgcl.tree(root, ignore=("conffiles.md5",)), output
+
+opk.regress_init()
+
+o = opk.OpkGroup()
+deps = []
+for i in range(8):
+	name = "p{}".format(i)
+	os.makedirs("etc")
+	f = open("etc/{}.conf".format(name), "w")
+	f.write("{}\n".format(name))
+	f.close()
+	o.add(Package=name, Version="1.0", Architecture="all",
+			Depends=deps[-1] if deps else "")
+	o.opk_list[-1].write(data_files=["etc"],
+			conffiles=["/etc/{}.conf".format(name)])
+	os.system("rm -rf etc")
+	deps.append(name)
+o.add(Package="top", Version="1.0", Architecture="all",
+		Depends=", ".join(deps))
+o.opk_list[-1].write()
+o.write_list()
+
+serial, _ = install_all("/tmp/opkg-serial", "")
+ahead, output = install_all("/tmp/opkg-ahead", "--read-ahead 3")
+
+os.system("rm -fr /tmp/opkg-serial /tmp/opkg-ahead")
+cfg.offline_root = "/tmp/opkg"
+
+if serial != ahead:
+	for k in sorted(set(serial) | set(ahead)):
+		if serial.get(k) != ahead.get(k):
+			print(__file__, ": {} differs after reading ahead."
+					.format(k))
+	exit(False)
+
+for name in deps + ["top"]:
+	if output.count("Downloading file:{}/{}_1.0_all.opk".format(
+			cfg.opkdir, name)) != 1:
+		print(__file__, ": {} was not downloaded once:\n{}"
+				.format(name, output))
+		exit(False)
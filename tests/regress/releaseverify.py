@@ -0,0 +1,68 @@
+#!/usr/bin/python3
+#
+# opkg update checks each package list of a dist against the size and
+# checksums in its Release file, so check that a list which matches them
+# is taken and one which does not is refused.
+
+import os, gzip, hashlib
+import opk, cfg, opkgcl
+
+def write_dist(md5=None, size=None):
+	lists = "dists/test/main/binary-all"
+	os.makedirs(lists, exist_ok=True)
+
+	g = opk.OpkGroup()
+	g.add(Package="a", Version="1.0", Architecture="all")
+	g.write_opk()
+	g.write_list("{}/Packages".format(lists))
+
+	data = open("{}/Packages".format(lists), "rb").read()
+	f = gzip.open("{}/Packages.gz".format(lists), "wb")
+	f.write(data)
+	f.close()
+	data = open("{}/Packages.gz".format(lists), "rb").read()
+
+	f = open("dists/test/Release", "w")
+	f.write("Codename: test\n")
+	f.write("Architectures: all\n")
+	f.write("Components: main\n")
+	f.write("MD5sum:\n")
+	f.write(" {} {} main/binary-all/Packages.gz\n".format(
+			md5 or hashlib.md5(data).hexdigest(),
+			size or len(data)))
+	f.write("SHA256:\n")
+	f.write(" {} {} main/binary-all/Packages.gz\n".format(
+			hashlib.sha256(data).hexdigest(), size or len(data)))
+	f.close()
+
+opk.regress_init()
+
+f = open("{}/etc/opkg/opkg.conf".format(cfg.offline_root), "w")
+f.write("arch all 1\n")
+f.write("dist/gz test file:{} main\n".format(cfg.opkdir))
+f.close()
+
+list_file = "{}/usr/lib/opkg/lists/test-main-all".format(cfg.offline_root)
+
+write_dist()
+if opkgcl.update() != 0 or not os.path.exists(list_file):
+	print(__file__, ": a list which matches its Release was refused.")
+	exit(False)
+
+opkgcl.install("a")
+if not opkgcl.is_installed("a"):
+	print(__file__, ": the package in the dist was not installed.")
+	exit(False)
+
+os.unlink(list_file)
+write_dist(md5="0" * 32)
+opkgcl.update()
+if os.path.exists(list_file):
+	print(__file__, ": a list with the wrong md5sum was taken.")
+	exit(False)
+
+write_dist(size=1)
+opkgcl.update()
+if os.path.exists(list_file):
+	print(__file__, ": a list of the wrong size was taken.")
+	exit(False)
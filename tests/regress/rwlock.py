@@ -0,0 +1,81 @@
+#!/usr/bin/python3
+
+import os, subprocess, threading
+import opk, cfg, opkgcl
+
+def start_readers(n):
+	procs = []
+	for i in range(n):
+		args = "list-installed" if i % 2 else "status a"
+		cmd = "{} -o {} {}".format(cfg.opkgcl, cfg.offline_root, args)
+		procs.append(subprocess.Popen(cmd, shell=True,
+				stdout=subprocess.PIPE, stderr=subprocess.STDOUT))
+	return procs
+
+def finish_reader(p):
+	out = p.communicate()[0].decode()
+	return (p.returncode, out)
+
+def consistent(out):
+	"""Both queries should always see a, whatever happens to b."""
+	return "a - 1.0" in out or "Package: a\n" in out
+
+opk.regress_init()
+
+os.makedirs("usr/share/b")
+for i in range(50):
+	f = open("usr/share/b/f{}".format(i), "w")
+	f.write("{}\n".format(i))
+	f.close()
+
+opk.Opk(Package="a", Version="1.0", Architecture="all").write()
+opk.Opk(Package="b", Version="1.0", Architecture="all").write(
+		data_files=["usr"])
+os.system("rm -rf usr")
+
+if opkgcl.install("a_1.0_all.opk"):
+	print(__file__, ": Failed to install a.")
+	exit(False)
+
+# Readers never get in each other's way.
+for (status, out) in map(finish_reader, start_readers(16)):
+	if status != 0 or not consistent(out):
+		print(__file__, ": Reader failed alongside other readers:")
+		print(out)
+		exit(False)
+
+# Against a writer, a reader waits for it, and always sees a consistent
+# database.
+stop = threading.Event()
+writes = []
+
+def writer():
+	while not stop.is_set():
+		if opkgcl.install("b_1.0_all.opk") == 0:
+			writes.append("install")
+		if opkgcl.remove("b") == 0:
+			writes.append("remove")
+
+w = threading.Thread(target=writer)
+w.start()
+
+for i in range(8):
+	for (status, out) in map(finish_reader, start_readers(8)):
+		if status != 0 or not consistent(out):
+			stop.set()
+			w.join()
+			print(__file__, ": Reader failed or saw an inconsistent "
+					"database alongside a writer:")
+			print(out)
+			exit(False)
+
+stop.set()
+w.join()
+
+if not writes:
+	print(__file__, ": Writer never got the lock.")
+	exit(False)
+
+if opkgcl.is_installed("b") != (writes[-1] == "install"):
+	print(__file__, ": Status of b does not match the last write.")
+	exit(False)
@@ -0,0 +1,100 @@
+#!/usr/bin/python3
+#
+# The signature of a package list is checked once, and the check is kept in
+# a stamp for later runs, but only for as long as the list, its signature
+# and the trusted CA certificates are unchanged: a CA file which is replaced,
+# whether given by signature_ca_file or inside signature_ca_path, has the
+# list checked again. Only for opkg built with OpenSSL.
+
+import os, shutil, subprocess
+import opk, cfg, opkgcl
+
+CA = "/tmp/opkg-sigstamp-ca"
+
+if "#define HAVE_OPENSSL 1" not in open("../../libopkg/config.h").read() \
+		or not shutil.which("openssl"):
+	exit(0)
+
+def openssl(args):
+	status, output = subprocess.getstatusoutput("openssl " + args)
+	if status != 0:
+		print(__file__, ": openssl {} failed:\n{}".format(args, output))
+		exit(False)
+	return output
+
+def make_ca(name):
+	"""Make a self-signed certificate and its key, and return the
+	certificate."""
+	openssl("req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN={} "
+			"-keyout {}/{}.key -out {}/{}.pem".format(name, CA, name,
+				CA, name))
+	return open("{}/{}.pem".format(CA, name)).read()
+
+def configure(option, value):
+	f = open("{}/etc/opkg/opkg.conf".format(cfg.offline_root), "w")
+	f.write("arch all 1\n")
+	f.write("option check_signature 1\n")
+	f.write("option {} {}\n".format(option, value))
+	f.write("src test file:{}\n".format(cfg.opkdir))
+	f.close()
+
+def install():
+	"""Install a, and return whether it was installed, and whether its
+	list was checked by an earlier run."""
+	status, output = opkgcl.opkgcl("-V3 install a")
+	installed = status == 0 and opkgcl.is_installed("a")
+	opkgcl.remove("a")
+	return installed, "checked by an earlier run" in output, output
+
+shutil.rmtree(CA, ignore_errors=True)
+os.makedirs("{}/certs".format(CA))
+good = make_ca("good")
+make_ca("other")
+other = open("{}/other.pem".format(CA)).read()
+cert_hash = openssl("x509 -hash -noout -in {}/good.pem".format(CA)).strip()
+
+opk.regress_init()
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0", Architecture="all")
+o.write_opk()
+o.write_list()
+openssl("smime -sign -binary -in Packages -signer {}/good.pem "
+		"-inkey {}/good.key -outform PEM -out Packages.sig"
+		.format(CA, CA))
+
+for option, ca_file in (
+		("signature_ca_file", "{}/ca.pem".format(CA)),
+		("signature_ca_path", "{}/certs/{}.0".format(CA, cert_hash))):
+	value = ca_file if option == "signature_ca_file" \
+			else os.path.dirname(ca_file)
+	open(ca_file, "w").write(good)
+	configure(option, value)
+	if opkgcl.update() != 0:
+		print(__file__, ": update with {} failed.".format(option))
+		exit(False)
+
+	installed, stamped, output = install()
+	if not installed or not stamped:
+		print(__file__, ": list not taken as checked with {}:\n{}"
+				.format(option, output))
+		exit(False)
+
+	# Replaced in place, so only the file itself changes.
+	open(ca_file, "w").write(other)
+	installed, stamped, output = install()
+	if installed or stamped:
+		print(__file__, ": list not checked again after the CA in "
+				"{} changed:\n{}".format(option, output))
+		exit(False)
+
+	open(ca_file, "w").write(good)
+	installed, stamped, output = install()
+	if not installed or stamped:
+		print(__file__, ": list not checked again after the CA in "
+				"{} was restored:\n{}".format(option, output))
+		exit(False)
+	os.unlink(ca_file)
+
+shutil.rmtree(CA)
+os.unlink("Packages.sig")
+os.unlink("a_1.0_all.opk")
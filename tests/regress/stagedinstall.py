@@ -0,0 +1,92 @@
+#!/usr/bin/python3
+
+import os
+import opk, cfg, opkgcl
+
+def write_pkg(version, files):
+	for name, data in files.items():
+		if not os.path.exists(os.path.dirname(name)):
+			os.makedirs(os.path.dirname(name))
+		if data.startswith("->"):
+			os.symlink(data[2:], name)
+		else:
+			f = open(name, "w")
+			f.write(data)
+			f.close()
+	o = opk.Opk(Package="a", Version=version, Architecture="all")
+	o.write(data_files=["usr"])
+	os.system("rm -rf usr")
+
+def upgrade(root, flags):
+	cfg.offline_root = root
+	opk.regress_init()
+	opkgcl.install("a_1.0_all.opk")
+	opkgcl.install("a_2.0_all.opk", flags)
+	return opkgcl.tree(root)
+
+opk.regress_init()
+
+write_pkg("1.0", {"usr/share/a/kept": "1.0\n",
+		"usr/share/a/obsolete": "1.0\n",
+		"usr/share/a/link": "->kept",
+		"usr/lib/a/old": "1.0\n"})
+write_pkg("2.0", {"usr/share/a/kept": "2.0\n",
+		"usr/share/a/link": "->new",
+		"usr/share/a/new": "2.0\n",
+		"usr/bin/a": "2.0\n"})
+
+serial = upgrade("/tmp/opkg-serial", "")
+staged = upgrade("/tmp/opkg-staged", "--staged-install")
+
+os.system("rm -fr /tmp/opkg-serial /tmp/opkg-staged")
+cfg.offline_root = "/tmp/opkg"
+
+if serial.get("usr/share/a/kept") != staged.get("usr/share/a/kept") \
+		or staged["usr/share/a/kept"][1] != b"2.0\n":
+	print(__file__, ": Upgraded file not committed.")
+	exit(False)
+
+for k in staged:
+	if k.startswith(".opkg-stage-"):
+		print(__file__, ": Staging dir {} left behind.".format(k))
+		exit(False)
+
+if serial != staged:
+	for k in sorted(set(serial) | set(staged)):
+		if serial.get(k) != staged.get(k):
+			print(__file__, ": {} differs after staged install.".format(k))
+	exit(False)
+
+# Each package's staged files are synced before any of them is renamed
+# into place.
+opk.regress_init()
+o = opk.OpkGroup()
+o.add(Package="b", Version="1.0", Architecture="all", Depends="c")
+o.add(Package="c", Version="1.0", Architecture="all")
+o.write_opk()
+o.write_list()
+opkgcl.update()
+status, output = opkgcl.opkgcl("-V3 --staged-install install b")
+if status != 0 or not opkgcl.is_installed("b") \
+		or not opkgcl.is_installed("c"):
+	print(__file__, ": install b failed:\n{}".format(output))
+	exit(False)
+synced = False
+commits = 0
+for line in output.split("\n"):
+	if "Syncing " in line:
+		synced = True
+	elif "Committing data files for " in line:
+		if not synced:
+			print(__file__, ": Committed before syncing:\n{}"
+					.format(output))
+			exit(False)
+		synced = False
+		commits += 1
+if commits != 2:
+	print(__file__, ": {} commits rather than 2:\n{}".format(commits,
+			output))
+	exit(False)
+
+for f in ("b_1.0_all.opk", "c_1.0_all.opk"):
+	os.unlink(f)
@@ -0,0 +1,93 @@
+#!/usr/bin/python3
+#
+# A package unpacked as it is downloaded with --stream-install is not yet
+# verified, so members which would be extracted outside its staging dir, by
+# an absolute name, a ".." or a symlink made by an earlier member, are
+# refused, and the package is not installed.
+
+import os, io, shutil, tarfile
+import opk, cfg, opkgcl
+
+ESCAPE = "/tmp/opkg-escape"
+
+def add(tar, name, type=tarfile.REGTYPE, linkname="", data=b""):
+	info = tarfile.TarInfo(name)
+	info.type = type
+	info.linkname = linkname
+	info.mode = 0o755 if type == tarfile.DIRTYPE else 0o644
+	info.size = len(data) if type == tarfile.REGTYPE else 0
+	tar.addfile(info, io.BytesIO(data))
+
+def write_opk(name, members):
+	"""Write package name, with a data member of members, each the
+	arguments of add()."""
+	open("control", "w").write("Package: {}\nVersion: 1.0\n"
+			"Architecture: all\n".format(name))
+	tar = tarfile.open("control.tar.gz", "w:gz", format=tarfile.GNU_FORMAT)
+	tar.add("control")
+	tar.close()
+	tar = tarfile.open("data.tar.gz", "w:gz", format=tarfile.GNU_FORMAT)
+	for member in members:
+		add(tar, *member)
+	tar.close()
+	opk_name = "{}_1.0_all.opk".format(name)
+	if os.path.exists(opk_name):
+		os.unlink(opk_name)
+	os.system("ar q {} control.tar.gz data.tar.gz 2>/dev/null"
+			.format(opk_name))
+	for f in ("control", "control.tar.gz", "data.tar.gz"):
+		os.unlink(f)
+
+opk.regress_init()
+shutil.rmtree(ESCAPE, ignore_errors=True)
+os.makedirs(ESCAPE)
+open("{}/target".format(ESCAPE), "w").write("target\n")
+
+pkgs = {
+	"abs": [("./usr/", tarfile.DIRTYPE),
+		("{}/pwned".format(ESCAPE), tarfile.REGTYPE, "", b"pwned\n")],
+	"dotdot": [("./usr/", tarfile.DIRTYPE),
+		("./usr/../../../{}/pwned".format(os.path.basename(ESCAPE)),
+			tarfile.REGTYPE, "", b"pwned\n")],
+	"symlink": [("./usr/", tarfile.DIRTYPE),
+		("./usr/share", tarfile.SYMTYPE, ESCAPE),
+		("./usr/share/pwned", tarfile.REGTYPE, "", b"pwned\n")],
+	"hardlink": [("./usr/", tarfile.DIRTYPE),
+		("./usr/target", tarfile.LNKTYPE,
+			"../../{}/target".format(os.path.basename(ESCAPE)))],
+}
+
+o = opk.OpkGroup()
+for name, members in pkgs.items():
+	write_opk(name, members)
+	o.add(Package=name, Version="1.0", Architecture="all")
+o.write_list()
+opkgcl.update()
+
+for name in pkgs:
+	status, output = opkgcl.opkgcl("--stream-install install {}"
+			.format(name))
+	if status == 0 or opkgcl.is_installed(name):
+		print(__file__, ": {} installed:\n{}".format(name, output))
+		exit(False)
+	if "Refusing to extract" not in output:
+		print(__file__, ": {} not refused:\n{}".format(name, output))
+		exit(False)
+	if sorted(os.listdir(ESCAPE)) != ["target"] \
+			or open("{}/target".format(ESCAPE)).read() != "target\n":
+		print(__file__, ": {} wrote outside its staging dir."
+				.format(name))
+		exit(False)
+	for f in ("usr/share", "usr/target"):
+		if os.path.lexists("{}/{}".format(cfg.offline_root, f)):
+			print(__file__, ": Files of {} installed.".format(name))
+			exit(False)
+	for f in os.listdir(cfg.offline_root):
+		if ".opkg-stage-" in f:
+			print(__file__, ": Staging dir {} left behind."
+					.format(f))
+			exit(False)
+
+shutil.rmtree(ESCAPE)
+for name in pkgs:
+	os.unlink("{}_1.0_all.opk".format(name))
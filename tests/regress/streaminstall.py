@@ -0,0 +1,72 @@
+#!/usr/bin/python3
+#
+# Installing with --stream-install, which unpacks packages as they are
+# downloaded instead of from a copy in tmp-dir, gives the same result as
+# installing them normally, for packages which depend on each other in a
+# circle and for a package in the tar.gz format too. A package which does
+# not match its checksum leaves nothing behind.
+
+import os
+import opk, cfg, opkgcl
+
+def install(root, flags, pkgs):
+	cfg.offline_root = root
+	opk.regress_init()
+	opkgcl.update()
+	return opkgcl.opkgcl("{} install {}".format(flags, pkgs))
+
+def install_all(root, flags):
+	status, output = install(root, flags, "top")
+	if status != 0:
+		print(__file__, ": install {} failed:\n{}".format(flags, output))
+		exit(False)
+	return opkgcl.tree(root, ignore=("conffiles.md5",))
+
+opk.regress_init()
+
+o = opk.OpkGroup()
+for name, depends in (("x", "y"), ("y", "x"), ("z", "")):
+	os.makedirs("usr/share/{}".format(name))
+	for i in range(3):
+		f = open("usr/share/{}/{}".format(name, i), "w")
+		f.write("{} {}\n".format(name, i) * 1000)
+		f.close()
+	os.symlink("0", "usr/share/{}/link".format(name))
+	o.add(Package=name, Version="1.0", Architecture="all", Depends=depends)
+	o.opk_list[-1].write(data_files=["usr"], tar_not_ar=(name == "z"))
+	os.system("rm -rf usr")
+o.add(Package="top", Version="1.0", Architecture="all", Depends="x, z")
+o.opk_list[-1].write()
+o.add(Package="bad", Version="1.0", Architecture="all",
+		MD5Sum="0" * 32)
+os.makedirs("usr/share/bad")
+open("usr/share/bad/file", "w").close()
+o.opk_list[-1].write(data_files=["usr"])
+os.system("rm -rf usr")
+o.write_list()
+
+plain = install_all("/tmp/opkg-plain", "")
+streamed = install_all("/tmp/opkg-streamed", "--stream-install")
+
+os.system("rm -fr /tmp/opkg-plain /tmp/opkg-streamed")
+cfg.offline_root = "/tmp/opkg"
+
+if plain != streamed:
+	for k in sorted(set(plain) | set(streamed)):
+		if plain.get(k) != streamed.get(k):
+			print(__file__, ": {} differs after streaming."
+					.format(k))
+	exit(False)
+
+status, output = install(cfg.offline_root, "--stream-install", "bad")
+if status == 0:
+	print(__file__, ": bad installed despite its checksum:\n{}"
+			.format(output))
+	exit(False)
+if os.path.exists("{}/usr/share/bad".format(cfg.offline_root)):
+	print(__file__, ": Files of bad installed despite its checksum.")
+	exit(False)
+for name in os.listdir(cfg.offline_root):
+	if ".opkg-stage-" in name:
+		print(__file__, ": Staging dir {} left behind.".format(name))
+		exit(False)
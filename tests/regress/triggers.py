@@ -0,0 +1,72 @@
+#!/usr/bin/python3
+#
+# A trigger activated by several packages runs once at the end of the
+# transaction for each distinct line of arguments given, and a package with
+# an interest in a trigger has its postinst run once when it is activated,
+# whether by a script or by the triggers file of another package. A trigger
+# which fails is reported, but does not fail the install.
+
+import os
+import opk, cfg, opkgcl
+
+def write_pkg(name, scripts):
+	opk.Opk(Package=name, Version="1.0", Architecture="all")\
+			.write(scripts=scripts)
+
+opk.regress_init()
+
+bindir = os.path.join(cfg.opkdir, "bin")
+log = os.path.join(cfg.opkdir, "trigger.log")
+os.makedirs(bindir, exist_ok=True)
+if os.path.exists(log):
+	os.unlink(log)
+
+f = open(os.path.join(bindir, "opkg-test-trigger"), "w")
+f.write("#!/bin/sh\necho \"run $*\" >> {}\n".format(log))
+f.close()
+os.chmod(os.path.join(bindir, "opkg-test-trigger"), 0o755)
+os.environ["PATH"] = bindir + ":" + os.environ["PATH"]
+
+activate = """#!/bin/sh
+[ "$1" = configure ] || exit 0
+echo {} >> $OPKG_INTERCEPT_DIR/opkg-test-trigger
+"""
+
+write_pkg("a", {"postinst": activate.format("x")})
+write_pkg("b", {"postinst": activate.format("x") + "echo y >> "
+		"$OPKG_INTERCEPT_DIR/opkg-test-trigger\n"})
+write_pkg("c", {"postinst": "#!/bin/sh\n[ \"$1\" = triggered ] && "
+			"echo \"c $2\" >> {}\nexit 0\n".format(log),
+		"triggers": "interest opkg-test-trigger\n"
+			"interest other-trigger\n"})
+write_pkg("d", {"triggers": "activate other-trigger\n"})
+
+status, output = opkgcl.opkgcl("--force-postinstall install a_1.0_all.opk "
+		"b_1.0_all.opk c_1.0_all.opk d_1.0_all.opk")
+if status != 0:
+	print(__file__, ": install failed:\n" + output)
+	exit(False)
+
+lines = []
+if os.path.exists(log):
+	lines = sorted(open(log).read().split("\n")[:-1])
+
+expected = ["c opkg-test-trigger", "c other-trigger", "run x", "run y"]
+if lines != expected:
+	print(__file__, ": expected the triggers to run as {}, but they ran as "
+			"{}:\n{}".format(expected, lines, output))
+	exit(False)
+
+f = open(os.path.join(bindir, "opkg-test-failing-trigger"), "w")
+f.write("#!/bin/sh\nexit 1\n")
+f.close()
+os.chmod(os.path.join(bindir, "opkg-test-failing-trigger"), 0o755)
+write_pkg("e", {"triggers": "activate opkg-test-failing-trigger\n"})
+
+status, output = opkgcl.opkgcl("--force-postinstall install e_1.0_all.opk")
+if status != 0 or not opkgcl.is_installed("e"):
+	print(__file__, ": install failed for a failing trigger:\n" + output)
+	exit(False)
+if "Trigger opkg-test-failing-trigger failed" not in output:
+	print(__file__, ": failing trigger not reported:\n" + output)
+	exit(False)